@@ -79,7 +79,7 @@ const SequencerArpeggiatorResult Arpeggiator::BuildNextResult(
     return result;
   }
 
-  uint8_t arp_range = part.sequencer_settings().arp_range;
+  uint8_t arp_range = part.arp_range();
   uint8_t arp_direction = part.sequencer_settings().arp_direction;
 
   uint8_t num_octaves = arp_range + 1;
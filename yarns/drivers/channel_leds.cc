@@ -30,11 +30,23 @@
 
 #include <stm32f10x_conf.h>
 
+#include "yarns/drivers/panel_scan.h"
+
 namespace yarns {
 
-// 8000/2^(6+1) = 62.5 Hz refresh rate
-// Add 1 because we do a mirrored duty cycle to prevent transition artifacts
-const uint8_t kBcmBits = 6;
+const uint16_t kLedPins[kNumLeds] = {
+  GPIO_Pin_12,
+  GPIO_Pin_11,
+  GPIO_Pin_8,
+  GPIO_Pin_14
+};
+
+const ScanPort kLedPorts[kNumLeds] = {
+  SCAN_PORT_A,
+  SCAN_PORT_A,
+  SCAN_PORT_A,
+  SCAN_PORT_B
+};
 
 void ChannelLeds::Init() {
   GPIO_InitTypeDef gpio_init = {0};
@@ -48,35 +60,26 @@ void ChannelLeds::Init() {
   gpio_init.GPIO_Mode = GPIO_Mode_Out_PP;
   GPIO_Init(GPIOB, &gpio_init);
   
-  bcm_bit_pos_ = -1;  // Start at last bit to roll over to 0 first
-  bcm_bit_pos_increment_ = 1;
-  bcm_bit_countdown_ = 0;
-  std::fill(&brightness_[0], &brightness_[kNumLeds], 0);
-}
-
-void ChannelLeds::Write() {
-  if (bcm_bit_countdown_ > 0) {
-    --bcm_bit_countdown_;
-    return;
+  for (uint8_t i = 0; i < kNumLeds; ++i) {
+    for (uint8_t slot = 0; slot < kNumScanSlots; ++slot) {
+      panel_scan.Write(kLedPorts[i], slot, kLedPins[i], false);
+    }
+    brightness_[i] = 0;
+    lit_slots_[i] = 0;
   }
+}
 
-  bcm_bit_pos_ += bcm_bit_pos_increment_;
-  if (bcm_bit_pos_ >= kBcmBits) {
-    bcm_bit_pos_ = kBcmBits - 1;
-    bcm_bit_pos_increment_ = -1;
-  } else if (bcm_bit_pos_ < 0) {
-    bcm_bit_pos_ = 0;
-    bcm_bit_pos_increment_ = 1;
+void ChannelLeds::RefreshScan() {
+  for (uint8_t i = 0; i < kNumLeds; ++i) {
+    // 6-bit resolution, like the BCM this replaced
+    uint8_t lit_slots = (brightness_[i] >> 2) * kNumScanSlots / 63;
+    while (lit_slots_[i] < lit_slots) {
+      panel_scan.Write(kLedPorts[i], lit_slots_[i]++, kLedPins[i], true);
+    }
+    while (lit_slots_[i] > lit_slots) {
+      panel_scan.Write(kLedPorts[i], --lit_slots_[i], kLedPins[i], false);
+    }
   }
-  bcm_bit_countdown_ = (1 << (kBcmBits - 1 - bcm_bit_pos_)) - 1;
-
-  const uint8_t mask = 1 << (7 - bcm_bit_pos_);
-  GPIOA->BSRR =
-    (brightness_[0] & mask ? GPIO_Pin_12  : GPIO_Pin_12 << 16) |
-    (brightness_[1] & mask ? GPIO_Pin_11  : GPIO_Pin_11 << 16) |
-    (brightness_[2] & mask ? GPIO_Pin_8   : GPIO_Pin_8  << 16);
-  GPIOB->BSRR =
-    (brightness_[3] & mask ? GPIO_Pin_14  : GPIO_Pin_14 << 16);
 }
 
 /* extern */
@@ -48,14 +48,13 @@ class ChannelLeds {
     std::copy(&brightness[0], &brightness[kNumLeds], &brightness_[0]);
   }
   
-  void Write();
+  // Copies the last brightness set to the panel scan
+  void RefreshScan();
   
  private:
-  int8_t bcm_bit_pos_;
-  int8_t bcm_bit_pos_increment_;
-  uint8_t bcm_bit_countdown_;
-
   uint8_t brightness_[kNumLeds];
+  // Number of panel scan slots, from the first, for which each LED is on
+  uint8_t lit_slots_[kNumLeds];
   
   DISALLOW_COPY_AND_ASSIGN(ChannelLeds);
 };
@@ -31,6 +31,7 @@
 
 #include "yarns/drivers/system.h"
 #include "yarns/multi.h"
+#include "yarns/profiler.h"
 
 #include <algorithm>
 
@@ -38,19 +39,28 @@ namespace yarns {
 
 using namespace std;
 
+#ifndef TEST
 const uint16_t kPinSS = GPIO_Pin_12;
 
 static volatile uint32_t dma_ss_high[kDacWordsPerSample] __attribute__((aligned(4))) = {kPinSS, 0};
 static volatile uint32_t dma_ss_low [kDacWordsPerSample] __attribute__((aligned(4))) = {kPinSS, 0};
+#endif  // TEST
 
 void Dac::Init() {
+  // The layout may already have picked a rate.
+  running_ = false;
+  set_frame_rate(frame_rate_);
   can_fill_ = false;
   fillable_block_ = 1; // DMA will initially be consuming the first half
+  num_blocks_consumed_ = 0;
   for (size_t i = 0; i < kBufferSize; i += kDacWordsPerSample) {
     spi_tx_buffer_[i] = kNoopHighWord;
     spi_tx_buffer_[i + 1] = kNoopLowWord;
   }
 
+#ifdef TEST
+  simulated_dma_cursor_frame_ = 0;
+#else
   // Initialize SS pin.
   GPIO_InitTypeDef gpio_init = {0};
   gpio_init.GPIO_Pin = kPinSS;
@@ -79,35 +89,7 @@ void Dac::Init() {
 
   SPI_Cmd(SPI2, ENABLE);
 
-  TIM_TimeBaseInitTypeDef timer_init = {0};
-  timer_init.TIM_Period = timer_period() - 1;
-  timer_init.TIM_Prescaler = 0;
-  timer_init.TIM_ClockDivision = TIM_CKD_DIV1;
-  timer_init.TIM_CounterMode = TIM_CounterMode_Up;
-  timer_init.TIM_RepetitionCounter = 0;
-  TIM_TimeBaseInit(TIM1, &timer_init);
-
-  TIM_OCInitTypeDef oc_init = {0};
-  oc_init.TIM_OCMode = TIM_OCMode_Timing;
-  oc_init.TIM_OutputState = TIM_OutputState_Disable;
-  oc_init.TIM_OutputNState = TIM_OutputNState_Disable;
-  oc_init.TIM_OCIdleState = TIM_OCIdleState_Reset;
-  oc_init.TIM_OCNIdleState = TIM_OCNIdleState_Reset;
-  oc_init.TIM_OCPolarity = TIM_OCPolarity_High;
-  oc_init.TIM_OCNPolarity = TIM_OCNPolarity_High;
-  
-  // SYNC high (conditional)
-  oc_init.TIM_Pulse = timer_period() * 1 / 1000 - 1;
-  TIM_OC1Init(TIM1, &oc_init);
-  
-  // SYNC low (conditional)
-  oc_init.TIM_Pulse = timer_period() * 2 / 1000 - 1;
-  TIM_OC2Init(TIM1, &oc_init);
-
-  // SPI2 TX
-  oc_init.TIM_Pulse = timer_period() * 3 / 1000 - 1;
-  TIM_OC3Init(TIM1, &oc_init);
-
+  ConfigureTimer();
 
   DMA_InitTypeDef ss_dma = {0};
   ss_dma.DMA_DIR = DMA_DIR_PeripheralDST;
@@ -164,6 +146,28 @@ void Dac::Init() {
   );
 
   TIM_Cmd(TIM1, ENABLE);
+#endif  // TEST
+  running_ = true;
+}
+
+void Dac::set_frame_rate(FrameRate frame_rate) {
+  frame_rate_ = frame_rate;
+  frame_rate_scale_ = (kBaseFrameHz << 16) / kFrameRateHz[frame_rate];
+  if (!running_) {
+    return;
+  }
+#ifndef TEST
+  // Stopping the timer pauses all three DMA streams on the same frame
+  // boundary, so the SYNC and SPI transfers stay aligned.
+  TIM_Cmd(TIM1, DISABLE);
+  ConfigureTimer();
+  TIM_SetCounter(TIM1, 0);
+  TIM_Cmd(TIM1, ENABLE);
+#endif  // TEST
+#ifdef PROFILE_INTERRUPTS
+  // Deadlines have changed, so have the stats.
+  profiler.Reset();
+#endif  // PROFILE_INTERRUPTS
 }
 
 // Write a packed high:low command word pair to a buffer position
@@ -221,8 +225,7 @@ void Dac::UpdateDC(uint8_t channel, uint16_t sample) {
   WRITE_WORDS(&spi_tx_buffer_[frame0_offset], words);
 
   // (2) Inject ahead of DMA cursor
-  size_t cursor_frame = (kBufferSize - DMA1_Channel6->CNDTR) / kDacWordsPerFrame;
-  size_t target_frame = (cursor_frame + kInjectGapFrames) % kTotalFrames;
+  size_t target_frame = (dma_cursor_frame() + kInjectGapFrames) % kTotalFrames;
   size_t inject_offset = target_frame * kDacWordsPerFrame
                        + (channel << kDacWordsPerSampleBits);
   WRITE_WORDS(&spi_tx_buffer_[inject_offset], words);
@@ -234,6 +237,8 @@ void Dac::FillDCNoops(uint8_t block, uint8_t channel) {
   BUFFER_SAMPLES(channel, noop, 1)
 }
 
+#ifndef TEST
+
 uint32_t Dac::timer_base_freq(uint8_t apb) const {
   RCC_ClocksTypeDef rcc_clocks;
   RCC_GetClocksFreq(&rcc_clocks);
@@ -244,9 +249,42 @@ uint32_t Dac::timer_base_freq(uint8_t apb) const {
 
 uint32_t Dac::timer_period() const {
   uint32_t base_freq = timer_base_freq(2);
-  return base_freq / kDacWordsHz;
+  return base_freq / (frame_hz() * kDacWordsPerFrame);
+}
+
+void Dac::ConfigureTimer() {
+  TIM_TimeBaseInitTypeDef timer_init = {0};
+  timer_init.TIM_Period = timer_period() - 1;
+  timer_init.TIM_Prescaler = 0;
+  timer_init.TIM_ClockDivision = TIM_CKD_DIV1;
+  timer_init.TIM_CounterMode = TIM_CounterMode_Up;
+  timer_init.TIM_RepetitionCounter = 0;
+  TIM_TimeBaseInit(TIM1, &timer_init);
+
+  TIM_OCInitTypeDef oc_init = {0};
+  oc_init.TIM_OCMode = TIM_OCMode_Timing;
+  oc_init.TIM_OutputState = TIM_OutputState_Disable;
+  oc_init.TIM_OutputNState = TIM_OutputNState_Disable;
+  oc_init.TIM_OCIdleState = TIM_OCIdleState_Reset;
+  oc_init.TIM_OCNIdleState = TIM_OCNIdleState_Reset;
+  oc_init.TIM_OCPolarity = TIM_OCPolarity_High;
+  oc_init.TIM_OCNPolarity = TIM_OCNPolarity_High;
+  
+  // SYNC high (conditional)
+  oc_init.TIM_Pulse = timer_period() * 1 / 1000 - 1;
+  TIM_OC1Init(TIM1, &oc_init);
+  
+  // SYNC low (conditional)
+  oc_init.TIM_Pulse = timer_period() * 2 / 1000 - 1;
+  TIM_OC2Init(TIM1, &oc_init);
+
+  // SPI2 TX
+  oc_init.TIM_Pulse = timer_period() * 3 / 1000 - 1;
+  TIM_OC3Init(TIM1, &oc_init);
 }
 
+#endif  // TEST
+
 /* extern */
 Dac dac;
 
@@ -31,7 +31,9 @@
 
 #include "stmlib/stmlib.h"
 
+#ifndef TEST
 #include <stm32f10x_conf.h>
+#endif  // TEST
 
 namespace yarns {
 
@@ -47,25 +49,56 @@ const uint32_t kDacWordsPerFrame = kNumCVOutputs * kDacWordsPerSample;
 const uint32_t kDacWordsPerBlock = kAudioBlockSize * kDacWordsPerFrame;
 const uint32_t kBufferSize = kNumBlocks * kDacWordsPerBlock;
 
-const uint32_t kFrameHz = 45000;
-const uint32_t kDacWordsHz = kFrameHz * kDacWordsPerFrame;
 const uint32_t kTotalFrames = kAudioBlockSize * kNumBlocks;
 
+// The oscillator and envelope LUTs are computed for this rate.
+const uint32_t kBaseFrameHz = 45000;
+
+// Rates at which the timer period is a whole number of 72 MHz cycles.
+enum FrameRate {
+  FRAME_RATE_45K,
+  FRAME_RATE_60K,
+  FRAME_RATE_90K,
+  FRAME_RATE_LAST
+};
+
+const uint32_t kFrameRateHz[FRAME_RATE_LAST] = { 45000, 60000, 90000 };
+
 // DAC8564 address-mismatch NOOP: setting DB23:DB22 to nonzero (vs A1=A0=GND)
 // causes the DAC to ignore the entire frame, holding its current output.
 const uint16_t kNoopHighWord = 0xC000;
 const uint16_t kNoopLowWord = 0x0000;
 
 // Frames ahead of the DMA cursor to place DC injections.
-// 1 frame = 8 DMA words = ~3200 CPU cycles of margin. Wildly conservative.
+// 1 frame = 8 DMA words = 800+ CPU cycles of margin. Wildly conservative.
 const size_t kInjectGapFrames = 1;
 
+// Rate at which SysTick computes the DC outputs.
+const uint32_t kDCRefreshHz = 4000;
+
+// Note onsets are rendered this long after their MIDI message was received.
+// Events are handled by the main loop before it fills the next block, which
+// starts playing between one and two blocks later, so two blocks is the
+// shortest latency that is the same for every event.
+const uint16_t kOnsetLatencyFrames = kTotalFrames;
+
 class Dac {
  public:
   Dac() { }
   ~Dac() { }
   
   void Init();
+
+  // Reprograms the frame timer if it is already running.
+  void set_frame_rate(FrameRate frame_rate);
+  inline FrameRate frame_rate() const { return frame_rate_; }
+  inline uint32_t frame_hz() const { return kFrameRateHz[frame_rate_]; }
+
+  // Converts a per-frame increment (or filter coefficient) computed for
+  // kBaseFrameHz to the current frame rate.
+  inline uint32_t ScaleToFrameRate(uint32_t base_value) const {
+    return static_cast<uint64_t>(base_value) * frame_rate_scale_ >> 16;
+  }
   
   uint8_t* PtrToFillableBlockNum() {
     uint8_t* res = can_fill_ ? &fillable_block_ : NULL;
@@ -76,6 +109,47 @@ class Dac {
   void OnBlockConsumed(bool first_block_consumed) {
     can_fill_ = true;
     fillable_block_ = first_block_consumed ? 0 : 1;
+    ++num_blocks_consumed_;
+  }
+
+  // Wrapping count of the frames output so far.  The DMA interrupt can count
+  // a block between the two reads, which are then taken again.  The cursor
+  // can also cross into the next block before the interrupt is served (or
+  // while SysTick holds it off), which its block number shows.
+  inline uint16_t frame_counter() const {
+    uint16_t num_blocks;
+    size_t cursor;
+    do {
+      num_blocks = num_blocks_consumed_;
+      cursor = dma_cursor_frame();
+    } while (num_blocks != num_blocks_consumed_);
+    if ((cursor >> kAudioBlockSizeBits) != (num_blocks & 1)) {
+      ++num_blocks;
+    }
+    return (num_blocks << kAudioBlockSizeBits) +
+        (cursor & (kAudioBlockSize - 1));
+  }
+
+  // Frames between two DC refreshes, rounded up.
+  inline uint16_t frames_per_dc_refresh() const {
+    return (frame_hz() + kDCRefreshHz - 1) / kDCRefreshHz;
+  }
+
+  // frame_counter() at which the block taken by PtrToFillableBlockNum starts
+  // playing.
+  inline uint16_t rendering_block_frame() const {
+    return static_cast<uint16_t>(
+        num_blocks_consumed_ + 1) << kAudioBlockSizeBits;
+  }
+
+  // Frames from the start of the next block to be rendered to the onset of an
+  // event received at the given frame_counter().
+  inline uint16_t OnsetDelay(uint16_t event_frame) const {
+    uint16_t next_block_frame = static_cast<uint16_t>(
+        num_blocks_consumed_ + (can_fill_ ? 1 : 2)) << kAudioBlockSizeBits;
+    int16_t delay = static_cast<int16_t>(
+        event_frame + kOnsetLatencyFrames - next_block_frame);
+    return delay > 0 ? delay : 0;
   }
 
   // Bits: 8 command | 16 data | 8 padding
@@ -98,12 +172,30 @@ class Dac {
 
   uint32_t timer_base_freq(uint8_t apb) const;
   uint32_t timer_period() const;
+  void ConfigureTimer();
+
+  // Frame that the DMA stream will read next.
+  inline size_t dma_cursor_frame() const {
+#ifdef TEST
+    return simulated_dma_cursor_frame_;
+#else
+    return (kBufferSize - DMA1_Channel6->CNDTR) / kDacWordsPerFrame;
+#endif  // TEST
+  }
 
   // Multipliers express the time-ordering of the buffer: block, frame, channel, word
   // Channels must be interleaved so they output at a consistent phase of each 40kHz tick
   volatile uint16_t spi_tx_buffer_[kBufferSize] __attribute__((aligned(4)));
   uint8_t fillable_block_;
   bool can_fill_;
+  FrameRate frame_rate_;
+  uint32_t frame_rate_scale_;  // 16.16
+  bool running_;
+  volatile uint16_t num_blocks_consumed_;
+#ifdef TEST
+  // Advanced by the host simulator in lieu of DMA1_Channel6->CNDTR.
+  size_t simulated_dma_cursor_frame_;
+#endif  // TEST
  
  private:
   DISALLOW_COPY_AND_ASSIGN(Dac);
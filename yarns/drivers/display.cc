@@ -29,9 +29,14 @@
 
 #include "yarns/drivers/display.h"
 
+#ifdef TEST
+#include "yarns/test/gpio.h"
+#else
 #include <stm32f10x_conf.h>
+#endif  // TEST
 #include <string.h>
 
+#include "yarns/drivers/panel_scan.h"
 #include "yarns/resources.h"
 
 namespace yarns {
@@ -43,17 +48,25 @@ const uint16_t kPinData = GPIO_Pin_9; // DISP_SER, DS, serial data input
 const uint16_t kScrollingDelay = 260;
 const uint16_t kScrollingPreDelay = 600;
 
+const uint8_t kDisplayBrightnessPWMBits = 6;
+#ifndef APPLICATION
 // 8000/2^(6+1) = 62.5 Hz refresh rate
 // Add 1 for kDisplayWidth = 2
-const uint8_t kDisplayBrightnessPWMBits = 6;
 const uint8_t kDisplayBrightnessPWMMax = 1 << kDisplayBrightnessPWMBits;
+#endif  // APPLICATION
 
 const uint16_t kCharacterEnablePins[] = {
   GPIO_Pin_6,
   GPIO_Pin_5
 };
+const uint16_t kAllCharacterEnablePins = GPIO_Pin_6 | GPIO_Pin_5;
+
+#ifdef APPLICATION
+STATIC_ASSERT(kDisplayWidth == kNumScanPositions, one_position_per_scan_half);
+#endif  // APPLICATION
 
 void Display::Init() {
+#ifndef TEST
   GPIO_InitTypeDef gpio_init = {0};
   gpio_init.GPIO_Pin = kPinClk;
   gpio_init.GPIO_Pin |= kPinEnable;
@@ -66,8 +79,7 @@ void Display::Init() {
   GPIO_Init(GPIOB, &gpio_init);
 
   GPIOB->BSRR = kPinEnable;
-  active_position_ = 0;
-  brightness_pwm_cycle_ = 0;
+#endif  // TEST
   memset(short_buffer_, ' ', kDisplayWidth);
   memset(long_buffer_, ' ', kScrollBufferSize);
   use_mask_ = false;
@@ -76,6 +88,36 @@ void Display::Init() {
   
   blinking_ = false;
   brightness_ = UINT16_MAX;
+
+#ifdef APPLICATION
+  // The clock rises on even slots, shifting the data bit set on the odd slot
+  // before it.  The storage register latches on the first slot of each half,
+  // and is let down again for the next shift.  The enable of the latched
+  // position is set again at every slot, after the blanking of the last one.
+  for (uint8_t slot = 0; slot < kNumScanSlots; ++slot) {
+    uint8_t position = slot / kScanSlotsPerPosition;
+    uint8_t step = slot % kScanSlotsPerPosition;
+    if (step == 0) {
+      panel_scan.Write(SCAN_PORT_B, slot, kPinEnable, true);
+    } else if (step == 1) {
+      panel_scan.Write(SCAN_PORT_B, slot, kPinEnable, false);
+    }
+    if (step && step <= 2 * 16) {
+      panel_scan.Write(SCAN_PORT_B, slot, kPinClk, !(step & 1));
+    }
+    panel_scan.Write(
+        SCAN_PORT_B, slot, kCharacterEnablePins[position], true);
+    panel_scan.Write(
+        SCAN_PORT_B, slot, kCharacterEnablePins[1 - position], false);
+  }
+  for (uint8_t i = 0; i < kDisplayWidth; ++i) {
+    Draw(i, 0);
+  }
+  panel_scan.set_blanking(kAllCharacterEnablePins, kScanSlotPeriod);
+#else
+  active_position_ = 0;
+  brightness_pwm_cycle_ = 0;
+#endif  // APPLICATION
 }
 
 void Display::Scroll() {
@@ -143,7 +185,6 @@ void Display::RefreshSlow() {
     actual_brightness_ = brightness_;
   }
   blink_counter_ = (blink_counter_ + 1) % kBlinkMask;
-  std::fill(&redraw_[0], &redraw_[kDisplayWidth], true); // Force redraw
 
 #else
 
@@ -155,6 +196,40 @@ void Display::RefreshSlow() {
   actual_brightness_ = actual_brightness_ >> (16 - kDisplayBrightnessPWMBits);
 }
 
+#ifdef APPLICATION
+
+void Display::RefreshScan() {
+  const char* buffer = displayed_buffer_;
+  for (uint8_t i = 0; i < kDisplayWidth; ++i) {
+    uint16_t segments = use_mask_ ? mask_[i] : chr_characters[
+        static_cast<uint8_t>(buffer[i])];
+    if (segments != drawn_[i]) {
+      Draw(i, segments);
+    }
+  }
+  // Lit for the same share of each slot as the PWM cycle used to
+  uint16_t delay = 0;
+  if (!blinking_ || blink_high()) {
+    delay = (actual_brightness_ + 1) * kScanSlotPeriod >>
+        kDisplayBrightnessPWMBits;
+  }
+  panel_scan.set_blanking(kAllCharacterEnablePins, delay);
+}
+
+// A position's segments are shifted in while the other one is lit, least
+// significant bit first.
+void Display::Draw(uint8_t position, uint16_t segments) {
+  uint8_t slot = (1 - position) * kScanSlotsPerPosition + 1;
+  drawn_[position] = segments;
+  for (uint8_t i = 0; i < 16; ++i) {
+    panel_scan.Write(SCAN_PORT_B, slot, kPinData, segments & 1);
+    segments >>= 1;
+    slot += 2;
+  }
+}
+
+#else
+
 void Display::RefreshFast() {
   if (brightness_pwm_cycle_ == 0) {
     // On rising edge, switch to next display position and draw it
@@ -183,6 +258,8 @@ void Display::RefreshFast() {
   brightness_pwm_cycle_ = (brightness_pwm_cycle_ + 1) % kDisplayBrightnessPWMMax;
 }
 
+#endif  // APPLICATION
+
 void Display::Print(
   const char* short_buffer, const char* long_buffer,
   uint16_t brightness, uint16_t fade, char prefix
@@ -214,6 +291,8 @@ void Display::Print(
   }
 }
 
+#ifndef APPLICATION
+
 # define SHIFT_BIT \
   GPIOB->BSRR = \
     kPinClk << 16 | \
@@ -224,24 +303,13 @@ void Display::Print(
 
 void Display::Shift14SegmentsWord(uint16_t data) {
   GPIOB->BRR = kPinEnable;
-  for (int i = 0; i < 2; ++i) {
-#ifdef APPLICATION
-    SHIFT_BIT
+  for (int i = 0; i < 16; ++i) {
     SHIFT_BIT
-    SHIFT_BIT
-    SHIFT_BIT
-    SHIFT_BIT
-    SHIFT_BIT
-    SHIFT_BIT
-    SHIFT_BIT
-#else
-    for (int j = 0; j < 8; ++j) {
-      SHIFT_BIT
-    }
-#endif  // APPLICATION
   }
   // The data in the shift register is transferred to the storage register on a LOW-to-HIGH transition of the STCP input.
   GPIOB->BSRR = kPinEnable;
 }
 
+#endif  // APPLICATION
+
 }  // namespace yarns
@@ -46,7 +46,12 @@ class Display {
   
   void Init();
   void RefreshSlow();
+#ifdef APPLICATION
+  // Copies the state of the last RefreshSlow to the panel scan
+  void RefreshScan();
+#else
   void RefreshFast();
+#endif  // APPLICATION
   
   inline void Print(const char* string) {
     Print(string, string);
@@ -74,7 +79,11 @@ class Display {
   inline bool blink_high() const { return blink_counter_ < (kBlinkMask >> 1); }
  
  private:
+#ifdef APPLICATION
+  void Draw(uint8_t position, uint16_t segments);
+#else
   void Shift14SegmentsWord(uint16_t data);
+#endif  // APPLICATION
 
   char short_buffer_[kDisplayWidth];
   char prefix_show_buffer_[kDisplayWidth];
@@ -97,10 +106,14 @@ class Display {
 
   uint8_t scrolling_step_;
   
+#ifdef APPLICATION
+  uint16_t drawn_[kDisplayWidth];
+#else
   uint16_t active_position_;
   uint16_t brightness_pwm_cycle_;
-  uint16_t brightness_;
   bool redraw_[kDisplayWidth];
+#endif  // APPLICATION
+  uint16_t brightness_;
   uint16_t blink_counter_;
   
   DISALLOW_COPY_AND_ASSIGN(Display);
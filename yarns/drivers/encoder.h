@@ -29,7 +29,9 @@
 #ifndef YARNS_DRIVERS_ENCODER_H_
 #define YARNS_DRIVERS_ENCODER_H_
 
+#ifndef TEST
 #include <stm32f10x_conf.h>
+#endif  // TEST
 #include "stmlib/stmlib.h"
 
 namespace yarns {
@@ -55,7 +57,11 @@ class Encoder {
   }
   
   inline bool pressed_immediate() const {
+#ifdef TEST
+    return false;
+#else
     return !GPIO_ReadInputDataBit(GPIOC, GPIO_Pin_15);
+#endif  // TEST
   }
   
   inline int32_t increment() const {
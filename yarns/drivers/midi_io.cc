@@ -56,6 +56,25 @@ void MidiIO::Init() {
   usart_init.USART_Mode = USART_Mode_Tx | USART_Mode_Rx;
   
   USART_Init(USART1, &usart_init);
+
+  // DMA for USART1 RX
+  DMA_InitTypeDef rx_dma = {0};
+  rx_dma.DMA_PeripheralBaseAddr = (uint32_t)&USART1->DR;
+  rx_dma.DMA_MemoryBaseAddr = (uint32_t)&rx_buffer_[0];
+  rx_dma.DMA_DIR = DMA_DIR_PeripheralSRC;
+  rx_dma.DMA_BufferSize = kMidiRxBufferSize;
+  rx_dma.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+  rx_dma.DMA_MemoryInc = DMA_MemoryInc_Enable;
+  rx_dma.DMA_M2M = DMA_M2M_Disable;
+  rx_dma.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+  rx_dma.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+  rx_dma.DMA_Mode = DMA_Mode_Circular;
+  rx_dma.DMA_Priority = DMA_Priority_Medium;
+  DMA_Init(DMA1_Channel5, &rx_dma);
+  rx_read_ptr_ = 0;
+
+  DMA_Cmd(DMA1_Channel5, ENABLE);
+  USART_DMACmd(USART1, USART_DMAReq_Rx, ENABLE);
   USART_Cmd(USART1, ENABLE);
 }
 
@@ -35,6 +35,14 @@
 
 namespace yarns {
 
+const uint8_t kMidiRxBufferSizeBits = 6;
+const uint8_t kMidiRxBufferSize = 1 << kMidiRxBufferSizeBits;
+// Kept free in the receive buffer for the bytes that arrive before the next
+// SysTick, since a full buffer reads as empty.  One arrives every 2.5 ticks.
+const uint8_t kMidiRxHeadroom = 8;
+// 31250 bauds, 10 bits per byte
+const uint16_t kMidiByteHz = 3125;
+
 class MidiIO {
  public:
   
@@ -47,19 +55,39 @@ class MidiIO {
     return USART1->SR & USART_FLAG_TXE;
   }
   
-  bool readable() {
-    return USART1->SR & USART_FLAG_RXNE;
-  }
-  
   void Overwrite(uint8_t byte) {
     USART1->DR = byte;
   }
+
+  // Received bytes are written to a circular buffer by DMA, so that none is
+  // lost when SysTick is held off for longer than a byte.
+  inline uint8_t num_readable() const {
+    return (rx_write_ptr() - rx_read_ptr_) & (kMidiRxBufferSize - 1);
+  }
+
+  inline bool readable() const {
+    return num_readable() != 0;
+  }
   
-  uint8_t ImmediateRead() {
-    return USART1->DR;
+  inline uint8_t ImmediateRead() {
+    uint8_t byte = rx_buffer_[rx_read_ptr_];
+    rx_read_ptr_ = (rx_read_ptr_ + 1) & (kMidiRxBufferSize - 1);
+    return byte;
+  }
+
+  inline void Skip(uint8_t num_bytes) {
+    rx_read_ptr_ = (rx_read_ptr_ + num_bytes) & (kMidiRxBufferSize - 1);
   }
   
  private:
+  inline uint8_t rx_write_ptr() const {
+    return (kMidiRxBufferSize - DMA1_Channel5->CNDTR) & \
+        (kMidiRxBufferSize - 1);
+  }
+
+  volatile uint8_t rx_buffer_[kMidiRxBufferSize];
+  uint8_t rx_read_ptr_;
+
   DISALLOW_COPY_AND_ASSIGN(MidiIO);
 };
 
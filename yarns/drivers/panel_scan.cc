@@ -0,0 +1,121 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Timer-driven multiplexing of the display and channel LEDs.
+
+#include "yarns/drivers/panel_scan.h"
+
+#ifndef TEST
+#include <stm32f10x_conf.h>
+#endif  // TEST
+
+#include <algorithm>
+
+namespace yarns {
+
+void PanelScan::Init() {
+  std::fill(&words_[0][0], &words_[0][0] + SCAN_PORT_LAST * kNumScanSlots, 0);
+  blanking_pins_ = 0;
+
+#ifdef TEST
+  simulated_blanking_delay_ = kScanSlotPeriod;
+#else
+  TIM_TimeBaseInitTypeDef timer_init = {0};
+  timer_init.TIM_Period = kScanSlotPeriod - 1;
+  timer_init.TIM_Prescaler = 0;
+  timer_init.TIM_ClockDivision = TIM_CKD_DIV1;
+  timer_init.TIM_CounterMode = TIM_CounterMode_Up;
+  timer_init.TIM_RepetitionCounter = 0;
+  TIM_TimeBaseInit(TIM4, &timer_init);
+
+  TIM_OCInitTypeDef oc_init = {0};
+  oc_init.TIM_OCMode = TIM_OCMode_Timing;
+  oc_init.TIM_OutputState = TIM_OutputState_Disable;
+  oc_init.TIM_OCPolarity = TIM_OCPolarity_High;
+
+  // Port A words, at the start of the slot like port B's
+  oc_init.TIM_Pulse = 0;
+  TIM_OC1Init(TIM4, &oc_init);
+
+  // Blanking, off until a delay is set
+  oc_init.TIM_Pulse = kScanSlotPeriod;
+  TIM_OC2Init(TIM4, &oc_init);
+
+  DMA_InitTypeDef dma_init = {0};
+  dma_init.DMA_DIR = DMA_DIR_PeripheralDST;
+  dma_init.DMA_BufferSize = kNumScanSlots;
+  dma_init.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+  dma_init.DMA_MemoryInc = DMA_MemoryInc_Enable;
+  dma_init.DMA_M2M = DMA_M2M_Disable;
+  dma_init.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+  dma_init.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
+  dma_init.DMA_Mode = DMA_Mode_Circular;
+
+  // Port B words (TIM4_UP).  Served before the blanking when both fall at the
+  // start of the slot.
+  DMA_InitTypeDef port_b_dma = dma_init;
+  port_b_dma.DMA_PeripheralBaseAddr = (uint32_t)&GPIOB->BSRR;
+  port_b_dma.DMA_MemoryBaseAddr = (uint32_t)&words_[SCAN_PORT_B][0];
+  port_b_dma.DMA_Priority = DMA_Priority_Medium;
+  DMA_Init(DMA1_Channel7, &port_b_dma);
+
+  // Port A words (TIM4_CH1)
+  DMA_InitTypeDef port_a_dma = dma_init;
+  port_a_dma.DMA_PeripheralBaseAddr = (uint32_t)&GPIOA->BSRR;
+  port_a_dma.DMA_MemoryBaseAddr = (uint32_t)&words_[SCAN_PORT_A][0];
+  port_a_dma.DMA_Priority = DMA_Priority_Low;
+  DMA_Init(DMA1_Channel1, &port_a_dma);
+
+  // Blanking (TIM4_CH2)
+  DMA_InitTypeDef blanking_dma = dma_init;
+  blanking_dma.DMA_PeripheralBaseAddr = (uint32_t)&GPIOB->BRR;
+  blanking_dma.DMA_MemoryBaseAddr = (uint32_t)&blanking_pins_;
+  blanking_dma.DMA_BufferSize = 1;
+  blanking_dma.DMA_MemoryInc = DMA_MemoryInc_Disable;
+  blanking_dma.DMA_Priority = DMA_Priority_Low;
+  DMA_Init(DMA1_Channel4, &blanking_dma);
+
+  DMA_Cmd(DMA1_Channel7, ENABLE);
+  DMA_Cmd(DMA1_Channel1, ENABLE);
+  DMA_Cmd(DMA1_Channel4, ENABLE);
+  TIM_DMACmd(TIM4, TIM_DMA_Update | TIM_DMA_CC1 | TIM_DMA_CC2, ENABLE);
+  TIM_Cmd(TIM4, ENABLE);
+#endif  // TEST
+}
+
+void PanelScan::set_blanking(uint16_t pins, uint16_t delay) {
+  blanking_pins_ = pins;
+#ifdef TEST
+  simulated_blanking_delay_ = delay;
+#else
+  TIM_SetCompare2(TIM4, delay);
+#endif  // TEST
+}
+
+/* extern */
+PanelScan panel_scan;
+
+}  // namespace yarns
@@ -0,0 +1,96 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Timer-driven multiplexing of the display and channel LEDs.  At each slot of
+// the scan, TIM4 has the DMA write one precomputed word to the set/reset
+// register of each port, so the CPU only edits the words when what is shown
+// changes.
+
+#ifndef YARNS_DRIVERS_PANEL_SCAN_H_
+#define YARNS_DRIVERS_PANEL_SCAN_H_
+
+#include "stmlib/stmlib.h"
+
+namespace yarns {
+
+// One display position is lit while the 16 segments of the other are shifted
+// in, a bit and a clock edge per slot, then latched at the next position's
+// first slot.
+const uint8_t kNumScanPositions = 2;
+const uint8_t kScanSlotsPerPosition = 34;
+const uint8_t kNumScanSlots = kNumScanPositions * kScanSlotsPerPosition;
+// 8 kHz slots at 72 MHz, for a 118 Hz scan
+const uint16_t kScanSlotPeriod = 9000;
+
+enum ScanPort {
+  SCAN_PORT_A,
+  SCAN_PORT_B,
+  SCAN_PORT_LAST
+};
+
+class PanelScan {
+ public:
+  PanelScan() { }
+  ~PanelScan() { }
+
+  void Init();
+
+  // Drives the pins high or low from the start of the slot.
+  inline void Write(ScanPort port, uint8_t slot, uint16_t pins, bool high) {
+    uint32_t mask = pins | static_cast<uint32_t>(pins) << 16;
+    uint32_t word = words_[port][slot] & ~mask;
+    words_[port][slot] = word | (high ? pins : static_cast<uint32_t>(pins) << 16);
+  }
+
+  // Port B pins driven low partway through every slot, after the given
+  // number of timer cycles.  A delay of 0 keeps them low, and one of a whole
+  // slot or more never drives them.
+  void set_blanking(uint16_t pins, uint16_t delay);
+
+#ifdef TEST
+  inline uint32_t word(ScanPort port, uint8_t slot) const {
+    return words_[port][slot];
+  }
+  inline uint16_t blanking_pins() const { return blanking_pins_; }
+  inline uint16_t blanking_delay() const { return simulated_blanking_delay_; }
+#endif  // TEST
+
+ private:
+  volatile uint32_t words_[SCAN_PORT_LAST][kNumScanSlots];
+  volatile uint32_t blanking_pins_;
+#ifdef TEST
+  // Stands in for TIM4's CCR2.
+  uint16_t simulated_blanking_delay_;
+#endif  // TEST
+
+  DISALLOW_COPY_AND_ASSIGN(PanelScan);
+};
+
+extern PanelScan panel_scan;
+
+}  // namespace yarns
+
+#endif  // YARNS_DRIVERS_PANEL_SCAN_H_
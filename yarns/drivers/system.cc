@@ -48,7 +48,8 @@ void System::Init() {
     ENABLE
   );
   RCC_APB1PeriphClockCmd(
-    RCC_APB1Periph_SPI2,
+    RCC_APB1Periph_SPI2 |
+    RCC_APB1Periph_TIM4,
     ENABLE
   );
   RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
@@ -35,7 +35,99 @@ namespace yarns {
 
 using namespace stmlib;
 
+// Stands in for the voice's ADSR until the first NoteOn
+static ADSR idle_adsr;
+
+// Rounds to the 24 significant bits of a float, to nearest even
+static uint64_t RoundToFloat(uint32_t x) {
+  if (!(x >> 24)) return x;
+  uint8_t shift = 8 - __builtin_clz(x);
+  uint32_t half = 1 << (shift - 1);
+  uint32_t rest = x & ((half << 1) - 1);
+  uint64_t rounded = x >> shift;
+  if (rest > half || (rest == half && (rounded & 1))) ++rounded;
+  return rounded << shift;
+}
+
+// The same for a product of two floats' mantissas
+static uint64_t RoundToFloat(uint64_t x) {
+  if (!(x >> 32)) return RoundToFloat(static_cast<uint32_t>(x));
+  uint8_t shift = 40 - __builtin_clzll(x);
+  uint64_t half = 1ULL << (shift - 1);
+  uint64_t rest = x & ((half << 1) - 1);
+  uint64_t rounded = x >> shift;
+  if (rest > half || (rest == half && (rounded & 1))) ++rounded;
+  return rounded << shift;
+}
+
+uint32_t TruncatedFloatRatio(uint32_t n, uint32_t d) {
+  n = static_cast<uint32_t>(RoundToFloat(n));
+  d = static_cast<uint32_t>(RoundToFloat(d));
+  uint32_t quotient = n / d;
+  if (quotient >> 24) {
+    // Already whole: round it like the float, with the remainder as the
+    // sticky bit, and saturate it like the conversion to a signed integer
+    uint64_t rounded = RoundToFloat(
+        (static_cast<uint64_t>(quotient) << 1) | (n % d != 0)) >> 1;
+    return rounded >> 31 ? INT32_MAX : static_cast<uint32_t>(rounded);
+  }
+  uint64_t shortfall = d - n % d;  // To the next integer, in units of 1 / d
+  // Bits below the point of the float quotient
+  uint8_t fraction_bits = 23 - (31 - __builtin_clz(quotient));
+  shortfall <<= fraction_bits + 1;
+  if (shortfall < d || (shortfall == d && (fraction_bits || quotient & 1))) {
+    ++quotient;
+  }
+  return quotient;
+}
+
+uint32_t ScalePhaseIncrement(uint32_t phase_increment, uint32_t ratio) {
+  uint64_t product = RoundToFloat(phase_increment) * RoundToFloat(ratio);
+  // Products of 2^32 or more saturate whatever their rounding
+  if (!(product >> 32)) product = RoundToFloat(static_cast<uint32_t>(product));
+  return product >> 32 ? UINT32_MAX : static_cast<uint32_t>(product);
+}
+
+int32_t ScaleLevel(int32_t level, int16_t new_scale, int16_t old_scale) {
+  if (!level || !new_scale) return 0;
+  // Line the scales up so that their quotient is in [1, 2)
+  uint32_t n = new_scale;
+  uint32_t d = old_scale;
+  int8_t exponent = 0;
+  while (n < d) { n <<= 1; --exponent; }
+  while (n >= d << 1) { d <<= 1; ++exponent; }
+  // 25 bits of the quotient, one 16-bit digit per division, then round it to
+  // the 24 of the float factor, with the remainder as the sticky bit
+  uint32_t quotient = (n << 8) / d;
+  uint32_t remainder = (n << 8) % d;
+  quotient = (quotient << 16) | ((remainder << 16) / d);
+  bool sticky = (remainder << 16) % d;
+  uint32_t mantissa = quotient >> 1;
+  if ((quotient & 1) && (sticky || (mantissa & 1))) ++mantissa;
+  exponent -= 23;
+
+  // The level too goes through a float, and so does the product.  The
+  // conversion back truncates towards zero and saturates.
+  uint32_t magnitude = level < 0 ? -static_cast<uint32_t>(level) : level;
+  uint64_t product = RoundToFloat(
+      RoundToFloat(magnitude) * static_cast<uint64_t>(mantissa));
+  uint64_t scaled = product >> -exponent;  // The factor is below 2^15
+  if (level > 0) {
+    return scaled > static_cast<uint64_t>(INT32_MAX) ? INT32_MAX : scaled;
+  }
+  return scaled > static_cast<uint64_t>(INT32_MAX) + 1
+      ? INT32_MIN
+      : static_cast<int32_t>(-static_cast<int64_t>(scaled));
+}
+
+static inline int16_t OutputSample(int32_t value, int32_t bias) {
+  int32_t overflowing_u16 = (value >> (30 - 16)) + (bias >> (31 - 16));
+  uint16_t clipped_u16 = ClipU16(overflowing_u16);
+  return clipped_u16 >> 1; // 0..INT16_MAX
+}
+
 void Envelope::Init(int16_t raw_zero_value) {
+  adsr_ = &idle_adsr;
   phase_ = phase_increment_ = 0;
   int32_t scaled_zero_value = raw_zero_value << (31 - 16);
   value_ = scaled_zero_value;
@@ -44,21 +136,20 @@ void Envelope::Init(int16_t raw_zero_value) {
     &stage_target_[ENV_NUM_STAGES],
     scaled_zero_value
   );
-  std::fill(
-    &expo_slope_lut_[0],
-    &expo_slope_lut_[LUT_EXPO_SLOPE_SHIFT_SIZE],
-    0
-  );
+  slope_ = 0;
+  linear_ = true;
+  num_pending_ = 0;
   Trigger(ENV_STAGE_DEAD);
 }
 
-void Envelope::NoteOff() {
-  Trigger(ENV_STAGE_RELEASE);
+void Envelope::NoteOff(uint16_t delay) {
+  Schedule(ENV_STAGE_RELEASE, delay);
 }
 
 void Envelope::NoteOn(
   ADSR& adsr,
-  int32_t min_target, int32_t max_target // Actual bounds, 16-bit signed
+  int32_t min_target, int32_t max_target, // Actual bounds, 16-bit signed
+  uint16_t delay
 ) {
   adsr_ = &adsr;
   int16_t scale = max_target - min_target;
@@ -71,24 +162,54 @@ void Envelope::NoteOn(
   stage_target_[ENV_STAGE_RELEASE] = stage_target_[ENV_STAGE_DEAD] =
     min_target >> 1;
 
-  switch (stage_) {
+  // A pending trigger is where the envelope will be by then
+  EnvelopeStage stage = static_cast<EnvelopeStage>(num_pending_
+    ? pending_stage_[num_pending_ - 1]
+    : stage_);
+  switch (stage) {
     case ENV_STAGE_ATTACK:
       // Legato: ignore changes to peak target
       break;
     case ENV_STAGE_DECAY:
     case ENV_STAGE_SUSTAIN:
       // Legato: respect changes to sustain target, using decay to transition
-      Trigger(ENV_STAGE_DECAY);
+      Schedule(ENV_STAGE_DECAY, delay);
       break;
     case ENV_STAGE_RELEASE:
     case ENV_STAGE_DEAD:
     case ENV_NUM_STAGES:
       // Start new attack
-      Trigger(ENV_STAGE_ATTACK);
+      Schedule(ENV_STAGE_ATTACK, delay);
       break;
   }
 }
 
+void Envelope::Schedule(EnvelopeStage stage, uint16_t delay) {
+  if (num_pending_) {
+    uint8_t last = num_pending_ - 1;
+    if (delay <= pending_delay_[last]) {
+      // Same frame (e.g. release before retrigger): the later call wins
+      pending_stage_[last] = stage;
+      return;
+    }
+    if (num_pending_ == kMaxPendingTriggers) {
+      // Out of room: the oldest trigger loses its timing
+      Trigger(static_cast<EnvelopeStage>(pending_stage_[0]));
+      for (uint8_t i = 1; i < num_pending_; ++i) {
+        pending_stage_[i - 1] = pending_stage_[i];
+        pending_delay_[i - 1] = pending_delay_[i];
+      }
+      --num_pending_;
+    }
+  } else if (!delay) {
+    Trigger(stage);
+    return;
+  }
+  pending_stage_[num_pending_] = stage;
+  pending_delay_[num_pending_] = delay;
+  ++num_pending_;
+}
+
 #define TRIGGER_NEXT_STAGE \
   return Trigger(static_cast<EnvelopeStage>(stage + 1));
 
@@ -136,11 +257,12 @@ void Envelope::Trigger(EnvelopeStage stage) {
     // Closer to target than expected -- shorten stage duration proportionally, keeping nominal slope
     // Cases: NoteOn during release (of same polarity); NoteOff from below sustain level during attack
     linear_slope = MulS32(nominal_delta, phase_increment_);
-    phase_increment_ = static_cast<uint32_t>(
-      static_cast<float>(phase_increment_) * abs(
-        static_cast<float>(nominal_delta) /
-        static_cast<float>(actual_delta)
-      )
+    // The float version passed the ratio through the integer abs(), so it
+    // only ever scaled by whole multiples.  Its roundings are kept, so that
+    // the curves stay the same.
+    phase_increment_ = ScalePhaseIncrement(
+      phase_increment_,
+      TruncatedFloatRatio(abs(nominal_delta), abs(actual_delta))
     );
   } else {
     // Distance is GTE expected -- keep nominal stage duration, but steepen the slope
@@ -149,34 +271,72 @@ void Envelope::Trigger(EnvelopeStage stage) {
   }
   if (!linear_slope) TRIGGER_NEXT_STAGE; // Too close to target for useful slope
 
-  // Populate dynamic LUT for phase-dependent slope
+  // If we won't get 2+ samples per expo shift, fall back on linear slope
   const uint32_t max_expo_phase_increment = UINT32_MAX >> (kLutExpoSlopeShiftSizeBits + 1);
-  if (phase_increment_ > max_expo_phase_increment) {
-    // If we won't get 2+ samples per expo shift, fall back on linear slope
-    std::fill(
-      &expo_slope_lut_[0],
-      &expo_slope_lut_[LUT_EXPO_SLOPE_SHIFT_SIZE],
-      linear_slope
-    );
-  } else {
-    const uint8_t max_shift = signed_clz(linear_slope) - 1; // Maintain 31-bit scaling
-    for (uint8_t i = 0; i < LUT_EXPO_SLOPE_SHIFT_SIZE; ++i) {
-      int8_t shift = lut_expo_slope_shift[i];
-      expo_slope_lut_[i] = shift >= 0
-        ? linear_slope << std::min(static_cast<uint8_t>(shift), max_shift)
-        : linear_slope >> static_cast<uint8_t>(-shift);
-      if (!expo_slope_lut_[i]) {
-        expo_slope_lut_[i] = linear_slope > 0 ? 1 : -1;
-      }
+  slope_ = linear_slope;
+  linear_ = phase_increment_ > max_expo_phase_increment;
+}
+
+void Envelope::ExpandSlope(int32_t* expo_slope) const {
+  if (linear_) {
+    std::fill(&expo_slope[0], &expo_slope[LUT_EXPO_SLOPE_SHIFT_SIZE], slope_);
+    return;
+  }
+  const uint8_t max_shift = signed_clz(slope_) - 1; // Maintain 31-bit scaling
+  for (uint8_t i = 0; i < LUT_EXPO_SLOPE_SHIFT_SIZE; ++i) {
+    int8_t shift = lut_expo_slope_shift[i];
+    expo_slope[i] = shift >= 0
+      ? slope_ << std::min(static_cast<uint8_t>(shift), max_shift)
+      : slope_ >> static_cast<uint8_t>(-shift);
+    if (!expo_slope[i]) {
+      expo_slope[i] = slope_ > 0 ? 1 : -1;
     }
   }
 }
 
-void Envelope::RenderSamples(int16_t* sample_buffer, int32_t bias_target) {
+bool Envelope::RenderSamples(int16_t* sample_buffer, int32_t bias_target) {
   // Bias is unaffected by stage change, thus has distinct lifecycle from other locals
   const int32_t bias_slope = ((bias_target >> 1) - (bias_ >> 1)) >> (kAudioBlockSizeBits - 1);
   size_t samples_left = kAudioBlockSize;
-  RenderStageDispatch(sample_buffer, samples_left, bias_, bias_slope);
+
+  // Held at a level with a settled bias, and no trigger in this block: every
+  // sample is the same
+  const bool flat = !phase_increment_ && !bias_slope && (
+    !num_pending_ || pending_delay_[0] >= kAudioBlockSize
+  );
+  uint8_t num_triggered = 0;
+  if (flat) {
+    value_ = target_;
+    std::fill(
+      &sample_buffer[0],
+      &sample_buffer[kAudioBlockSize],
+      OutputSample(value_, bias_)
+    );
+  } else {
+    // Render up to each trigger that falls in this block, then trigger it
+    while (
+      num_triggered < num_pending_ &&
+      pending_delay_[num_triggered] < kAudioBlockSize
+    ) {
+      size_t samples = pending_delay_[num_triggered] -
+        (kAudioBlockSize - samples_left);
+      RenderStageDispatch(sample_buffer, samples, bias_, bias_slope);
+      sample_buffer += samples;
+      samples_left -= samples;
+      Trigger(static_cast<EnvelopeStage>(pending_stage_[num_triggered++]));
+    }
+    RenderStageDispatch(sample_buffer, samples_left, bias_, bias_slope);
+  }
+
+  // Later triggers move one block closer
+  uint8_t num_left = 0;
+  for (uint8_t i = num_triggered; i < num_pending_; ++i) {
+    pending_stage_[num_left] = pending_stage_[i];
+    pending_delay_[num_left] = pending_delay_[i] - kAudioBlockSize;
+    ++num_left;
+  }
+  num_pending_ = num_left;
+  return flat;
 }
 
 void Envelope::RenderStageDispatch(
@@ -184,7 +344,7 @@ void Envelope::RenderStageDispatch(
 ) {
   if (phase_increment_ == 0) {
     RenderStage<false , false >(sample_buffer, samples_left, bias, bias_slope);
-  } else if (expo_slope_lut_[0] > 0) {
+  } else if (slope_ > 0) {
     RenderStage<true  , true  >(sample_buffer, samples_left, bias, bias_slope);
   } else {
     RenderStage<true  , false >(sample_buffer, samples_left, bias, bias_slope);
@@ -198,9 +358,7 @@ void Envelope::RenderStageDispatch(
 
 #define OUTPUT \
   bias += bias_slope; \
-  int32_t overflowing_u16 = (value >> (30 - 16)) + (bias >> (31 - 16)); \
-  uint16_t clipped_u16 = ClipU16(overflowing_u16); \
-  *sample_buffer++ = clipped_u16 >> 1; // 0..INT16_MAX
+  *sample_buffer++ = OutputSample(value, bias);
 
 template<bool MOVING, bool POSITIVE_SLOPE>
 void Envelope::RenderStage(
@@ -210,13 +368,9 @@ void Envelope::RenderStage(
   int32_t target = target_;
   uint32_t phase = phase_;
   uint32_t phase_increment = phase_increment_;
-  EnvelopeStage stage = stage_;
+  EnvelopeStage stage = static_cast<EnvelopeStage>(stage_);
   int32_t expo_slope[LUT_EXPO_SLOPE_SHIFT_SIZE];
-  std::copy(
-    &expo_slope_lut_[0],
-    &expo_slope_lut_[LUT_EXPO_SLOPE_SHIFT_SIZE],
-    &expo_slope[0]
-  );
+  if (MOVING) ExpandSlope(expo_slope);
   // int32_t nominal_start = nominal_start_;
   // bool nominal_start_reached = false;
 
@@ -258,16 +412,17 @@ void Envelope::RenderStage(
   bias_ = bias;
 }
 
-void Envelope::Rescale(float factor) {
-  bias_ = static_cast<int32_t>(bias_ * factor);
-  value_ = static_cast<int32_t>(value_ * factor);
-  target_ = static_cast<int32_t>(target_ * factor);
+void Envelope::Rescale(int16_t new_scale, int16_t old_scale) {
+  if (new_scale < 0 || old_scale <= 0) return;
+  bias_ = ScaleLevel(bias_, new_scale, old_scale);
+  value_ = ScaleLevel(value_, new_scale, old_scale);
+  target_ = ScaleLevel(target_, new_scale, old_scale);
   for (int i = 0; i < ENV_NUM_STAGES; ++i) {
-    stage_target_[i] = static_cast<int32_t>(stage_target_[i] * factor);
-  }
-  for (int i = 0; i < LUT_EXPO_SLOPE_SHIFT_SIZE; ++i) {
-    expo_slope_lut_[i] = static_cast<int32_t>(expo_slope_lut_[i] * factor);
+    stage_target_[i] = ScaleLevel(stage_target_[i], new_scale, old_scale);
   }
+  int32_t slope = ScaleLevel(slope_, new_scale, old_scale);
+  if (!slope && slope_) slope = slope_ > 0 ? 1 : -1;  // Keep moving
+  slope_ = slope;
 }
 
 }  // namespace yarns
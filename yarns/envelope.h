@@ -46,25 +46,44 @@ struct ADSR {
   uint32_t attack, decay, release; // Timing
 };
 
+// A NoteOn and the NoteOff of a note shorter than a block.
+const uint8_t kMaxPendingTriggers = 2;
+
 const uint8_t kLutExpoSlopeShiftSizeBits = 4;
 STATIC_ASSERT(
   1 << kLutExpoSlopeShiftSizeBits == LUT_EXPO_SLOPE_SHIFT_SIZE,
   expo_slope_shift_size
 );
 
+// The float math that Trigger and Rescale used to do, in integers, rounding
+// included.  The float quotient n / d, for n >= d, truncated to an integer
+// and saturated to 31 bits.
+uint32_t TruncatedFloatRatio(uint32_t n, uint32_t d);
+// The float product of the phase increment and a whole ratio, truncated and
+// saturated.
+uint32_t ScalePhaseIncrement(uint32_t phase_increment, uint32_t ratio);
+// The float level * new_scale / old_scale, for new_scale >= 0 and
+// old_scale > 0, truncated and saturated to 32 bits.
+int32_t ScaleLevel(int32_t level, int16_t new_scale, int16_t old_scale);
+
 class Envelope {
  public:
   Envelope() { }
   ~Envelope() { }
 
+  // NoteOn and NoteOff take effect delay frames into the next render, so that
+  // onsets are not quantized to the block size.
   void Init(int16_t zero_value);
-  void NoteOff();
+  void NoteOff(uint16_t delay);
   void NoteOn(
     ADSR& adsr,
-    int32_t min_target, int32_t max_target // Actual bounds, 16-bit signed
+    int32_t min_target, int32_t max_target, // Actual bounds, 16-bit signed
+    uint16_t delay
   );
   void Trigger(EnvelopeStage stage);
-  void RenderSamples(int16_t* sample_buffer, int32_t bias_target);
+  void Schedule(EnvelopeStage stage, uint16_t delay);
+  // Returns whether the block is flat, every sample the same.
+  bool RenderSamples(int16_t* sample_buffer, int32_t bias_target);
   void RenderStageDispatch(
     int16_t* sample_buffer, size_t samples_left, int32_t bias, int32_t bias_slope
   );
@@ -73,7 +92,9 @@ class Envelope {
     int16_t* sample_buffer, size_t samples_left, int32_t bias, int32_t bias_slope
   );
 
-  void Rescale(float scaling_factor);
+  // Scales the levels by new_scale / old_scale.  Ignored unless old_scale is
+  // positive.
+  void Rescale(int16_t new_scale, int16_t old_scale);
 
   inline int16_t tremolo(uint16_t strength) const {
     int32_t relative_value = (value_ - stage_target_[ENV_STAGE_RELEASE]) >> (31 - 16);
@@ -87,21 +108,40 @@ class Envelope {
     return __builtin_clzl(x_for_clz) - 1;
   }
 
+#ifdef TEST
+  uint32_t phase_increment() const { return phase_increment_; }
+#endif  // TEST
+
  private:
+  // Expands the stage's slope into the slope of each phase segment
+  void ExpandSlope(int32_t* expo_slope) const;
+
   ADSR* adsr_;
 
   // 31-bit, so slope increment can skip overflow checks
   int32_t stage_target_[ENV_NUM_STAGES];
   int32_t target_, value_;
-  int32_t expo_slope_lut_[LUT_EXPO_SLOPE_SHIFT_SIZE];
+
+  // Linear slope of the stage.  Rendering shapes it into an expo slope with
+  // the shared lut_expo_slope_shift, so no envelope keeps its own table.
+  int32_t slope_;
 
   // 32-bit
   int32_t bias_;
 
+  uint32_t phase_, phase_increment_;
+
+  // Triggers waiting for their frame, in order.  Delays count frames from the
+  // start of the next render.
+  uint16_t pending_delay_[kMaxPendingTriggers];
+  uint8_t pending_stage_[kMaxPendingTriggers];  // EnvelopeStage
+  uint8_t num_pending_;
+
   // Current stage.
-  EnvelopeStage stage_;
+  uint8_t stage_;  // EnvelopeStage
 
-  uint32_t phase_, phase_increment_;
+  // The stage is too short for the expo shape, so its slope stays linear
+  bool linear_;
 
   DISALLOW_COPY_AND_ASSIGN(Envelope);
 };
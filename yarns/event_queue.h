@@ -0,0 +1,153 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Timestamped events from SysTick to the main loop.
+//
+// SysTick is the only producer and the main loop the only consumer, so the
+// queue needs no locking: each side owns one of the two pointers.  Everything
+// that parses MIDI or allocates voices runs in the consumer, so the interrupt
+// only ever reads voice state that the main loop has finished writing.
+
+#ifndef YARNS_EVENT_QUEUE_H_
+#define YARNS_EVENT_QUEUE_H_
+
+#include "stmlib/stmlib.h"
+
+#include "yarns/drivers/dac.h"
+
+namespace yarns {
+
+enum EventType {
+  EVENT_MIDI_BYTE,
+  // A tick of the internal clock
+  EVENT_INTERNAL_CLOCK,
+  // A part's swing LFO reached the point where its swung step is due
+  EVENT_SWING_STEP,
+};
+
+struct TimedEvent {
+  // Value of dac.frame_counter() when the event happened
+  uint16_t frame;
+  uint8_t type;
+  uint8_t data;
+};
+
+// With what the MIDI input's DMA buffer holds, room for the input of a 50 ms
+// main loop stall, longer than a flash page erase, at the full MIDI rate.
+const uint8_t kEventQueueSizeBits = 7;
+const uint8_t kEventQueueSize = 1 << kEventQueueSizeBits;
+// Entries that MIDI input leaves to the clock ticks and swung steps
+const uint8_t kNumReservedEvents = 16;
+
+class EventQueue {
+ public:
+  EventQueue() { }
+  ~EventQueue() { }
+
+  void Init() {
+    read_ptr_ = write_ptr_ = 0;
+    num_dropped_ = 0;
+    handling_event_ = false;
+  }
+
+  // Producer side, called from SysTick.  Returns false, counting the event
+  // as dropped, when the queue is full.
+  inline bool Push(EventType type, uint8_t data) {
+    return Push(type, data, dac.frame_counter());
+  }
+
+  // For events that happened before SysTick got to them.
+  inline bool Push(EventType type, uint8_t data, uint16_t frame) {
+    uint8_t write_ptr = write_ptr_;
+    uint8_t next = (write_ptr + 1) & (kEventQueueSize - 1);
+    if (next == read_ptr_) {
+      ++num_dropped_;
+      return false;
+    }
+    TimedEvent& e = events_[write_ptr];
+    e.frame = frame;
+    e.type = type;
+    e.data = data;
+    // The event must be complete before the consumer can see it.
+    __asm__ volatile ("" ::: "memory");
+    write_ptr_ = next;
+    return true;
+  }
+
+  inline uint8_t num_writable() const {
+    return (read_ptr_ - write_ptr_ - 1) & (kEventQueueSize - 1);
+  }
+
+  // MIDI input beyond this waits in the DMA buffer.
+  inline uint8_t num_writable_midi_bytes() const {
+    uint8_t n = num_writable();
+    return n > kNumReservedEvents ? n - kNumReservedEvents : 0;
+  }
+
+  // For input lost before it could be queued.
+  inline void CountDropped(uint8_t n) { num_dropped_ += n; }
+
+  // Consumer side, called from the main loop.
+  inline bool readable() const { return read_ptr_ != write_ptr_; }
+
+  inline TimedEvent Pop() {
+    uint8_t read_ptr = read_ptr_;
+    TimedEvent e = events_[read_ptr];
+    __asm__ volatile ("" ::: "memory");
+    read_ptr_ = (read_ptr + 1) & (kEventQueueSize - 1);
+    event_frame_ = e.frame;
+    handling_event_ = true;
+    return e;
+  }
+
+  // Called once the popped events have been handled.
+  inline void Release() { handling_event_ = false; }
+
+  // Frame at which the event being handled was received.  Notes that do not
+  // come from an event (UI, looper playback) happen now.
+  inline uint16_t event_frame() const {
+    return handling_event_ ? event_frame_ : dac.frame_counter();
+  }
+
+  inline uint16_t num_dropped() const { return num_dropped_; }
+
+ private:
+  TimedEvent events_[kEventQueueSize];
+  volatile uint8_t read_ptr_;
+  volatile uint8_t write_ptr_;
+  uint16_t num_dropped_;
+
+  uint16_t event_frame_;
+  bool handling_event_;
+
+  DISALLOW_COPY_AND_ASSIGN(EventQueue);
+};
+
+extern EventQueue event_queue;
+
+}  // namespace yarns
+
+#endif  // YARNS_EVENT_QUEUE_H_
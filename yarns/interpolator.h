@@ -58,6 +58,8 @@ class Interpolator {
   }
   int16_t value() const { return y_.hi; }
   int16_t target() const { return y_target_; }
+  // Reached the target of the last ComputeSlope before it
+  bool settled() const { return m_ == 0; }
 
 private:
   fixed_point y_;
@@ -30,6 +30,8 @@
 
 #include <algorithm>
 
+#include "yarns/drivers/dac.h"
+#include "yarns/event_queue.h"
 #include "yarns/resources.h"
 
 namespace yarns {
@@ -44,20 +46,160 @@ void JustIntonationProcessor::Init() {
   HistoryEntry e;
   e.note = 0;
   e.pitch = 0;
+  e.octave_pitch = 0;
   e.weight = 0;
   std::fill(&history_[0], &history_[kHistorySize], e);
+  for (uint8_t i = 0; i < kHistorySize; ++i) {
+    order_[i] = i;
+  }
+  chord_frame_ = 0;
+  num_chord_notes_ = 0;
+  num_retuned_ = 0;
+}
+
+void JustIntonationProcessor::Move(uint8_t index, uint8_t position) {
+  uint8_t from = 0;
+  while (order_[from] != index) {
+    ++from;
+  }
+  for (; from > position; --from) {
+    order_[from] = order_[from - 1];
+  }
+  for (; from < position; ++from) {
+    order_[from] = order_[from + 1];
+  }
+  order_[position] = index;
+}
+
+void JustIntonationProcessor::SetPitch(uint8_t index, int16_t pitch) {
+  history_[index].pitch = pitch;
+  history_[index].octave_pitch = (pitch + kOctave * 12) % kOctave;
+}
+
+void JustIntonationProcessor::NoteOff(uint8_t note) {
+  for (uint8_t i = 0; i < kHistorySize; ++i) {
+    if (history_[i].note == note && history_[i].weight == 255) {
+      history_[i].weight = 192;
+      // Behind the notes still playing, ahead of all the decayed ones.
+      uint8_t num_playing = 0;
+      for (uint8_t j = 0; j < kHistorySize; ++j) {
+        num_playing += history_[j].weight == 255;
+      }
+      Move(i, num_playing);
+    }
+  }
+}
+
+int16_t JustIntonationProcessor::NoteOn(uint8_t note, bool chord) {
+  if (note != cached_note_) {
+    // Skip the computationally expensive routine on expensive notes.
+    cached_note_ = note;
+    cached_pitch_ = Tune(static_cast<int>(note) << 7);
+  }
+  // Decay the weight of the previous notes - except those that are still
+  // playing.  This keeps them in order.
+  for (size_t i = 0; i < kHistorySize; ++i) {
+    if (history_[i].weight != 255) {
+      history_[i].weight = (history_[i].weight * 3) >> 2;
+    }
+  }
+  uint8_t index = write_ptr_;
+  history_[index].note = note;
+  history_[index].weight = 255;
+  SetPitch(index, cached_pitch_);
+  Move(index, 0);
+  ++write_ptr_;
+  if (write_ptr_ >= kHistorySize) {
+    write_ptr_ = 0;
+  }
+  if (chord) {
+    JoinChord(index);
+  } else {
+    num_chord_notes_ = 0;
+  }
+  return history_[index].pitch;
+}
+
+void JustIntonationProcessor::JoinChord(uint8_t index) {
+  uint16_t frame = event_queue.event_frame();
+  uint16_t window = dac.frame_hz() * kChordWindowMs / 1000;
+  // Only the notes of the chord that are still held are retuned.
+  uint8_t num_notes = 0;
+  if (static_cast<uint16_t>(frame - chord_frame_) <= window) {
+    for (uint8_t i = 0; i < num_chord_notes_; ++i) {
+      uint8_t member = chord_[i];
+      if (member != index && history_[member].weight == 255) {
+        chord_[num_notes++] = member;
+      }
+    }
+  }
+  if (num_notes == 0 || num_notes == kMaxChordNotes) {
+    chord_frame_ = frame;
+    chord_[0] = index;
+    num_chord_notes_ = 1;
+    return;
+  }
+  chord_[num_notes++] = index;
+  num_chord_notes_ = num_notes;
+
+  // One refinement pass over the chord, the new note last.  Each note is
+  // searched around its current tuning, against everything else, without
+  // leaving the range of the initial search.
+  for (uint8_t i = 0; i < num_chord_notes_; ++i) {
+    uint8_t member = chord_[i];
+    int note = static_cast<int>(history_[member].note) << 7;
+    int correction = history_[member].pitch - note;
+    int min = std::max(correction - 6, -38);
+    int max = std::min(correction + 6, 38);
+    int refined = Tune(note, min, max, 1, BuildTerms(member));
+    if (refined == correction) continue;
+    SetPitch(member, note + refined);
+    if (member == index) continue;
+    bool queued = false;
+    for (uint8_t j = 0; j < num_retuned_; ++j) {
+      queued = queued || retuned_[j] == member;
+    }
+    if (!queued) {
+      retuned_[num_retuned_++] = member;
+    }
+  }
+}
+
+bool JustIntonationProcessor::PopRetuned(uint8_t* note, int16_t* pitch) {
+  if (!num_retuned_) return false;
+  const HistoryEntry& e = history_[retuned_[--num_retuned_]];
+  *note = e.note;
+  *pitch = e.pitch;
+  return true;
 }
 
-int JustIntonationProcessor::Tune(int note, int min, int max, int step) {
+uint8_t JustIntonationProcessor::BuildTerms(uint8_t excluded) {
+  uint8_t num_terms = 0;
+  for (uint8_t i = 0; i < kHistorySize; ++i) {
+    const HistoryEntry& e = history_[order_[i]];
+    if (!e.weight) break;
+    if (order_[i] == excluded) continue;
+    terms_[num_terms].octave_pitch = e.octave_pitch;
+    terms_[num_terms].weight = e.weight;
+    ++num_terms;
+  }
+  return num_terms;
+}
+
+int JustIntonationProcessor::Tune(
+    int note, int min, int max, int step, uint8_t num_terms) const {
   int best_score = 0x7fffffff;
   int best_correction = 0;
   for (int correction = min; correction <= max; correction += step) {
     int score = lut_consonance[
         correction >= 0 ? correction : (kOctave + correction)];
-    int pitch = correction + note;
-    for (size_t i = 0; i < kHistorySize; ++i) {
-      int interval = (pitch - history_[i].pitch + kOctave * 12) % kOctave;
-      score += lut_consonance[interval] * history_[i].weight;
+    int pitch = (correction + note + kOctave * 12) % kOctave;
+    for (uint8_t i = 0; i < num_terms; ++i) {
+      int interval = pitch - terms_[i].octave_pitch;
+      if (interval < 0) {
+        interval += kOctave;
+      }
+      score += lut_consonance[interval] * terms_[i].weight;
       if (score > best_score) {
         break;
       }
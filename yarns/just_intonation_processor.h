@@ -41,6 +41,17 @@
 // interval involves more convoluted ratios (say 32/27), and goes up according
 // to a square law as we move away from the just intervals.
 // The tuning giving the least badness score is selected.
+//
+// The history is also kept sorted by decreasing weight, which the decay and
+// the note on/off updates preserve with a single move each. The search walks
+// the non-zero weights in this order, with each pitch already reduced to an
+// octave, so that the heaviest terms push a bad candidate's score past the
+// best one as early as possible.
+//
+// In chord mode, notes received within a few milliseconds of each other are
+// tuned jointly: each new note of the chord refines the tuning of the notes
+// already sounding against it, and the notes whose tuning changed are
+// returned by PopRetuned.
 
 #ifndef YARNS_JUST_INTONATION_PROCESSOR_H_
 #define YARNS_JUST_INTONATION_PROCESSOR_H_
@@ -53,9 +64,17 @@ struct HistoryEntry {
   uint8_t note;
   uint8_t weight;
   int16_t pitch;
+  int16_t octave_pitch;  // pitch % kOctave
+};
+
+struct ConsonanceTerm {
+  int16_t octave_pitch;
+  uint8_t weight;
 };
 
 const size_t kHistorySize = 16;
+const uint8_t kMaxChordNotes = 8;
+const uint8_t kChordWindowMs = 20;
 
 class JustIntonationProcessor {
  public:
@@ -64,49 +83,39 @@ class JustIntonationProcessor {
   
   void Init();
   
-  inline void NoteOff(uint8_t note) {
-    for (uint8_t i = 0; i < kHistorySize; ++i) {
-      if (history_[i].note == note && history_[i].weight == 255) {
-        history_[i].weight = 192;
-      }
-    }
-  }
-  
-  inline int16_t NoteOn(uint8_t note) {
-    if (note != cached_note_) {
-      // Skip the computationally expensive routine on expensive notes.
-      cached_note_ = note;
-      cached_pitch_ = Tune(static_cast<int>(note) << 7);
-    }
-    // Decay the weight of the previous notes - except those that are still
-    // playing.
-    for (size_t i = 0; i < kHistorySize; ++i) {
-      if (history_[i].weight != 255) {
-        history_[i].weight = (history_[i].weight * 3) >> 2;
-      }
-    }
-    history_[write_ptr_].note = note;
-    history_[write_ptr_].weight = 255;
-    history_[write_ptr_].pitch = cached_pitch_;
-    ++write_ptr_;
-    if (write_ptr_ >= kHistorySize) {
-      write_ptr_ = 0;
-    }
-    return cached_pitch_;
-  }
+  void NoteOff(uint8_t note);
+  int16_t NoteOn(uint8_t note, bool chord = false);
+
+  // Chord notes whose tuning was changed by the last NoteOn.
+  bool PopRetuned(uint8_t* note, int16_t* pitch);
   
  private:
-  int Tune(int note, int min, int max, int steps);
+  int Tune(int note, int min, int max, int steps, uint8_t num_terms) const;
   
   int16_t Tune(int note) {
-    int coarse = Tune(note, -32, 32, 4);
-    return int16_t(note + Tune(note, coarse - 6, coarse + 6, 1));
+    uint8_t num_terms = BuildTerms(kHistorySize);
+    int coarse = Tune(note, -32, 32, 4, num_terms);
+    return int16_t(note + Tune(note, coarse - 6, coarse + 6, 1, num_terms));
   }
 
+  // Collects the non-zero weights, heaviest first, leaving out one entry.
+  uint8_t BuildTerms(uint8_t excluded);
+  void Move(uint8_t index, uint8_t position);
+  void SetPitch(uint8_t index, int16_t pitch);
+  void JoinChord(uint8_t index);
+
   size_t write_ptr_;
   int16_t cached_pitch_;
   uint8_t cached_note_;
   HistoryEntry history_[kHistorySize];
+  uint8_t order_[kHistorySize];  // history_ indices, by decreasing weight
+  ConsonanceTerm terms_[kHistorySize];
+
+  uint16_t chord_frame_;
+  uint8_t chord_[kMaxChordNotes];  // history_ indices, oldest first
+  uint8_t num_chord_notes_;
+  uint8_t retuned_[kMaxChordNotes];
+  uint8_t num_retuned_;
   
   DISALLOW_COPY_AND_ASSIGN(JustIntonationProcessor);
 };
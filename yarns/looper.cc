@@ -35,32 +35,78 @@ namespace yarns {
 
 namespace looper {
 
-void Deck::Init(Part* part) {
+/* extern */
+NotePool note_pool;
+
+#ifdef TEST
+static Note pool_notes[kMaxPoolSize];
+#else
+// From the linker script: the end of .bss, and the top of the stack
+extern uint32_t _ebss;
+extern uint32_t _estack;
+#endif  // TEST
+
+void NotePool::Init() {
+#ifdef TEST
+  notes_ = pool_notes;
+  size_ = kMaxPoolSize;
+#else
+  // The notes take the RAM between .bss and the stack
+  uint8_t* start = reinterpret_cast<uint8_t*>(&_ebss);
+  uint32_t num_bytes = reinterpret_cast<uint8_t*>(&_estack) - start;
+  num_bytes = num_bytes > kStackReserve ? num_bytes - kStackReserve : 0;
+  notes_ = reinterpret_cast<Note*>(start);
+  size_ = std::min<uint32_t>(num_bytes / sizeof(Note), kMaxPoolSize);
+#endif  // TEST
+  for (uint16_t i = 0; i < size_; ++i) {
+    notes_[i].newer = i + 1 < size_ ? i + 1 : kNullIndex;
+    notes_[i].deck = kNullDeck;
+  }
+  free_head_ = size_ ? 0 : kNullIndex;
+  num_free_ = size_;
+}
+
+uint16_t NotePool::Allocate() {
+  uint16_t index = free_head_;
+  if (index == kNullIndex) {
+    return kNullIndex;
+  }
+  free_head_ = notes_[index].newer;
+  --num_free_;
+  return index;
+}
+
+void NotePool::Free(uint16_t index) {
+  notes_[index].newer = free_head_;
+  notes_[index].deck = kNullDeck;
+  free_head_ = index;
+  ++num_free_;
+}
+
+void Deck::Init(Part* part, uint8_t id) {
   part_ = part;
-  RemoveAll();
+  id_ = id;
+  // The pool has just been reset, so there is nothing to give back
+  head_.on = kNullIndex;
+  head_.off = kNullIndex;
+  oldest_ = newest_ = kNullIndex;
+  size_ = 0;
   JumpToTick(0, NULL, NULL);
 }
 
 void Deck::RemoveAll() {
-  for (uint8_t i = 0; i < size_; ++i) {
-    KillNote(index_mod(oldest_index_ + i));
+  uint16_t index = oldest_;
+  while (index != kNullIndex) {
+    uint16_t newer = note(index).newer;
+    KillNote(index);
+    note_pool.Free(index);
+    index = newer;
   }
 
-  std::fill(
-    &notes_[0],
-    &notes_[kMaxNotes],
-    Note()
-  );
   head_.on = kNullIndex;
   head_.off = kNullIndex;
-  oldest_index_ = 0;
+  oldest_ = newest_ = kNullIndex;
   size_ = 0;
-
-  std::fill(
-    &next_link_[0],
-    &next_link_[kMaxNotes],
-    Link()
-  );
 }
 
 void Deck::JumpToTick(int32_t tick_counter, NoteOnFn note_on_fn, NoteOffFn note_off_fn) {
@@ -71,42 +117,94 @@ void Deck::JumpToTick(int32_t tick_counter, NoteOnFn note_on_fn, NoteOffFn note_
 
 void Deck::Unpack(PackedPart& storage) {
   RemoveAll();
-  oldest_index_ = storage.looper_oldest_index;
-  size_ = storage.looper_size;
-  for (uint8_t ordinal = 0; ordinal < kMaxNotes; ++ordinal) {
-    uint8_t index = index_mod(oldest_index_ + ordinal);
-    PackedNote& packed_note = storage.looper_notes[index];
-    Note& note = notes_[index];
-
-    note.on_pos   = packed_note.on_pos  << (16 - kBitsPos);
-    note.off_pos  = packed_note.off_pos << (16 - kBitsPos);
-    note.pitch    = packed_note.pitch;
-    note.velocity = packed_note.velocity;
-
-    if (ordinal < size_) {
-      ProcessNotes(note.on_pos, NULL, NULL);
-      LinkOn(index);
-      ProcessNotes(note.off_pos, NULL, NULL);
-      LinkOff(index);
+  for (uint8_t ordinal = 0; ordinal < storage.looper_size; ++ordinal) {
+    uint16_t index = stmlib::modulo(
+      storage.looper_oldest_index + ordinal, kMaxPackedNotes);
+    if (!AppendPackedNote(storage.looper_notes[index])) {
+      break;
     }
   }
 }
 
-void Deck::Pack(PackedPart& storage) const {
-  storage.looper_oldest_index = oldest_index_;
-  storage.looper_size = size_;
-  for (uint8_t ordinal = 0; ordinal < kMaxNotes; ++ordinal) {
-    uint8_t index = index_mod(oldest_index_ + ordinal);
-    PackedNote& packed_note = storage.looper_notes[index];
-    const Note& note = notes_[index];
+void Deck::Pack(PackedPart& storage, uint8_t max_notes) const {
+  // The notes take the last slots before the modulation matrix, which leaves
+  // the free ones next to the step slots for StepSequence::Pack
+  uint8_t skip = size_ > max_notes ? size_ - max_notes : 0;
+  uint8_t ordinal = storage.looper_capacity() - (size_ - skip);
+  storage.looper_oldest_index = ordinal % kMaxPackedNotes;
+  storage.looper_size = size_ - skip;
+  for (uint16_t index = oldest_; index != kNullIndex; index = note(index).newer) {
+    if (skip) {
+      --skip;
+      continue;
+    }
+    PackNote(index, storage.looper_notes[ordinal++]);
+  }
+}
 
-    packed_note.on_pos    = (note.on_pos  - pos_offset) >> (16 - kBitsPos);
-    packed_note.off_pos   = (note.off_pos - pos_offset) >> (16 - kBitsPos);
-    packed_note.pitch     = note.pitch;
-    packed_note.velocity  = note.velocity;
+void Deck::PackNote(uint16_t index, PackedNote& packed_note) const {
+  const Note& n = note(index);
+  packed_note.on_pos    = (n.on_pos    - pos_offset) >> (16 - kBitsPos);
+  packed_note.off_pos   = (n.off_pos() - pos_offset) >> (16 - kBitsPos);
+  packed_note.pitch     = n.pitch;
+  packed_note.velocity  = n.velocity;
+}
+
+bool Deck::AppendPackedNote(const PackedNote& packed_note) {
+  if (size_ == kMaxDeckNotes) {
+    return false;
+  }
+  uint16_t index = note_pool.Allocate();
+  if (index == kNullIndex) {
+    return false;
+  }
+  Note& n = note(index);
+  n.on_pos        = packed_note.on_pos  << (16 - kBitsPos);
+  n.duration      = (packed_note.off_pos << (16 - kBitsPos)) - n.on_pos;
+  n.pitch         = packed_note.pitch;
+  n.velocity      = packed_note.velocity;
+  n.output_pitch  = kNoOutputPitch;
+  AppendToAgeList(index);
+  LinkNote(index);
+  return true;
+}
+
+void Deck::SwapNotes(Deck& other) {
+  // As with Pack/Unpack, each deck's offset is baked into the notes it gives
+  BakeOffset();
+  other.BakeOffset();
+  std::swap(oldest_, other.oldest_);
+  std::swap(newest_, other.newest_);
+  std::swap(size_, other.size_);
+  Relink();
+  other.Relink();
+}
+
+void Deck::BakeOffset() {
+  for (uint16_t index = oldest_; index != kNullIndex; index = note(index).newer) {
+    note(index).on_pos -= pos_offset;
   }
 }
 
+void Deck::Relink() {
+  head_.on = kNullIndex;
+  head_.off = kNullIndex;
+  for (uint16_t index = oldest_; index != kNullIndex; index = note(index).newer) {
+    note(index).deck = id_;
+    LinkNote(index);
+  }
+}
+
+void Deck::LinkNote(uint16_t index) {
+  const Note& n = note(index);
+  note(index).next_on = kNullIndex;
+  note(index).next_off = kNullIndex;
+  ProcessNotes(n.on_pos, NULL, NULL);
+  LinkOn(index);
+  ProcessNotes(n.off_pos(), NULL, NULL);
+  LinkOff(index);
+}
+
 uint16_t Deck::period_ticks() const {
   return part_->PPQN() << part_->sequencer_settings().loop_length;
 }
@@ -120,38 +218,35 @@ void Deck::Clock(int32_t tick_counter) {
 }
 
 void Deck::RemoveOldestNote() {
-  RemoveNote(oldest_index_);
-  if (size_) {
-    oldest_index_ = index_mod(oldest_index_ + 1);
-  }
+  RemoveNote(oldest_);
 }
 
 void Deck::RemoveNewestNote() {
-  RemoveNote(index_mod(oldest_index_ + size_ - 1));
+  RemoveNote(newest_);
 }
 
-uint8_t Deck::PeekNextOn() const {
+uint16_t Deck::PeekNextOn() const {
   if (head_.on == kNullIndex) {
     return kNullIndex;
   }
-  return next_link_[head_.on].on;
+  return note(head_.on).next_on;
 }
 
-uint8_t Deck::PeekNextOff() const {
+uint16_t Deck::PeekNextOff() const {
   if (head_.off == kNullIndex) {
     return kNullIndex;
   }
-  return next_link_[head_.off].off;
+  return note(head_.off).next_off;
 }
 
 void Deck::ProcessNotes(uint16_t new_pos, NoteOnFn note_on_fn, NoteOffFn note_off_fn) {
-  uint8_t first_seen_on_index, first_seen_off_index;
+  uint16_t first_seen_on_index, first_seen_off_index;
   first_seen_on_index = first_seen_off_index = looper::kNullIndex;
   while (true) {
-    const uint8_t on_index = PeekNextOn();
-    const uint8_t off_index = PeekNextOff();
-    const Note& on = notes_[on_index];
-    const Note& off = notes_[off_index];
+    const uint16_t on_index = PeekNextOn();
+    const uint16_t off_index = PeekNextOff();
+    const Note& on = note(on_index);
+    const Note& off = note(off_index);
 
     bool full_cycle = new_pos == pos_;
     bool can_on = (
@@ -162,14 +257,14 @@ void Deck::ProcessNotes(uint16_t new_pos, NoteOnFn note_on_fn, NoteOffFn note_of
     bool can_off = (
       off_index != kNullIndex &&
       off_index != first_seen_off_index &&
-      (full_cycle || Passed(off.off_pos, pos_, new_pos))
+      (full_cycle || Passed(off.off_pos(), pos_, new_pos))
     );
 
     if (can_on && (
-      !can_off || (on.on_pos - pos_) < (off.off_pos - pos_)
+      !can_off || (on.on_pos - pos_) < (off.off_pos() - pos_)
     )) {
       if (first_seen_on_index == looper::kNullIndex) first_seen_on_index = on_index;
-      if (next_link_[on_index].off == kNullIndex) {
+      if (on.next_off == kNullIndex) {
         // If the next 'on' note doesn't yet have an off link, it's still held,
         // and has been for an entire loop
         RecordNoteOff(on_index);
@@ -187,51 +282,72 @@ void Deck::ProcessNotes(uint16_t new_pos, NoteOnFn note_on_fn, NoteOffFn note_of
   pos_ = new_pos;
 }
 
-uint8_t Deck::RecordNoteOn(uint8_t pitch, uint8_t velocity) {
-  if (size_ == kMaxNotes) {
+uint16_t Deck::RecordNoteOn(uint8_t pitch, uint8_t velocity) {
+  if (size_ == kMaxDeckNotes) {
     RemoveOldestNote();
   }
-  uint8_t index = index_mod(oldest_index_ + size_);
+  uint16_t index = note_pool.Allocate();
+  if (index == kNullIndex) {
+    // The pool is shared, so make room by giving up our own oldest note
+    if (!size_) {
+      return kNullIndex;
+    }
+    RemoveOldestNote();
+    index = note_pool.Allocate();
+  }
 
   LinkOn(index);
-  Note& note = notes_[index];
-  note.pitch = pitch;
-  note.velocity = velocity;
-  note.on_pos = pos_;
-  note.off_pos = pos_;
-  next_link_[index].off = kNullIndex;
-  size_++;
+  Note& n = note(index);
+  n.pitch = pitch;
+  n.velocity = velocity;
+  n.output_pitch = kNoOutputPitch;
+  n.on_pos = pos_;
+  n.duration = 0;
+  n.next_off = kNullIndex;
+  AppendToAgeList(index);
 
   return index;
 }
 
 // Returns whether the NoteOff should be sent
-bool Deck::RecordNoteOff(uint8_t index) {
+bool Deck::RecordNoteOff(uint16_t index) {
   if (
     // Note was already removed
-    next_link_[index].on == kNullIndex ||
+    !Contains(index) ||
     // off link was already set by Advance
-    next_link_[index].off != kNullIndex
+    note(index).next_off != kNullIndex
   ) {
     return false;
   }
   LinkOff(index);
-  notes_[index].off_pos = pos_;
+  note(index).duration = pos_ - note(index).on_pos;
   return true;
 }
 
-uint16_t Deck::NoteFractionCompleted(uint8_t index) const {
-  const Note& note = notes_[index];
-  uint16_t pos_since_on = pos_ - note.on_pos;
-  return (static_cast<uint32_t>(pos_since_on) << 16) / note.length();
+uint16_t Deck::NoteFractionCompleted(uint16_t index) const {
+  const Note& n = note(index);
+  uint16_t pos_since_on = pos_ - n.on_pos;
+  return (static_cast<uint32_t>(pos_since_on) << 16) / n.length();
+}
+
+uint8_t Deck::NotePitch(uint16_t index) const {
+  return note(index).pitch;
 }
 
-uint8_t Deck::NotePitch(uint8_t index) const {
-  return notes_[index].pitch;
+uint8_t Deck::NoteAgeOrdinal(uint16_t index) const {
+  // Notes only leave from either end of the age list, so the serials of the
+  // rest stay consecutive
+  return note(index).serial - note(oldest_).serial;
 }
 
-uint8_t Deck::NoteAgeOrdinal(uint8_t index) const {
-  return index_mod(index - oldest_index_);
+void Deck::ClearOutputPitches() {
+  for (uint16_t index = oldest_; index != kNullIndex; index = note(index).newer) {
+    note(index).output_pitch = kNoOutputPitch;
+  }
+}
+
+bool Deck::Contains(uint16_t index) const {
+  return note(index).deck == id_;
 }
 
 bool Deck::Passed(uint16_t target, uint16_t before, uint16_t after) const {
@@ -242,44 +358,63 @@ bool Deck::Passed(uint16_t target, uint16_t before, uint16_t after) const {
   }
 }
 
-void Deck::LinkOn(uint8_t index) {
+void Deck::AppendToAgeList(uint16_t index) {
+  Note& n = note(index);
+  n.newer = kNullIndex;
+  n.older = newest_;
+  n.deck = id_;
+  if (newest_ == kNullIndex) {
+    oldest_ = index;
+    n.serial = 0;
+  } else {
+    note(newest_).newer = index;
+    n.serial = note(newest_).serial + 1;
+  }
+  newest_ = index;
+  size_++;
+}
+
+void Deck::LinkOn(uint16_t index) {
   if (head_.on == kNullIndex) {
     // there is no prev note to link to this one, so link it to itself
-    next_link_[index].on = index;
+    note(index).next_on = note(index).prev_on = index;
   } else {
-    next_link_[index].on = next_link_[head_.on].on;
-    next_link_[head_.on].on = index;
+    uint16_t next = note(head_.on).next_on;
+    note(index).next_on = next;
+    note(index).prev_on = head_.on;
+    note(head_.on).next_on = index;
+    note(next).prev_on = index;
   }
   head_.on = index;
 }
 
-void Deck::LinkOff(uint8_t index) {
+void Deck::LinkOff(uint16_t index) {
   if (head_.off == kNullIndex) {
     // there is no prev note to link to this one, so link it to itself
-    next_link_[index].off = index;
+    note(index).next_off = note(index).prev_off = index;
   } else {
-    next_link_[index].off = next_link_[head_.off].off;
-    next_link_[head_.off].off = index;
+    uint16_t next = note(head_.off).next_off;
+    note(index).next_off = next;
+    note(index).prev_off = head_.off;
+    note(head_.off).next_off = index;
+    note(next).prev_off = index;
   }
   head_.off = index;
 }
 
-void Deck::KillNote(uint8_t target_index) {
-  Note& target_note = notes_[target_index];
+void Deck::KillNote(uint16_t target_index) {
+  const Note& target_note = note(target_index);
   if (
     // Note is being recorded
-    next_link_[target_index].off == kNullIndex ||
+    target_note.next_off == kNullIndex ||
     // Note is being played
-    Passed(pos_, target_note.on_pos, target_note.off_pos)
+    Passed(pos_, target_note.on_pos, target_note.off_pos())
   ) {
     part_->LooperPlayNoteOff(target_index, target_note.pitch);
   }
 }
 
-void Deck::RemoveNote(uint8_t target_index) {
-  // Though this takes an arbitrary index, other methods like NoteAgeOrdinal
-  // assume that notes are stored sequentially in memory, so removing a "middle"
-  // note will cause problems
+void Deck::RemoveNote(uint16_t target_index) {
   if (!size_) {
     return;
   }
@@ -287,47 +422,50 @@ void Deck::RemoveNote(uint8_t target_index) {
   KillNote(target_index);
 
   size_--;
-  uint8_t search_prev_index;
-  uint8_t search_next_index;
+  Note& target = note(target_index);
 
-  search_prev_index = target_index;
-  while (true) {
-    search_next_index = next_link_[search_prev_index].on;
-    if (search_next_index == target_index) {
-      break;
-    }
-    search_prev_index = search_next_index;
-  }
-  next_link_[search_prev_index].on = next_link_[target_index].on;
-  next_link_[target_index].on = kNullIndex; // unneeded?
-  if (target_index == search_prev_index) {
-    // If this was the last note
-    head_.on = kNullIndex;
-  } else if (target_index == head_.on) {
-    head_.on = search_prev_index;
+  // Age list
+  if (target.older == kNullIndex) {
+    oldest_ = target.newer;
+  } else {
+    note(target.older).newer = target.newer;
   }
-
-  if (next_link_[target_index].off == kNullIndex) {
-    // Don't try to relink off
-    return;
+  if (target.newer == kNullIndex) {
+    newest_ = target.older;
+  } else {
+    note(target.newer).older = target.older;
   }
 
-  search_prev_index = target_index;
-  while (true) {
-    search_next_index = next_link_[search_prev_index].off;
-    if (search_next_index == target_index) {
-      break;
+  uint16_t prev_index = target.prev_on;
+  if (prev_index == target_index) {
+    // If this was the last note
+    head_.on = kNullIndex;
+  } else {
+    note(prev_index).next_on = target.next_on;
+    note(target.next_on).prev_on = prev_index;
+    if (target_index == head_.on) {
+      head_.on = prev_index;
     }
-    search_prev_index = search_next_index;
   }
-  next_link_[search_prev_index].off = next_link_[target_index].off;
-  next_link_[target_index].off = kNullIndex;
-  if (target_index == search_prev_index) {
-    // If this was the last note
-    head_.off = kNullIndex;
-  } else if (target_index == head_.off) {
-    head_.off = search_prev_index;
+  target.next_on = kNullIndex; // unneeded?
+
+  // Don't try to relink off if the note was still being recorded
+  if (target.next_off != kNullIndex) {
+    prev_index = target.prev_off;
+    if (prev_index == target_index) {
+      // If this was the last note
+      head_.off = kNullIndex;
+    } else {
+      note(prev_index).next_off = target.next_off;
+      note(target.next_off).prev_off = prev_index;
+      if (target_index == head_.off) {
+        head_.off = prev_index;
+      }
+    }
+    target.next_off = kNullIndex;
   }
+
+  note_pool.Free(target_index);
 }
 
 } // namespace looper
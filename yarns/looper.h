@@ -38,37 +38,100 @@ namespace yarns {
 
 class Part;
 struct PackedPart;
-typedef void (Part::*NoteOnFn)(uint8_t looper_note_index, uint8_t pitch, uint8_t velocity);
-typedef void (Part::*NoteOffFn)(uint8_t looper_note_index, uint8_t pitch);
+typedef void (Part::*NoteOnFn)(uint16_t looper_note_index, uint8_t pitch, uint8_t velocity);
+typedef void (Part::*NoteOffFn)(uint16_t looper_note_index, uint8_t pitch);
 
 namespace looper {
 
 const uint8_t kBitsNoteIndex = 5;
-STATIC_ASSERT(kBitsNoteIndex <= 7, bits); // Leave room for kNullIndex
-const uint8_t kNullIndex = UINT8_MAX;
+// Indexes into the note pool, with the top value left for kNullIndex
+const uint8_t kBitsPoolIndex = 9;
+const uint16_t kNullIndex = (1 << kBitsPoolIndex) - 1;
 
-const uint8_t kMaxNotes = 30;
-STATIC_ASSERT(kMaxNotes < (1 << kBitsNoteIndex), bits);
+// Notes that fit in a PackedPart (the flash layout is fixed)
+const uint8_t kMaxPackedNotes = 30;
+STATIC_ASSERT(kMaxPackedNotes < (1 << kBitsNoteIndex), bits);
+
+// Notes shared by all decks, at most.  The pool takes what RAM the stack
+// leaves, so it may hold fewer (see NotePool::Init).
+const uint16_t kMaxPoolSize = 511;
+STATIC_ASSERT(kMaxPoolSize <= kNullIndex, pool_indexes);
+// Notes in one deck, at most (sizes and serials are 8-bit)
+const uint8_t kMaxDeckNotes = UINT8_MAX;
+// Kept free below the pool for the stack
+const uint16_t kStackReserve = 2048;
+
+// Marks a free note in the pool
+const uint8_t kNullDeck = 7;
+// Marks a note that is not sounding
+const uint8_t kNoOutputPitch = UINT8_MAX;
 
 struct Link {
   Link() {
     on = off = kNullIndex;
   }
   // Note indexes
-  uint8_t on;
-  uint8_t off;
+  uint16_t on;
+  uint16_t off;
 };
 
 struct Note {
   Note() { }
   uint16_t on_pos;
-  uint16_t off_pos;
+  uint16_t duration; // off_pos - on_pos
   uint8_t pitch;
   uint8_t velocity;
-  uint16_t length() const {
-    return off_pos - 1 - on_pos;
+  uint8_t output_pitch; // Post-transpose, or kNoOutputPitch if not sounding
+  // Counts up from the oldest note in the deck, modulo 256
+  uint8_t serial;
+  // next/prev lists track current and upcoming notes.  newer/older chain the
+  // deck's notes by age, and newer also chains the free notes in the pool.
+  // deck is the owning deck, or kNullDeck if free.
+  uint32_t
+    next_on   : kBitsPoolIndex,
+    next_off  : kBitsPoolIndex,
+    prev_on   : kBitsPoolIndex,
+    deck      : 3;
+  uint32_t
+    prev_off  : kBitsPoolIndex,
+    newer     : kBitsPoolIndex,
+    older     : kBitsPoolIndex;
+
+  inline uint16_t off_pos() const {
+    return on_pos + duration;
+  }
+  inline uint16_t length() const {
+    return duration - 1;
   }
 };
+STATIC_ASSERT(sizeof(Note) == 16, note_size);
+
+class NotePool {
+ public:
+  NotePool() { }
+  ~NotePool() { }
+
+  void Init();
+
+  // Returns kNullIndex if the pool is exhausted
+  uint16_t Allocate();
+  void Free(uint16_t index);
+
+  inline Note& note(uint16_t index) { return notes_[index]; }
+  inline const Note& note(uint16_t index) const { return notes_[index]; }
+  inline uint16_t size() const { return size_; }
+  inline uint16_t num_free() const { return num_free_; }
+
+ private:
+  Note* notes_;
+  uint16_t size_;
+  uint16_t free_head_;
+  uint16_t num_free_;
+
+  DISALLOW_COPY_AND_ASSIGN(NotePool);
+};
+
+extern NotePool note_pool;
 
 const uint8_t kBitsPos = 13;
 const uint8_t kBitsMIDI = 7;
@@ -88,12 +151,24 @@ class Deck {
   Deck() { }
   ~Deck() { }
 
-  void Init(Part* part);
+  void Init(Part* part, uint8_t id);
 
   void RemoveAll();
   void JumpToTick(int32_t tick_counter, NoteOnFn on_fn, NoteOffFn off_fn);
   void Unpack(PackedPart& storage);
-  void Pack(PackedPart& storage) const;
+  // Keeps at most max_notes of the newest notes
+  void Pack(PackedPart& storage, uint8_t max_notes) const;
+
+  // Age-ordered access for formats without the PackedPart note limit
+  inline uint16_t oldest_index() const { return oldest_; }
+  inline uint16_t newer_index(uint16_t index) const {
+    return note_pool.note(index).newer;
+  }
+  void PackNote(uint16_t index, PackedNote& packed_note) const;
+  // Returns false if the pool is exhausted or the deck is full
+  bool AppendPackedNote(const PackedNote& packed_note);
+  // Trades every note with another deck, without the PackedPart note limit
+  void SwapNotes(Deck& other);
 
   inline uint16_t phase() const {
     return pos_;
@@ -115,7 +190,7 @@ class Deck {
     }
   }
 
-  inline bool num_notes() const { return size_; }
+  inline uint8_t num_notes() const { return size_; }
 
   void RemoveOldestNote();
   void RemoveNewestNote();
@@ -126,40 +201,54 @@ class Deck {
     ProcessNotes(new_pos, note_on_fn, note_off_fn);
     needs_advance_ = false;
   }
-  uint8_t RecordNoteOn(uint8_t pitch, uint8_t velocity);
-  bool RecordNoteOff(uint8_t index);
-  uint8_t PeekNextOn() const;
-  uint8_t PeekNextOff() const;
+  uint16_t RecordNoteOn(uint8_t pitch, uint8_t velocity);
+  bool RecordNoteOff(uint16_t index);
+  uint16_t PeekNextOn() const;
+  uint16_t PeekNextOff() const;
+
+  uint16_t NoteFractionCompleted(uint16_t index) const;
+  uint8_t NotePitch(uint16_t index) const;
+  uint8_t NoteAgeOrdinal(uint16_t index) const;
 
-  uint16_t NoteFractionCompleted(uint8_t index) const;
-  uint8_t NotePitch(uint8_t index) const;
-  uint8_t NoteAgeOrdinal(uint8_t index) const;
+  inline const Note& note_at(uint16_t index) const {
+    return note_pool.note(index);
+  }
 
-  inline const Note& note_at(uint8_t index) const {
-    return notes_[index];
+  inline uint8_t output_pitch(uint16_t index) const {
+    return note_pool.note(index).output_pitch;
+  }
+  inline void set_output_pitch(uint16_t index, uint8_t pitch) {
+    note_pool.note(index).output_pitch = pitch;
   }
+  void ClearOutputPitches();
 
   uint16_t pos_offset;
 
  private:
 
-  inline uint8_t index_mod(int8_t i) const {
-    return stmlib::modulo(i, kMaxNotes);
+  inline Note& note(uint16_t index) { return note_pool.note(index); }
+  inline const Note& note(uint16_t index) const {
+    return note_pool.note(index);
   }
+  bool Contains(uint16_t index) const;
   bool Passed(uint16_t target, uint16_t before, uint16_t after) const;
-  void LinkOn(uint8_t index);
-  void LinkOff(uint8_t index);
-  void RemoveNote(uint8_t index);
-  void KillNote(uint8_t index);
+  void AppendToAgeList(uint16_t index);
+  void LinkNote(uint16_t index);
+  void BakeOffset();
+  void Relink();
+  void LinkOn(uint16_t index);
+  void LinkOff(uint16_t index);
+  void RemoveNote(uint16_t index);
+  void KillNote(uint16_t index);
 
   Part* part_;
+  uint8_t id_;
 
-  Note notes_[kMaxNotes];
-  uint8_t oldest_index_;
+  // Notes live in note_pool, chained both ways from oldest to newest
+  uint16_t oldest_;
+  uint16_t newest_;
   uint8_t size_;
-  // Linked lists track current and upcoming notes
   Link head_; // Points to the latest on/off
-  Link next_link_[kMaxNotes];
 
   // Phase tracking
   SyncedLFO<18, 11> lfo_; // Gentle sync
@@ -96,6 +96,8 @@ namespace yarns {
 #define MENU_END \
   SETTING_REMOTE_CONTROL_CHANNEL, \
   SETTING_CONTROL_CHANGE_MODE, \
+  SETTING_DC_INTERPOLATION, \
+  SETTING_PROGRAM_CHANGE_MODE, \
   SETTING_LAST
 
 #define MENU_LIVE \
@@ -118,6 +120,7 @@ static const SettingIndex menu_live[] = {
   SETTING_MENU_SETUP,
   SETTING_MENU_OSCILLATOR,
   SETTING_MENU_ENVELOPE,
+  SETTING_MENU_MATRIX,
   MENU_LIVE,
   SETTING_LAST
 };
@@ -150,6 +153,23 @@ static const SettingIndex menu_amplitude[] = {
   SETTING_LAST
 };
 
+static const SettingIndex menu_matrix[] = {
+  SETTING_VOICING_MOD_1_SOURCE,
+  SETTING_VOICING_MOD_1_DESTINATION,
+  SETTING_VOICING_MOD_1_DEPTH,
+  SETTING_VOICING_MOD_2_SOURCE,
+  SETTING_VOICING_MOD_2_DESTINATION,
+  SETTING_VOICING_MOD_2_DEPTH,
+  SETTING_VOICING_MOD_3_SOURCE,
+  SETTING_VOICING_MOD_3_DESTINATION,
+  SETTING_VOICING_MOD_3_DEPTH,
+  SETTING_VOICING_MOD_4_SOURCE,
+  SETTING_VOICING_MOD_4_DESTINATION,
+  SETTING_VOICING_MOD_4_DEPTH,
+
+  SETTING_LAST
+};
+
 static const SettingIndex menu_live_quad_triggers[] = {
   SETTING_MENU_SETUP,
   SETTING_MENU_ENVELOPE,
@@ -357,6 +377,9 @@ class Menu {
       case SETTING_MENU_ENVELOPE:
         return menu_amplitude;
 
+      case SETTING_MENU_MATRIX:
+        return menu_matrix;
+
       default:
         switch (multi.layout()) {
           case LAYOUT_QUAD_TRIGGERS:
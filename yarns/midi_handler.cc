@@ -31,6 +31,7 @@
 #include <algorithm>
 
 #include "yarns/multi.h"
+#include "yarns/profiler.h"
 #ifndef TEST
 #include "yarns/storage_manager.h"
 #include "yarns/ui.h"
@@ -40,15 +41,15 @@ namespace yarns {
 
 using namespace std;
 
-/* static */
-MidiHandler::MidiBuffer MidiHandler::input_buffer_; 
-
 /* static */
 MidiHandler::MidiBuffer MidiHandler::output_buffer_;
 
 /* static */
 MidiHandler::SmallMidiBuffer MidiHandler::high_priority_output_buffer_;
 
+/* static */
+MidiOutputQueue MidiHandler::output_queue_;
+
 /* static */
 stmlib_midi::MidiStreamParser<MidiHandler> MidiHandler::parser_;
 
@@ -69,6 +70,9 @@ const MidiHandler::SysExDescription MidiHandler::accepted_sysex_[] = {
 /* static */
 uint8_t MidiHandler::sysex_rx_write_ptr_;
 
+/* static */
+bool MidiHandler::sysex_thru_open_;
+
 /* static */
 uint8_t MidiHandler::previous_packet_index_;
 
@@ -86,10 +90,11 @@ bool MidiHandler::factory_testing_requested_;
 
 /* static */
 void MidiHandler::Init() {
-  input_buffer_.Init();
   output_buffer_.Init();
   high_priority_output_buffer_.Init();
+  output_queue_.Init();
   sysex_rx_write_ptr_ = 0;
+  sysex_thru_open_ = false;
   previous_packet_index_ = 0;
   calibration_voice_ = 0xff;
   calibration_note_ = 0xff;
@@ -164,34 +169,23 @@ void MidiHandler::HandleYarnsSpecificMessage() {
     }
     previous_packet_index_ = packet_index;
     
-    // Denibblize.
     uint8_t* data = &sysex_rx_buffer_[8];
-    uint8_t* byte_ptr = data;
-    uint8_t* nibble_ptr = data;
-    uint8_t checksum = 0;
-    while (*nibble_ptr != 0xf7 &&
-           static_cast<size_t>(byte_ptr - data) <= kSysexMaxChunkSize + 1) {
-      *byte_ptr = (*nibble_ptr++) << 4;
-      *byte_ptr |= (*nibble_ptr++);
-      // Warning! The last byte of the block, which is the checksum
-      // is summed here!
-      checksum += *byte_ptr++;
-    }
-    size_t size = byte_ptr - data - 1;
-    checksum -= data[size];
-    if (checksum != data[size]) {
+    size_t size;
+    if (!Denibblize(data, &size)) {
       previous_packet_index_ = 0xff;
       return;
     }
-    if (size != 0) {
+    if (size != 0 && command == SYSEX_COMMAND_DUMP_PACKET_TAGGED) {
+      storage_manager.AppendTaggedData(data, size, packet_index == 0);
+    } else if (size != 0) {
       storage_manager.AppendData(data, size, packet_index == 0);
     } else if (packet_index) {
       if (command == SYSEX_COMMAND_DUMP_PACKET_TAGGED) {
         bool ok = storage_manager.DeserializeMultiTagged();
         ui.SplashString(ok ? "T+" : "T-");
       } else {
-        storage_manager.DeserializeMultiPacked();
-        ui.SplashString("P+");
+        bool ok = storage_manager.DeserializeMultiPacked();
+        ui.SplashString(ok ? "P+" : "P-");
       }
     }
   } else if (command == SYSEX_COMMAND_REQUEST_PACKETS_PACKED) {
@@ -210,6 +204,26 @@ void MidiHandler::HandleYarnsSpecificMessage() {
       storage_manager.SysExSendMultiTagged();
       ui.SplashString("T>");
     }
+  } else if (command == SYSEX_COMMAND_BULK_PACKET) {
+    uint8_t* data = &sysex_rx_buffer_[9];
+    size_t size;
+    bool valid = Denibblize(data, &size) && size <= kSysexBulkChunkSize;
+    storage_manager.ReceiveBulkChunk(
+        sysex_rx_buffer_[7], sysex_rx_buffer_[8], valid ? data : NULL, size);
+  } else if (command == SYSEX_COMMAND_BULK_ACK) {
+    if (sysex_rx_buffer_[10] == 0xf7) {
+      storage_manager.OnBulkAck(
+          sysex_rx_buffer_[7], sysex_rx_buffer_[8], sysex_rx_buffer_[9] == 0);
+    }
+  } else if (command == SYSEX_COMMAND_REQUEST_BULK_DUMP) {
+    if (sysex_rx_buffer_[7] == 0 &&
+        sysex_rx_buffer_[8] == 0 &&
+        sysex_rx_buffer_[9] == 0 &&
+        sysex_rx_buffer_[10] == 0xf7) {
+      if (!storage_manager.StartBulkDump()) {
+        ui.SplashString("B-");
+      }
+    }
   } else if (command == SYSEX_COMMAND_FACTORY_TESTING_MODE) {
     if (sysex_rx_buffer_[7] == 0 &&
         sysex_rx_buffer_[8] == 0 && 
@@ -228,10 +242,87 @@ void MidiHandler::HandleYarnsSpecificMessage() {
     } else {
       storage_manager.SaveCalibration();
     }
+#ifdef PROFILE_INTERRUPTS
+  } else if (command == SYSEX_COMMAND_REQUEST_PROFILE) {
+    // The third data byte asks for the stats to be cleared once read.
+    if (sysex_rx_buffer_[7] == 0 &&
+        sysex_rx_buffer_[8] == 0 &&
+        sysex_rx_buffer_[9] <= 1 &&
+        sysex_rx_buffer_[10] == 0xf7) {
+      const ProfilerStageStats* stats = profiler.Snapshot(
+          sysex_rx_buffer_[9]);
+      SysExSendPackets(
+          reinterpret_cast<const uint8_t*>(stats),
+          sizeof(ProfilerStageStats) * PROFILER_STAGE_LAST,
+          SYSEX_COMMAND_DUMP_PROFILE);
+    }
+#endif  // PROFILE_INTERRUPTS
   }
 #endif  // TEST
 }
 
+/* static */
+bool MidiHandler::Denibblize(uint8_t* data, size_t* size) {
+  uint8_t* byte_ptr = data;
+  uint8_t* nibble_ptr = data;
+  uint8_t checksum = 0;
+  while (*nibble_ptr != 0xf7 &&
+         static_cast<size_t>(byte_ptr - data) <= kSysexMaxChunkSize + 1) {
+    *byte_ptr = (*nibble_ptr++) << 4;
+    *byte_ptr |= (*nibble_ptr++);
+    // Warning! The last byte of the block, which is the checksum
+    // is summed here!
+    checksum += *byte_ptr++;
+  }
+  *size = byte_ptr - data - 1;
+  checksum -= data[*size];
+  return checksum == data[*size];
+}
+
+/* static */
+void MidiHandler::SysExWriteHeader(uint8_t command) {
+  output_queue_.CancelRunningStatus();
+  for (uint8_t i = 0; i < 6; ++i) {
+    output_buffer_.Overwrite(accepted_sysex_[0].prefix[i]);
+  }
+  output_buffer_.Overwrite(command);
+}
+
+/* static */
+bool MidiHandler::SysExTrySendBulkPacket(
+    uint8_t page, uint8_t chunk, const uint8_t* data, size_t size) {
+  if (!SysExCanSend(12 + 2 * size)) {
+    return false;
+  }
+  SysExWriteHeader(SYSEX_COMMAND_BULK_PACKET);
+  output_buffer_.Overwrite(page);
+  output_buffer_.Overwrite(chunk);
+  uint8_t checksum = 0;
+  for (uint8_t i = 0; i < size; ++i) {
+    checksum += data[i];
+    output_buffer_.Overwrite(data[i] >> 4);
+    output_buffer_.Overwrite(data[i] & 0x0f);
+  }
+  output_buffer_.Overwrite(checksum >> 4);
+  output_buffer_.Overwrite(checksum & 0x0f);
+  output_buffer_.Overwrite(0xf7);
+  return true;
+}
+
+/* static */
+bool MidiHandler::SysExTrySendBulkAck(
+    uint8_t page, uint8_t chunk, uint8_t status) {
+  if (!SysExCanSend(11)) {
+    return false;
+  }
+  SysExWriteHeader(SYSEX_COMMAND_BULK_ACK);
+  output_buffer_.Overwrite(page);
+  output_buffer_.Overwrite(chunk);
+  output_buffer_.Overwrite(status);
+  output_buffer_.Overwrite(0xf7);
+  return true;
+}
+
 /* static */
 void MidiHandler::SysExSendPacket(
     uint8_t packet_index,
@@ -277,6 +368,26 @@ void MidiHandler::SysExSendPackets(
   SysExSendPacket(block_index, NULL, 0, command);
 }
 
+void SysExPacketStream::Write(const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  while (size--) {
+    packet_[size_++] = *bytes++;
+    if (size_ == kSysexMaxChunkSize) {
+      MidiHandler::SysExSendPacket(packet_index_++, packet_, size_, command_);
+      size_ = 0;
+    }
+  }
+}
+
+void SysExPacketStream::Close() {
+  if (size_) {
+    MidiHandler::SysExSendPacket(packet_index_++, packet_, size_, command_);
+    size_ = 0;
+  }
+  // Send a NULL packet to indicate end of transmission.
+  MidiHandler::SysExSendPacket(packet_index_, NULL, 0, command_);
+}
+
 /* extern */
 MidiHandler midi_handler;
 
@@ -34,6 +34,8 @@
 #include "stmlib/utils/ring_buffer.h"
 #include "stmlib/midi/midi.h"
 
+#include "yarns/event_queue.h"
+#include "yarns/midi_output_queue.h"
 #include "yarns/multi.h"
 
 namespace yarns {
@@ -41,14 +43,26 @@ namespace yarns {
 enum SysExCommand {
   SYSEX_COMMAND_DUMP_PACKET_PACKED = 1,
   SYSEX_COMMAND_DUMP_PACKET_TAGGED = 2,
+  SYSEX_COMMAND_DUMP_PROFILE = 3,
+  SYSEX_COMMAND_BULK_PACKET = 4,
+  SYSEX_COMMAND_BULK_ACK = 5,
   SYSEX_COMMAND_REQUEST_PACKETS_PACKED = 17,
   SYSEX_COMMAND_REQUEST_PACKETS_TAGGED = 18,
+  SYSEX_COMMAND_REQUEST_BULK_DUMP = 19,
   SYSEX_COMMAND_FACTORY_TESTING_MODE = 32,
   SYSEX_COMMAND_CALIBRATE = 33,
+  SYSEX_COMMAND_REQUEST_PROFILE = 34,
 };
 
 const size_t kSysexMaxChunkSize = 64;
 const size_t kSysexRxBufferSize = kSysexMaxChunkSize * 2 + 16;
+// A bulk packet is 12 bytes plus two per data byte, so that it fits in the
+// output buffer behind a few queued messages, and holds up MIDI thru for no
+// more than ~25 ms.
+const size_t kSysexBulkChunkSize = 32;
+// About 5 ms at the MIDI byte rate. Messages beyond this wait in the output
+// queue, where newer controller values can still replace them.
+const uint8_t kMidiOutputBytesAhead = 16;
 
 class MidiHandler {
  public:
@@ -94,6 +108,7 @@ class MidiHandler {
   }
   
   static void ProgramChange(uint8_t channel, uint8_t program) {
+    multi.ProgramChange(channel, program);
     if (!multi.direct_thru()) {
       Send2(0xc0 | channel, program);
     }
@@ -107,6 +122,7 @@ class MidiHandler {
 
   static void SysExStart() {
     sysex_rx_write_ptr_ = 0;
+    sysex_thru_open_ = true;
     ProcessSysExByte(0xf0);
   }
 
@@ -116,6 +132,7 @@ class MidiHandler {
   
   static void SysExEnd() {
     ProcessSysExByte(0xf7);
+    sysex_thru_open_ = false;
     DecodeSysExMessage();
   }
   
@@ -159,6 +176,7 @@ class MidiHandler {
   static void RawByte(uint8_t byte) {
     if (multi.direct_thru()) {
       if (byte != 0xfa && byte != 0xf8 && byte != 0xfc) {
+        output_queue_.CancelRunningStatus();
         output_buffer_.Overwrite(byte);
       }
     }
@@ -195,37 +213,69 @@ class MidiHandler {
     SendNow(0xfc);
   }
   
-  static void PushByte(uint8_t byte) {
-    input_buffer_.Overwrite(byte);
-  }
-  
+  // Drains the events queued by SysTick, in the order they were received.
   static void ProcessInput() {
-    while (input_buffer_.readable()) {
-      parser_.PushByte(input_buffer_.ImmediateRead());
+    while (event_queue.readable()) {
+      TimedEvent e = event_queue.Pop();
+      switch (e.type) {
+        case EVENT_MIDI_BYTE:
+          parser_.PushByte(e.data);
+          break;
+        case EVENT_INTERNAL_CLOCK:
+          multi.Clock();
+          break;
+        case EVENT_SWING_STEP:
+          multi.ClockSwingStep(e.data);
+          break;
+      }
+    }
+    event_queue.Release();
+    ProcessOutput();
+  }
+
+  // Moves the queued messages that fit to the buffer SysTick sends from.
+  static void ProcessOutput() {
+    uint8_t size;
+    while ((size = output_queue_.next_size()) != 0 &&
+           output_buffer_.readable() + size <= kMidiOutputBytesAhead) {
+      uint8_t bytes[3];
+      output_queue_.Pop(bytes);
+      for (uint8_t i = 0; i < size; ++i) {
+        output_buffer_.Overwrite(bytes[i]);
+      }
     }
   }
   
   static inline MidiBuffer* mutable_output_buffer() { return &output_buffer_; }
+  static inline const MidiOutputQueue& output_queue() { return output_queue_; }
   static inline SmallMidiBuffer* mutable_high_priority_output_buffer() {
     return &high_priority_output_buffer_;
   }
 
   static inline void Send3(uint8_t byte_1, uint8_t byte_2, uint8_t byte_3) {
-    output_buffer_.Overwrite(byte_1);
-    output_buffer_.Overwrite(byte_2);
-    output_buffer_.Overwrite(byte_3);
+    output_queue_.Push(byte_1, byte_2, byte_3);
   }
 
   static inline void Send2(uint8_t byte_1, uint8_t byte_2) {
-    output_buffer_.Overwrite(byte_1);
-    output_buffer_.Overwrite(byte_2);
+    output_queue_.Push(byte_1, byte_2, 0);
   }
 
+  // Bytes that are not channel messages skip the queue, after the messages
+  // already in it.
   static inline void Send1(uint8_t byte) {
+    uint8_t bytes[3];
+    while (!output_queue_.empty()) {
+      uint8_t size = output_queue_.Pop(bytes);
+      for (uint8_t i = 0; i < size; ++i) {
+        output_buffer_.Overwrite(bytes[i]);
+      }
+    }
+    output_queue_.CancelRunningStatus();
     output_buffer_.Overwrite(byte);
   }
   
   static inline void SendBlocking(uint8_t byte) {
+    output_queue_.CancelRunningStatus();
     output_buffer_.Write(byte);
   }
 
@@ -242,12 +292,21 @@ class MidiHandler {
   };
 
   static void Flush() {
+    while (!output_queue_.empty()) {
+      ProcessOutput();
+    }
     while (output_buffer_.readable());
   }
   
   static void SysExSendPackets(
       const uint8_t* data, size_t size,
       uint8_t command = SYSEX_COMMAND_DUMP_PACKET_PACKED);
+
+  // Bulk transfer messages are written to the output buffer whole, without
+  // waiting for it to drain.  They return false if there is no room yet.
+  static bool SysExTrySendBulkPacket(
+      uint8_t page, uint8_t chunk, const uint8_t* data, size_t size);
+  static bool SysExTrySendBulkAck(uint8_t page, uint8_t chunk, uint8_t status);
   
   static inline bool calibrating() {
     return calibration_voice_ < kNumCVOutputs && calibration_note_ < kNumOctaves;
@@ -268,6 +327,14 @@ class MidiHandler {
       size_t size,
       uint8_t command = SYSEX_COMMAND_DUMP_PACKET_PACKED);
   static void DecodeSysExMessage();
+  static bool Denibblize(uint8_t* data, size_t* size);
+  // A message can't start in the middle of another, including a SysEx message
+  // being passed thru.
+  static inline bool SysExCanSend(size_t size) {
+    return !sysex_thru_open_ && output_queue_.empty() &&
+        output_buffer_.writable() >= size;
+  }
+  static void SysExWriteHeader(uint8_t command);
   inline static void ProcessSysExByte(uint8_t sysex_byte) {
     if (!multi.direct_thru()) {
       Send1(sysex_byte);
@@ -281,13 +348,14 @@ class MidiHandler {
   static void HandleScaleOctaveTuning2ByteForm();
   static void HandleYarnsSpecificMessage();
   
-  static MidiBuffer input_buffer_; 
   static MidiBuffer output_buffer_; 
   static SmallMidiBuffer high_priority_output_buffer_;
+  static MidiOutputQueue output_queue_;
   static stmlib_midi::MidiStreamParser<MidiHandler> parser_;
   
   static uint8_t sysex_rx_buffer_[kSysexRxBufferSize];
   static uint8_t sysex_rx_write_ptr_;
+  static bool sysex_thru_open_;
   
   static uint8_t previous_packet_index_;
   
@@ -298,9 +366,36 @@ class MidiHandler {
   
   static const SysExDescription accepted_sysex_[];
    
+  friend class SysExPacketStream;
+
   DISALLOW_COPY_AND_ASSIGN(MidiHandler);
 };
 
+// Sends what is written to it as the packets of SysExSendPackets, a packet
+// at a time, so that a dump doesn't have to be held whole.
+class SysExPacketStream {
+ public:
+  SysExPacketStream(uint8_t command)
+      : command_(command), packet_index_(0), size_(0) { }
+  ~SysExPacketStream() { }
+
+  void Write(const void* data, size_t size);
+  template<typename T>
+  void Write(const T& value) {
+    Write(&value, sizeof(T));
+  }
+  // Sends what is left, then the empty packet that ends the transmission.
+  void Close();
+
+ private:
+  uint8_t command_;
+  uint8_t packet_index_;
+  uint8_t size_;
+  uint8_t packet_[kSysexMaxChunkSize];
+
+  DISALLOW_COPY_AND_ASSIGN(SysExPacketStream);
+};
+
 extern MidiHandler midi_handler;
 
 }  // namespace yarns
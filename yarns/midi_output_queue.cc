@@ -0,0 +1,120 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+//
+// Channel messages waiting for the MIDI out.
+
+#include "yarns/midi_output_queue.h"
+
+namespace yarns {
+
+void MidiOutputQueue::Init() {
+  read_ptr_ = 0;
+  size_ = 0;
+  running_status_ = 0;
+  num_merged_ = 0;
+  num_dropped_ = 0;
+}
+
+/* static */
+bool MidiOutputQueue::IsMergeable(uint8_t status, uint8_t data_1) {
+  switch (status & 0xf0) {
+    case 0xa0:
+    case 0xd0:
+    case 0xe0:
+      return true;
+    case 0xb0:
+      switch (data_1) {
+        // Bank select, data entry, and the (N)RPN they apply to
+        case 0x00:
+        case 0x06:
+        case 0x20:
+        case 0x26:
+        case 0x60:
+        case 0x61:
+        case 0x62:
+        case 0x63:
+        case 0x64:
+        case 0x65:
+          return false;
+        default:
+          // Channel mode messages
+          return data_1 < 0x78;
+      }
+    default:
+      return false;
+  }
+}
+
+bool MidiOutputQueue::Push(uint8_t status, uint8_t data_1, uint8_t data_2) {
+  if (IsMergeable(status, data_1)) {
+    // Pressure has no key; pitch bend's first byte is part of the value.
+    bool keyed = (status & 0xf0) == 0xa0 || (status & 0xf0) == 0xb0;
+    uint8_t channel = status & 0x0f;
+    for (uint8_t i = size_; i--; ) {
+      MidiMessage& m = messages_[
+          (read_ptr_ + i) & (kMidiOutputQueueSize - 1)];
+      if ((m.status & 0x0f) != channel) continue;
+      if (!IsMergeable(m.status, m.data[0])) break;
+      if (m.status == status && (!keyed || m.data[0] == data_1)) {
+        m.data[0] = data_1;
+        m.data[1] = data_2;
+        ++num_merged_;
+        return true;
+      }
+    }
+  }
+  if (size_ == kMidiOutputQueueSize) {
+    ++num_dropped_;
+    return false;
+  }
+  MidiMessage& m = messages_[
+      (read_ptr_ + size_) & (kMidiOutputQueueSize - 1)];
+  m.status = status;
+  m.data[0] = data_1;
+  m.data[1] = data_2;
+  ++size_;
+  return true;
+}
+
+uint8_t MidiOutputQueue::Pop(uint8_t* bytes) {
+  const MidiMessage& m = messages_[read_ptr_];
+  uint8_t status = OutputStatus(m);
+  uint8_t size = 0;
+  if (status != running_status_) {
+    bytes[size++] = status;
+    running_status_ = status;
+  }
+  bytes[size++] = m.data[0];
+  if (MessageSize(m.status) == 3) {
+    bytes[size++] = m.data[1];
+  }
+  read_ptr_ = (read_ptr_ + 1) & (kMidiOutputQueueSize - 1);
+  --size_;
+  return size;
+}
+
+}  // namespace yarns
@@ -0,0 +1,107 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+//
+// Channel messages waiting for the MIDI out.
+//
+// Messages wait here, rather than in the byte buffer that SysTick sends from,
+// until that buffer has room for the whole message, so that a saturated
+// output delays messages instead of losing bytes in the middle of one.  While
+// a controller, pitch bend or pressure message waits, a newer value for it
+// replaces the waiting one, unless a message that depends on the order
+// (a note, a program change, a data entry or mode controller) was queued
+// after it on the same channel.  Messages leave with running status.
+
+#ifndef YARNS_MIDI_OUTPUT_QUEUE_H_
+#define YARNS_MIDI_OUTPUT_QUEUE_H_
+
+#include "stmlib/stmlib.h"
+
+namespace yarns {
+
+struct MidiMessage {
+  uint8_t status;
+  uint8_t data[2];
+};
+
+const uint8_t kMidiOutputQueueSizeBits = 5;
+const uint8_t kMidiOutputQueueSize = 1 << kMidiOutputQueueSizeBits;
+
+class MidiOutputQueue {
+ public:
+  MidiOutputQueue() { }
+  ~MidiOutputQueue() { }
+
+  void Init();
+
+  // Returns false if the message had to be dropped.
+  bool Push(uint8_t status, uint8_t data_1, uint8_t data_2);
+
+  inline bool empty() const { return size_ == 0; }
+
+  // Bytes that the next message will take.
+  inline uint8_t next_size() const {
+    if (empty()) return 0;
+    const MidiMessage& m = messages_[read_ptr_];
+    return MessageSize(m.status) - (OutputStatus(m) == running_status_);
+  }
+
+  // Writes the next message to bytes and returns its size.
+  uint8_t Pop(uint8_t* bytes);
+
+  // Called when bytes that did not come from the queue were sent.
+  inline void CancelRunningStatus() { running_status_ = 0; }
+
+  inline uint16_t num_merged() const { return num_merged_; }
+  inline uint16_t num_dropped() const { return num_dropped_; }
+
+ private:
+  static inline uint8_t MessageSize(uint8_t status) {
+    uint8_t type = status & 0xf0;
+    return type == 0xc0 || type == 0xd0 ? 2 : 3;
+  }
+  static bool IsMergeable(uint8_t status, uint8_t data_1);
+
+  // A note off without velocity continues a run of note ons.
+  inline uint8_t OutputStatus(const MidiMessage& m) const {
+    return (m.status & 0xf0) == 0x80 && m.data[1] == 0 &&
+        running_status_ == (m.status | 0x10) ? running_status_ : m.status;
+  }
+
+  MidiMessage messages_[kMidiOutputQueueSize];
+  uint8_t read_ptr_;
+  uint8_t size_;
+  uint8_t running_status_;
+
+  uint16_t num_merged_;
+  uint16_t num_dropped_;
+
+  DISALLOW_COPY_AND_ASSIGN(MidiOutputQueue);
+};
+
+}  // namespace yarns
+
+#endif  // YARNS_MIDI_OUTPUT_QUEUE_H_
@@ -35,6 +35,7 @@
 
 #include "yarns/just_intonation_processor.h"
 #include "yarns/midi_handler.h"
+#include "yarns/preset_morph.h"
 #include "yarns/settings.h"
 #include "yarns/ui.h"
 
@@ -43,6 +44,8 @@ namespace yarns {
 using namespace std;
 using namespace stmlib;
 
+const uint8_t kCCMorph = 9;
+
 const uint8_t kCCLooperPhaseOffset = 115;
 
 const uint8_t kCCMacroRecord = 116;
@@ -67,11 +70,16 @@ const uint8_t kBackupClockLFOPeriodTicksBits = 4;
 // Converts BPM to the Refresh phase increment of an LFO that cycles at 24 PPQN
 const uint32_t kTempoToTickPhaseIncrement = (UINT32_MAX / 4000) * 24 / 60;
 
+// Block-fill cost of an interpolated DC output, in 1/16ths of an oscillator
+// voice at the same frame rate (see yarns_test -I)
+const uint8_t kDCInterpolationCost[DC_INTERPOLATION_LAST] = { 0, 8, 10 };
+
 void Multi::PrintDebugByte(uint8_t byte) { ui.PrintDebugByte(byte); }
 void Multi::PrintInt32E(int32_t value) { ui.PrintInt32E(value); }
 
 void Multi::Init(bool reset_calibration) {
   just_intonation_processor.Init();
+  looper::note_pool.Init();
 
   fill(
       &settings_.custom_pitch_table[0],
@@ -79,7 +87,7 @@ void Multi::Init(bool reset_calibration) {
       0);
   
   for (uint8_t i = 0; i < kNumParts; ++i) {
-    part_[i].Init();
+    part_[i].Init(i);
     part_[i].set_custom_pitch_table(settings_.custom_pitch_table);
   }
 
@@ -90,13 +98,19 @@ void Multi::Init(bool reset_calibration) {
 
   for (uint8_t i = 0; i < kNumSystemVoices; ++i) {
     voice_[i].Init();
+    voice_[i].set_refresh_phase(
+        (i << kLowFreqRefreshBits) / kNumSystemVoices);
   }
   for (uint8_t i = 0; i < kNumCVOutputs; ++i) {
     cv_outputs_[i].Init(reset_calibration);
   }
   running_ = false;
   can_advance_lfos_ = true;
+  num_pending_clock_ticks_ = 0;
+  pending_swing_steps_ = 0;
   recording_ = false;
+  requested_program_ = kNoProgram;
+  queued_program_ = NULL;
   recording_part_ = 0;
   started_by_keyboard_ = true;
   
@@ -112,19 +126,17 @@ void Multi::Init(bool reset_calibration) {
   settings_.clock_manual_start = 0;
   settings_.control_change_mode = CONTROL_CHANGE_MODE_ABSOLUTE;
   settings_.clock_offset = 0;
+  settings_.dc_interpolation = DC_INTERPOLATION_OFF;
+  settings_.program_change_mode = PROGRAM_CHANGE_MODE_OFF;
 
   clock_input_ticks_ = backup_clock_lfo_ticks_ = -1;
+  backup_clock_lfo_.Init();
 
   // A test sequence...
-  // seq->num_steps = 4;
-  // seq->step[0].data[0] = 48;
-  // seq->step[0].data[1] = 0x7f;
-  // seq->step[1].data[0] = 72;
-  // seq->step[1].data[1] = 0x7f;
-  // seq->step[2].data[0] = 60;
-  // seq->step[2].data[1] = 0x7f;
-  // seq->step[3].data[0] = 72;
-  // seq->step[3].data[1] = 0x7f;
+  // sequence->SetStep(0, SequencerStep(48, 0x7f));
+  // sequence->SetStep(1, SequencerStep(72, 0x7f));
+  // sequence->SetStep(2, SequencerStep(60, 0x7f));
+  // sequence->SetStep(3, SequencerStep(72, 0x7f));
   // voicing->oscillator_shape = 1;
   // settings_.clock_tempo = 100;
   // settings_.clock_swing = 99;
@@ -137,6 +149,16 @@ void Multi::Clock() {
   if (!running_) {
     return;
   }
+
+  // A queued program takes over just before the tick that starts its step or
+  // bar, so that the new parts play that tick.
+  if (
+    queued_program_ &&
+    (clock_input_ticks_ + 1) % settings_.clock_input_division == 0 &&
+    IsProgramBoundary(tick_counter(1))
+  ) {
+    SwapQueuedProgram();
+  }
   
   can_advance_lfos_ = true;
   // Pre-increment so that the tick count will stay valid until the next Clock()
@@ -221,7 +243,6 @@ void Multi::Start(bool started_by_keyboard) {
     return;
   }
   if (internal_clock()) {
-    internal_clock_ticks_ = 0;
     internal_clock_.Start(settings_.clock_tempo * kTempoToTickPhaseIncrement);
   }
   midi_handler.OnStart();
@@ -307,7 +328,7 @@ void Multi::ClockLFOs(int32_t ticks, bool force_phase) {
     uint32_t swing_lfo_phase = part.swing_lfo().ComputeTargetPhase(ticks, part.PPQN());
     part.swing_lfo().RegisterPhase(swing_lfo_phase, force_phase);
 
-    uint8_t lfo_rate = part.voicing_settings().lfo_rate;
+    uint8_t lfo_rate = part.lfo_rate();
     FastSyncedLFO* part_lfos[part.num_voices()];
     for (uint8_t v = 0; v < part.num_voices(); ++v) {
       part_lfos[v] = part.voice(v)->lfo(static_cast<LFORole>(0));
@@ -330,6 +351,10 @@ void Multi::ClockLFOs(int32_t ticks, bool force_phase) {
 }
 
 void Multi::Refresh() {
+  for (uint8_t p = 0; p < num_active_parts_; ++p) {
+    part_[p].RefreshVoicing();
+  }
+
   for (uint8_t i = 0; i < kNumCVOutputs; ++i) {
     cv_outputs_[i].Refresh();
   }
@@ -344,15 +369,29 @@ void Multi::Refresh() {
       FastSyncedLFO& swing_lfo = part.swing_lfo();
       swing_lfo.Refresh();
       bool hit_swing = swing_lfo.GetPhase() - swing_phase < swing_lfo.GetPhaseIncrement();
-      if (running_ && tick_counter() >= 0 && hit_swing && part.current_step_has_swing()) part.ClockStep();
+      if (running_ && tick_counter() >= 0 && hit_swing && part.current_step_has_swing()) {
+        pending_swing_steps_ |= 1 << p;
+      }
 
       part.mutable_looper().Refresh();
+      part.RefreshModMatrix();
       for (uint8_t v = 0; v < part.num_voices(); ++v) {
         part.voice(v)->Refresh();
       }
     }
   }
 
+  // A swung step that finds the queue full is retried at the next refresh
+  if (!running_) {
+    pending_swing_steps_ = 0;
+  }
+  for (uint8_t p = 0; p < kNumParts; ++p) {
+    if ((pending_swing_steps_ & (1 << p)) &&
+        event_queue.Push(EVENT_SWING_STEP, p)) {
+      pending_swing_steps_ &= ~(1 << p);
+    }
+  }
+
   // Since the backup LFO runs at 1/n of clock freq, we compensate by treating
   // each 1/n of its phase as a new tick, to make these output ticks 1:1 with
   // the original clock ticks
@@ -370,6 +409,17 @@ void Multi::Refresh() {
   };
 }
 
+void Multi::ClockSwingStep(uint8_t part) {
+  // The step may have been stopped or reconfigured while the event was queued
+  if (
+    !running_ || tick_counter() < 0 || part >= num_active_parts_ ||
+    !part_[part].current_step_has_swing()
+  ) {
+    return;
+  }
+  part_[part].ClockStep();
+}
+
 bool Multi::clock() const {
   if (!running_) return false;
   uint16_t output_division = lut_clock_ratio_ticks[settings_.clock_output_division];
@@ -393,6 +443,8 @@ bool Multi::Set(uint8_t address, uint8_t value) {
         static_cast<Layout>(value));
   } else if (address == MULTI_CLOCK_TEMPO) {
     UpdateTempo();
+  } else if (address == MULTI_DC_INTERPOLATION) {
+    AssignDCInterpolation();
   }
   return true;
 }
@@ -477,13 +529,82 @@ void Multi::AssignVoicesToCVOutputs() {
       MapVoices(3, DC_AUX_1, kNumParaphonicVoices, 1, 1);
       break;
   }
+
+  // Layouts with fewer audio voices spend the same render budget as four
+  // voices at the base rate on a faster DAC frame rate.
+  uint8_t num_audio_voices = 0;
+  for (uint8_t i = 0; i < kNumCVOutputs; ++i) {
+    num_audio_voices += cv_outputs_[i].num_audio_voices();
+  }
+  uint8_t frame_rate = FRAME_RATE_LAST - 1;
+  while (frame_rate > FRAME_RATE_45K &&
+      num_audio_voices * kFrameRateHz[frame_rate] >
+      kNumParaphonicVoices * kBaseFrameHz) {
+    --frame_rate;
+  }
+  dac.set_frame_rate(static_cast<FrameRate>(frame_rate));
+  AssignDCInterpolation();
+}
+
+void Multi::RetuneJustIntonationChord() {
+  // A chord can span parts, so every part holding a retuned note follows it.
+  uint8_t note;
+  int16_t pitch;
+  while (just_intonation_processor.PopRetuned(&note, &pitch)) {
+    for (uint8_t i = 0; i < num_active_parts_; ++i) {
+      part_[i].Retune(note, pitch);
+    }
+  }
+}
+
+void Multi::AssignDCInterpolation() {
+  // Render budget left over by the audio voices, in voice-frames per second.
+  // An output that can carry audio already has a share of its own, which
+  // covers interpolation whenever it is outputting DC instead.
+  int32_t budget = kNumParaphonicVoices * kBaseFrameHz;
+  for (uint8_t i = 0; i < kNumCVOutputs; ++i) {
+    budget -= cv_outputs_[i].num_audio_voices() * dac.frame_hz();
+  }
+  DCInterpolation mode = static_cast<DCInterpolation>(
+      settings_.dc_interpolation);
+  int32_t cost = (kDCInterpolationCost[mode] * dac.frame_hz()) >> 4;
+  // An interpolated output plays a value this long after SysTick computed it,
+  // and cubic overshoots it for one more refresh.  Its gate waits as many
+  // refreshes, rounded up.
+  uint32_t lag = kOnsetLatencyFrames + dac.frames_per_dc_refresh() * (
+      mode == DC_INTERPOLATION_CUBIC ? 3 : 1);
+  uint8_t interpolated_gate_delay = (
+      lag * kDCRefreshHz + dac.frame_hz() - 1) / dac.frame_hz();
+  // Audio onsets are dated from their event, but SysTick only computes the DC
+  // at the next refresh, and the pitch of a new note a refresh later still,
+  // since the outputs refresh before the voices.  Other outputs play their DC
+  // two refreshes less than the onset latency after it is computed, so that
+  // it never trails the audio.  Their gate, which is written a refresh after
+  // it is computed, opens at the first refresh once the DC has been played.
+  uint8_t dc_delay = kOnsetLatencyFrames - 2 * dac.frames_per_dc_refresh();
+  uint8_t gate_delay = (
+      kOnsetLatencyFrames * kDCRefreshHz + dac.frame_hz() - 1) /
+      dac.frame_hz() - 2;
+  for (uint8_t i = 0; i < kNumCVOutputs; ++i) {
+    CVOutput& output = cv_outputs_[i];
+    output.set_delays(dc_delay, gate_delay, interpolated_gate_delay);
+    if (output.num_audio_voices() || cost <= budget) {
+      if (!output.num_audio_voices()) budget -= cost;
+      output.set_dc_interpolation(mode);
+    } else {
+      output.set_dc_interpolation(DC_INTERPOLATION_OFF);
+    }
+  }
 }
 
 void Multi::GetCvGate(uint16_t* cv, bool* gate) {
+  uint16_t frame = dac.frame_counter();
   for (uint8_t i = 0; i < kNumCVOutputs; ++i) {
     cv[i] = cv_outputs_[i].dc_dac_code();
     gate[i] = cv_outputs_[i].gate();
   }
+  // Gates that aren't the outputs' own don't come from a dated event
+  uint8_t unstamped = 0;
 
   switch (settings_.layout) {
     case LAYOUT_MONO:
@@ -491,6 +612,7 @@ void Multi::GetCvGate(uint16_t* cv, bool* gate) {
       gate[1] = voice_[0].trigger();
       gate[2] = clock();
       gate[3] = reset_or_playing_flag();
+      unstamped = 1 << 1 | 1 << 2 | 1 << 3;
       break;
       
     case LAYOUT_DUAL_MONO:
@@ -498,6 +620,7 @@ void Multi::GetCvGate(uint16_t* cv, bool* gate) {
     case LAYOUT_QUAD_POLYCHAINED:
       gate[2] = clock();
       gate[3] = reset_or_playing_flag();
+      unstamped = 1 << 2 | 1 << 3;
       break;
     
     case LAYOUT_QUAD_MONO:
@@ -507,6 +630,7 @@ void Multi::GetCvGate(uint16_t* cv, bool* gate) {
       if (settings_.clock_override) {
         gate[2] = clock();
         gate[3] = reset_or_playing_flag();
+        unstamped = 1 << 2 | 1 << 3;
       }
       break;
 
@@ -514,20 +638,24 @@ void Multi::GetCvGate(uint16_t* cv, bool* gate) {
     case LAYOUT_TWO_TWO:
       if (settings_.clock_override) {
         gate[3] = clock();
+        unstamped = 1 << 3;
       }
       break;
     
     case LAYOUT_TWO_ONE:
       gate[3] = clock();
+      unstamped = 1 << 3;
       break;
 
     case LAYOUT_PARAPHONIC_PLUS_TWO:
       gate[0] = voice_[kNumSystemVoices - 1].gate();
       gate[2] = settings_.clock_override ? clock() : cv_outputs_[2].trigger();
+      unstamped = 1 << 0 | 1 << 2;
       break;
 
     case LAYOUT_TRI_MONO:
       gate[3] = clock();
+      unstamped = 1 << 3;
       cv[3] = cv_outputs_[3].volts_dac_code(reset_or_playing_flag() ? 5 : 0);
       break;
 
@@ -540,6 +668,7 @@ void Multi::GetCvGate(uint16_t* cv, bool* gate) {
       // ) ? 0 : part_[0].voice(last_voice)->velocity() << 1;
       gate[2] = clock();
       gate[3] = reset_or_playing_flag();
+      unstamped = 1 << 2 | 1 << 3;
       break;
 
     case LAYOUT_QUAD_TRIGGERS:
@@ -547,8 +676,14 @@ void Multi::GetCvGate(uint16_t* cv, bool* gate) {
       gate[1] = voice_[0].trigger() && voice_[1].gate();
       gate[2] = clock();
       gate[3] = reset_or_playing_flag();
+      unstamped = 1 << 0 | 1 << 1 | 1 << 2 | 1 << 3;
       break;
   }
+
+  for (uint8_t i = 0; i < kNumCVOutputs; ++i) {
+    gate[i] = cv_outputs_[i].DelayGate(
+        gate[i], !(unstamped & (1 << i)), frame);
+  }
 }
 
 void Multi::GetLedsBrightness(uint8_t* brightness) {
@@ -758,16 +893,17 @@ void Multi::ChangeLayout(Layout old_layout, Layout new_layout) {
           if (destination != source) {
             memcpy(
                 part_[destination].mutable_midi_settings(),
-                part_[source].mutable_midi_settings(),
+                &part_[source].midi_settings(),
                 sizeof(MidiSettings));
             memcpy(
                 part_[destination].mutable_voicing_settings(),
-                part_[source].mutable_voicing_settings(),
+                &part_[source].voicing_settings(),
                 sizeof(VoicingSettings));
             memcpy(
                 part_[destination].mutable_sequencer_settings(),
-                part_[source].mutable_sequencer_settings(),
+                &part_[source].sequencer_settings(),
                 sizeof(SequencerSettings));
+            *part_[destination].mutable_sequence() = part_[source].sequence();
           }
         }
       }
@@ -781,8 +917,8 @@ void Multi::ChangeLayout(Layout old_layout, Layout new_layout) {
             midi->min_note = 36 + i * 2;
             midi->max_note = 36 + i * 2;
           }
-          midi->channel = part_[0].mutable_midi_settings()->channel;
-          midi->out_mode = part_[0].mutable_midi_settings()->out_mode;
+          midi->channel = part_[0].midi_settings().channel;
+          midi->out_mode = part_[0].midi_settings().out_mode;
         }
         
         // Duplicate sequencer settings.
@@ -792,8 +928,9 @@ void Multi::ChangeLayout(Layout old_layout, Layout new_layout) {
           if (destination != source) {
             memcpy(
                 part_[destination].mutable_sequencer_settings(),
-                part_[source].mutable_sequencer_settings(),
+                &part_[source].sequencer_settings(),
                 sizeof(SequencerSettings));
+            *part_[destination].mutable_sequence() = part_[source].sequence();
           }
         }
       }
@@ -827,24 +964,41 @@ void Multi::SwapParts(uint8_t x, uint8_t y) {
   PackedPart x_packed, y_packed;
   part_[x].Pack(x_packed);
   part_[y].Pack(y_packed);
-  part_[x].Unpack(y_packed);
-  part_[y].Unpack(x_packed);
+  part_[x].UnpackSettings(y_packed);
+  part_[y].UnpackSettings(x_packed);
+  // PackedPart only has room for the newest looper notes, and for part of a
+  // long sequence
+  part_[x].mutable_looper().SwapNotes(part_[y].mutable_looper());
+  std::swap(*part_[x].mutable_sequence(), *part_[y].mutable_sequence());
 
   AfterDeserialize();
 }
 
 void Multi::AfterDeserialize() {
   CONSTRAIN(settings_.control_change_mode, 0, CONTROL_CHANGE_MODE_LAST - 1);
+  CONSTRAIN(settings_.dc_interpolation, 0, DC_INTERPOLATION_LAST - 1);
+  CONSTRAIN(settings_.program_change_mode, 0, PROGRAM_CHANGE_MODE_LAST - 1);
+  // Whatever replaced the multi also replaces a program waiting to switch in
+  queued_program_ = NULL;
 
   Stop();
   UpdateTempo();
   AllocateParts();
+  // The parts no longer hold the program being morphed from
+  preset_morph.Stop();
   
   for (uint8_t i = 0; i < kNumParts; ++i) {
     part_[i].AfterDeserialize();
   }
 
-  for (uint8_t controller = 0; controller < 128; ++controller) {
+  // Left to LowPriority, which is the bulk of the work of a program switch
+  num_inferred_controllers_ = 0;
+}
+
+void Multi::InferControllerValues(uint8_t end) {
+  for (; num_inferred_controllers_ < end && num_inferred_controllers_ < 128;
+       ++num_inferred_controllers_) {
+    uint8_t controller = num_inferred_controllers_;
     InferControllerValue(CCRouting::Remote(controller));
     for (uint8_t p = 0; p < kNumParts; ++p) {
       InferControllerValue(CCRouting::Part(controller, p));
@@ -852,6 +1006,140 @@ void Multi::AfterDeserialize() {
   }
 }
 
+void Multi::ProgramChange(uint8_t channel, uint8_t program) {
+  if (
+    is_remote_control_channel(channel) &&
+    settings_.program_change_mode != PROGRAM_CHANGE_MODE_OFF
+  ) {
+    requested_program_ = program;
+  }
+}
+
+void Multi::QueueProgram(
+    PackedMulti* program, const uint8_t* const* sequence_tails) {
+  queued_program_ = program;
+  for (uint8_t i = 0; i < kNumParts; ++i) {
+    queued_sequence_tails_[i] = sequence_tails ? sequence_tails[i] : NULL;
+  }
+  if (!running_ || settings_.program_change_mode <= PROGRAM_CHANGE_MODE_NOW) {
+    SwapQueuedProgram();
+  }
+}
+
+bool Multi::IsProgramBoundary(int32_t ticks) const {
+  switch (settings_.program_change_mode) {
+    case PROGRAM_CHANGE_MODE_BAR:
+      if (
+        settings_.clock_bar_duration &&
+        settings_.clock_bar_duration <= kMaxBarDuration
+      ) {
+        return modulo(ticks, settings_.clock_bar_duration * 24) == 0;
+      }
+      // Without bars, switch on the step
+    case PROGRAM_CHANGE_MODE_STEP:
+      return modulo(ticks, part_[0].PPQN()) == 0;
+    default:
+      return true;
+  }
+}
+
+// A key held on a part that a program switch replaces, as it came in.
+struct HandedOverKey {
+  uint8_t part;
+  uint8_t channel;
+  uint8_t note;
+  uint8_t velocity;
+  bool sustained;
+};
+
+void Multi::SwapQueuedProgram() {
+  PackedMulti* program = queued_program_;
+  StopRecording(recording_part_);
+
+  // Recover the held and sustained keys from the parts, newest first.  A key
+  // that several parts received is kept once.
+  HandedOverKey keys[kNumParts * kNoteStackSize];
+  uint8_t num_keys = 0;
+  for (uint8_t p = 0; p < num_active_parts_; ++p) {
+    const HeldKeys& held = part_[p].HeldKeysForUI();
+    const MidiSettings& settings = midi(p);
+    uint8_t velocity_range = settings.max_velocity - settings.min_velocity + 1;
+    for (
+      uint8_t i = held.stack.most_recent_note_index();
+      i;
+      i = held.stack.note(i).next_ptr
+    ) {
+      const NoteEntry& e = held.stack.note(i);
+      HandedOverKey key;
+      key.part = p;
+      key.channel = settings.channel;
+      int16_t note = e.note - 12 * settings.transpose_octaves;
+      CONSTRAIN(note, 0, 127);
+      key.note = note;
+      // Undoes the velocity scaling of Part::NoteOn
+      uint8_t velocity = e.velocity & ~HeldKeys::VELOCITY_SUSTAIN_MASK;
+      key.velocity = settings.min_velocity + \
+          ((velocity * velocity_range + 127) >> 7);
+      key.sustained = held.IsSustained(e);
+      bool duplicate = false;
+      for (uint8_t j = 0; j < num_keys; ++j) {
+        duplicate = duplicate || (
+            keys[j].channel == key.channel && keys[j].note == key.note);
+      }
+      if (!duplicate) {
+        keys[num_keys++] = key;
+      }
+    }
+  }
+
+  // The clock carries on if the new program keeps its source.  Stop() would
+  // also send a MIDI stop, so only the old parts' sequencer notes are ended.
+  bool keep_running = running_ &&
+      (program->clock_tempo > TEMPO_EXTERNAL) == internal_clock();
+  bool started_by_keyboard = started_by_keyboard_;
+  if (keep_running) {
+    for (uint8_t p = 0; p < num_active_parts_; ++p) {
+      part_[p].StopSequencerArpeggiatorNotes();
+    }
+    running_ = false;
+  }
+  for (uint8_t i = 0; i < kNumParts; i++) {
+    part_[i].Unpack(program->parts[i], queued_sequence_tails_[i]);
+  }
+  settings_.Unpack(*program);
+  AfterDeserialize();
+  if (keep_running) {
+    running_ = true;
+    started_by_keyboard_ = started_by_keyboard;
+    for (uint8_t p = 0; p < num_active_parts_; ++p) {
+      part_[p].Start();
+    }
+  }
+
+  // Oldest first, so that the newest key ends up on top of the note stacks.
+  // An omni part's keys are taken to come in on the channel of the part now
+  // in its place.
+  while (num_keys) {
+    const HandedOverKey& key = keys[--num_keys];
+    uint8_t channel = key.channel;
+    if (channel == kMidiChannelOmni && key.part < num_active_parts_) {
+      channel = midi(key.part).channel;
+    }
+    if (channel == kMidiChannelOmni) {
+      channel = 0;
+    }
+    for (uint8_t p = 0; p < num_active_parts_; ++p) {
+      if (!part_accepts_note_on(p, channel, key.note, key.velocity)) continue;
+      uint8_t note = part_[p].TransposeInputPitch(key.note);
+      part_[p].NoteOn(channel, note, key.velocity);
+      if (key.sustained) {
+        // Sustained again if the hold pedal is still down
+        part_[p].NoteOff(channel, note);
+      }
+    }
+  }
+}
+
 void Multi::StartRecording(uint8_t part) {
   if (
     part_[part].midi_settings().play_mode == PLAY_MODE_MANUAL ||
@@ -918,6 +1206,8 @@ int16_t Multi::GetControllableValue(CCRouting cc) const {
     }
     case kCCLooperPhaseOffset:
       return part.looped() ? part.looper().pos_offset >> 9 : 0;
+    case kCCMorph:
+      return preset_morph.position(part_index);
     default:
       return 0;
   }
@@ -954,6 +1244,8 @@ bool Multi::ControlChange(uint8_t channel, uint8_t controller, uint8_t value_7bi
   bool thru = true;
 
   if (settings_.control_change_mode == CONTROL_CHANGE_MODE_OFF) return thru;
+  // The CC may read or update values not yet inferred from the program
+  InferControllerValues(128);
 
   if (
     is_remote_control_channel(channel) &&
@@ -1009,6 +1301,11 @@ bool Multi::ControlChange(uint8_t channel, uint8_t controller, uint8_t value_7bi
         ui.SplashPartString(label, part_index);
         break;
 
+      case kCCMorph:
+        // Applied from the main loop, so a fast sweep costs one pass
+        preset_morph.set_position(part_index, scaled_value);
+        break;
+
       case kCCLooperPhaseOffset:
         if (part_[part_index].looped()) {
           part_->mutable_looper().pos_offset = scaled_value << 9;
@@ -1179,6 +1476,7 @@ const SettingIndex Multi::kTaggedSkippedSettings[] = {
   SETTING_MENU_OSCILLATOR,
   SETTING_MENU_ENVELOPE,
   SETTING_MIDI_NOTE,
+  SETTING_MENU_MATRIX,
 };
 const uint8_t Multi::kNumTaggedSkippedSettings =
     sizeof(kTaggedSkippedSettings) / sizeof(kTaggedSkippedSettings[0]);
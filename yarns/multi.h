@@ -30,9 +30,12 @@
 #ifndef YARNS_MULTI_H_
 #define YARNS_MULTI_H_
 
+#include <algorithm>
+
 #include "stmlib/stmlib.h"
 
 #include "yarns/drivers/dac.h"
+#include "yarns/event_queue.h"
 #include "yarns/internal_clock.h"
 #include "yarns/layout_configurator.h"
 #include "yarns/part.h"
@@ -89,7 +92,7 @@ struct PackedMulti {
 
   int8_t custom_pitch_table[12];
 
-  unsigned int // 7 bits to spare
+  unsigned int // 3 bits to spare
     layout : 4, // values free: 1
     clock_tempo : 8, // values free: 54
     clock_swing : 7, // values free: 28
@@ -99,7 +102,9 @@ struct PackedMulti {
     clock_override : 1,
     remote_control_channel : 5, // values free: 15
     nudge_first_tick : 1,
-    clock_manual_start : 1;
+    clock_manual_start : 1,
+    dc_interpolation : 2, // values free: 1
+    program_change_mode : 2; // values free: 0
 
   uint8_t control_change_mode; // Breaking: move to bitfield when convenient
   int8_t clock_offset;
@@ -119,7 +124,9 @@ struct MultiSettings {
   uint8_t clock_manual_start;
   uint8_t control_change_mode;
   int8_t clock_offset;
-  uint8_t padding[8];
+  uint8_t dc_interpolation;
+  uint8_t program_change_mode;
+  uint8_t padding[6];
 
   void Pack(PackedMulti& packed) {
     for (uint8_t i = 0; i < 12; i++) {
@@ -137,6 +144,8 @@ struct MultiSettings {
     packed.clock_manual_start = clock_manual_start;
     packed.control_change_mode = control_change_mode;
     packed.clock_offset = clock_offset;
+    packed.dc_interpolation = dc_interpolation;
+    packed.program_change_mode = program_change_mode;
   }
 
   void Unpack(PackedMulti& packed) {
@@ -155,6 +164,8 @@ struct MultiSettings {
     clock_manual_start = packed.clock_manual_start;
     control_change_mode = packed.control_change_mode;
     clock_offset = packed.clock_offset;
+    dc_interpolation = packed.dc_interpolation;
+    program_change_mode = packed.program_change_mode;
   }
 };
 
@@ -170,6 +181,21 @@ enum ControlChangeMode {
   CONTROL_CHANGE_MODE_LAST,
 };
 
+// When a program loaded by a program change, or from the panel, replaces the
+// one playing.  Off ignores program changes, and loads immediately.
+enum ProgramChangeMode {
+  PROGRAM_CHANGE_MODE_OFF,
+  PROGRAM_CHANGE_MODE_NOW,
+  PROGRAM_CHANGE_MODE_STEP,
+  PROGRAM_CHANGE_MODE_BAR,
+  PROGRAM_CHANGE_MODE_LAST,
+};
+
+const uint8_t kNoProgram = 0xff;
+// After a program is loaded, controller values are inferred a few at a time
+// by each main loop iteration.
+const uint8_t kNumControllersInferredPerTick = 8;
+
 enum MultiSetting {
   MULTI_LAYOUT,
   MULTI_CLOCK_TEMPO,
@@ -195,6 +221,8 @@ enum MultiSetting {
   MULTI_CLOCK_MANUAL_START,
   MULTI_CONTROL_CHANGE_MODE,
   MULTI_CLOCK_OFFSET,
+  MULTI_DC_INTERPOLATION,
+  MULTI_PROGRAM_CHANGE_MODE,
 };
 
 enum Layout {
@@ -322,6 +350,9 @@ class Multi {
   int16_t UpdateController(CCRouting cc, uint8_t value_7bits);
   void SetFromCC(CCRouting cc, int16_t scaled_value);
   void InferControllerValue(CCRouting cc);
+  // Infers the values of the controllers up to end that haven't been since the
+  // multi was last deserialized.
+  void InferControllerValues(uint8_t end);
 
   uint8_t ScaleSettingToController(SettingRange range, int16_t value) const;
   const Setting* GetSettingForController(CCRouting cc) const;
@@ -432,21 +463,53 @@ class Multi {
   }
   
   void AfterDeserialize();
+
+  // A program change on the remote control channel requests a program, which
+  // the storage manager decodes into a shadow PackedMulti between block
+  // renders and queues.  The queued program replaces the playing one at the
+  // boundary set by the program change mode: immediately, or on the clock's
+  // next step or bar.  The clock keeps running through the switch, and held
+  // keys are played again under the new program.
+  void ProgramChange(uint8_t channel, uint8_t program);
+  inline uint8_t PopRequestedProgram() {
+    uint8_t program = requested_program_;
+    requested_program_ = kNoProgram;
+    return program;
+  }
+  // The program, and the sequence tails that go with it, must stay untouched
+  // until it has been swapped in.
+  void QueueProgram(
+      PackedMulti* program, const uint8_t* const* sequence_tails = NULL);
+  inline void CancelQueuedProgram() { queued_program_ = NULL; }
+  inline const PackedMulti* queued_program() const { return queued_program_; }
+
   inline void UpdateResetPulse() { if (reset_pulse_counter_) --reset_pulse_counter_; }
   void Refresh();
   void ClockLFOs(int32_t, bool);
   void RefreshInternalClock() {
-    if (running() && internal_clock() && internal_clock_.Process()) {
-      ++internal_clock_ticks_;
+    if (!running() || !internal_clock()) {
+      num_pending_clock_ticks_ = 0;
+    } else if (internal_clock_.Process()) {
+      ++num_pending_clock_ticks_;
+    }
+    // A tick that finds the queue full is retried at the next refresh
+    while (num_pending_clock_ticks_ &&
+           event_queue.Push(EVENT_INTERNAL_CLOCK, 0)) {
+      --num_pending_clock_ticks_;
     }
   }
 
+  void ClockSwingStep(uint8_t part);
+
   void LowPriority() {
-    while (internal_clock_ticks_) {
-      Clock();
-      --internal_clock_ticks_;
+    if (queued_program_ && !running_) {
+      // No step or bar to wait for
+      SwapQueuedProgram();
+    }
+    if (num_inferred_controllers_ < 128) {
+      InferControllerValues(
+          num_inferred_controllers_ + kNumControllersInferredPerTick);
     }
-
     bool can_play = tick_counter() >= 0;
     for (uint8_t p = 0; p < num_active_parts_; ++p) {
       if (running()) {
@@ -483,6 +546,15 @@ class Multi {
   inline bool reset_or_playing_flag() const {
     return reset() || ((settings_.clock_bar_duration == 0) && running_);
   }
+  // Nothing is gated or droning, so stalling the CPU (for a flash erase)
+  // would go unheard.
+  inline bool idle() const {
+    if (running_) return false;
+    for (uint8_t i = 0; i < kNumCVOutputs; ++i) {
+      if (cv_outputs_[i].gate() || cv_outputs_[i].drone()) return false;
+    }
+    return true;
+  }
   
   inline const CVOutput& cv_output(uint8_t index) const { return cv_outputs_[index]; }
   inline const Part& part(uint8_t index) const { return part_[index]; }
@@ -519,12 +591,30 @@ class Multi {
     cv_outputs_[cv_i].AssignVoices(&voice_[voice_i], role, num_dc, num_audio);
   }
   void AssignVoicesToCVOutputs();
+  void AssignDCInterpolation();
+  void RetuneJustIntonationChord();
   void GetCvGate(uint16_t* cv, bool* gate);
   void GetLedsBrightness(uint8_t* brightness);
 
+  // PackedPart only keeps the newest looper notes of each part, in the slots
+  // that its modulation matrix leaves
+  inline bool looper_notes_fit_packed() const {
+    for (uint8_t i = 0; i < kNumParts; i++) {
+      if (part_[i].looper().num_notes() > part_[i].packed_looper_capacity()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
   template<typename T>
   void SerializePacked(T* stream_buffer) {
+    // Padding bits are zeroed so that an unchanged multi always serializes to
+    // the same bytes, which the preset log diffs against.
     PackedMulti packed;
+    std::fill(
+        reinterpret_cast<uint8_t*>(&packed),
+        reinterpret_cast<uint8_t*>(&packed) + sizeof(packed), 0);
     for (uint8_t i = 0; i < kNumParts; i++) {
       part_[i].Pack(packed.parts[i]);
     }
@@ -532,14 +622,18 @@ class Multi {
     stream_buffer->Write(packed);
   };
   
+  // Without sequence_tails, long sequences are cut to what the parts hold
+  // (see StepSequence::Unpack).
   template<typename T>
-  void DeserializePacked(T* stream_buffer) {
+  void DeserializePacked(
+      T* stream_buffer, const uint8_t* const* sequence_tails = NULL) {
     StopRecording(recording_part_);
     Stop();
     PackedMulti packed;
     stream_buffer->Read(&packed);
     for (uint8_t i = 0; i < kNumParts; i++) {
-      part_[i].Unpack(packed.parts[i]);
+      part_[i].Unpack(
+          packed.parts[i], sequence_tails ? sequence_tails[i] : NULL);
     }
     settings_.Unpack(packed);
     AfterDeserialize();
@@ -565,6 +659,7 @@ class Multi {
     TAGGED_SECTION_PART_SETTINGS   = 0x03,
     TAGGED_SECTION_SEQUENCER       = 0x04,
     TAGGED_SECTION_LOOPER          = 0x05,
+    TAGGED_SECTION_STEP_SEQUENCE   = 0x06,
   };
 
   // Wire format structs — these are the single source of truth for section
@@ -586,7 +681,8 @@ class Multi {
     uint8_t part_index;
   } __attribute__((packed));
 
-  // Sequencer: { part_index, num_steps } followed by TaggedSequencerStep[kNumSteps]
+  // Sequencer, as written by older firmware: { part_index, num_steps }
+  // followed by TaggedSequencerStep[kNumSteps]
   struct TaggedSequencerPrefix {
     uint8_t part_index;
     uint8_t num_steps;
@@ -600,7 +696,16 @@ class Multi {
     uint8_t is_slide;
   } __attribute__((packed));
 
-  // Looper: { part_index, size, oldest_index } followed by TaggedLooperNote[kMaxNotes]
+  // Step sequence: { part_index, num_steps } followed by the encoded steps, as
+  // held by StepSequence
+  struct TaggedStepSequencePrefix {
+    uint8_t part_index;
+    uint16_t num_steps;
+  } __attribute__((packed));
+
+  // Looper: { part_index, size, oldest_index } followed by TaggedLooperNote[size]
+  // from oldest to newest.  Older payloads always carry kMaxPackedNotes notes in
+  // ring order starting at oldest_index.
   struct TaggedLooperPrefix {
     uint8_t part_index;
     uint8_t size;
@@ -628,12 +733,14 @@ class Multi {
   }
 
   // Setting counts per domain.  Validated by STATIC_ASSERTs in multi.cc.
-  static const uint16_t kNumTaggedMultiSettings = 12;
-  static const uint16_t kNumTaggedPartSettings = 63;
+  static const uint16_t kNumTaggedMultiSettings = 14;
+  static const uint16_t kNumTaggedPartSettings = 75;
 
   // Complete wire layout of a tagged payload.  Not used for actual I/O
   // (we stream element-by-element to avoid a large stack allocation), but
-  // sizeof(TaggedPayload) is the definitive buffer size.
+  // sizeof(TaggedPayload) is the size of the largest one.  SysEx dumps are
+  // sent as they are written and applied a section at a time, so only
+  // kMaxTaggedSectionSize has to be held.
   struct TaggedPayload {
     uint8_t version;
     TaggedSectionHeader multi_settings_header;
@@ -647,26 +754,30 @@ class Multi {
     } part_settings[kNumParts];
     struct {
       TaggedSectionHeader header;
-      TaggedSequencerPrefix prefix;
-      TaggedSequencerStep steps[kNumSteps];
-    } sequencers[kNumParts];
+      TaggedStepSequencePrefix prefix;
+      uint8_t steps[kStepSequenceSize];
+    } sequences[kNumParts];
     struct {
       TaggedSectionHeader header;
       TaggedLooperPrefix prefix;
-      TaggedLooperNote notes[looper::kMaxNotes];
     } loopers[kNumParts];
+    // All decks draw from one note pool
+    TaggedLooperNote looper_notes[looper::kMaxPoolSize];
     uint8_t end;
   } __attribute__((packed));
 
   static const uint16_t kTaggedPayloadSize = sizeof(TaggedPayload);
+  // A looper section holding a full deck
+  static const uint16_t kMaxTaggedSectionSize =
+      sizeof(TaggedSectionHeader) + sizeof(TaggedLooperPrefix) +
+      looper::kMaxDeckNotes * sizeof(TaggedLooperNote);
 
-  // Writes a section header with a placeholder length, returns the position
-  // of the length field so it can be patched after the data is written.
+  // Section lengths are worked out ahead of the data, so that a payload can
+  // be sent as it is written, without being held whole.
   template<typename T>
-  size_t SerializeTaggedSectionBegin(T* b, uint8_t type) {
-    TaggedSectionHeader header = { type, 0 };
+  void SerializeTaggedSectionHeader(T* b, uint8_t type, uint16_t length) {
+    TaggedSectionHeader header = { type, length };
     b->Write(header);
-    return b->position();  // data starts here
   }
 
   // Bounds-checked read: returns false (without reading) if we would read past
@@ -678,15 +789,13 @@ class Multi {
     return true;
   }
 
-  // Patches the length field written by SerializeTaggedSectionBegin.
-  // data_start is the position returned by SerializeTaggedSectionBegin.
-  template<typename T>
-  void SerializeTaggedSectionEnd(T* b, size_t data_start) {
-    size_t end = b->position();
-    uint16_t length = end - data_start;
-    b->Seek(data_start - sizeof(TaggedSectionHeader::length));
-    b->Write(length);
-    b->Seek(end);
+  static uint8_t NumTaggedSettings(SettingDomain domain) {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < SETTING_LAST; i++) {
+      count += IsTaggedSerializedSetting(i) &&
+          setting_defs.get(i).domain == domain;
+    }
+    return count;
   }
 
   template<typename T>
@@ -696,7 +805,9 @@ class Multi {
 
     // Multi settings
     {
-      size_t data_start = SerializeTaggedSectionBegin(b, TAGGED_SECTION_MULTI_SETTINGS);
+      SerializeTaggedSectionHeader(
+          b, TAGGED_SECTION_MULTI_SETTINGS,
+          NumTaggedSettings(SETTING_DOMAIN_MULTI) * sizeof(TaggedSettingPair));
       for (uint8_t i = 0; i < SETTING_LAST; i++) {
         if (!IsTaggedSerializedSetting(i)) continue;
         const Setting& setting = setting_defs.get(i);
@@ -706,21 +817,25 @@ class Multi {
         };
         b->Write(pair);
       }
-      SerializeTaggedSectionEnd(b, data_start);
     }
 
     // Custom pitch table
     {
-      size_t data_start = SerializeTaggedSectionBegin(b, TAGGED_SECTION_CUSTOM_PITCH);
+      SerializeTaggedSectionHeader(
+          b, TAGGED_SECTION_CUSTOM_PITCH,
+          sizeof(settings_.custom_pitch_table));
       for (uint8_t i = 0; i < sizeof(settings_.custom_pitch_table); i++) {
         b->Write(settings_.custom_pitch_table[i]);
       }
-      SerializeTaggedSectionEnd(b, data_start);
     }
 
     // Part settings (one section per part)
     for (uint8_t p = 0; p < kNumParts; p++) {
-      size_t data_start = SerializeTaggedSectionBegin(b, TAGGED_SECTION_PART_SETTINGS);
+      SerializeTaggedSectionHeader(
+          b, TAGGED_SECTION_PART_SETTINGS,
+          sizeof(TaggedPartPrefix) +
+              NumTaggedSettings(SETTING_DOMAIN_PART) *
+              sizeof(TaggedSettingPair));
       TaggedPartPrefix prefix = { p };
       b->Write(prefix);
       for (uint8_t setting_index = 0; setting_index < SETTING_LAST; setting_index++) {
@@ -732,51 +847,45 @@ class Multi {
         };
         b->Write(pair);
       }
-      SerializeTaggedSectionEnd(b, data_start);
     }
 
-    // Sequencer data (one section per part)
+    // Step sequences (one section per part), still encoded
     for (uint8_t p = 0; p < kNumParts; p++) {
-      size_t data_start = SerializeTaggedSectionBegin(b, TAGGED_SECTION_SEQUENCER);
-      const SequencerSettings& seq = part_[p].sequencer_settings();
-      TaggedSequencerPrefix prefix = { p, seq.num_steps };
+      const StepSequence& sequence = part_[p].sequence();
+      SerializeTaggedSectionHeader(
+          b, TAGGED_SECTION_STEP_SEQUENCE,
+          sizeof(TaggedStepSequencePrefix) + sequence.size());
+      TaggedStepSequencePrefix prefix = { p, sequence.num_steps() };
       b->Write(prefix);
-      for (uint8_t i = 0; i < kNumSteps; i++) {
-        const SequencerStep& s = seq.step[i];
-        TaggedSequencerStep step = {
-          s.note(),
-          static_cast<uint8_t>(s.data[1] & 0x7F),
-          s.is_rest(),
-          s.is_tie(),
-          s.is_slide()
-        };
-        b->Write(step);
+      for (uint16_t i = 0; i < sequence.size(); i++) {
+        b->Write(sequence.data()[i]);
       }
-      SerializeTaggedSectionEnd(b, data_start);
     }
 
-    // Looper data (one section per part).
-    // Uses PackedPart as intermediary — Deck's only serialization interface.
+    // Looper data (one section per part), every note from oldest to newest.
     for (uint8_t p = 0; p < kNumParts; p++) {
-      size_t data_start = SerializeTaggedSectionBegin(b, TAGGED_SECTION_LOOPER);
-      PackedPart packed;
-      part_[p].looper().Pack(packed);
-      TaggedLooperPrefix prefix = {
-        p,
-        static_cast<uint8_t>(packed.looper_size),
-        static_cast<uint8_t>(packed.looper_oldest_index)
-      };
+      const looper::Deck& deck = part_[p].looper();
+      SerializeTaggedSectionHeader(
+          b, TAGGED_SECTION_LOOPER,
+          sizeof(TaggedLooperPrefix) +
+              deck.num_notes() * sizeof(TaggedLooperNote));
+      TaggedLooperPrefix prefix = { p, deck.num_notes(), 0 };
       b->Write(prefix);
-      for (uint8_t i = 0; i < looper::kMaxNotes; i++) {
+      for (
+        uint16_t i = deck.oldest_index();
+        i != looper::kNullIndex;
+        i = deck.newer_index(i)
+      ) {
+        looper::PackedNote packed_note;
+        deck.PackNote(i, packed_note);
         TaggedLooperNote note = {
-          static_cast<uint16_t>(packed.looper_notes[i].on_pos),
-          static_cast<uint16_t>(packed.looper_notes[i].off_pos),
-          static_cast<uint8_t>(packed.looper_notes[i].pitch),
-          static_cast<uint8_t>(packed.looper_notes[i].velocity)
+          static_cast<uint16_t>(packed_note.on_pos),
+          static_cast<uint16_t>(packed_note.off_pos),
+          static_cast<uint8_t>(packed_note.pitch),
+          static_cast<uint8_t>(packed_note.velocity)
         };
         b->Write(note);
       }
-      SerializeTaggedSectionEnd(b, data_start);
     }
 
     // End marker
@@ -829,36 +938,66 @@ class Multi {
         TaggedSequencerPrefix prefix = {};
         if (!ReadTaggedObject(b, &prefix, section_end)) return;
         if (prefix.part_index >= kNumParts) return;
-        SequencerSettings* seq = part_[prefix.part_index].mutable_sequencer_settings();
-        seq->num_steps = prefix.num_steps;
+        StepSequence* sequence = part_[prefix.part_index].mutable_sequence();
+        sequence->Clear();
         for (uint8_t i = 0; i < kNumSteps; i++) {
           TaggedSequencerStep step = {};
           if (!ReadTaggedObject(b, &step, section_end)) break;
-          seq->step[i].data[0] = step.is_rest ? SEQUENCER_STEP_REST
-              : step.is_tie ? SEQUENCER_STEP_TIE
-              : step.pitch;
-          seq->step[i].data[1] = (step.is_slide << 7) | (step.velocity & 0x7F);
+          if (i >= prefix.num_steps) continue;
+          sequence->SetStep(i, SequencerStep(
+              step.is_rest ? SEQUENCER_STEP_REST
+                  : step.is_tie ? SEQUENCER_STEP_TIE
+                  : step.pitch,
+              (step.is_slide << 7) | (step.velocity & 0x7F)));
         }
         return;
       }
 
-      // Uses PackedPart as intermediary — Deck::Unpack rebuilds linked lists.
+      case TAGGED_SECTION_STEP_SEQUENCE: {
+        TaggedStepSequencePrefix prefix = {};
+        if (!ReadTaggedObject(b, &prefix, section_end)) return;
+        if (prefix.part_index >= kNumParts) return;
+        // Loaded in place, which spares a copy on the stack
+        part_[prefix.part_index].mutable_sequence()->Load(
+            b->bytes() + b->position(), section_end - b->position(),
+            prefix.num_steps);
+        return;
+      }
+
+      // Deck rebuilds its linked lists as notes are appended.
       case TAGGED_SECTION_LOOPER: {
         TaggedLooperPrefix prefix = {};
         if (!ReadTaggedObject(b, &prefix, section_end)) return;
         if (prefix.part_index >= kNumParts) return;
-        PackedPart packed;
-        packed.looper_size = prefix.size;
-        packed.looper_oldest_index = prefix.oldest_index;
-        for (uint8_t i = 0; i < looper::kMaxNotes; i++) {
+        looper::Deck& deck = part_[prefix.part_index].mutable_looper();
+        if (prefix.oldest_index) {
+          // Older ring-ordered payload: go through PackedPart to reorder it
+          if (prefix.size > looper::kMaxPackedNotes) return;
+          PackedPart packed;
+          packed.looper_size = prefix.size;
+          packed.looper_oldest_index = prefix.oldest_index;
+          for (uint8_t i = 0; i < looper::kMaxPackedNotes; i++) {
+            TaggedLooperNote note = {};
+            if (!ReadTaggedObject(b, &note, section_end)) break;
+            packed.looper_notes[i].on_pos = note.on_pos;
+            packed.looper_notes[i].off_pos = note.off_pos;
+            packed.looper_notes[i].pitch = note.pitch;
+            packed.looper_notes[i].velocity = note.velocity;
+          }
+          deck.Unpack(packed);
+          return;
+        }
+        deck.RemoveAll();
+        for (uint8_t i = 0; i < prefix.size; i++) {
           TaggedLooperNote note = {};
           if (!ReadTaggedObject(b, &note, section_end)) break;
-          packed.looper_notes[i].on_pos = note.on_pos;
-          packed.looper_notes[i].off_pos = note.off_pos;
-          packed.looper_notes[i].pitch = note.pitch;
-          packed.looper_notes[i].velocity = note.velocity;
+          looper::PackedNote packed_note;
+          packed_note.on_pos = note.on_pos;
+          packed_note.off_pos = note.off_pos;
+          packed_note.pitch = note.pitch;
+          packed_note.velocity = note.velocity;
+          if (!deck.AppendPackedNote(packed_note)) break;
         }
-        part_[prefix.part_index].mutable_looper().Unpack(packed);
         return;
       }
 
@@ -885,6 +1024,18 @@ class Multi {
     }
   }
 
+  // A payload too large to hold whole is applied as it arrives instead:
+  // BeginTagged with its version byte, then each section followed by
+  // AfterDeserialize, so that one cut short leaves a consistent multi with the
+  // sections that came.
+  bool BeginTagged(uint8_t version) {
+    if (version != TAGGED_FORMAT_VERSION) return false;
+    StopRecording(recording_part_);
+    Stop();
+    Init(false);  // Reset to defaults, preserve calibration
+    return true;
+  }
+
   template<typename T>
   bool DeserializeTagged(T* b) {
     // First pass: validate structure without modifying state.
@@ -893,12 +1044,9 @@ class Multi {
 
     // Second pass: apply.
     b->Rewind();
-    StopRecording(recording_part_);
-    Stop();
-    Init(false);  // Reset to defaults, preserve calibration
-
     uint8_t version = 0;
     b->Read(&version);  // Already validated
+    BeginTagged(version);
 
     while (true) {
       size_t position_before = b->position();
@@ -954,6 +1102,8 @@ class Multi {
   void ChangeLayout(Layout old_layout, Layout new_layout);
   void UpdateTempo();
   void AllocateParts();
+  bool IsProgramBoundary(int32_t ticks) const;
+  void SwapQueuedProgram();
   void SpreadLFOs(int8_t spread, FastSyncedLFO** base_lfo, uint8_t num_lfos, bool force_phase);
   
   MultiSettings settings_;
@@ -964,7 +1114,10 @@ class Multi {
   uint8_t recording_part_;
   
   InternalClock internal_clock_;
-  uint8_t internal_clock_ticks_;
+  // Clock ticks and swung steps (one bit per part) that SysTick could not
+  // queue yet
+  uint8_t num_pending_clock_ticks_;
+  uint8_t pending_swing_steps_;
   
   // The 0-based index of the last received Clock event, ignoring division and
   // offset.  At 240 BPM * 24 PPQN = 96 Hz, this overflows after 259 days
@@ -989,6 +1142,12 @@ class Multi {
   
   uint8_t num_active_parts_;
 
+  uint8_t requested_program_;
+  PackedMulti* queued_program_;
+  const uint8_t* queued_sequence_tails_[kNumParts];
+  // Controllers whose values have been inferred from the settings
+  uint8_t num_inferred_controllers_;
+
   // "Virtual knobs" to track the accumulated result of CCs in relative mode.
   //
   // There is some wasted space here, because 1) not all controller numbers are mapped to a setting or macro, and 2) most remote controls map to part settings, which are also tracked in part_controller_value_
@@ -52,19 +52,19 @@ static const uint32_t kTransferPeakPhase = 1u << (32 - 2);
 static const uint32_t kTransferAsymmetricBias = kTransferPeakPhase / 2;  // 1/8 cycle -- max asymmetry
 
 /* static */
-Oscillator::RenderFn Oscillator::fn_table_[] = {
-  &Oscillator::RenderFilteredNoise,
-  &Oscillator::RenderFilteredNoise,
-  &Oscillator::RenderFilteredNoise,
-  &Oscillator::RenderFilteredNoise,
-  &Oscillator::RenderPhaseDistortionPulse,
-  &Oscillator::RenderPhaseDistortionPulse,
-  &Oscillator::RenderPhaseDistortionPulse,
-  &Oscillator::RenderPhaseDistortionPulse,
-  &Oscillator::RenderPhaseDistortionSaw,
-  &Oscillator::RenderPhaseDistortionSaw,
-  &Oscillator::RenderPhaseDistortionSaw,
-  &Oscillator::RenderPhaseDistortionSaw,
+const Oscillator::RenderFn Oscillator::fn_table_[] = {
+  &Oscillator::RenderFilteredNoise<OSC_SHAPE_NOISE_NOTCH>,
+  &Oscillator::RenderFilteredNoise<OSC_SHAPE_NOISE_LP>,
+  &Oscillator::RenderFilteredNoise<OSC_SHAPE_NOISE_BP>,
+  &Oscillator::RenderFilteredNoise<OSC_SHAPE_NOISE_HP>,
+  &Oscillator::RenderPhaseDistortionPulse<0>,
+  &Oscillator::RenderPhaseDistortionPulse<1>,
+  &Oscillator::RenderPhaseDistortionPulse<2>,
+  &Oscillator::RenderPhaseDistortionPulse<3>,
+  &Oscillator::RenderPhaseDistortionSaw<0>,
+  &Oscillator::RenderPhaseDistortionSaw<1>,
+  &Oscillator::RenderPhaseDistortionSaw<2>,
+  &Oscillator::RenderPhaseDistortionSaw<3>,
   &Oscillator::RenderLPPulse,
   &Oscillator::RenderLPSaw,
   &Oscillator::RenderVariablePulse,
@@ -79,24 +79,25 @@ Oscillator::RenderFn Oscillator::fn_table_[] = {
   &Oscillator::RenderDiracComb,
   &Oscillator::RenderTanhSine,
   &Oscillator::RenderExponentialSine,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
-  &Oscillator::RenderTransfer,
+  // Carrier, transfer function, bias
+  &Oscillator::RenderTransfer<WAVEFORM_SINE, WAVEFORM_SINE, false>,
+  &Oscillator::RenderTransfer<WAVEFORM_TRIANGLE, WAVEFORM_SINE, false>,
+  &Oscillator::RenderTransfer<WAVEFORM_EXPO, WAVEFORM_SINE, false>,
+  &Oscillator::RenderTransfer<WAVEFORM_SINE, WAVEFORM_SINE, true>,
+  &Oscillator::RenderTransfer<WAVEFORM_TRIANGLE, WAVEFORM_SINE, true>,
+  &Oscillator::RenderTransfer<WAVEFORM_EXPO, WAVEFORM_SINE, true>,
+  &Oscillator::RenderTransfer<WAVEFORM_SINE, WAVEFORM_TRIANGLE, false>,
+  &Oscillator::RenderTransfer<WAVEFORM_TRIANGLE, WAVEFORM_TRIANGLE, false>,
+  &Oscillator::RenderTransfer<WAVEFORM_EXPO, WAVEFORM_TRIANGLE, false>,
+  &Oscillator::RenderTransfer<WAVEFORM_SINE, WAVEFORM_TRIANGLE, true>,
+  &Oscillator::RenderTransfer<WAVEFORM_TRIANGLE, WAVEFORM_TRIANGLE, true>,
+  &Oscillator::RenderTransfer<WAVEFORM_EXPO, WAVEFORM_TRIANGLE, true>,
+  &Oscillator::RenderTransfer<WAVEFORM_SINE, WAVEFORM_EXPO, false>,
+  &Oscillator::RenderTransfer<WAVEFORM_TRIANGLE, WAVEFORM_EXPO, false>,
+  &Oscillator::RenderTransfer<WAVEFORM_EXPO, WAVEFORM_EXPO, false>,
+  &Oscillator::RenderTransfer<WAVEFORM_SINE, WAVEFORM_EXPO, true>,
+  &Oscillator::RenderTransfer<WAVEFORM_TRIANGLE, WAVEFORM_EXPO, true>,
+  &Oscillator::RenderTransfer<WAVEFORM_EXPO, WAVEFORM_EXPO, true>,
   &Oscillator::RenderFM,
 };
 
@@ -116,12 +117,14 @@ void StateVariableFilter::RenderInit(int16_t resonance) {
 }
 
 void Oscillator::Refresh(int16_t pitch, int16_t timbre_bias, uint16_t gain_bias) {
-  pitch_ = pitch;
   // if (shape_ >= OSC_SHAPE_FM) {
   //   pitch_ += lut_fm_carrier_corrections[shape_ - OSC_SHAPE_FM];
   // }
-  CONSTRAIN(pitch_, 0, kHighestNote - 1);
-  phase_increment_ = ComputePhaseIncrement(pitch_);
+  CONSTRAIN(pitch, 0, kHighestNote - 1);
+  next_pitch_ = pitch;
+  if (!num_held_pitch_blocks_) {
+    UpdatePitch();
+  }
   raw_gain_bias_ = gain_bias;
   raw_timbre_bias_ = timbre_bias;
 }
@@ -130,14 +133,16 @@ int16_t Oscillator::WarpTimbre(int16_t timbre, OscillatorShape shape) const {
   // Limit cutoff range for filtered noise
   if (shape >= OSC_SHAPE_NOISE_NOTCH && shape <= OSC_SHAPE_NOISE_HP) {
     int32_t cutoff_freq = 0x1000 + (timbre >> 1); // 1/8..5/8
-    return Interpolate824(lut_svf_cutoff, cutoff_freq << 17) >> 1;
+    return dac.ScaleToFrameRate(
+        Interpolate824(lut_svf_cutoff, cutoff_freq << 17) >> 1);
   }
 
   // LP filter cutoff tracks pitch
   if (shape >= OSC_SHAPE_LP_PULSE && shape <= OSC_SHAPE_LP_SAW) {
     int32_t cutoff_freq = (pitch_ >> 1) + (timbre >> 1);
     CONSTRAIN(cutoff_freq, 0, 0x7fff);
-    return Interpolate824(lut_svf_cutoff, cutoff_freq << 17) >> 1;
+    return dac.ScaleToFrameRate(
+        Interpolate824(lut_svf_cutoff, cutoff_freq << 17) >> 1);
   }
 
   // Phase distortion modulator tracks pitch
@@ -191,10 +196,10 @@ void Oscillator::set_shape(OscillatorShape new_shape) {
 
   // Remap timbre envelope on the fly so held notes keep an ~equivalent timbre
   int16_t midpoint_timbre = 1 << 14;
-  float old_scale = static_cast<float>(WarpTimbre(midpoint_timbre, shape_));
-  float new_scale = static_cast<float>(WarpTimbre(midpoint_timbre, new_shape));
-  float scaling_factor = new_scale / old_scale;
-  timbre_envelope_.Rescale(scaling_factor);
+  timbre_envelope_.Rescale(
+    WarpTimbre(midpoint_timbre, new_shape),
+    WarpTimbre(midpoint_timbre, shape_)
+  );
 
   shape_ = new_shape;
 
@@ -203,15 +208,7 @@ void Oscillator::set_shape(OscillatorShape new_shape) {
       new_shape <= OSC_SHAPE_EXP_THRU_EXP_BIASED) {
     static const uint8_t slope_factor[] = {1, 2, 3}; // sine, tri, expo
     uint8_t index = new_shape - OSC_SHAPE_SINE_THRU_SINE;
-    transfer_carrier_ = index % 3;
-    transfer_function_ = index / 6;
-    transfer_bias_ = (index % 6) >= 3 ? kTransferAsymmetricBias : 0;
-    transfer_crest_factor_ = slope_factor[transfer_carrier_]
-        * slope_factor[transfer_function_];
-    // Halve max transfer gain when triangle is involved (carrier or transfer)
-    // to compensate for its derivative discontinuities.
-    transfer_gain_shift_ = (transfer_carrier_ == 1 || transfer_function_ == 1)
-        ? 1 : 0;
+    transfer_crest_factor_ = slope_factor[index % 3] * slope_factor[index / 6];
   }
 }
 
@@ -237,26 +234,56 @@ uint32_t Oscillator::ComputePhaseIncrement(int16_t midi_pitch) const {
     num_shifts = std::min(__builtin_clzl(phase_increment), static_cast<int>(-num_shifts));
     phase_increment <<= num_shifts;
   }
-  return phase_increment;
+  return dac.ScaleToFrameRate(phase_increment);
 }
 
-void Oscillator::Render(int16_t* audio_mix) {
-  
-  int16_t timbre_samples[kAudioBlockSize] = {0};
+/* static */
+bool Oscillator::RenderBatch(
+    Oscillator* const* oscillators, uint8_t num_oscillators,
+    int16_t bias, int16_t* audio_mix) {
+  int16_t gain_samples[kMaxBatchedOscillators][kAudioBlockSize];
+  int16_t audio_samples[kMaxBatchedOscillators][kAudioBlockSize];
+  // Silent voices give up their buffers to the next one
+  uint8_t num_sounding = 0;
+  for (uint8_t v = 0; v < num_oscillators; ++v) {
+    num_sounding += oscillators[v]->RenderVoice(
+        gain_samples[num_sounding], audio_samples[num_sounding]);
+  }
+  switch (num_sounding) {
+    case 0: return false;
+    case 1: MixVoices<1>(gain_samples, audio_samples, bias, audio_mix); break;
+    case 2: MixVoices<2>(gain_samples, audio_samples, bias, audio_mix); break;
+    case 3: MixVoices<3>(gain_samples, audio_samples, bias, audio_mix); break;
+    case 4: MixVoices<4>(gain_samples, audio_samples, bias, audio_mix); break;
+  }
+  return true;
+}
+
+// Envelopes and render functions write every sample of the block, so the
+// buffers need no clearing.  A block of zero gain would only scale the
+// waveform to nothing, so it is not rendered: the phase moves on by a block,
+// which keeps unison voices in step, and the voice reports itself silent.
+bool Oscillator::RenderVoice(int16_t* gain_samples, int16_t* audio_samples) {
+  int16_t timbre_samples[kAudioBlockSize];
   int16_t timbre_bias = WarpTimbre(raw_timbre_bias_);
   timbre_envelope_.RenderSamples(timbre_samples, timbre_bias << 16);
 
+  int16_t gain_bias = gain_envelope_.tremolo(raw_gain_bias_);
+  if (
+    gain_envelope_.RenderSamples(gain_samples, gain_bias << 16) &&
+    !gain_samples[0]
+  ) {
+    phase_ += phase_increment_ << kAudioBlockSizeBits;
+    CountHeldPitchBlock();
+    return false;
+  }
+
   uint8_t fn_index = shape_;
   CONSTRAIN(fn_index, 0, OSC_SHAPE_FM);
   RenderFn fn = fn_table_[fn_index];
-  int16_t audio_samples[kAudioBlockSize] = {0};
   (this->*fn)(timbre_samples, audio_samples);
-
-  int16_t gain_samples[kAudioBlockSize] = {0};
-  int16_t gain_bias = gain_envelope_.tremolo(raw_gain_bias_);
-  gain_envelope_.RenderSamples(gain_samples, gain_bias << 16);
-  
-  q15_multiply_accumulate<kAudioBlockSize>(gain_samples, audio_samples, audio_mix);
+  CountHeldPitchBlock();
+  return true;
 }
 
 #define RENDER_CORE(...) \
@@ -537,28 +564,22 @@ inline uint32_t amplify_for_transfer(
   return amped_sample + bias;
 }
 
+template<uint8_t carrier, uint8_t transfer, bool biased>
 void Oscillator::RenderTransfer(int16_t* timbre_samples, int16_t* audio_samples) {
-  uint8_t carrier_index = transfer_carrier_;
-  uint8_t transfer_index = transfer_function_;
-  uint32_t bias = transfer_bias_;
-  uint8_t gain_shift = transfer_gain_shift_;
+  const uint32_t bias = biased ? kTransferAsymmetricBias : 0;
+  // Halve max transfer gain when triangle is involved (carrier or transfer)
+  // to compensate for its derivative discontinuities.
+  const uint8_t gain_shift =
+      (carrier == WAVEFORM_TRIANGLE || transfer == WAVEFORM_TRIANGLE) ? 1 : 0;
   // int16_t prev_raw = prev_transfer_raw_;
   // int16_t prev_avg = prev_transfer_avg_;
   // Cascaded boxcar (triangular window {1/4, 1/2, 1/4}) anti-aliasing:
   // double null at Nyquist, -6dB at Nyquist/2.
   RENDER_PERIODIC(
-    switch (carrier_index) {
-      case 0: this_sample = sine(phase); break;
-      case 1: this_sample = triangle(phase); break;
-      case 2: this_sample = expo(phase); break;
-    }
+    this_sample = waveform<carrier>(phase);
     uint32_t transfer_phase =
         amplify_for_transfer(this_sample, timbre >> gain_shift, bias);
-    switch (transfer_index) {
-      case 0: this_sample = sine(transfer_phase); break;
-      case 1: this_sample = triangle(transfer_phase); break;
-      case 2: this_sample = expo(transfer_phase); break;
-    }
+    this_sample = waveform<transfer>(transfer_phase);
     // int16_t raw = this_sample;
     // int16_t avg = (raw + prev_raw) >> 1;
     // this_sample = (avg + prev_avg) >> 1;
@@ -604,8 +625,8 @@ const uint32_t kPhaseResetPulse[] = {
   0x80000000,
 };
 
+template<uint8_t filter_type>
 void Oscillator::RenderPhaseDistortionPulse(int16_t* timbre_samples, int16_t* audio_samples) {
-  uint8_t filter_type = shape_ - OSC_SHAPE_CZ_PULSE_LP;
   int32_t integrator = pd_square_.integrator;
   RENDER_MODULATED(
     SET_MODULATOR_PHASE_INCREMENT_FROM_TIMBRE;
@@ -636,8 +657,8 @@ void Oscillator::RenderPhaseDistortionPulse(int16_t* timbre_samples, int16_t* au
   pd_square_.integrator = integrator;
 }
 
+template<uint8_t filter_type>
 void Oscillator::RenderPhaseDistortionSaw(int16_t* timbre_samples, int16_t* audio_samples) {
-  uint8_t filter_type = shape_ - OSC_SHAPE_CZ_SAW_LP;
   RENDER_MODULATED(
     SET_MODULATOR_PHASE_INCREMENT_FROM_TIMBRE;
     modulator_phase += modulator_phase_increment;
@@ -670,10 +691,10 @@ void Oscillator::RenderDiracComb(int16_t* timbre_samples, int16_t* audio_samples
   )
 }
 
+template<OscillatorShape shape>
 void Oscillator::RenderFilteredNoise(int16_t* timbre_samples, int16_t* audio_samples) {
   StateVariableFilter svf = svf_;
   svf.RenderInit(pitch_ << 1);
-  OscillatorShape shape = shape_;
   // int32_t scale = Interpolate824(lut_svf_scale, pitch_ << 18);
   // int32_t gain_correction = cutoff > scale ? scale * 32767 / cutoff : 32767;
   RENDER_CORE(
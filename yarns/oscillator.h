@@ -42,8 +42,14 @@
 #include <cstring>
 #include <cstdio>
 
+#if defined(TEST) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace yarns {
 
+const uint8_t kMaxBatchedOscillators = 4;
+
 class StateVariableFilter {
  public:
   void Init();
@@ -119,6 +125,13 @@ enum OscillatorShape {
   OSC_SHAPE_FM,
 };
 
+// Carriers and transfer functions of the transfer shapes.
+enum Waveform {
+  WAVEFORM_SINE,
+  WAVEFORM_TRIANGLE,
+  WAVEFORM_EXPO
+};
+
 class Oscillator {
  public:
   typedef void (Oscillator::*RenderFn)(int16_t* timbre_samples, int16_t* audio_samples);
@@ -132,9 +145,11 @@ class Oscillator {
     gain_envelope_.Init(0);
     timbre_envelope_.Init(0);
     svf_.Init();
-    pitch_ = 60 << 7;
+    pitch_ = next_pitch_ = 60 << 7;
+    num_held_pitch_blocks_ = 0;
     phase_ = 0;
     phase_increment_ = 1;
+    phase_increment_frame_hz_ = 0;
     high_ = false;
     next_sample_ = 0;
     prev_transfer_raw_ = 0;
@@ -150,22 +165,81 @@ class Oscillator {
 
   void set_shape(OscillatorShape shape);
 
-  inline void NoteOn(ADSR& adsr, bool drone, int16_t raw_max_timbre) {
-    gain_envelope_.NoteOn(adsr, drone ? scale_ >> 1 : 0, scale_ >> 1);
-    timbre_envelope_.NoteOn(adsr, 0, WarpTimbre(raw_max_timbre));
+  inline void NoteOn(
+    ADSR& adsr, bool drone, int16_t raw_max_timbre, uint16_t delay
+  ) {
+    gain_envelope_.NoteOn(adsr, drone ? scale_ >> 1 : 0, scale_ >> 1, delay);
+    timbre_envelope_.NoteOn(adsr, 0, WarpTimbre(raw_max_timbre), delay);
+    // Until the block where the onset falls, the previous note's release
+    // keeps its pitch.
+    num_held_pitch_blocks_ = delay >> kAudioBlockSizeBits;
   }
-  inline void NoteOff() {
-    gain_envelope_.NoteOff();
-    timbre_envelope_.NoteOff();
+  inline void NoteOff(uint16_t delay) {
+    gain_envelope_.NoteOff(delay);
+    timbre_envelope_.NoteOff(delay);
   }
   
-  void Render(int16_t* audio_mix);
+  // Renders oscillators that share an output. Waveforms and gains go to
+  // per-voice buffers, then a single pass mixes them onto the bias.  Returns
+  // false, leaving audio_mix untouched, if every voice is silent: the output
+  // is then the bias alone.
+  static bool RenderBatch(
+      Oscillator* const* oscillators, uint8_t num_oscillators,
+      int16_t bias, int16_t* audio_mix);
 
-  static RenderFn fn_table_[];
+  static const RenderFn fn_table_[];
   
  private:
+  // Returns false for a silent block, whose waveform is left unrendered.
+  bool RenderVoice(int16_t* gain_samples, int16_t* audio_samples);
+
+  template<uint8_t num_voices>
+  static void MixVoices(
+      const int16_t (*gain_samples)[kAudioBlockSize],
+      const int16_t (*audio_samples)[kAudioBlockSize],
+      int16_t bias, int16_t* audio_mix) {
+#if defined(TEST) && defined(__SSE2__)
+    // 8 samples per iteration; same rounding and saturation as below.
+    const __m128i bias_32 = _mm_set1_epi32(bias);
+    for (size_t i = 0; i < kAudioBlockSize; i += 8) {
+      __m128i sum_lo = bias_32;
+      __m128i sum_hi = bias_32;
+      for (uint8_t v = 0; v < num_voices; ++v) {
+        __m128i g = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(&gain_samples[v][i]));
+        __m128i a = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(&audio_samples[v][i]));
+        __m128i product_lo = _mm_mullo_epi16(g, a);
+        __m128i product_hi = _mm_mulhi_epi16(g, a);
+        sum_lo = _mm_add_epi32(sum_lo, _mm_srai_epi32(
+            _mm_unpacklo_epi16(product_lo, product_hi), 15));
+        sum_hi = _mm_add_epi32(sum_hi, _mm_srai_epi32(
+            _mm_unpackhi_epi16(product_lo, product_hi), 15));
+      }
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(&audio_mix[i]),
+          _mm_packs_epi32(sum_lo, sum_hi));
+    }
+#else
+    // The M3 has no packed multiplies: accumulate every voice in 32 bits so
+    // the mix is read-free and written once.
+    for (size_t i = 0; i < kAudioBlockSize; ++i) {
+      int32_t sum = bias;
+      for (uint8_t v = 0; v < num_voices; ++v) {
+        sum += gain_samples[v][i] * audio_samples[v][i] >> 15;
+      }
+      audio_mix[i] = Clip16(sum);
+    }
+#endif
+  }
+
+  // Shape variants are template parameters, so that each entry of fn_table_
+  // has its per-sample branches resolved at compile time.
+  template<OscillatorShape shape>
   void RenderFilteredNoise(int16_t* timbre_samples, int16_t* audio_samples);
+  template<uint8_t filter_type>
   void RenderPhaseDistortionPulse(int16_t* timbre_samples, int16_t* audio_samples);
+  template<uint8_t filter_type>
   void RenderPhaseDistortionSaw(int16_t* timbre_samples, int16_t* audio_samples);
   void RenderLPPulse(int16_t* timbre_samples, int16_t* audio_samples);
   void RenderLPSaw(int16_t* timbre_samples, int16_t* audio_samples);
@@ -181,10 +255,28 @@ class Oscillator {
   void RenderDiracComb(int16_t* timbre_samples, int16_t* audio_samples);
   void RenderTanhSine(int16_t* timbre_samples, int16_t* audio_samples);
   void RenderExponentialSine(int16_t* timbre_samples, int16_t* audio_samples);
+  template<uint8_t carrier, uint8_t transfer, bool biased>
   void RenderTransfer(int16_t* timbre_samples, int16_t* audio_samples);
   void RenderFM(int16_t* timbre_samples, int16_t* audio_samples);
   
   uint32_t ComputePhaseIncrement(int16_t midi_pitch) const;
+
+  inline void UpdatePitch() {
+    // Most refreshes find a held note at the same pitch
+    if (next_pitch_ != pitch_ ||
+        dac.frame_hz() != phase_increment_frame_hz_) {
+      pitch_ = next_pitch_;
+      phase_increment_ = ComputePhaseIncrement(pitch_);
+      phase_increment_frame_hz_ = dac.frame_hz();
+    }
+  }
+
+  // Counts down the blocks rendered before the pitch follows the refreshes.
+  inline void CountHeldPitchBlock() {
+    if (num_held_pitch_blocks_ && !--num_held_pitch_blocks_) {
+      UpdatePitch();
+    }
+  }
   
   inline int32_t ThisBlepSample(uint32_t t) const {
     if (t > 65535) {
@@ -228,21 +320,31 @@ class Oscillator {
     return ((phase >> 15) ^ (phase >> 31 ? 0xffff : 0x0000)) - 0x8000;
   }
 
+  template<uint8_t shape>
+  inline int16_t waveform(uint32_t phase) const {
+    switch (shape) {
+      case WAVEFORM_SINE: return sine(phase);
+      case WAVEFORM_TRIANGLE: return triangle(phase);
+      default: return expo(phase);
+    }
+  }
+
   OscillatorShape shape_;
   Envelope gain_envelope_, timbre_envelope_;
   int16_t raw_timbre_bias_;
   uint16_t raw_gain_bias_;
   int16_t pitch_;
+  // Latest refreshed pitch, applied once no block is held
+  int16_t next_pitch_;
+  uint8_t num_held_pitch_blocks_;
 
-  // Calculated from shape, cached to avoid conditionals during render
-  uint8_t transfer_carrier_;
-  uint8_t transfer_function_;
-  uint32_t transfer_bias_;
+  // Calculated from shape, cached for WarpTimbre
   uint8_t transfer_crest_factor_;
-  uint8_t transfer_gain_shift_;
 
   uint32_t phase_;
   uint32_t phase_increment_;
+  // Frame rate phase_increment_ was computed for
+  uint32_t phase_increment_frame_hz_;
   uint32_t modulator_phase_;
   bool high_;
 
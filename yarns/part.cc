@@ -49,12 +49,22 @@ using namespace stmlib;
 using namespace stmlib_midi;
 using namespace std;
 
-void Part::Init() {
+// Offsets a setting of the given resolution by a matrix modulation
+inline int16_t Modulate(
+    int16_t value, int16_t modulation_15, uint8_t bits,
+    int16_t min, int16_t max) {
+  value += modulation_15 >> (15 - bits);
+  CONSTRAIN(value, min, max);
+  return value;
+}
+
+void Part::Init(uint8_t index) {
   manual_keys_.Init();
   arp_keys_.Init();
   mono_allocator_.Init();
   poly_allocator_.Init();
   generated_notes_.Init();
+  swing_lfo_.Init();
   std::fill(
       &active_note_[0],
       &active_note_[kNumMaxVoicesPerPart],
@@ -62,8 +72,9 @@ void Part::Init() {
   num_voices_ = 0;
   polychained_ = false;
   seq_recording_ = false;
+  dirty_voicing_ = 0;
 
-  looper_.Init(this);
+  looper_.Init(this, index);
 
   midi_.channel = 0;
   midi_.min_note = 0;
@@ -111,6 +122,8 @@ void Part::Init() {
   voicing_.env_mod_decay = -32;
   voicing_.env_mod_sustain = 0;
   voicing_.env_mod_release = 32;
+  voicing_.ClearModMatrix();
+  num_mod_routes_ = 0;
 
   seq_.clock_division = 20;
   seq_.gate_length = 3;
@@ -137,6 +150,7 @@ void Part::AllocateVoices(Voice* voice, uint8_t num_voices, bool polychain) {
   poly_allocator_.Reset();
   poly_allocator_.set_size(num_voices_ * (polychain ? 2 : 1));
   TouchVoices();
+  TouchModMatrix();
 }
 
 uint8_t Part::HeldKeysNoteOn(HeldKeys &keys, uint8_t pitch, uint8_t velocity) {
@@ -318,7 +332,18 @@ void Part::PitchBend(uint8_t channel, uint16_t pitch_bend) {
   
   if (seq_recording_ &&
       (pitch_bend > 8192 + 2048 || pitch_bend < 8192 - 2048)) {
-    seq_.step[seq_rec_step_].set_slide(true);
+    SetRecordingStepSlide(true);
+  }
+}
+
+void Part::SetRecordingStepSlide(bool slide) {
+  if (seq_rec_step_ < sequence_.num_steps()) {
+    SequencerStep step = sequence_.step(seq_rec_step_);
+    step.set_slide(slide);
+    sequence_.SetStep(seq_rec_step_, step);
+  } else {
+    // Held until the step is recorded, rather than lengthening the sequence
+    seq_rec_slide_ = slide;
   }
 }
 
@@ -369,6 +394,8 @@ void Part::ClockStep() {
   // The rest of the method is only for the step sequencer and/or arpeggiator
   if (!doing_stepped_stuff()) return;
 
+  // Keeps this step and the next (peeked by ClockStepGateEndings) decoded
+  sequence_.Prefetch(step_counter_);
   SequencerArpeggiatorResult result = BuildNextStepResult(step_counter_);
   arpeggiator_ = result.arpeggiator;
   if (result.note.has_note()) {
@@ -397,12 +424,12 @@ SequencerArpeggiatorResult Part::BuildNextStepResult(uint32_t step_counter) cons
   }
 
   // Advance sequencer and arpeggiator state
-  if (seq_.num_steps) {
-    result.note = BuildSeqStep(step_counter % seq_.num_steps);
+  if (sequence_.num_steps()) {
+    result.note = BuildSeqStep(step_counter % sequence_.num_steps());
   }
   if (midi_.play_mode == PLAY_MODE_ARPEGGIATOR) {
     // If seq-driven and there are no steps, early return
-    if (seq_driven_arp() && !seq_.num_steps) return result;
+    if (seq_driven_arp() && !sequence_.num_steps()) return result;
     if (arp_should_reset_on_step(step_counter)) result.arpeggiator.Reset();
     result = result.arpeggiator.BuildNextResult(*this, arp_keys_, step_counter, result.note);
   }
@@ -458,6 +485,7 @@ void Part::Start() {
     // NOOP if the last step triggered is less than 0 -- can't predict arp states before 0
     for (uint16_t step = 0; step <= last_step_triggered; step++) {
       if (arp_reset_steps && step % arp_reset_steps == 0) arpeggiator_.Reset();
+      sequence_.Prefetch(step);
       SequencerArpeggiatorResult result = BuildNextStepResult(step);
       arpeggiator_ = result.arpeggiator;
     }
@@ -474,11 +502,7 @@ void Part::Start() {
     &looper_note_index_for_generated_note_index_[kNoteStackMapping],
     looper::kNullIndex
   );
-  std::fill(
-    &output_pitch_for_looper_note_[0],
-    &output_pitch_for_looper_note_[kNoteStackMapping],
-    looper::kNullIndex
-  );
+  looper_.ClearOutputPitches();
   generated_notes_.Clear();
 }
 
@@ -514,7 +538,8 @@ void Part::StartRecording() {
     }
   } else {
     seq_rec_step_ = 0;
-    seq_overdubbing_ = seq_.num_steps > 0;
+    seq_rec_slide_ = false;
+    seq_overdubbing_ = sequence_.num_steps() > 0;
   }
 }
 
@@ -526,13 +551,9 @@ void Part::DeleteRecording() {
 }
 
 void Part::DeleteSequence() {
-  std::fill(
-    &seq_.step[0],
-    &seq_.step[kNumSteps],
-    SequencerStep(SEQUENCER_STEP_REST, 0)
-  );
+  sequence_.Clear();
   seq_rec_step_ = 0;
-  seq_.num_steps = 0;
+  seq_rec_slide_ = false;
   seq_overdubbing_ = false;
 }
 
@@ -554,12 +575,15 @@ void Part::StopSequencerArpeggiatorNotes() {
 
 void Part::GeneratedNoteOff(uint8_t pitch) {
   uint8_t generated_note_index = generated_notes_.Find(pitch);
-  uint8_t looper_note_index = looper_note_index_for_generated_note_index_[generated_note_index];
+  uint16_t looper_note_index = looper_note_index_for_generated_note_index_[generated_note_index];
   looper_note_index_for_generated_note_index_[generated_note_index] = looper::kNullIndex;
   generated_notes_.NoteOff(pitch);
   if (looper_in_use()) {
-    if (midi_.play_mode == PLAY_MODE_ARPEGGIATOR) {
-      pitch = output_pitch_for_looper_note_[looper_note_index];
+    if (
+      midi_.play_mode == PLAY_MODE_ARPEGGIATOR &&
+      looper_note_index != looper::kNullIndex
+    ) {
+      pitch = looper_.output_pitch(looper_note_index);
     }
     if (!looper_can_control(pitch)) return;
   } else if (manual_keys_.stack.Find(pitch)) return;
@@ -597,15 +621,15 @@ uint8_t Part::ApplySequencerInputResponse(int16_t pitch, int8_t root_pitch) cons
   return pitch;
 }
 
-const SequencerStep Part::BuildSeqStep(uint8_t step_index) const {
-  const SequencerStep& step = seq_.step[step_index];
+const SequencerStep Part::BuildSeqStep(uint16_t step_index) const {
+  const SequencerStep step = sequence_.step(step_index);
   int16_t note = step.note();
   if (step.has_note()) {
     // When we play a monophonic sequence, we can make the guess that root
     // note = first note.
     // But this is not the case when we are playing several sequences at the
     // same time. In this case, we use root note = 60.
-    int8_t root_note = !has_siblings_ ? seq_.first_note() : kC4;
+    int8_t root_note = !has_siblings_ ? sequence_.first_note() : kC4;
     note = ApplySequencerInputResponse(note, root_note);
   }
   return SequencerStep((0x80 & step.data[0]) | (0x7f & note), step.data[1]);
@@ -615,23 +639,26 @@ void Part::RecordStep(const SequencerStep& step) {
   if (!seq_recording_) return;
 
   if (seq_overwrite_) { DeleteRecording(); }
-  SequencerStep* target = &seq_.step[seq_rec_step_];
-  target->data[0] = step.data[0];
-  target->data[1] |= step.data[1];
-  if (!target->has_note()) target->set_slide(false);
-  ++seq_rec_step_;
-  uint8_t last_step = seq_overdubbing_ ? seq_.num_steps : kNumSteps;
-  // Extend sequence.
-  if (!seq_overdubbing_ && seq_rec_step_ > seq_.num_steps) {
-    seq_.num_steps = seq_rec_step_;
+  SequencerStep target = recording_step_contents();
+  seq_rec_slide_ = false;
+  target.data[0] = step.data[0];
+  target.data[1] |= step.data[1];
+  if (!target.has_note()) target.set_slide(false);
+  // Writing past the end extends the sequence
+  if (!sequence_.SetStep(seq_rec_step_, target) && !seq_overdubbing_) {
+    // No room for more steps: wrap, as at the last step
+    seq_rec_step_ = 0;
+    return;
   }
+  ++seq_rec_step_;
+  uint16_t last_step = seq_overdubbing_ ? sequence_.num_steps() : kMaxNumSteps;
   // Wrap to first step.
   if (seq_rec_step_ >= last_step) {
     seq_rec_step_ = 0;
   }
 }
 
-void Part::LooperPlayNoteOn(uint8_t looper_note_index, uint8_t pitch, uint8_t velocity) {
+void Part::LooperPlayNoteOn(uint16_t looper_note_index, uint8_t pitch, uint8_t velocity) {
   if (!looper_in_use()) return;
   uint8_t generated_note_index = GeneratedNoteOn(pitch, velocity);
   if (!generated_note_index) return;
@@ -647,25 +674,25 @@ void Part::LooperPlayNoteOn(uint8_t looper_note_index, uint8_t pitch, uint8_t ve
       InternalNoteOn(pitch, result.note.velocity(), slide);
       if (slide) {
         // NB: currently impossible (see LooperPlayNoteOff)
-        InternalNoteOff(output_pitch_for_looper_note_[looper_note_index]);
+        InternalNoteOff(looper_.output_pitch(looper_note_index));
       }
-      output_pitch_for_looper_note_[looper_note_index] = pitch;
-    } //  else if tie, output_pitch_for_looper_note_ is already set to the tied pitch
+      looper_.set_output_pitch(looper_note_index, pitch);
+    } //  else if tie, the looper note's output pitch is already set to the tied pitch
   } else if (looper_can_control(pitch)) {
     InternalNoteOn(pitch, velocity);
-    output_pitch_for_looper_note_[looper_note_index] = pitch;
+    looper_.set_output_pitch(looper_note_index, pitch);
   }
 }
 
-void Part::LooperPlayNoteOff(uint8_t looper_note_index, uint8_t pitch) {
+void Part::LooperPlayNoteOff(uint16_t looper_note_index, uint8_t pitch) {
   if (!looper_in_use()) { return; }
   looper_note_index_for_generated_note_index_[generated_notes_.NoteOff(pitch)] = looper::kNullIndex;
-  pitch = output_pitch_for_looper_note_[looper_note_index];
-  if (pitch == looper::kNullIndex) { return; }
-  output_pitch_for_looper_note_[looper_note_index] = looper::kNullIndex;
+  pitch = looper_.output_pitch(looper_note_index);
+  if (pitch == looper::kNoOutputPitch) { return; }
+  looper_.set_output_pitch(looper_note_index, looper::kNoOutputPitch);
   if (midi_.play_mode == PLAY_MODE_ARPEGGIATOR) {
     // Peek at next looper note
-    uint8_t next_on_index = looper_.PeekNextOn();
+    uint16_t next_on_index = looper_.PeekNextOn();
     const looper::Note& next_on_note = looper_.note_at(next_on_index);
     SequencerStep next_step = SequencerStep(next_on_note.pitch, next_on_note.velocity);
     // Predicting whether the looper will have looped around by this next note
@@ -681,7 +708,7 @@ void Part::LooperPlayNoteOff(uint8_t looper_note_index, uint8_t pitch) {
       // NB: currently impossible, since the arp can only return a
       // continuation when driven by an input sequencer note that is a
       // continuation, which the looper can't do
-      output_pitch_for_looper_note_[next_on_index] = pitch;
+      looper_.set_output_pitch(next_on_index, pitch);
     } else {
       InternalNoteOff(pitch);
     }
@@ -693,14 +720,15 @@ void Part::LooperPlayNoteOff(uint8_t looper_note_index, uint8_t pitch) {
 void Part::LooperRecordNoteOn(uint8_t pressed_key_index) {
   if (seq_overwrite_) { DeleteRecording(); }
   const stmlib::NoteEntry& e = manual_keys_.stack.note(pressed_key_index);
-  uint8_t looper_note_index = looper_.RecordNoteOn(e.note, e.velocity & 0x7f);
+  uint16_t looper_note_index = looper_.RecordNoteOn(e.note, e.velocity & 0x7f);
+  if (looper_note_index == looper::kNullIndex) { return; } // Pool exhausted
   looper_note_recording_pressed_key_[pressed_key_index] = looper_note_index;
   LooperPlayNoteOn(looper_note_index, e.note, e.velocity & 0x7f);
 }
 
 void Part::LooperRecordNoteOff(uint8_t pressed_key_index) {
   const stmlib::NoteEntry& e = manual_keys_.stack.note(pressed_key_index);
-  uint8_t looper_note_index = looper_note_recording_pressed_key_[pressed_key_index];
+  uint16_t looper_note_index = looper_note_recording_pressed_key_[pressed_key_index];
   if (looper_.RecordNoteOff(looper_note_index)) {
     LooperPlayNoteOff(looper_note_index, e.note);
   }
@@ -793,8 +821,24 @@ void Part::VoiceNoteOn(
   uint8_t voice_index, uint8_t pitch, uint8_t vel,
   bool legato, bool reset_gate_counter
 ) {
+  Voice* voice = voice_[voice_index];
+  if (num_mod_routes_) {
+    voice->set_mod_velocity(vel);
+    voice->RefreshModMatrix(mod_routes_, num_mod_routes_);
+  }
+
   uint8_t portamento = legato || !voicing_.portamento_legato_only ?
     voicing_.portamento : 0;
+  if (portamento) {
+    // Lengthen or shorten the glide, keeping its shape
+    uint8_t split_point = LUT_PORTAMENTO_INCREMENTS_SIZE;
+    bool rate = portamento > split_point;
+    int16_t amount = rate ? portamento - split_point : split_point - portamento;
+    amount = Modulate(
+        amount, voice->mod_matrix(MOD_DESTINATION_PORTAMENTO), 6,
+        0, split_point - 1);
+    portamento = rate ? split_point + amount : split_point - amount;
+  }
   bool trigger = !legato || voicing_.legato_retrigger;
 
   // If this pitch is under manual control, don't extend the gate
@@ -802,7 +846,6 @@ void Part::VoiceNoteOn(
     gate_length_counter_[voice_index] = gate_length();
   }
   active_note_[voice_index] = pitch;
-  Voice* voice = voice_[voice_index];
 
   int32_t timbre_14 = (voicing_.timbre_mod_envelope << 7) + vel * voicing_.timbre_mod_velocity;
   CONSTRAIN(timbre_14, -1 << 13, (1 << 13) - 1)
@@ -815,20 +858,35 @@ void Part::VoiceNoteOn(
 
   ADSR adsr;
   adsr.peak = UINT16_MAX - (damping_22 >> (22 - 16));
-  adsr.sustain = modulate_7_13(voicing_.env_init_sustain, voicing_.env_mod_sustain, vel) << (16 - 13);
+  adsr.sustain = Modulate(
+    modulate_7_13(voicing_.env_init_sustain, voicing_.env_mod_sustain, vel),
+    voice->mod_matrix(MOD_DESTINATION_SUSTAIN), 13, 0, (1 << 13) - 1
+  ) << (16 - 13);
   // NB: this LUT only has 128 values, so we use a 15-bit index
   adsr.attack   = Interpolate88(
     lut_envelope_phase_increments,
-    modulate_7_13(voicing_.env_init_attack  , voicing_.env_mod_attack , vel) << (15 - 13)
+    Modulate(
+      modulate_7_13(voicing_.env_init_attack  , voicing_.env_mod_attack , vel),
+      voice->mod_matrix(MOD_DESTINATION_ATTACK), 13, 0, (1 << 13) - 1
+    ) << (15 - 13)
   );
   adsr.decay    = Interpolate88(
     lut_envelope_phase_increments,
-    modulate_7_13(voicing_.env_init_decay   , voicing_.env_mod_decay  , vel) << (15 - 13)
+    Modulate(
+      modulate_7_13(voicing_.env_init_decay   , voicing_.env_mod_decay  , vel),
+      voice->mod_matrix(MOD_DESTINATION_DECAY), 13, 0, (1 << 13) - 1
+    ) << (15 - 13)
   );
   adsr.release  = Interpolate88(
     lut_envelope_phase_increments,
-    modulate_7_13(voicing_.env_init_release , voicing_.env_mod_release, vel) << (15 - 13)
+    Modulate(
+      modulate_7_13(voicing_.env_init_release , voicing_.env_mod_release, vel),
+      voice->mod_matrix(MOD_DESTINATION_RELEASE), 13, 0, (1 << 13) - 1
+    ) << (15 - 13)
   );
+  adsr.attack = dac.ScaleToFrameRate(adsr.attack);
+  adsr.decay = dac.ScaleToFrameRate(adsr.decay);
+  adsr.release = dac.ScaleToFrameRate(adsr.release);
 
   voice->NoteOn(Tune(pitch), vel, portamento, trigger, adsr, timbre_14 << 2);
 }
@@ -851,8 +909,12 @@ void Part::InternalNoteOn(uint8_t note, uint8_t velocity, bool force_legato) {
     // If a previous note was a sequencer step tie/slide, it will have skipped
     // its normal ending, so we end all generated notes except the new note
     for (uint8_t i = 1; i <= generated_notes_.max_size(); ++i) {
-      if (generated_notes_.note(i).note != after.note) {
-        GeneratedNoteOff(generated_notes_.note(i).note);
+      uint8_t generated_note = generated_notes_.note(i).note;
+      if (
+        generated_note != after.note &&
+        generated_note != NOTE_STACK_FREE_SLOT
+      ) {
+        GeneratedNoteOff(generated_note);
       }
     }
     // Check if the note that has been played should be triggered according
@@ -944,7 +1006,7 @@ void Part::InternalNoteOff(uint8_t note) {
     midi_handler.OnInternalNoteOff(tx_channel(), note);
   }
   
-  if (voicing_.tuning_system == TUNING_SYSTEM_JUST_INTONATION) {
+  if (uses_just_intonation()) {
     just_intonation_processor.NoteOff(note);
   }
   
@@ -1003,31 +1065,158 @@ void Part::TouchVoiceAllocation() {
   ResetAllControllers();
 }
 
+// Bit of a voicing setting in dirty_voicing_
+static inline uint32_t VoicingField(uint8_t address) {
+  return 1UL << (address - PART_VOICING_ALLOCATION_MODE);
+}
+
+STATIC_ASSERT(
+  PART_VOICING_TIMBRE_MOD_LFO - PART_VOICING_ALLOCATION_MODE < 32,
+  voicing_fields_fit_in_a_word
+);
+
 void Part::TouchVoices() {
+  for (uint8_t i = 0; i < num_voices_; ++i) {
+    voice_[i]->garbage(0);
+  }
+  dirty_voicing_ = 0;
+  PushVoicing(0xffffffff);
+}
+
+// Runs in the 4 kHz refresh, so that a burst of changes reaches the voices
+// once.  A change made while this runs is at worst passed on twice.
+void Part::RefreshVoicing() {
+  uint32_t fields = dirty_voicing_;
+  if (!fields) return;
+  dirty_voicing_ = 0;
+  PushVoicing(fields);
+}
+
+void Part::TouchVoiceField(uint8_t address) {
+  dirty_voicing_ |= VoicingField(address);
+}
+
+void Part::PushVoicing(uint32_t fields) {
   CONSTRAIN(voicing_.aux_cv, 0, MOD_AUX_LAST - 1);
   CONSTRAIN(voicing_.aux_cv_2, 0, MOD_AUX_LAST - 1);
+  const uint32_t tuning = VoicingField(PART_VOICING_TUNING_TRANSPOSE) |
+      VoicingField(PART_VOICING_TUNING_FINE);
   for (uint8_t i = 0; i < num_voices_; ++i) {
-    voice_[i]->garbage(0);
-    voice_[i]->set_pitch_bend_range(voicing_.pitch_bend_range);
-    voice_[i]->set_vibrato_range(voicing_.vibrato_range);
-    voice_[i]->set_vibrato_mod(voicing_.vibrato_mod);
-    voice_[i]->set_tremolo_mod(voicing_.tremolo_mod);
-    voice_[i]->set_lfo_shape(LFO_ROLE_PITCH, voicing_.vibrato_shape);
-    voice_[i]->set_lfo_shape(LFO_ROLE_TIMBRE, voicing_.timbre_lfo_shape);
-    voice_[i]->set_lfo_shape(LFO_ROLE_AMPLITUDE, voicing_.tremolo_shape);
-    voice_[i]->set_trigger_duration(voicing_.trigger_duration);
-    voice_[i]->set_trigger_scale(voicing_.trigger_scale);
-    voice_[i]->set_trigger_shape(voicing_.trigger_shape);
-    voice_[i]->set_aux_cv(voicing_.aux_cv);
-    voice_[i]->set_aux_cv_2(voicing_.aux_cv_2);
-    voice_[i]->set_oscillator_mode(voicing_.oscillator_mode);
-    voice_[i]->set_oscillator_shape(voicing_.oscillator_shape);
-    voice_[i]->set_tuning(voicing_.tuning_transpose, voicing_.tuning_fine);
-    voice_[i]->set_timbre_init(voicing_.timbre_initial);
-    voice_[i]->set_timbre_mod_lfo(voicing_.timbre_mod_lfo);
+    Voice* voice = voice_[i];
+    if (fields & VoicingField(PART_VOICING_PITCH_BEND_RANGE)) {
+      voice->set_pitch_bend_range(voicing_.pitch_bend_range);
+    }
+    if (fields & VoicingField(PART_VOICING_VIBRATO_RANGE)) {
+      voice->set_vibrato_range(voicing_.vibrato_range);
+    }
+    if (fields & VoicingField(PART_VOICING_VIBRATO_MOD)) {
+      voice->set_vibrato_mod(voicing_.vibrato_mod);
+    }
+    if (fields & VoicingField(PART_VOICING_TREMOLO_MOD)) {
+      voice->set_tremolo_mod(voicing_.tremolo_mod);
+    }
+    if (fields & VoicingField(PART_VOICING_VIBRATO_SHAPE)) {
+      voice->set_lfo_shape(LFO_ROLE_PITCH, voicing_.vibrato_shape);
+    }
+    if (fields & VoicingField(PART_VOICING_TIMBRE_LFO_SHAPE)) {
+      voice->set_lfo_shape(LFO_ROLE_TIMBRE, voicing_.timbre_lfo_shape);
+    }
+    if (fields & VoicingField(PART_VOICING_TREMOLO_SHAPE)) {
+      voice->set_lfo_shape(LFO_ROLE_AMPLITUDE, voicing_.tremolo_shape);
+    }
+    if (fields & VoicingField(PART_VOICING_TRIGGER_DURATION)) {
+      voice->set_trigger_duration(voicing_.trigger_duration);
+    }
+    if (fields & VoicingField(PART_VOICING_TRIGGER_SCALE)) {
+      voice->set_trigger_scale(voicing_.trigger_scale);
+    }
+    if (fields & VoicingField(PART_VOICING_TRIGGER_SHAPE)) {
+      voice->set_trigger_shape(voicing_.trigger_shape);
+    }
+    if (fields & VoicingField(PART_VOICING_AUX_CV)) {
+      voice->set_aux_cv(voicing_.aux_cv);
+    }
+    if (fields & VoicingField(PART_VOICING_AUX_CV_2)) {
+      voice->set_aux_cv_2(voicing_.aux_cv_2);
+    }
+    if (fields & VoicingField(PART_VOICING_OSCILLATOR_MODE)) {
+      voice->set_oscillator_mode(voicing_.oscillator_mode);
+    }
+    if (fields & VoicingField(PART_VOICING_OSCILLATOR_SHAPE)) {
+      voice->set_oscillator_shape(voicing_.oscillator_shape);
+    }
+    if (fields & tuning) {
+      voice->set_tuning(voicing_.tuning_transpose, voicing_.tuning_fine);
+    }
+    if (fields & VoicingField(PART_VOICING_TIMBRE_INIT)) {
+      voice->set_timbre_init(voicing_.timbre_initial);
+    }
+    if (fields & VoicingField(PART_VOICING_TIMBRE_MOD_LFO)) {
+      voice->set_timbre_mod_lfo(voicing_.timbre_mod_lfo);
+    }
+  }
+}
+
+STATIC_ASSERT(
+  MOD_SOURCE_LFO - MOD_SOURCE_VELOCITY == MOD_AUX_FULL_LFO - MOD_AUX_VELOCITY,
+  mod_sources_are_mod_aux
+);
+
+// Compiles the slots into routes grouped by destination, so that the refresh
+// costs at most one multiply per slot and one store per destination
+void Part::TouchModMatrix() {
+  num_mod_routes_ = 0;
+  for (uint8_t d = 0; d < MOD_DESTINATION_LAST; ++d) {
+    for (uint8_t i = 0; i < kNumModSlots; ++i) {
+      const ModSlot& slot = voicing_.mod_slot[i];
+      if (slot.destination != d || !slot.depth) continue;
+      if (slot.source == MOD_SOURCE_OFF || slot.source >= MOD_SOURCE_LAST) {
+        continue;
+      }
+      ModRoute& route = mod_routes_[num_mod_routes_++];
+      route.mod_aux = MOD_AUX_VELOCITY + slot.source - MOD_SOURCE_VELOCITY;
+      route.destination = d;
+      route.depth = slot.depth;
+      // Bend and the LFOs swing both ways around their center
+      route.center = slot.source >= MOD_SOURCE_BEND ? 32768 : 0;
+    }
+  }
+  for (uint8_t i = 0; i < num_voices_; ++i) {
+    voice_[i]->ClearModMatrix();
   }
 }
 
+void Part::RefreshModMatrix() {
+  if (!num_mod_routes_) return;
+  for (uint8_t i = 0; i < num_voices_; ++i) {
+    voice_[i]->RefreshModMatrix(mod_routes_, num_mod_routes_);
+  }
+}
+
+// Sequencer and LFO destinations follow the first voice
+int16_t Part::part_mod_matrix(ModDestination d) const {
+  return num_mod_routes_ ? voice_[0]->mod_matrix(d) : 0;
+}
+
+uint8_t Part::gate_length() const {
+  return Modulate(
+      seq_.gate_length, part_mod_matrix(MOD_DESTINATION_GATE_LENGTH), 6,
+      0, 63) + 1;
+}
+
+uint8_t Part::arp_range() const {
+  return Modulate(
+      seq_.arp_range, part_mod_matrix(MOD_DESTINATION_ARP_RANGE), 2, 0, 3);
+}
+
+uint8_t Part::lfo_rate() const {
+  // Stay synced, or free-running, like the setting
+  uint8_t min = voicing_.lfo_rate < 64 ? 0 : 64;
+  return Modulate(
+      voicing_.lfo_rate, part_mod_matrix(MOD_DESTINATION_LFO_RATE), 6,
+      min, min + 63);
+}
+
 bool Part::Set(uint8_t address, uint8_t value) {
   uint8_t* bytes;
   bytes = static_cast<uint8_t*>(static_cast<void*>(&midi_));
@@ -1059,7 +1248,6 @@ bool Part::Set(uint8_t address, uint8_t value) {
       break;
       
     case PART_VOICING_PITCH_BEND_RANGE:
-    case PART_VOICING_LFO_RATE:
     case PART_VOICING_VIBRATO_RANGE:
     case PART_VOICING_VIBRATO_MOD:
     case PART_VOICING_TREMOLO_MOD:
@@ -1076,7 +1264,22 @@ bool Part::Set(uint8_t address, uint8_t value) {
     case PART_VOICING_TIMBRE_MOD_LFO:
     case PART_VOICING_TUNING_TRANSPOSE:
     case PART_VOICING_TUNING_FINE:
-      TouchVoices();
+      TouchVoiceField(address);
+      break;
+
+    case PART_VOICING_MOD_1_SOURCE:
+    case PART_VOICING_MOD_1_DESTINATION:
+    case PART_VOICING_MOD_1_DEPTH:
+    case PART_VOICING_MOD_2_SOURCE:
+    case PART_VOICING_MOD_2_DESTINATION:
+    case PART_VOICING_MOD_2_DEPTH:
+    case PART_VOICING_MOD_3_SOURCE:
+    case PART_VOICING_MOD_3_DESTINATION:
+    case PART_VOICING_MOD_3_DEPTH:
+    case PART_VOICING_MOD_4_SOURCE:
+    case PART_VOICING_MOD_4_DESTINATION:
+    case PART_VOICING_MOD_4_DEPTH:
+      TouchModMatrix();
       break;
       
     case PART_SEQUENCER_ARP_DIRECTION:
@@ -1098,7 +1301,7 @@ bool Part::Set(uint8_t address, uint8_t value) {
 
     case PART_VOICING_OSCILLATOR_MODE:
       AllNotesOff();
-      TouchVoices();
+      TouchVoiceField(address);
       break;
 
     default:
@@ -1108,14 +1311,22 @@ bool Part::Set(uint8_t address, uint8_t value) {
 }
 
 void Part::Pack(PackedPart& packed) const {
-  looper_.Pack(packed);
-  midi_.Pack(packed);
+  // The modulation matrix goes first.  The looper then leaves the sequence
+  // the note slots it doesn't need, next to the step slots.
   voicing_.Pack(packed);
+  looper_.Pack(packed, packed_looper_capacity());
+  midi_.Pack(packed);
   seq_.Pack(packed);
+  sequence_.Pack(packed, seq_.step_offset);
 }
 
-void Part::Unpack(PackedPart& packed) {
+void Part::Unpack(PackedPart& packed, const uint8_t* sequence_tail) {
   looper_.Unpack(packed);
+  sequence_.Unpack(packed, sequence_tail);
+  UnpackSettings(packed);
+}
+
+void Part::UnpackSettings(PackedPart& packed) {
   midi_.Unpack(packed);
   voicing_.Unpack(packed);
   seq_.Unpack(packed);
@@ -1127,8 +1338,13 @@ void Part::AfterDeserialize() {
   CONSTRAIN(seq_.loop_length, 0, 7);
   CONSTRAIN(seq_.arp_range, 0, 3);
   CONSTRAIN(seq_.arp_direction, 0, ARPEGGIATOR_DIRECTION_LAST - 1);
+  for (uint8_t i = 0; i < kNumModSlots; ++i) {
+    CONSTRAIN(voicing_.mod_slot[i].source, 0, MOD_SOURCE_LAST - 1);
+    CONSTRAIN(voicing_.mod_slot[i].destination, 0, MOD_DESTINATION_LAST - 1);
+  }
   AllNotesOff();
   TouchVoices();
+  TouchModMatrix();
   TouchVoiceAllocation();
   ResetAllKeys();
 }
@@ -1160,6 +1376,9 @@ int16_t Part::Tune(int16_t midi_note) {
   // Just intonation.
   if (voicing_.tuning_system == TUNING_SYSTEM_JUST_INTONATION) {
     pitch = just_intonation_processor.NoteOn(note);
+  } else if (voicing_.tuning_system == TUNING_SYSTEM_JUST_INTONATION_CHORDS) {
+    pitch = just_intonation_processor.NoteOn(note, true);
+    multi.RetuneJustIntonationChord();
   } else if (voicing_.tuning_system == TUNING_SYSTEM_CUSTOM) {
     pitch += custom_pitch_table_[pitch_class];
   } else if (voicing_.tuning_system > TUNING_SYSTEM_JUST_INTONATION) {
@@ -1168,7 +1387,19 @@ int16_t Part::Tune(int16_t midi_note) {
     pitch += lookup_table_signed_table[LUT_SCALE_PYTHAGOREAN + \
         voicing_.tuning_system - TUNING_SYSTEM_PYTHAGOREAN][pitch_class];
   }
-  
+  return ScaleTunedPitch(pitch);
+}
+
+void Part::Retune(uint8_t note, int16_t pitch) {
+  if (voicing_.tuning_system != TUNING_SYSTEM_JUST_INTONATION_CHORDS) return;
+  for (uint8_t v = 0; v < num_voices_; ++v) {
+    if (active_note_[v] == note) {
+      voice_[v]->Retune(ScaleTunedPitch(pitch));
+    }
+  }
+}
+
+int16_t Part::ScaleTunedPitch(int16_t pitch) const {
   int32_t root = (static_cast<int32_t>(voicing_.tuning_root) + 60) << 7;
   int32_t scaled_pitch = static_cast<int32_t>(pitch);
   scaled_pitch -= root;
@@ -40,12 +40,14 @@
 #include "yarns/drivers/dac.h"
 #include "yarns/looper.h"
 #include "yarns/sequencer_step.h"
+#include "yarns/step_sequence.h"
 #include "yarns/arpeggiator.h"
 
 namespace yarns {
 
 class Voice;
 
+// Steps that fit in the step slots of a PackedPart
 const uint8_t kNumSteps = 30;
 
 const uint8_t kNumParaphonicVoices = 4;
@@ -105,6 +107,7 @@ enum TuningSystem {
   TUNING_SYSTEM_RAGA_1,
   TUNING_SYSTEM_RAGA_27 = TUNING_SYSTEM_RAGA_1 + 26,
   TUNING_SYSTEM_CUSTOM,
+  TUNING_SYSTEM_JUST_INTONATION_CHORDS,
   TUNING_SYSTEM_LAST
 };
 
@@ -134,6 +137,51 @@ enum SustainMode {
   SUSTAIN_MODE_LAST,
 };
 
+// Sources of the modulation matrix.  All but OFF are voice modulations that
+// can also drive the aux CV outputs (see ModAux).
+enum ModSource {
+  MOD_SOURCE_OFF,
+  MOD_SOURCE_VELOCITY,
+  MOD_SOURCE_MODULATION,
+  MOD_SOURCE_AFTERTOUCH,
+  MOD_SOURCE_BREATH,
+  MOD_SOURCE_PEDAL,
+  MOD_SOURCE_BEND,
+  MOD_SOURCE_VIBRATO_LFO,
+  MOD_SOURCE_LFO,
+  MOD_SOURCE_LAST
+};
+
+enum ModDestination {
+  MOD_DESTINATION_TIMBRE,
+  MOD_DESTINATION_ATTACK,
+  MOD_DESTINATION_DECAY,
+  MOD_DESTINATION_SUSTAIN,
+  MOD_DESTINATION_RELEASE,
+  MOD_DESTINATION_PORTAMENTO,
+  MOD_DESTINATION_LFO_RATE,
+  MOD_DESTINATION_GATE_LENGTH,
+  MOD_DESTINATION_ARP_RANGE,
+  MOD_DESTINATION_LAST
+};
+
+const uint8_t kNumModSlots = 4;
+
+struct ModSlot {
+  uint8_t source;
+  uint8_t destination;
+  int8_t depth;
+};
+
+// A matrix slot compiled for the refresh: the voice modulation to read, and
+// the value it has at rest
+struct ModRoute {
+  uint8_t mod_aux;
+  uint8_t destination;
+  int8_t depth;
+  uint16_t center;
+};
+
 typedef SyncedLFO<15, 9> FastSyncedLFO; // Locks on in less than a second
 
 struct SequencerArpeggiatorResult { // Supports multiple return
@@ -141,8 +189,22 @@ struct SequencerArpeggiatorResult { // Supports multiple return
   SequencerStep note; // Resulting note, including possible rest/tie
 };
 
+// A modulation matrix slot, as stored in the last looper note slots of a
+// PackedPart whose mod_matrix bit is set
+struct PackedModSlot {
+  uint8_t
+    source : 4, // values free: 7
+    destination : 4; // values free: 6
+  int8_t depth;
+}__attribute__((packed));
+
+// Looper note slots taken by a stored modulation matrix
+const uint8_t kPackedModMatrixNotes = (
+    kNumModSlots * sizeof(PackedModSlot) + sizeof(looper::PackedNote) - 1) /
+    sizeof(looper::PackedNote);
+
 struct PackedPart {
-  // Currently has 7 bits to spare
+  // Currently has 6 bits to spare
 
   struct PackedSequencerStep {
     unsigned int
@@ -151,7 +213,7 @@ struct PackedPart {
   }__attribute__((packed));
   PackedSequencerStep sequencer_steps[kNumSteps];
 
-  looper::PackedNote looper_notes[looper::kMaxNotes];
+  looper::PackedNote looper_notes[looper::kMaxPackedNotes];
   unsigned int
     looper_oldest_index : looper::kBitsNoteIndex,
     looper_size         : looper::kBitsNoteIndex;
@@ -200,7 +262,7 @@ struct PackedPart {
     vibrato_mod : 7,
     lfo_rate : 7, // values free: 0
     tuning_root : 4, // values free: 4
-    tuning_system : 6, // values free: 30
+    tuning_system : 6, // values free: 29
     trigger_duration : 7, // Breaking: probably excessive
     trigger_scale : 1,
     trigger_shape : 3, // values free: 2
@@ -229,10 +291,19 @@ struct PackedPart {
     arp_pattern : 5, // values free: 0
     euclidean_length : 5, // values free: 0
     euclidean_fill : 5, // values free: 0
-    step_offset : 5, // values free: 2 (see kNumSteps)
-    num_steps : 5, // values free: 1
+    step_offset : 5, // values free: 0 (wider offsets use kPackedStepsExtended)
+    num_steps : 5, // values free: 0 (see kPackedStepsExtended)
     clock_quantization : 1,
-    loop_length : 3; // values free: 0
+    loop_length : 3, // values free: 0
+    mod_matrix : 1;
+
+  // Looper note slots left to the notes by the modulation matrix
+  inline uint8_t looper_capacity() const {
+    return looper::kMaxPackedNotes - (mod_matrix ? kPackedModMatrixNotes : 0);
+  }
+  inline PackedModSlot* mod_slots() {
+    return reinterpret_cast<PackedModSlot*>(&looper_notes[looper_capacity()]);
+  }
 
 }__attribute__((packed));
 
@@ -321,7 +392,9 @@ struct VoicingSettings {
   int8_t env_mod_decay;
   int8_t env_mod_sustain;
   int8_t env_mod_release;
-  // uint8_t padding[-2];
+  // Stored in PackedPart only if a slot is in use
+  ModSlot mod_slot[kNumModSlots];
+  // uint8_t padding[-14];
 
   void Pack(PackedPart& packed) const {
     packed.allocation_mode = allocation_mode;
@@ -364,6 +437,16 @@ struct VoicingSettings {
     packed.env_mod_decay = env_mod_decay;
     packed.env_mod_sustain = env_mod_sustain;
     packed.env_mod_release = env_mod_release;
+    // Ahead of the looper notes, which take the slots the matrix leaves
+    packed.mod_matrix = mod_matrix_in_use();
+    if (packed.mod_matrix) {
+      PackedModSlot* slots = packed.mod_slots();
+      for (uint8_t i = 0; i < kNumModSlots; ++i) {
+        slots[i].source = mod_slot[i].source;
+        slots[i].destination = mod_slot[i].destination;
+        slots[i].depth = mod_slot[i].depth;
+      }
+    }
   }
 
   void Unpack(PackedPart& packed) {
@@ -407,6 +490,30 @@ struct VoicingSettings {
     env_mod_decay = packed.env_mod_decay;
     env_mod_sustain = packed.env_mod_sustain;
     env_mod_release = packed.env_mod_release;
+    ClearModMatrix();
+    if (packed.mod_matrix) {
+      const PackedModSlot* slots = packed.mod_slots();
+      for (uint8_t i = 0; i < kNumModSlots; ++i) {
+        mod_slot[i].source = slots[i].source;
+        mod_slot[i].destination = slots[i].destination;
+        mod_slot[i].depth = slots[i].depth;
+      }
+    }
+  }
+
+  bool mod_matrix_in_use() const {
+    for (uint8_t i = 0; i < kNumModSlots; ++i) {
+      if (mod_slot[i].source != MOD_SOURCE_OFF) return true;
+    }
+    return false;
+  }
+
+  void ClearModMatrix() {
+    for (uint8_t i = 0; i < kNumModSlots; ++i) {
+      mod_slot[i].source = MOD_SOURCE_OFF;
+      mod_slot[i].destination = MOD_DESTINATION_TIMBRE;
+      mod_slot[i].depth = 0;
+    }
   }
 
 };
@@ -465,6 +572,18 @@ enum PartSetting {
   PART_VOICING_ENV_MOD_DECAY,
   PART_VOICING_ENV_MOD_SUSTAIN,
   PART_VOICING_ENV_MOD_RELEASE,
+  PART_VOICING_MOD_1_SOURCE,
+  PART_VOICING_MOD_1_DESTINATION,
+  PART_VOICING_MOD_1_DEPTH,
+  PART_VOICING_MOD_2_SOURCE,
+  PART_VOICING_MOD_2_DESTINATION,
+  PART_VOICING_MOD_2_DEPTH,
+  PART_VOICING_MOD_3_SOURCE,
+  PART_VOICING_MOD_3_DESTINATION,
+  PART_VOICING_MOD_3_DEPTH,
+  PART_VOICING_MOD_4_SOURCE,
+  PART_VOICING_MOD_4_DESTINATION,
+  PART_VOICING_MOD_4_DEPTH,
   PART_VOICING_LAST = PART_VOICING_ALLOCATION_MODE + sizeof(VoicingSettings) - 1,
   PART_SEQUENCER_CLOCK_DIVISION,
   PART_SEQUENCER_GATE_LENGTH,
@@ -474,7 +593,7 @@ enum PartSetting {
   PART_SEQUENCER_EUCLIDEAN_LENGTH,
   PART_SEQUENCER_EUCLIDEAN_FILL,
   PART_SEQUENCER_STEP_OFFSET,
-  PART_SEQUENCER_NUM_STEPS,
+  PART_SEQUENCER_NUM_STEPS, // Unused, the sequence holds its length
   PART_SEQUENCER_CLOCK_QUANTIZATION,
   PART_SEQUENCER_LOOP_LENGTH,
 };
@@ -489,21 +608,13 @@ struct SequencerSettings {
   uint8_t euclidean_length;
   uint8_t euclidean_fill;
   uint8_t step_offset;
-  uint8_t num_steps;
+  uint8_t num_steps_unused;
   uint8_t clock_quantization;
   uint8_t loop_length;
   uint8_t padding_fields[5];
 
-  SequencerStep step[kNumSteps];
-  uint8_t padding_steps[2];
-
+  // The steps and the step offset are packed by StepSequence::Pack
   void Pack(PackedPart& packed) const {
-    for (uint8_t i = 0; i < kNumSteps; i++) {
-      PackedPart::PackedSequencerStep& packed_step = packed.sequencer_steps[i];
-      packed_step.pitch = step[i].data[0];
-      packed_step.velocity = step[i].data[1];
-    }
-
     packed.clock_division = clock_division;
     packed.gate_length = gate_length;
     packed.arp_range = arp_range;
@@ -511,19 +622,11 @@ struct SequencerSettings {
     packed.arp_pattern = arp_pattern;
     packed.euclidean_length = euclidean_length;
     packed.euclidean_fill = euclidean_fill;
-    packed.step_offset = step_offset;
-    packed.num_steps = num_steps;
     packed.clock_quantization = clock_quantization;
     packed.loop_length = loop_length;
   }
 
   void Unpack(PackedPart& packed) {
-    for (uint8_t i = 0; i < kNumSteps; i++) {
-      PackedPart::PackedSequencerStep& packed_step = packed.sequencer_steps[i];
-      step[i].data[0] = packed_step.pitch;
-      step[i].data[1] = packed_step.velocity;
-    }
-
     clock_division = packed.clock_division;
     gate_length = packed.gate_length;
     arp_range = packed.arp_range;
@@ -531,20 +634,10 @@ struct SequencerSettings {
     arp_pattern = packed.arp_pattern;
     euclidean_length = packed.euclidean_length;
     euclidean_fill = packed.euclidean_fill;
-    step_offset = packed.step_offset;
-    num_steps = packed.num_steps;
+    step_offset = StepSequence::UnpackStepOffset(packed);
     clock_quantization = packed.clock_quantization;
     loop_length = packed.loop_length;
   }
-  
-  int16_t first_note() const {
-    for (uint8_t i = 0; i < num_steps; ++i) {
-      if (step[i].has_note()) {
-        return step[i].note();
-      }
-    }
-    return kC4;
-  }
 };
 
 struct HeldKeys {
@@ -620,7 +713,8 @@ class Part {
   Part() { }
   ~Part() { }
   
-  void Init();
+  // The index tells the part's looper notes apart in the shared pool
+  void Init(uint8_t index);
   
   uint8_t HeldKeysNoteOn(HeldKeys &keys, uint8_t pitch, uint8_t velocity);
   void NoteOn(uint8_t channel, uint8_t note, uint8_t velocity);
@@ -647,7 +741,14 @@ class Part {
   void Reset();
   // Pulses Per Quarter Note
   uint16_t PPQN() const { return lut_clock_ratio_ticks[seq_.clock_division]; }
-  uint8_t gate_length() const { return seq_.gate_length + 1; }
+  // Sequencer and LFO settings, offset by the modulation matrix
+  uint8_t gate_length() const;
+  uint8_t arp_range() const;
+  uint8_t lfo_rate() const;
+  // Sums the matrix for every voice, ahead of their refresh
+  void RefreshModMatrix();
+  // Passes the voicing settings changed since the last refresh to the voices
+  void RefreshVoicing();
   void ClockStep();
   // Advance step sequencer and/or arpeggiator
   SequencerArpeggiatorResult BuildNextStepResult(uint32_t step_counter) const;
@@ -664,7 +765,7 @@ class Part {
     return n;
   }
   inline uint16_t steps_per_arp_reset() const {
-    uint8_t steps_per_sequence_repeat = looped() ? (1 << seq_.loop_length) : seq_.num_steps;
+    uint16_t steps_per_sequence_repeat = looped() ? (1 << seq_.loop_length) : sequence_.num_steps();
     return sequence_repeats_per_arp_reset() * steps_per_sequence_repeat;
   }
 
@@ -689,7 +790,7 @@ class Part {
     voicing_.portamento_legato_only = false;
   }
 
-  inline bool seq_has_notes() const { return looped() ? looper_.num_notes() : seq_.num_steps; }
+  inline bool seq_has_notes() const { return looped() ? looper_.num_notes() : sequence_.num_steps(); }
   inline bool seq_overwrite() const { return seq_overwrite_; }
   inline void toggle_seq_overwrite() { set_seq_overwrite(!seq_overwrite_); }
   inline void set_seq_overwrite(bool b) {
@@ -698,7 +799,7 @@ class Part {
 
   inline const looper::Deck& looper() const { return looper_; }
   inline looper::Deck& mutable_looper() { return looper_; }
-  inline uint8_t LooperCurrentNoteIndex() const {
+  inline uint16_t LooperCurrentNoteIndex() const {
     return looper_note_index_for_generated_note_index_[generated_notes_.most_recent_note_index()];
   }
 
@@ -760,11 +861,11 @@ class Part {
     arpeggiator_ = result.arpeggiator;
     return result;
   }
-  inline void AdvanceArpForLooperNoteOnWithoutReturn(uint8_t looper_note_index, uint8_t pitch, uint8_t velocity) {
+  inline void AdvanceArpForLooperNoteOnWithoutReturn(uint16_t looper_note_index, uint8_t pitch, uint8_t velocity) {
     AdvanceArpForLooperNoteOn(pitch, velocity);
   }
-  void LooperPlayNoteOn(uint8_t looper_note_index, uint8_t pitch, uint8_t velocity);
-  void LooperPlayNoteOff(uint8_t looper_note_index, uint8_t pitch);
+  void LooperPlayNoteOn(uint16_t looper_note_index, uint8_t pitch, uint8_t velocity);
+  void LooperPlayNoteOff(uint16_t looper_note_index, uint8_t pitch);
   void LooperRecordNoteOn(uint8_t pressed_key_index);
   void LooperRecordNoteOff(uint8_t pressed_key_index);
 
@@ -795,10 +896,21 @@ class Part {
   void RecordStep(const SequencerStep& step);
 
   inline void ModifyNoteAtCurrentStep(uint8_t note) {
-    if (seq_recording_) {
-      seq_.step[seq_rec_step_].data[0] = note;
+    if (seq_recording_ && seq_rec_step_ < sequence_.num_steps()) {
+      SequencerStep step = sequence_.step(seq_rec_step_);
+      step.data[0] = note;
+      sequence_.SetStep(seq_rec_step_, step);
     }
   }
+
+  // Includes a slide held for a step not yet recorded
+  inline SequencerStep recording_step_contents() const {
+    if (seq_rec_step_ < sequence_.num_steps()) {
+      return sequence_.step(seq_rec_step_);
+    }
+    return SequencerStep(SEQUENCER_STEP_REST, seq_rec_slide_ ? 0x80 : 0);
+  }
+  void SetRecordingStepSlide(bool slide);
   
   inline void RecordStep(SequencerStepFlags flag) {
     RecordStep(SequencerStep(flag, 0));
@@ -848,6 +960,10 @@ class Part {
     return VOICE_ALLOCATION_NOT_FOUND;
   }
 
+  // Moves the voices playing a note to a pitch retuned by a just intonation
+  // chord.
+  void Retune(uint8_t note, int16_t pitch);
+
   inline const stmlib::NoteEntry& priority_note(
       stmlib::NoteStackFlags priority,
       uint8_t index = 0
@@ -877,9 +993,19 @@ class Part {
   inline const MidiSettings& midi_settings() const { return midi_; }
   inline const VoicingSettings& voicing_settings() const { return voicing_; }
   inline const SequencerSettings& sequencer_settings() const { return seq_; }
+  inline const StepSequence& sequence() const { return sequence_; }
+
+  // A preset keeps the looper's newest notes in the note slots left by the
+  // modulation matrix.  The sequence takes the slots left by both, and its
+  // tail is stored with the preset.
+  inline uint8_t packed_looper_capacity() const {
+    return looper::kMaxPackedNotes - (
+        voicing_.mod_matrix_in_use() ? kPackedModMatrixNotes : 0);
+  }
   inline MidiSettings* mutable_midi_settings() { return &midi_; }
   inline VoicingSettings* mutable_voicing_settings() { return &voicing_; }
   inline SequencerSettings* mutable_sequencer_settings() { return &seq_; }
+  inline StepSequence* mutable_sequence() { return &sequence_; }
 
   inline bool has_notes() const {
     return arp_keys_.stack.most_recent_note_index() ||
@@ -888,16 +1014,21 @@ class Part {
   
   inline bool recording() const { return seq_recording_; }
   inline bool overdubbing() const { return seq_overdubbing_; }
-  inline uint8_t recording_step() const { return seq_rec_step_; }
-  inline uint8_t playing_step() const { return step_counter_ % seq_.num_steps; }
-  inline uint8_t num_steps() const { return seq_.num_steps; }
-  inline void increment_recording_step_index(uint8_t n) {
-    seq_rec_step_ += n;
-    seq_rec_step_ = stmlib::modulo(seq_rec_step_, overdubbing() ? seq_.num_steps : kNumSteps);
+  inline uint16_t recording_step() const { return seq_rec_step_; }
+  inline uint16_t playing_step() const { return step_counter_ % sequence_.num_steps(); }
+  inline uint16_t num_steps() const { return sequence_.num_steps(); }
+  inline void increment_recording_step_index(int8_t n) {
+    int16_t step = seq_rec_step_ + n;
+    seq_rec_step_ = stmlib::modulo(step, static_cast<int16_t>(
+        overdubbing() ? sequence_.num_steps() : kMaxNumSteps));
+    seq_rec_slide_ = false;
   }
 
   void Pack(PackedPart& packed) const;
-  void Unpack(PackedPart& packed);
+  // sequence_tail is what StepSequence::Pack left out of the PackedPart, if
+  // it was kept.
+  void Unpack(PackedPart& packed, const uint8_t* sequence_tail = NULL);
+  void UnpackSettings(PackedPart& packed);
   void AfterDeserialize();
 
   void set_siblings(bool has_siblings) {
@@ -906,9 +1037,18 @@ class Part {
   
  private:
   int16_t Tune(int16_t note);
+  int16_t ScaleTunedPitch(int16_t pitch) const;
+  inline bool uses_just_intonation() const {
+    return voicing_.tuning_system == TUNING_SYSTEM_JUST_INTONATION ||
+        voicing_.tuning_system == TUNING_SYSTEM_JUST_INTONATION_CHORDS;
+  }
   void ResetAllControllers();
   void TouchVoiceAllocation();
   void TouchVoices();
+  void TouchVoiceField(uint8_t address);
+  void PushVoicing(uint32_t fields);
+  void TouchModMatrix();
+  int16_t part_mod_matrix(ModDestination d) const;
   
   void StopNotesBySustainStatus(HeldKeys &keys, bool where_sustained);
   void StopSustainedNotes(HeldKeys &keys) {
@@ -924,11 +1064,12 @@ class Part {
   void UpdateHighestPriorityVoice();
 
   uint8_t ApplySequencerInputResponse(int16_t pitch, int8_t root_pitch = kC4) const;
-  const SequencerStep BuildSeqStep(uint8_t step_index) const;
+  const SequencerStep BuildSeqStep(uint16_t step_index) const;
 
   MidiSettings midi_;
   VoicingSettings voicing_;
   SequencerSettings seq_;
+  StepSequence sequence_;
   
   Voice* voice_[kNumMaxVoicesPerPart];
   int8_t* custom_pitch_table_;
@@ -950,7 +1091,8 @@ class Part {
   bool seq_recording_;
   bool seq_overdubbing_;
   int32_t step_counter_;
-  uint8_t seq_rec_step_;
+  uint16_t seq_rec_step_;
+  bool seq_rec_slide_;
   bool seq_overwrite_;
   
   looper::Deck looper_;
@@ -960,15 +1102,20 @@ class Part {
   // held key. Used to a) find and conclude that looper note again when a
   // NoteOff arrives, and b) allow ApplySequencerInputResponse to distinguish
   // keys held for true manual control vs recording (ignored)
-  uint8_t looper_note_recording_pressed_key_[kNoteStackMapping];
+  uint16_t looper_note_recording_pressed_key_[kNoteStackMapping];
 
   // Tracks which looper notes are currently playing, so they can be turned off later
-  uint8_t looper_note_index_for_generated_note_index_[kNoteStackMapping];
-
-  // Post-transpose
-  uint8_t output_pitch_for_looper_note_[looper::kMaxNotes];
+  uint16_t looper_note_index_for_generated_note_index_[kNoteStackMapping];
 
   uint16_t gate_length_counter_[kNumMaxVoicesPerPart];
+
+  // Active slots of the matrix, grouped by destination
+  ModRoute mod_routes_[kNumModSlots];
+  uint8_t num_mod_routes_;
+
+  // Voicing settings changed since the last refresh, one bit per field by its
+  // offset in VoicingSettings
+  uint32_t dirty_voicing_;
   
   bool has_siblings_;
   
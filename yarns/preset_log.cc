@@ -0,0 +1,325 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Log of changes to the saved programs.
+
+#include "yarns/preset_log.h"
+
+#include <algorithm>
+
+#ifndef TEST
+#include <stm32f10x_conf.h>
+#endif  // TEST
+
+namespace yarns {
+
+const uint16_t kLogPageMagic = 0x4c47;
+const uint16_t kErased = 0xffff;
+
+#ifdef TEST
+static uint16_t flash[kNumLogPages * kFlashPageSize / 2];
+static bool flash_initialized = false;
+#endif  // TEST
+
+static inline uint8_t record_slot(const LogRecord& r) {
+  return r.header >> 12;
+}
+
+static inline uint16_t record_offset(const LogRecord& r) {
+  return r.header & 0xfff;
+}
+
+static inline uint8_t record_value(const LogRecord& r) {
+  return r.data & 0xff;
+}
+
+static inline uint8_t check_byte(uint16_t header, uint8_t value) {
+  return ~(value + (header & 0xff) + (header >> 8));
+}
+
+static inline bool record_used(const LogRecord& r) {
+  return r.header != kErased || r.data != kErased;
+}
+
+static inline bool record_valid(const LogRecord& r) {
+  return r.header != kErased &&
+      (r.data >> 8) == check_byte(r.header, record_value(r));
+}
+
+void PresetLog::Init(uint32_t end_address) {
+#ifdef TEST
+  if (!flash_initialized) {
+    std::fill(&flash[0], &flash[kNumLogPages * kFlashPageSize / 2], kErased);
+    flash_initialized = true;
+  }
+  base_address_ = reinterpret_cast<uintptr_t>(&flash[0]);
+#else
+  base_address_ = end_address - kNumLogPages * kFlashPageSize;
+#endif  // TEST
+
+  // Pages that hold something else are left alone, and never used.  Only
+  // log pages that a power cut left torn get erased: a header without its
+  // sequence number, or an erased header above what an erase left behind.
+  uint8_t log_pages = 0;
+  erased_pages_ = stray_pages_ = foreign_pages_ = 0;
+  for (uint8_t page = 0; page < kNumLogPages; ++page) {
+    const LogPageHeader& header = page_header(page);
+    if (PageErased(page)) {
+      erased_pages_ |= 1 << page;
+    } else if (header.magic == kLogPageMagic && header.sequence != kErased) {
+      log_pages |= 1 << page;
+    } else if (header.magic == kLogPageMagic || header.magic == kErased) {
+      stray_pages_ |= 1 << page;
+    } else {
+      foreign_pages_ |= 1 << page;
+    }
+  }
+
+  // The oldest page is the one that does not follow on from the page before.
+  oldest_page_ = 0;
+  num_pages_ = 0;
+  num_records_ = 0;
+  sequence_ = 0;
+  for (uint8_t page = 0; page < kNumLogPages; ++page) {
+    if (!(log_pages & (1 << page))) continue;
+    uint8_t previous = (page + kNumLogPages - 1) % kNumLogPages;
+    if ((log_pages & (1 << previous)) &&
+        static_cast<uint16_t>(page_header(previous).sequence + 1) ==
+            page_header(page).sequence) {
+      continue;
+    }
+    oldest_page_ = page;
+    num_pages_ = 1;
+    sequence_ = page_header(page).sequence;
+    break;
+  }
+  while (num_pages_ && num_pages_ < kNumLogPages) {
+    uint8_t page = page_in_order(num_pages_);
+    if (!(log_pages & (1 << page)) ||
+        page_header(page).sequence != static_cast<uint16_t>(sequence_ + 1)) {
+      break;
+    }
+    ++num_pages_;
+    ++sequence_;
+  }
+  for (uint8_t ordinal = 0; ordinal < num_pages_; ++ordinal) {
+    log_pages &= ~(1 << page_in_order(ordinal));
+  }
+  // Log pages left over belong to no log, e.g. after a power cut
+  // mid-compaction.
+  stray_pages_ |= log_pages;
+
+  if (num_pages_) {
+    uint8_t newest_page = page_in_order(num_pages_ - 1);
+    num_records_ = kLogRecordsPerPage;
+    while (num_records_ && !record_used(record(newest_page, num_records_ - 1))) {
+      --num_records_;
+    }
+  }
+
+  uncommitted_ = false;
+  for (uint16_t position = num_positions(); position--; ) {
+    const LogRecord& r = record_at(position);
+    if (record_valid(r)) {
+      uncommitted_ = record_offset(r) < LOG_MARKER_ABORT;
+      break;
+    }
+  }
+}
+
+void PresetLog::Replay(uint8_t slot, uint8_t* image, uint16_t size) const {
+  uint16_t end = num_positions();
+
+  // Records that came before the slot's page was last rewritten
+  uint16_t first = 0;
+  for (uint16_t position = 0; position < end; ++position) {
+    const LogRecord& r = record_at(position);
+    if (record_valid(r) && record_slot(r) == slot &&
+        record_offset(r) == LOG_MARKER_REWRITTEN) {
+      first = position + 1;
+    }
+  }
+
+  // Apply each group of records that a marker (other than an abort) ends.
+  uint16_t group = 0;
+  for (uint16_t position = 0; position < end; ++position) {
+    const LogRecord& marker = record_at(position);
+    if (!record_valid(marker) || record_offset(marker) < LOG_MARKER_ABORT) {
+      continue;
+    }
+    if (record_offset(marker) != LOG_MARKER_ABORT) {
+      for (uint16_t i = group > first ? group : first; i < position; ++i) {
+        const LogRecord& r = record_at(i);
+        if (record_valid(r) && record_slot(r) == slot &&
+            record_offset(r) < size) {
+          image[record_offset(r)] = record_value(r);
+        }
+      }
+    }
+    group = position + 1;
+  }
+}
+
+bool PresetLog::HasRecords(uint8_t slot) const {
+  bool has_records = false;
+  for (uint16_t position = 0; position < num_positions(); ++position) {
+    const LogRecord& r = record_at(position);
+    if (!record_valid(r) || record_slot(r) != slot) continue;
+    if (record_offset(r) < LOG_MARKER_ABORT) {
+      has_records = true;
+    } else if (record_offset(r) == LOG_MARKER_REWRITTEN) {
+      has_records = false;
+    }
+  }
+  return has_records;
+}
+
+uint16_t PresetLog::OldestPageSlots() const {
+  uint16_t slots = 0;
+  uint16_t end = num_pages_ == 1 ? num_records_ : kLogRecordsPerPage;
+  for (uint16_t i = 0; num_pages_ && i < end; ++i) {
+    const LogRecord& r = record(oldest_page_, i);
+    if (record_valid(r) && record_offset(r) < LOG_MARKER_ABORT) {
+      slots |= 1 << record_slot(r);
+    }
+  }
+  return slots;
+}
+
+uint16_t PresetLog::capacity() const {
+  // A page holding something else would cut the ring short, so the log is
+  // not used at all.
+  return foreign_pages_ ? 0 : kNumLogPages * kLogRecordsPerPage;
+}
+
+uint16_t PresetLog::num_free_records() const {
+  uint16_t num_free = num_pages_ ? kLogRecordsPerPage - num_records_ : 0;
+  for (uint8_t ordinal = num_pages_; ordinal < kNumLogPages; ++ordinal) {
+    if (!(erased_pages_ & (1 << page_in_order(ordinal)))) break;
+    num_free += kLogRecordsPerPage;
+  }
+  return num_free;
+}
+
+bool PresetLog::Append(uint8_t slot, uint16_t offset, uint8_t value) {
+  if (!ProgramRecord((slot << 12) | offset, value)) {
+    return false;
+  }
+  uncommitted_ = true;
+  return true;
+}
+
+bool PresetLog::AppendMarker(uint8_t slot, uint16_t marker) {
+  if (!ProgramRecord((slot << 12) | marker, 0)) {
+    return false;
+  }
+  uncommitted_ = false;
+  return true;
+}
+
+bool PresetLog::ProgramRecord(uint16_t header, uint8_t value) {
+  if ((!num_pages_ || num_records_ == kLogRecordsPerPage) && !OpenPage()) {
+    return false;
+  }
+  uintptr_t address = reinterpret_cast<uintptr_t>(
+      &record(page_in_order(num_pages_ - 1), num_records_));
+  // The header goes last: until it is programmed, the record is ignored.
+  Program(address, (check_byte(header, value) << 8) | value);
+  Program(address + 2, header);
+  ++num_records_;
+  return true;
+}
+
+bool PresetLog::OpenPage() {
+  if (num_pages_ == kNumLogPages) {
+    return false;
+  }
+  uint8_t page = page_in_order(num_pages_);
+  if (!(erased_pages_ & (1 << page))) {
+    return false;
+  }
+  if (num_pages_) {
+    ++sequence_;
+  }
+  Program(page_address(page), kLogPageMagic);
+  Program(page_address(page) + 2, sequence_);
+  erased_pages_ &= ~(1 << page);
+  ++num_pages_;
+  num_records_ = 0;
+  return true;
+}
+
+void PresetLog::EraseStrayPage() {
+  uint8_t page = 0;
+  while (!(stray_pages_ & (1 << page))) {
+    ++page;
+  }
+  ErasePage(page);
+  stray_pages_ &= ~(1 << page);
+}
+
+void PresetLog::EraseOldestPage() {
+  ErasePage(oldest_page_);
+  oldest_page_ = page_in_order(1);
+  --num_pages_;
+  if (!num_pages_) {
+    num_records_ = 0;
+  }
+}
+
+bool PresetLog::PageErased(uint8_t page) const {
+  const uint32_t* words = reinterpret_cast<const uint32_t*>(page_address(page));
+  for (uint16_t i = 0; i < kFlashPageSize / 4; ++i) {
+    if (words[i] != 0xffffffff) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void PresetLog::ErasePage(uint8_t page) {
+#ifdef TEST
+  std::fill(
+      &flash[page * kFlashPageSize / 2],
+      &flash[(page + 1) * kFlashPageSize / 2],
+      kErased);
+#else
+  FLASH_Unlock();
+  FLASH_ErasePage(page_address(page));
+#endif  // TEST
+  erased_pages_ |= 1 << page;
+}
+
+void PresetLog::Program(uintptr_t address, uint16_t value) {
+#ifdef TEST
+  *reinterpret_cast<uint16_t*>(address) = value;
+#else
+  FLASH_Unlock();
+  FLASH_ProgramHalfWord(address, value);
+#endif  // TEST
+}
+
+}  // namespace yarns
@@ -0,0 +1,177 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Log of changes to the saved programs.
+//
+// Rewriting a program's page means erasing it, and the CPU cannot fetch code
+// from flash while a page is being erased, so the DAC runs dry for the whole
+// erase.  Saving to the log only programs half-words, which is quick enough
+// to do a record at a time between block renders.  Each record patches one
+// byte of a program's PackedMulti image, and loading a program replays them
+// on top of its page.  Pages are used in turn and the oldest is folded back
+// into the program pages when nothing is playing, or sooner if a save is
+// waiting for room.
+
+#ifndef YARNS_PRESET_LOG_H_
+#define YARNS_PRESET_LOG_H_
+
+#include "stmlib/stmlib.h"
+
+namespace yarns {
+
+const uint16_t kFlashPageSize = 0x400;  // Medium density
+const uint8_t kNumLogPages = 4;
+
+struct LogRecord {
+  // Value, and a check byte that catches a record whose header was
+  // programmed over a stale value.
+  uint16_t data;
+  // Slot in the top 4 bits, then the offset in the image or a marker.
+  // Erased when the record is free.
+  uint16_t header;
+};
+
+struct LogPageHeader {
+  uint16_t magic;
+  uint16_t sequence;
+};
+
+const uint16_t kLogRecordsPerPage =
+    (kFlashPageSize - sizeof(LogPageHeader)) / sizeof(LogRecord);
+
+enum LogMarker {
+  // Ends a save: the records since the previous marker apply.
+  LOG_MARKER_COMMIT = 0xffe,
+  // The slot's page was rewritten, so its earlier records no longer apply.
+  LOG_MARKER_REWRITTEN = 0xffd,
+  // Ends a save that was interrupted: the records since the previous marker
+  // do not apply.
+  LOG_MARKER_ABORT = 0xffc,
+};
+
+class PresetLog {
+ public:
+  PresetLog() { }
+  ~PresetLog() { }
+
+  // Scans the pages that end at end_address.
+  void Init(uint32_t end_address);
+
+  // Applies the slot's committed records to its image.
+  void Replay(uint8_t slot, uint8_t* image, uint16_t size) const;
+  bool HasRecords(uint8_t slot) const;
+
+  // Each of these programs one record.  They return false when the log is
+  // full.
+  bool Append(uint8_t slot, uint16_t offset, uint8_t value);
+  inline bool Commit(uint8_t slot) {
+    return AppendMarker(slot, LOG_MARKER_COMMIT);
+  }
+  inline bool MarkRewritten(uint8_t slot) {
+    return AppendMarker(slot, LOG_MARKER_REWRITTEN);
+  }
+  inline bool Abort() {
+    return AppendMarker(0, LOG_MARKER_ABORT);
+  }
+
+  uint16_t num_free_records() const;
+  // Records the log holds once compacted
+  uint16_t capacity() const;
+  // The last save was interrupted before its commit.
+  inline bool uncommitted() const { return uncommitted_; }
+
+  // Compaction: pages in use beyond this are folded away when idle.
+  inline bool needs_compaction() const {
+    return stray_pages_ || num_pages_ > kNumLogPages / 2;
+  }
+  inline bool empty() const { return !stray_pages_ && !num_pages_; }
+  inline bool has_stray_pages() const { return stray_pages_; }
+  // Slots with records in the oldest page, as a bit mask.
+  uint16_t OldestPageSlots() const;
+  // Erases a log page that a power cut left torn, or out of the log.
+  void EraseStrayPage();
+  // Erases the oldest page, once its slots have been folded.
+  void EraseOldestPage();
+
+#ifdef TEST
+  // The emulated flash, for tests to leave torn writes in
+  inline uint16_t* mutable_page(uint8_t page) {
+    return reinterpret_cast<uint16_t*>(page_address(page));
+  }
+#endif  // TEST
+
+ private:
+  bool AppendMarker(uint8_t slot, uint16_t marker);
+  bool OpenPage();
+  bool PageErased(uint8_t page) const;
+  void ErasePage(uint8_t page);
+  void Program(uintptr_t address, uint16_t value);
+  bool ProgramRecord(uint16_t header, uint8_t value);
+
+  inline uintptr_t page_address(uint8_t page) const {
+    return base_address_ + static_cast<uintptr_t>(page) * kFlashPageSize;
+  }
+  inline const LogPageHeader& page_header(uint8_t page) const {
+    return *reinterpret_cast<const LogPageHeader*>(page_address(page));
+  }
+  inline const LogRecord& record(uint8_t page, uint16_t index) const {
+    return *reinterpret_cast<const LogRecord*>(
+        page_address(page) + sizeof(LogPageHeader) + index * sizeof(LogRecord));
+  }
+  inline uint8_t page_in_order(uint8_t ordinal) const {
+    return (oldest_page_ + ordinal) % kNumLogPages;
+  }
+  // Records are numbered from the start of the oldest page.
+  inline uint16_t num_positions() const {
+    return num_pages_ ? (num_pages_ - 1) * kLogRecordsPerPage + num_records_ : 0;
+  }
+  inline const LogRecord& record_at(uint16_t position) const {
+    return record(
+        page_in_order(position / kLogRecordsPerPage),
+        position % kLogRecordsPerPage);
+  }
+
+  uintptr_t base_address_;
+
+  // The log runs through num_pages_ pages starting at oldest_page_, with
+  // num_records_ used in the newest one.
+  uint8_t oldest_page_;
+  uint8_t num_pages_;
+  uint16_t num_records_;
+  uint16_t sequence_;
+
+  // Bit masks
+  uint8_t erased_pages_;
+  uint8_t stray_pages_;
+  uint8_t foreign_pages_;
+  bool uncommitted_;
+
+  DISALLOW_COPY_AND_ASSIGN(PresetLog);
+};
+
+}  // namespace yarns
+
+#endif  // YARNS_PRESET_LOG_H_
@@ -0,0 +1,177 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Morph between the part settings of two programs.
+
+#include "yarns/preset_morph.h"
+
+#include <algorithm>
+
+#include "yarns/settings.h"
+
+namespace yarns {
+
+using namespace std;
+
+// Laid out like the settings at the start of Part, so that a setting's
+// address indexes it the same way Part::Get does.
+struct UnpackedPartSettings {
+  MidiSettings midi;
+  VoicingSettings voicing;
+  SequencerSettings seq;
+
+  void Unpack(PackedPart& packed) {
+    midi.Unpack(packed);
+    voicing.Unpack(packed);
+    seq.Unpack(packed);
+  }
+
+  inline uint8_t Get(uint8_t address) const {
+    return static_cast<const uint8_t*>(static_cast<const void*>(&midi))[address];
+  }
+};
+
+/* static */
+bool PresetMorph::IsMorphed(uint8_t index) {
+  const Setting& setting = setting_defs.get(index);
+  if (setting.domain != SETTING_DOMAIN_PART) return false;
+  if (!Multi::IsTaggedSerializedSetting(index)) return false;
+  switch (index) {
+    // Changing these could stop the part from receiving the morph CC
+    case SETTING_MIDI_CHANNEL:
+    case SETTING_MIDI_MIN_NOTE:
+    case SETTING_MIDI_MAX_NOTE:
+    case SETTING_MIDI_MIN_VELOCITY:
+    case SETTING_MIDI_MAX_VELOCITY:
+      return false;
+    default:
+      break;
+  }
+  // Aliases write the same byte as an earlier setting
+  for (uint8_t i = 0; i < index; ++i) {
+    const Setting& other = setting_defs.get(i);
+    if (other.domain == SETTING_DOMAIN_PART &&
+        other.address[0] == setting.address[0]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* static */
+bool PresetMorph::IsContinuous(uint8_t index) {
+  switch (setting_defs.get(index).unit) {
+    case SETTING_UNIT_UINT8:
+    case SETTING_UNIT_INT8:
+    case SETTING_UNIT_LFO_RATE:
+    case SETTING_UNIT_LFO_SPREAD:
+    case SETTING_UNIT_PORTAMENTO:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool PresetMorph::Start(PackedMulti& a, PackedMulti& b) {
+  Stop();
+  UnpackedPartSettings settings_a;
+  UnpackedPartSettings settings_b;
+  uint8_t num_settings = 0;
+  bool complete = true;
+  for (uint8_t part = 0; part < multi.num_active_parts(); ++part) {
+    settings_a.Unpack(a.parts[part]);
+    settings_b.Unpack(b.parts[part]);
+    for (uint8_t i = 0; i < SETTING_LAST; ++i) {
+      if (!IsMorphed(i)) continue;
+      const Setting& setting = setting_defs.get(i);
+      uint8_t value_a = settings_a.Get(setting.address[0]);
+      uint8_t value_b = settings_b.Get(setting.address[0]);
+      if (value_a == value_b) continue;
+      if (num_settings == kMaxMorphSettings) {
+        complete = false;
+        continue;
+      }
+      MorphSetting& s = settings_[num_settings++];
+      s.setting = i;
+      s.a = value_a;
+      s.b = value_b;
+    }
+    part_end_[part] = num_settings;
+  }
+  fill(&part_end_[multi.num_active_parts()], &part_end_[kNumParts],
+       num_settings);
+  return complete;
+}
+
+void PresetMorph::Stop() {
+  fill(&part_end_[0], &part_end_[kNumParts], 0);
+  fill(&position_[0], &position_[kNumParts], 0);
+  fill(&applied_position_[0], &applied_position_[kNumParts], 0);
+  next_part_ = 0;
+}
+
+int16_t PresetMorph::Interpolate(
+    const MorphSetting& s, uint8_t position) const {
+  bool is_signed = setting_defs.get(s.setting).min_value < 0;
+  int16_t a = is_signed ? static_cast<int8_t>(s.a) : s.a;
+  int16_t b = is_signed ? static_cast<int8_t>(s.b) : s.b;
+  if (!IsContinuous(s.setting)) {
+    return position <= kMorphPositionMax / 2 ? a : b;
+  }
+  // Rounded to the nearest value; the bias keeps the numerator positive.
+  int32_t sum = \
+      static_cast<int32_t>(a + 128) * (kMorphPositionMax - position) +
+      static_cast<int32_t>(b + 128) * position;
+  return (sum + kMorphPositionMax / 2) / kMorphPositionMax - 128;
+}
+
+uint8_t PresetMorph::Tick() {
+  for (uint8_t i = 0; i < kNumParts; ++i) {
+    uint8_t part = next_part_;
+    next_part_ = (next_part_ + 1) % kNumParts;
+    uint8_t position = position_[part];
+    uint8_t applied_position = applied_position_[part];
+    if (position == applied_position) continue;
+
+    applied_position_[part] = position;
+    uint8_t num_applied = 0;
+    uint8_t begin = part ? part_end_[part - 1] : 0;
+    for (uint8_t j = begin; j < part_end_[part]; ++j) {
+      const MorphSetting& s = settings_[j];
+      int16_t value = Interpolate(s, position);
+      if (value == Interpolate(s, applied_position)) continue;
+      multi.ApplySetting(setting_defs.get(s.setting), part, value);
+      ++num_applied;
+    }
+    return num_applied;
+  }
+  return 0;
+}
+
+/* extern */
+PresetMorph preset_morph;
+
+}  // namespace yarns
@@ -0,0 +1,99 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Morph between the part settings of two programs.
+//
+// Only the settings that differ between the programs are kept, each with its
+// value in both.  Continuous settings are interpolated along the morph
+// position, and the others switch at the midpoint.  The morph CC only moves a
+// part's position; the main loop then applies the settings whose value at the
+// new position differs from the one at the position last applied, so a CC
+// sweep at full MIDI rate costs one pass per part per main loop iteration.
+
+#ifndef YARNS_PRESET_MORPH_H_
+#define YARNS_PRESET_MORPH_H_
+
+#include "stmlib/stmlib.h"
+
+#include "yarns/multi.h"
+
+namespace yarns {
+
+// Enough for 32 differing settings in each of 4 parts
+const uint8_t kMaxMorphSettings = 128;
+const uint8_t kMorphPositionMax = 127;
+
+struct MorphSetting {
+  uint8_t setting;  // SettingIndex
+  // Raw setting bytes, as stored by Part::Set
+  uint8_t a;
+  uint8_t b;
+};
+
+class PresetMorph {
+ public:
+  PresetMorph() { }
+  ~PresetMorph() { }
+
+  void Init() { Stop(); }
+
+  // The multi must already hold program a.  Returns false if more settings
+  // differ than fit, in which case the ones left out stay at their value in a.
+  bool Start(PackedMulti& a, PackedMulti& b);
+  void Stop();
+
+  inline bool active() const { return part_end_[kNumParts - 1] != 0; }
+  inline uint8_t position(uint8_t part) const { return position_[part]; }
+  inline void set_position(uint8_t part, uint8_t position) {
+    position_[part] = position;
+  }
+  inline uint8_t num_settings() const { return part_end_[kNumParts - 1]; }
+
+  // Applies the changes for one part whose position moved, and returns the
+  // number of settings applied.
+  uint8_t Tick();
+
+  static bool IsMorphed(uint8_t setting);
+  static bool IsContinuous(uint8_t setting);
+
+ private:
+  int16_t Interpolate(const MorphSetting& s, uint8_t position) const;
+
+  MorphSetting settings_[kMaxMorphSettings];
+  // Settings of part p are [part_end_[p - 1], part_end_[p])
+  uint8_t part_end_[kNumParts];
+  uint8_t position_[kNumParts];
+  uint8_t applied_position_[kNumParts];
+  uint8_t next_part_;
+
+  DISALLOW_COPY_AND_ASSIGN(PresetMorph);
+};
+
+extern PresetMorph preset_morph;
+
+}  // namespace yarns
+
+#endif  // YARNS_PRESET_MORPH_H_
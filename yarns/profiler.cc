@@ -0,0 +1,116 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Interrupt profiler.
+
+#ifdef PROFILE_INTERRUPTS
+
+#include "yarns/profiler.h"
+
+#include <algorithm>
+
+#ifndef TEST
+#include <stm32f10x_conf.h>
+#endif  // TEST
+
+#include "yarns/drivers/dac.h"
+
+namespace yarns {
+
+// The simulator's clock runs at a different rate, so on the host the bins are
+// only indicative; min and max are still comparable between builds.
+const uint32_t kProfilerCpuHz = 72000000;
+const uint32_t kSysTickPeriod = kProfilerCpuHz / 8000;
+const uint32_t kRefreshPeriod = kProfilerCpuHz / 4000;
+
+static uint32_t StageDeadline(ProfilerStage stage) {
+  uint32_t frame_period = kProfilerCpuHz / dac.frame_hz();
+  switch (stage) {
+    case PROFILER_STAGE_SYSTICK:
+    case PROFILER_STAGE_UI_POLL:
+      return kSysTickPeriod;
+    case PROFILER_STAGE_DMA_IRQ:
+      return frame_period;
+    case PROFILER_STAGE_RENDER_SAMPLES:
+    case PROFILER_STAGE_BLOCK_FILL_LATENCY:
+      return frame_period * kAudioBlockSize;
+    default:
+      return kRefreshPeriod;
+  }
+}
+
+#ifndef TEST
+volatile uint32_t* const Profiler::kDwtCycleCount = \
+    reinterpret_cast<volatile uint32_t*>(0xe0001004);
+static volatile uint32_t* const kDwtControl = \
+    reinterpret_cast<volatile uint32_t*>(0xe0001000);
+static volatile uint32_t* const kDebugExceptionMonitorControl = \
+    reinterpret_cast<volatile uint32_t*>(0xe000edfc);
+#endif  // TEST
+
+void Profiler::Init() {
+#ifndef TEST
+  *kDebugExceptionMonitorControl |= 1 << 24;  // TRCENA
+  *kDwtCycleCount = 0;
+  *kDwtControl |= 1;  // CYCCNTENA
+#endif  // TEST
+  block_consumed_at_ = cycles();
+  Reset();
+}
+
+// Deadlines follow the DAC frame rate, so they are refreshed here too.
+void Profiler::Reset() {
+  for (uint8_t i = 0; i < PROFILER_STAGE_LAST; ++i) {
+    deadline_[i] = StageDeadline(static_cast<ProfilerStage>(i));
+    bin_scale_[i] = ((kProfilerNumBins - 1) << 16) / deadline_[i];
+    ProfilerStageStats* s = &stats_[i];
+    s->count = 0;
+    s->min = 0xffffffff;
+    s->max = 0;
+    std::fill(&s->histogram[0], &s->histogram[kProfilerNumBins], 0);
+  }
+}
+
+const ProfilerStageStats* Profiler::Snapshot(bool reset) {
+#ifndef TEST
+  __disable_irq();
+#endif  // TEST
+  std::copy(&stats_[0], &stats_[PROFILER_STAGE_LAST], &snapshot_[0]);
+  if (reset) {
+    Reset();
+  }
+#ifndef TEST
+  __enable_irq();
+#endif  // TEST
+  return snapshot_;
+}
+
+/* extern */
+Profiler profiler;
+
+}  // namespace yarns
+
+#endif  // PROFILE_INTERRUPTS
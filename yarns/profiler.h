@@ -0,0 +1,166 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Interrupt profiler. Timestamps the stages of SysTick_Handler and the DAC
+// block fill, to see how close each layout runs to its deadlines.
+//
+// Compiled out unless PROFILE_INTERRUPTS is defined (make PROFILE=TRUE).
+
+#ifndef YARNS_PROFILER_H_
+#define YARNS_PROFILER_H_
+
+#include "stmlib/stmlib.h"
+
+#ifdef TEST
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+#endif  // TEST
+
+namespace yarns {
+
+enum ProfilerStage {
+  PROFILER_STAGE_SYSTICK,
+  PROFILER_STAGE_UI_POLL,
+  PROFILER_STAGE_MULTI_REFRESH,
+  PROFILER_STAGE_GET_CV_GATE,
+  PROFILER_STAGE_UPDATE_DC,
+  PROFILER_STAGE_DMA_IRQ,
+  PROFILER_STAGE_RENDER_SAMPLES,
+  // From the DMA interrupt releasing a block to the main loop having filled it
+  PROFILER_STAGE_BLOCK_FILL_LATENCY,
+  PROFILER_STAGE_LAST
+};
+
+// Eighths of the stage's deadline, plus one bin for overruns
+const uint8_t kProfilerNumBins = 9;
+
+#ifdef TEST
+inline uint64_t ReadCycleCounter() {
+#if defined(__i386__) || defined(__x86_64__)
+  return __rdtsc();
+#else
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return static_cast<uint64_t>(t.tv_sec) * 1000000000 + t.tv_nsec;
+#endif
+}
+#endif  // TEST
+
+struct ProfilerStageStats {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint32_t histogram[kProfilerNumBins];
+};
+
+class Profiler {
+ public:
+  Profiler() { }
+  ~Profiler() { }
+
+  void Init();
+  void Reset();
+
+  static inline uint32_t cycles() {
+#ifdef TEST
+    return static_cast<uint32_t>(ReadCycleCounter());
+#else
+    return *kDwtCycleCount;
+#endif
+  }
+
+  inline void Record(ProfilerStage stage, uint32_t start) {
+    uint32_t elapsed = cycles() - start;
+    ProfilerStageStats* s = &stats_[stage];
+    ++s->count;
+    if (elapsed < s->min) {
+      s->min = elapsed;
+    }
+    if (elapsed > s->max) {
+      s->max = elapsed;
+    }
+    uint32_t bin = elapsed >= deadline_[stage]
+        ? kProfilerNumBins - 1
+        : elapsed * bin_scale_[stage] >> 16;
+    ++s->histogram[bin];
+  }
+
+  inline void OnBlockConsumed() { block_consumed_at_ = cycles(); }
+  inline void OnBlockFilled() {
+    Record(PROFILER_STAGE_BLOCK_FILL_LATENCY, block_consumed_at_);
+  }
+
+  inline const ProfilerStageStats& stats(ProfilerStage stage) const {
+    return stats_[stage];
+  }
+  // Copies (and optionally clears) the stats with interrupts masked, so that a
+  // SysEx dump sent from the main loop is consistent.
+  const ProfilerStageStats* Snapshot(bool reset);
+
+  inline uint32_t deadline(ProfilerStage stage) const {
+    return deadline_[stage];
+  }
+
+ private:
+#ifndef TEST
+  static volatile uint32_t* const kDwtCycleCount;
+#endif  // TEST
+
+  ProfilerStageStats stats_[PROFILER_STAGE_LAST];
+  ProfilerStageStats snapshot_[PROFILER_STAGE_LAST];
+  uint32_t deadline_[PROFILER_STAGE_LAST];
+  uint32_t bin_scale_[PROFILER_STAGE_LAST];
+  volatile uint32_t block_consumed_at_;
+
+  DISALLOW_COPY_AND_ASSIGN(Profiler);
+};
+
+extern Profiler profiler;
+
+#ifdef PROFILE_INTERRUPTS
+
+#define PROFILE_BEGIN(name) uint32_t name = profiler.cycles()
+#define PROFILE_END(stage, name) profiler.Record(stage, name)
+#define PROFILE(stage, statement) do { \
+  uint32_t profile_start_ = profiler.cycles(); \
+  statement; \
+  profiler.Record(stage, profile_start_); \
+} while (0)
+
+#else
+
+#define PROFILE_BEGIN(name)
+#define PROFILE_END(stage, name)
+#define PROFILE(stage, statement) statement
+
+#endif  // PROFILE_INTERRUPTS
+
+}  // namespace yarns
+
+#endif // YARNS_PROFILER_H_
@@ -0,0 +1,94 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Flash pages for the tails of long step sequences.
+
+#include "yarns/sequence_pages.h"
+
+#include <algorithm>
+
+#ifndef TEST
+#include <stm32f10x_conf.h>
+#endif  // TEST
+
+namespace yarns {
+
+#ifdef TEST
+static uint16_t flash[kNumSequencePages * kFlashPageSize / 2];
+static bool flash_initialized = false;
+#endif  // TEST
+
+void SequencePages::Init(uint32_t end_address) {
+#ifdef TEST
+  if (!flash_initialized) {
+    std::fill(&flash[0], &flash[kNumSequencePages * kFlashPageSize / 2], 0xffff);
+    flash_initialized = true;
+  }
+  base_address_ = reinterpret_cast<uintptr_t>(&flash[0]);
+#else
+  base_address_ = end_address - kNumSequencePages * kFlashPageSize;
+#endif  // TEST
+}
+
+void SequencePages::Write(
+    uint8_t page, const uint8_t* const* tails, const uint16_t* sizes) {
+  ErasePage(page);
+  for (uint8_t half = 0; half < kSequenceTailsPerPage; ++half) {
+    const uint8_t* tail = tails[half];
+    uint16_t size = std::min(sizes[half], kSequenceTailSize);
+    if (!tail) continue;
+    uintptr_t address = page_address(page) + half * kSequenceTailSize;
+    for (uint16_t i = 0; i < size; i += 2) {
+      // An odd byte out is paired with an erased one
+      uint8_t next = i + 1 < size ? tail[i + 1] : 0xff;
+      Program(address + i, tail[i] | (next << 8));
+    }
+  }
+}
+
+void SequencePages::ErasePage(uint8_t page) {
+#ifdef TEST
+  std::fill(
+      &flash[page * kFlashPageSize / 2],
+      &flash[(page + 1) * kFlashPageSize / 2],
+      0xffff);
+  ++num_erases();
+#else
+  FLASH_Unlock();
+  FLASH_ErasePage(page_address(page));
+#endif  // TEST
+}
+
+void SequencePages::Program(uintptr_t address, uint16_t value) {
+#ifdef TEST
+  *reinterpret_cast<uint16_t*>(address) = value;
+#else
+  FLASH_Unlock();
+  FLASH_ProgramHalfWord(address, value);
+#endif  // TEST
+}
+
+}  // namespace yarns
@@ -0,0 +1,92 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Flash pages for what the saved programs have no room for: the tails of their
+// long step sequences.
+//
+// A page holds two tails, one in each half.  It is erased, then programmed
+// half-word by half-word straight from wherever the tails are, so no image of
+// the page is needed in RAM.  The program that a tail belongs to carries its
+// checksum, which tells a tail from a stale or torn one.
+
+#ifndef YARNS_SEQUENCE_PAGES_H_
+#define YARNS_SEQUENCE_PAGES_H_
+
+#include "stmlib/stmlib.h"
+
+#include "yarns/preset_log.h"
+
+namespace yarns {
+
+const uint8_t kNumSequencePages = 16;
+const uint8_t kSequenceTailsPerPage = 2;
+const uint16_t kSequenceTailSize = kFlashPageSize / kSequenceTailsPerPage;
+
+class SequencePages {
+ public:
+  SequencePages() { }
+  ~SequencePages() { }
+
+  // The pages end at end_address.
+  void Init(uint32_t end_address);
+
+  inline const uint8_t* page(uint8_t page) const {
+    return reinterpret_cast<const uint8_t*>(page_address(page));
+  }
+  inline const uint8_t* tail(uint8_t page, uint8_t half) const {
+    return this->page(page) + half * kSequenceTailSize;
+  }
+
+  // Erases the page, then programs the first sizes[i] bytes of tails[i] into
+  // each half.  A NULL tail leaves its half erased.
+  void Write(uint8_t page, const uint8_t* const* tails, const uint16_t* sizes);
+
+#ifdef TEST
+  inline uint8_t* mutable_page(uint8_t page) {
+    return reinterpret_cast<uint8_t*>(page_address(page));
+  }
+  static uint32_t& num_erases() {
+    static uint32_t count = 0;
+    return count;
+  }
+#endif  // TEST
+
+ private:
+  void ErasePage(uint8_t page);
+  void Program(uintptr_t address, uint16_t value);
+
+  inline uintptr_t page_address(uint8_t page) const {
+    return base_address_ + static_cast<uintptr_t>(page) * kFlashPageSize;
+  }
+
+  uintptr_t base_address_;
+
+  DISALLOW_COPY_AND_ASSIGN(SequencePages);
+};
+
+}  // namespace yarns
+
+#endif  // YARNS_SEQUENCE_PAGES_H_
@@ -219,7 +219,8 @@ const char* const tuning_system_values[TUNING_SYSTEM_LAST] = {
   "25 KAUSHIK TODI",
   "26 JOGESHWARI",
   "27 RASIA",
-  "CUSTOM"
+  "CUSTOM",
+  "JUST INTONATION CHORDS"
 };
 
 const char* const sequencer_play_mode_values[PLAY_MODE_LAST] = {
@@ -269,6 +270,38 @@ const char* const tuning_factor_values[] = {
   "ALPHA"
 };
 
+const char* const dc_interpolation_values[DC_INTERPOLATION_LAST] = {
+  "OFF", "LINEAR", "CUBIC"
+};
+
+const char* const program_change_mode_values[PROGRAM_CHANGE_MODE_LAST] = {
+  "OFF", "NOW", "STEP", "BAR"
+};
+
+const char* const mod_source_values[MOD_SOURCE_LAST] = {
+  "OFF",
+  "VELOCITY",
+  "MODULATION",
+  "AFTERTOUCH",
+  "BREATH",
+  "PEDAL",
+  "BEND",
+  "VIBRATO LFO",
+  "LFO",
+};
+
+const char* const mod_destination_values[MOD_DESTINATION_LAST] = {
+  "TIMBRE",
+  "ATTACK",
+  "DECAY",
+  "SUSTAIN",
+  "RELEASE",
+  "PORTAMENTO",
+  "LFO RATE",
+  "GATE LENGTH",
+  "ARP RANGE",
+};
+
 /* static */
 const Setting Settings::settings_[] = {
   {
@@ -697,7 +730,7 @@ const Setting Settings::settings_[] = {
   {
     "SO", "STEP OFFSET",
     SETTING_DOMAIN_PART, { PART_SEQUENCER_STEP_OFFSET, 0 },
-    SETTING_UNIT_UINT8, 0, 31, NULL,
+    SETTING_UNIT_UINT8, 0, kMaxNumSteps - 1, NULL,
     109, 31,
   },
   {
@@ -748,6 +781,102 @@ const Setting Settings::settings_[] = {
     SETTING_UNIT_ENUMERATION, 0, 13,
     tuning_factor_values,
     0xff, 0xff,
+  },
+  {
+    "CS", "CV SMOOTHING",
+    SETTING_DOMAIN_MULTI, { MULTI_DC_INTERPOLATION, 0 },
+    SETTING_UNIT_ENUMERATION, 0, DC_INTERPOLATION_LAST - 1,
+    dc_interpolation_values,
+    0xff, 0xff,
+  },
+  {
+    "PC", "PROGRAM CHANGE",
+    SETTING_DOMAIN_MULTI, { MULTI_PROGRAM_CHANGE_MODE, 0 },
+    SETTING_UNIT_ENUMERATION, 0, PROGRAM_CHANGE_MODE_LAST - 1,
+    program_change_mode_values,
+    0xff, 0xff,
+  },
+  {
+    "\x82""M", "MATRIX MENU",
+    SETTING_DOMAIN_MULTI, { 0, 0 },
+    SETTING_UNIT_UINT8, 0, 0, NULL,
+    0xff, 0xff,
+  },
+  {
+    "1S", "MOD 1 SOURCE",
+    SETTING_DOMAIN_PART, { PART_VOICING_MOD_1_SOURCE, 0 },
+    SETTING_UNIT_ENUMERATION, 0, MOD_SOURCE_LAST - 1, mod_source_values,
+    0xff, 0xff,
+  },
+  {
+    "1D", "MOD 1 DESTINATION",
+    SETTING_DOMAIN_PART, { PART_VOICING_MOD_1_DESTINATION, 0 },
+    SETTING_UNIT_ENUMERATION, 0, MOD_DESTINATION_LAST - 1,
+    mod_destination_values,
+    0xff, 0xff,
+  },
+  {
+    "1*", "MOD 1 DEPTH",
+    SETTING_DOMAIN_PART, { PART_VOICING_MOD_1_DEPTH, 0 },
+    SETTING_UNIT_INT8, -64, 63, NULL,
+    0xff, 0xff,
+  },
+  {
+    "2S", "MOD 2 SOURCE",
+    SETTING_DOMAIN_PART, { PART_VOICING_MOD_2_SOURCE, 0 },
+    SETTING_UNIT_ENUMERATION, 0, MOD_SOURCE_LAST - 1, mod_source_values,
+    0xff, 0xff,
+  },
+  {
+    "2D", "MOD 2 DESTINATION",
+    SETTING_DOMAIN_PART, { PART_VOICING_MOD_2_DESTINATION, 0 },
+    SETTING_UNIT_ENUMERATION, 0, MOD_DESTINATION_LAST - 1,
+    mod_destination_values,
+    0xff, 0xff,
+  },
+  {
+    "2*", "MOD 2 DEPTH",
+    SETTING_DOMAIN_PART, { PART_VOICING_MOD_2_DEPTH, 0 },
+    SETTING_UNIT_INT8, -64, 63, NULL,
+    0xff, 0xff,
+  },
+  {
+    "3S", "MOD 3 SOURCE",
+    SETTING_DOMAIN_PART, { PART_VOICING_MOD_3_SOURCE, 0 },
+    SETTING_UNIT_ENUMERATION, 0, MOD_SOURCE_LAST - 1, mod_source_values,
+    0xff, 0xff,
+  },
+  {
+    "3D", "MOD 3 DESTINATION",
+    SETTING_DOMAIN_PART, { PART_VOICING_MOD_3_DESTINATION, 0 },
+    SETTING_UNIT_ENUMERATION, 0, MOD_DESTINATION_LAST - 1,
+    mod_destination_values,
+    0xff, 0xff,
+  },
+  {
+    "3*", "MOD 3 DEPTH",
+    SETTING_DOMAIN_PART, { PART_VOICING_MOD_3_DEPTH, 0 },
+    SETTING_UNIT_INT8, -64, 63, NULL,
+    0xff, 0xff,
+  },
+  {
+    "4S", "MOD 4 SOURCE",
+    SETTING_DOMAIN_PART, { PART_VOICING_MOD_4_SOURCE, 0 },
+    SETTING_UNIT_ENUMERATION, 0, MOD_SOURCE_LAST - 1, mod_source_values,
+    0xff, 0xff,
+  },
+  {
+    "4D", "MOD 4 DESTINATION",
+    SETTING_DOMAIN_PART, { PART_VOICING_MOD_4_DESTINATION, 0 },
+    SETTING_UNIT_ENUMERATION, 0, MOD_DESTINATION_LAST - 1,
+    mod_destination_values,
+    0xff, 0xff,
+  },
+  {
+    "4*", "MOD 4 DEPTH",
+    SETTING_DOMAIN_PART, { PART_VOICING_MOD_4_DEPTH, 0 },
+    SETTING_UNIT_INT8, -64, 63, NULL,
+    0xff, 0xff,
   }
 };
 
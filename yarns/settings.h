@@ -139,6 +139,21 @@ enum SettingIndex {
   SETTING_MIDI_SUSTAIN_POLARITY,
   SETTING_REMOTE_CONTROL_CHANNEL,
   SETTING_VOICING_TUNING_FACTOR,
+  SETTING_DC_INTERPOLATION,
+  SETTING_PROGRAM_CHANGE_MODE,
+  SETTING_MENU_MATRIX,
+  SETTING_VOICING_MOD_1_SOURCE,
+  SETTING_VOICING_MOD_1_DESTINATION,
+  SETTING_VOICING_MOD_1_DEPTH,
+  SETTING_VOICING_MOD_2_SOURCE,
+  SETTING_VOICING_MOD_2_DESTINATION,
+  SETTING_VOICING_MOD_2_DEPTH,
+  SETTING_VOICING_MOD_3_SOURCE,
+  SETTING_VOICING_MOD_3_DESTINATION,
+  SETTING_VOICING_MOD_3_DEPTH,
+  SETTING_VOICING_MOD_4_SOURCE,
+  SETTING_VOICING_MOD_4_DESTINATION,
+  SETTING_VOICING_MOD_4_DEPTH,
 
   SETTING_LAST,
 };
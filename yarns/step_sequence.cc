@@ -0,0 +1,395 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Step sequence.
+
+#include "yarns/step_sequence.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "yarns/part.h"
+
+namespace yarns {
+
+using namespace std;
+
+// Byte 0 of a step is at most SEQUENCER_STEP_TIE, which leaves the bytes from
+// kRunToken up free to mark runs: 0b11t0llll, a run of l + 1 rests (or ties,
+// with t set).
+const uint8_t kRunToken = 0xc0;
+const uint8_t kRunTie = 0x20;
+const uint8_t kRunLengthMask = kStepPageSize - 1;
+const uint8_t kRunTokenMask = 0xd0;
+STATIC_ASSERT(SEQUENCER_STEP_TIE < kRunToken, run_tokens_are_free);
+
+// Width of PackedPart::step_offset
+const uint8_t kMaxPackedStepOffset = 31;
+
+void StepSequence::Clear() {
+  size_ = 0;
+  num_steps_ = 0;
+  fill(&page_start_[0], &page_start_[kNumStepPages], 0);
+  window_page_[0] = window_page_[1] = kNoPage;
+  first_note_index_ = kMaxNumSteps;
+  first_note_ = kC4;
+}
+
+bool StepSequence::Load(
+    const uint8_t* data, uint16_t size, uint16_t num_steps) {
+  Clear();
+  size = min(size, kStepSequenceSize);
+  copy(&data[0], &data[size], &encoded_[0]);
+  return Index(size, num_steps);
+}
+
+bool StepSequence::Index(uint16_t size, uint16_t num_steps) {
+  uint16_t i = 0;
+  for (uint16_t n = 0; n < num_steps; ) {
+    if (i >= size || n >= kMaxNumSteps) {
+      Clear();
+      return false;
+    }
+    if (!(n & kRunLengthMask)) {
+      page_start_[n >> kStepPageBits] = i;
+    }
+    uint8_t byte = encoded_[i];
+    if (byte >= kRunToken) {
+      uint8_t run = (byte & kRunLengthMask) + 1;
+      if ((byte & kRunTokenMask) != kRunToken ||
+          (n & kRunLengthMask) + run > kStepPageSize ||
+          n + run > num_steps) {
+        Clear();
+        return false;
+      }
+      n += run;
+      ++i;
+    } else {
+      ++n;
+      i += 2;
+    }
+  }
+  if (i > size) {
+    Clear();
+    return false;
+  }
+  size_ = i;
+  num_steps_ = num_steps;
+  fill(&page_start_[num_pages()], &page_start_[kNumStepPages], size_);
+  FindFirstNote();
+  return true;
+}
+
+SequencerStep StepSequence::step(uint16_t index) const {
+  if (index >= num_steps_) {
+    return SequencerStep(SEQUENCER_STEP_REST, 0);
+  }
+  uint8_t page = index >> kStepPageBits;
+  uint8_t offset = index & kRunLengthMask;
+  if (window_page_[0] == page) return window_[0][offset];
+  if (window_page_[1] == page) return window_[1][offset];
+
+  // Off the window: walk the page's tokens
+  uint16_t i = page_start_[page];
+  while (true) {
+    uint8_t byte = encoded_[i];
+    if (byte >= kRunToken) {
+      uint8_t run = (byte & kRunLengthMask) + 1;
+      if (offset < run) {
+        return SequencerStep(
+            byte & kRunTie ? SEQUENCER_STEP_TIE : SEQUENCER_STEP_REST, 0);
+      }
+      offset -= run;
+      ++i;
+    } else {
+      if (!offset) return SequencerStep(byte, encoded_[i + 1]);
+      --offset;
+      i += 2;
+    }
+  }
+}
+
+void StepSequence::DecodePage(uint8_t page, SequencerStep* steps) const {
+  uint8_t n = 0;
+  for (uint16_t i = page_start_[page]; i < page_end(page); ) {
+    uint8_t byte = encoded_[i++];
+    if (byte >= kRunToken) {
+      SequencerStep run_step(
+          byte & kRunTie ? SEQUENCER_STEP_TIE : SEQUENCER_STEP_REST, 0);
+      for (uint8_t run = (byte & kRunLengthMask) + 1; run; --run) {
+        steps[n++] = run_step;
+      }
+    } else {
+      steps[n++] = SequencerStep(byte, encoded_[i++]);
+    }
+  }
+  fill(&steps[n], &steps[kStepPageSize],
+       SequencerStep(SEQUENCER_STEP_REST, 0));
+}
+
+/* static */
+uint8_t StepSequence::EncodePage(
+    const SequencerStep* steps, uint8_t num_steps, uint8_t* data) {
+  uint8_t size = 0;
+  for (uint8_t n = 0; n < num_steps; ) {
+    const SequencerStep& s = steps[n];
+    uint8_t run = 0;
+    if ((s.is_rest() || s.is_tie()) && !s.data[1]) {
+      while (
+          n + run < num_steps &&
+          steps[n + run].data[0] == s.data[0] &&
+          !steps[n + run].data[1]) {
+        ++run;
+      }
+    }
+    if (run) {
+      if (data) data[size] = kRunToken | (s.is_tie() ? kRunTie : 0) | (run - 1);
+      ++size;
+      n += run;
+    } else {
+      if (data) {
+        data[size] = s.data[0];
+        data[size + 1] = s.data[1];
+      }
+      size += 2;
+      ++n;
+    }
+  }
+  return size;
+}
+
+bool StepSequence::SetStep(uint16_t index, SequencerStep step) {
+  if (index >= kMaxNumSteps) return false;
+  if (step.data[0] >= kRunToken) step.data[0] = SEQUENCER_STEP_REST;
+
+  // Rewrites the page of the step, and any pages that a longer sequence adds
+  // before it
+  uint16_t num_steps = max(num_steps_, static_cast<uint16_t>(index + 1));
+  uint8_t step_page = index >> kStepPageBits;
+  uint8_t first_page = min(index, num_steps_) >> kStepPageBits;
+  SequencerStep steps[kStepPageSize];
+
+  int16_t growth = 0;
+  for (uint8_t page = first_page; page <= step_page; ++page) {
+    DecodePage(page, steps);
+    if (page == step_page) steps[index & kRunLengthMask] = step;
+    uint8_t count = min(
+        static_cast<uint16_t>(num_steps - (page << kStepPageBits)),
+        static_cast<uint16_t>(kStepPageSize));
+    growth += EncodePage(steps, count, NULL) - (page_end(page) - page_start_[page]);
+  }
+  if (size_ + growth > kStepSequenceSize) return false;
+
+  for (uint8_t page = first_page; page <= step_page; ++page) {
+    DecodePage(page, steps);
+    if (page == step_page) steps[index & kRunLengthMask] = step;
+    uint8_t count = min(
+        static_cast<uint16_t>(num_steps - (page << kStepPageBits)),
+        static_cast<uint16_t>(kStepPageSize));
+    uint8_t page_data[kStepPageSize * 2];
+    uint8_t size = EncodePage(steps, count, page_data);
+    uint16_t start = page_start_[page];
+    uint16_t end = page_end(page);
+    int16_t delta = size - (end - start);
+    memmove(&encoded_[end + delta], &encoded_[end], size_ - end);
+    copy(&page_data[0], &page_data[size], &encoded_[start]);
+    for (uint8_t p = page + 1; p < kNumStepPages; ++p) {
+      page_start_[p] += delta;
+    }
+    size_ += delta;
+    for (uint8_t slot = 0; slot < 2; ++slot) {
+      if (window_page_[slot] == page) {
+        copy(&steps[0], &steps[kStepPageSize], &window_[slot][0]);
+      }
+    }
+  }
+  num_steps_ = num_steps;
+
+  if (step.has_note() && index <= first_note_index_) {
+    first_note_index_ = index;
+    first_note_ = step.note();
+  } else if (index == first_note_index_) {
+    FindFirstNote();
+  }
+  return true;
+}
+
+void StepSequence::LoadPage(uint8_t slot, uint8_t page) {
+  DecodePage(page, window_[slot]);
+  window_page_[slot] = page;
+}
+
+void StepSequence::Prefetch(uint32_t step_counter) {
+  if (!num_steps_) return;
+  uint8_t page = (step_counter % num_steps_) >> kStepPageBits;
+  uint8_t next = page + 1 < num_pages() ? page + 1 : 0;
+  uint8_t slot = window_page_[1] == page;
+  if (window_page_[slot] != page) {
+    // Keep the next page if it's already decoded
+    slot = window_page_[0] == next;
+    LoadPage(slot, page);
+  }
+  if (next != page && window_page_[!slot] != next) {
+    LoadPage(!slot, next);
+  }
+}
+
+void StepSequence::FindFirstNote() {
+  first_note_index_ = kMaxNumSteps;
+  uint16_t n = 0;
+  for (uint16_t i = 0; i < size_; ) {
+    uint8_t byte = encoded_[i];
+    if (byte >= kRunToken) {
+      n += (byte & kRunLengthMask) + 1;
+      ++i;
+    } else {
+      if (!(byte & 0x80)) {
+        first_note_index_ = n;
+        first_note_ = byte;
+        return;
+      }
+      ++n;
+      i += 2;
+    }
+  }
+}
+
+uint16_t StepSequence::WholeTokens(
+    uint16_t max_size, uint16_t* num_steps) const {
+  uint16_t i = 0;
+  uint16_t n = 0;
+  while (i < max_size) {
+    bool run = encoded_[i] >= kRunToken;
+    uint8_t token_size = run ? 1 : 2;
+    if (i + token_size > max_size) break;
+    n += run ? (encoded_[i] & kRunLengthMask) + 1 : 1;
+    i += token_size;
+  }
+  *num_steps = n;
+  return i;
+}
+
+// Bytes free for the extended layout: the step slots, then the looper note
+// slots ahead of the notes that Deck::Pack keeps before the modulation matrix.
+static uint16_t PackedSequenceRegionSize(const PackedPart& packed) {
+  return sizeof(packed.sequencer_steps) +
+      (packed.looper_capacity() - packed.looper_size) *
+      sizeof(looper::PackedNote);
+}
+
+static PackedStepSequenceHeader PackedHeader(const PackedPart& packed) {
+  PackedStepSequenceHeader header;
+  memcpy(&header, &packed.sequencer_steps[0], sizeof(header));
+  return header;
+}
+
+// Seeded with the size, so that a tail cut short doesn't match
+static uint16_t TailChecksum(const uint8_t* tail, uint16_t size) {
+  uint16_t checksum = size;
+  for (uint16_t i = 0; i < size; ++i) {
+    checksum = (checksum << 1 | checksum >> 15) ^ tail[i];
+  }
+  return checksum;
+}
+
+/* static */
+uint16_t StepSequence::PackedHeadSize(const PackedPart& packed) {
+  if (packed.num_steps != kPackedStepsExtended) return 0;
+  return min(
+      PackedHeader(packed).size,
+      static_cast<uint16_t>(
+          PackedSequenceRegionSize(packed) - sizeof(PackedStepSequenceHeader)));
+}
+
+/* static */
+uint16_t StepSequence::PackedTailSize(const PackedPart& packed) {
+  if (packed.num_steps != kPackedStepsExtended) return 0;
+  uint16_t size = min(PackedHeader(packed).size, kStepSequenceSize);
+  uint16_t head_size = PackedHeadSize(packed);
+  return size > head_size ? size - head_size : 0;
+}
+
+void StepSequence::Pack(PackedPart& packed, uint8_t step_offset) const {
+  if (num_steps_ <= kNumSteps && step_offset <= kMaxPackedStepOffset) {
+    for (uint8_t i = 0; i < kNumSteps; ++i) {
+      SequencerStep s = step(i);
+      packed.sequencer_steps[i].pitch = s.data[0];
+      packed.sequencer_steps[i].velocity = s.data[1];
+    }
+    packed.step_offset = step_offset;
+    packed.num_steps = num_steps_;
+    return;
+  }
+
+  // Part::Pack has packed the looper, so the region is known
+  uint8_t* region = reinterpret_cast<uint8_t*>(&packed.sequencer_steps[0]);
+  PackedStepSequenceHeader header;
+  uint16_t head_size = min(
+      size_,
+      static_cast<uint16_t>(PackedSequenceRegionSize(packed) - sizeof(header)));
+  header.num_steps = num_steps_;
+  header.step_offset = step_offset;
+  header.size = size_;
+  header.tail_checksum = TailChecksum(&encoded_[head_size], size_ - head_size);
+  memcpy(region, &header, sizeof(header));
+  copy(&encoded_[0], &encoded_[head_size], &region[sizeof(header)]);
+  packed.step_offset = 0;
+  packed.num_steps = kPackedStepsExtended;
+}
+
+void StepSequence::Unpack(const PackedPart& packed, const uint8_t* tail) {
+  Clear();
+  if (packed.num_steps == kPackedStepsExtended) {
+    const uint8_t* region = reinterpret_cast<const uint8_t*>(
+        &packed.sequencer_steps[0]);
+    PackedStepSequenceHeader header = PackedHeader(packed);
+    uint16_t head_size = PackedHeadSize(packed);
+    uint16_t tail_size = PackedTailSize(packed);
+    uint16_t num_steps = header.num_steps;
+    copy(&region[sizeof(header)], &region[sizeof(header) + head_size],
+         &encoded_[0]);
+    if (tail && TailChecksum(tail, tail_size) == header.tail_checksum) {
+      copy(&tail[0], &tail[tail_size], &encoded_[head_size]);
+    } else if (tail_size) {
+      head_size = WholeTokens(head_size, &num_steps);
+      tail_size = 0;
+    }
+    Index(head_size + tail_size, num_steps);
+    return;
+  }
+  for (uint8_t i = 0; i < packed.num_steps; ++i) {
+    SetStep(i, SequencerStep(
+        packed.sequencer_steps[i].pitch, packed.sequencer_steps[i].velocity));
+  }
+}
+
+/* static */
+uint8_t StepSequence::UnpackStepOffset(const PackedPart& packed) {
+  if (packed.num_steps != kPackedStepsExtended) return packed.step_offset;
+  return PackedHeader(packed).step_offset;
+}
+
+}  // namespace yarns
@@ -0,0 +1,143 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Step sequence, in pages of encoded steps.
+//
+// A page holds kStepPageSize steps as a series of tokens.  A run of plain
+// rests or ties takes one byte; any other step takes the two bytes of its
+// SequencerStep.  Runs stop at page boundaries, so each page decodes on its
+// own from its start offset.  The clock path reads steps from a window of two
+// decoded pages, the playhead's and the next, which Prefetch refills one page
+// ahead of the playhead: a step lookup costs the same at any sequence length.
+
+#ifndef YARNS_STEP_SEQUENCE_H_
+#define YARNS_STEP_SEQUENCE_H_
+
+#include "stmlib/stmlib.h"
+
+#include "yarns/sequencer_step.h"
+
+namespace yarns {
+
+struct PackedPart;
+
+const uint16_t kMaxNumSteps = 256;
+const uint8_t kStepPageBits = 4;
+const uint8_t kStepPageSize = 1 << kStepPageBits;
+const uint8_t kNumStepPages = kMaxNumSteps >> kStepPageBits;
+// Enough for 256 notes
+const uint16_t kStepSequenceSize = kMaxNumSteps * 2;
+
+// A PackedPart whose num_steps holds this value carries a sequence too long
+// for its step slots: the header and the encoded steps spill over into the
+// looper note slots that Deck::Pack leaves free.  What doesn't fit there is
+// the sequence's tail, which the program keeps next to its PackedMulti.
+const uint8_t kPackedStepsExtended = 31;
+
+struct PackedStepSequenceHeader {
+  uint16_t num_steps;
+  uint8_t step_offset;
+  // Of the whole encoding, tail included
+  uint16_t size;
+  uint16_t tail_checksum;
+} __attribute__((packed));
+
+class StepSequence {
+ public:
+  void Clear();
+
+  // Replaces the sequence with num_steps steps read from encoded bytes, as
+  // returned by data().  Returns false, leaving the sequence empty, if the
+  // bytes are malformed or hold fewer steps.
+  bool Load(const uint8_t* data, uint16_t size, uint16_t num_steps);
+
+  // Writing past the end lengthens the sequence, with rests in between.
+  // Returns false, leaving the sequence unchanged, if the encoded steps would
+  // no longer fit.
+  bool SetStep(uint16_t index, SequencerStep step);
+
+  // Decodes the pages holding the step at step_counter and the one after it.
+  void Prefetch(uint32_t step_counter);
+
+  // Rests past the end of the sequence
+  SequencerStep step(uint16_t index) const;
+
+  void Pack(PackedPart& packed, uint8_t step_offset) const;
+  // Without its tail, or if the tail doesn't match the checksum, the
+  // sequence is cut to the whole tokens that the PackedPart holds.
+  void Unpack(const PackedPart& packed, const uint8_t* tail);
+  static uint8_t UnpackStepOffset(const PackedPart& packed);
+  // The encoded bytes that Pack puts in the PackedPart, and those left over
+  // for the tail.  The tail follows on from data() + PackedHeadSize().
+  static uint16_t PackedHeadSize(const PackedPart& packed);
+  static uint16_t PackedTailSize(const PackedPart& packed);
+
+  inline uint16_t num_steps() const { return num_steps_; }
+  inline const uint8_t* data() const { return encoded_; }
+  inline uint16_t size() const { return size_; }
+
+  inline int16_t first_note() const {
+    return first_note_index_ < num_steps_ ? first_note_ : kC4;
+  }
+
+ private:
+  static const uint8_t kNoPage = 0xff;
+
+  inline uint8_t num_pages() const {
+    return (num_steps_ + kStepPageSize - 1) >> kStepPageBits;
+  }
+  inline uint16_t page_end(uint8_t page) const {
+    return page + 1 < kNumStepPages ? page_start_[page + 1] : size_;
+  }
+  // Pads with rests past the end of the sequence
+  void DecodePage(uint8_t page, SequencerStep* steps) const;
+  // Returns the encoded size; with data NULL, only measures it
+  static uint8_t EncodePage(
+      const SequencerStep* steps, uint8_t num_steps, uint8_t* data);
+  void LoadPage(uint8_t slot, uint8_t page);
+  void FindFirstNote();
+  // Indexes the pages of the first size bytes of encoded_, as Load
+  bool Index(uint16_t size, uint16_t num_steps);
+  // Returns the size of the longest series of whole tokens in the first
+  // max_size bytes of encoded_, and the number of steps they hold.
+  uint16_t WholeTokens(uint16_t max_size, uint16_t* num_steps) const;
+
+  uint8_t encoded_[kStepSequenceSize];
+  // Pages past the end start at size_
+  uint16_t page_start_[kNumStepPages];
+  uint16_t size_;
+  uint16_t num_steps_;
+
+  SequencerStep window_[2][kStepPageSize];
+  uint8_t window_page_[2];
+
+  uint16_t first_note_index_;
+  uint8_t first_note_;
+};
+
+}  // namespace yarns
+
+#endif  // YARNS_STEP_SEQUENCE_H_
@@ -28,8 +28,12 @@
 
 #include "yarns/storage_manager.h"
 
+#include "stmlib/system/system_clock.h"
+
 #include "yarns/midi_handler.h"
 #include "yarns/multi.h"
+#include "yarns/preset_morph.h"
+#include "yarns/ui.h"
 
 namespace yarns {
 
@@ -42,35 +46,463 @@ STATIC_ASSERT(kPackedSize <= FlashStorage::MAX_DATA_SIZE, flash_fits_packed);
 STATIC_ASSERT(kPackedSize == 1020, i_just_want_to_know_if_this_changes);
 
 STATIC_ASSERT(kStreamBufferSize >= kPackedSize, buffer_fits_packed);
-STATIC_ASSERT(kStreamBufferSize >= Multi::kTaggedPayloadSize, buffer_fits_tagged);
+STATIC_ASSERT(
+    kStreamBufferSize >= Multi::kMaxTaggedSectionSize,
+    buffer_fits_tagged_section);
+STATIC_ASSERT(kStreamBufferSize >= 2 * kPackedSize, buffer_fits_log_save);
+STATIC_ASSERT(kPackedSize < LOG_MARKER_ABORT, log_offsets_fit);
+
+// Sequence pages
+STATIC_ASSERT(
+    (kNumFlashStoragePages - 1) * kNumSequencePagesPerSlot == kNumSequencePages,
+    sequence_pages_per_slot);
+// The longest tail is left by a PackedPart whose looper fills its note slots
+STATIC_ASSERT(
+    kStepSequenceSize + sizeof(PackedStepSequenceHeader) <=
+        kNumSteps * sizeof(PackedPart::PackedSequencerStep) + kSequenceTailSize,
+    sequence_pages_fit_tails);
+
+// Bulk transfers
+STATIC_ASSERT(kCalibrationSize <= kPackedSize, buffer_fits_calibration);
+STATIC_ASSERT(kFlashPageSize <= kStreamBufferSize, buffer_fits_sequence_page);
+STATIC_ASSERT(kFlashPageSize / kSysexBulkChunkSize < 0x7f, bulk_chunks_fit);
 
-void StorageManager::SaveMulti(uint8_t slot) {
+void StorageManager::Init() {
+  log_.Init(kPresetLogEnd);
+  sequence_pages_.Init(kSequencePagesEnd);
+  log_save_slot_ = kNoLogSlot;
+  folded_slots_ = 0;
+  receiving_ = false;
+  bulk_transfer_ = BULK_TRANSFER_NONE;
+  bulk_page_ = 0;
+  bulk_chunk_ = 0;
+  bulk_ack_pending_ = false;
+  bulk_page_done_ = false;
+  pending_page_ = kNoPendingPage;
+  pending_sequence_pages_ = 0;
+  calibration_queued_ = false;
+  FormatSlots();
+}
+
+// A slot that was never saved gets the initial program, so that the first
+// save to it is logged like any other.
+void StorageManager::FormatSlots() {
   stream_buffer_.Rewind();
   multi.SerializePacked(&stream_buffer_);
-  storage_.Save(stream_buffer_.bytes(), stream_buffer_.position(), 1 + slot);
+  uint8_t* saved_image = stream_buffer_.mutable_bytes() + kPackedSize;
+  for (uint8_t slot = 0; slot < kNumFlashStoragePages - 1; ++slot) {
+    if (!storage_.Load(saved_image, kPackedSize, 1 + slot) &&
+        MarkRewritten(slot)) {
+      storage_.Save(stream_buffer_.bytes(), kPackedSize, 1 + slot);
+    }
+  }
 }
 
-bool StorageManager::LoadMulti(uint8_t slot) {
-  // Dummy serialization of the multi to know its size.
+bool StorageManager::SaveMulti(uint8_t slot) {
+  uint16_t held_size;
+  uint8_t stale_pages = StaleSequencePages(slot, &held_size);
+  bool erase_now = can_erase();
+  if (stale_pages && !erase_now && held_size > kPackedSize) {
+    return false;
+  }
+  // A program waiting to switch in may have been given the held tails.
+  if ((log_save_slot_ == slot || pending_page_ == 1 + slot) &&
+      bulk_transfer_ == BULK_TRANSFER_NONE &&
+      !(pending_sequence_pages_ && multi.queued_program())) {
+    // Replaced before it was written.  Records already logged for it are
+    // left uncommitted, and aborted by the next save.
+    log_save_slot_ = kNoLogSlot;
+    pending_page_ = kNoPendingPage;
+    pending_sequence_pages_ = 0;
+  } else if (!ClaimStreamBuffer()) {
+    return false;
+  }
   stream_buffer_.Rewind();
   multi.SerializePacked(&stream_buffer_);
-  uint32_t expected_size = stream_buffer_.position();
-  
-  if (!storage_.Load(stream_buffer_.mutable_bytes(), expected_size, 1 + slot)) {
-    return false;
+  if (stale_pages && !erase_now) {
+    pending_sequence_pages_ = stale_pages;
+    pending_page_ = 1 + slot;
+    HoldSequenceTails();
+    return true;
+  }
+  if (stale_pages) {
+    const uint8_t* tails[kNumParts];
+    LiveSequenceTails(tails);
+    for (uint8_t page = 0; page < kNumSequencePagesPerSlot; ++page) {
+      if (stale_pages & (1 << page)) {
+        WriteSequencePage(slot, page, tails);
+      }
+    }
+  }
+  // The tails are in place before the image that checks them is saved.
+  SaveImage(slot);
+  return true;
+}
+
+// The slot's sequence pages that don't hold the multi's tails, as a bit mask,
+// and the size of all the tails that go in them.
+uint8_t StorageManager::StaleSequencePages(
+    uint8_t slot, uint16_t* held_size) const {
+  uint16_t tail_sizes[kNumParts];
+  uint8_t stale_pages = 0;
+  for (uint8_t p = 0; p < kNumParts; ++p) {
+    PackedPart packed;
+    multi.part(p).Pack(packed);
+    const uint8_t* tail = multi.part(p).sequence().data() +
+        StepSequence::PackedHeadSize(packed);
+    tail_sizes[p] = StepSequence::PackedTailSize(packed);
+    if (!std::equal(tail, tail + tail_sizes[p], sequence_tail(slot, p))) {
+      stale_pages |= 1 << (p / kSequenceTailsPerPage);
+    }
+  }
+  *held_size = 0;
+  for (uint8_t p = 0; p < kNumParts; ++p) {
+    if (stale_pages & (1 << (p / kSequenceTailsPerPage))) {
+      *held_size += tail_sizes[p];
+    }
+  }
+  return stale_pages;
+}
+
+// The tails of the program at the start of the stream buffer, as the multi
+// holds them.
+void StorageManager::LiveSequenceTails(const uint8_t** tails) const {
+  const PackedMulti& image = *reinterpret_cast<const PackedMulti*>(
+      stream_buffer_.bytes());
+  for (uint8_t p = 0; p < kNumParts; ++p) {
+    tails[p] = multi.part(p).sequence().data() +
+        StepSequence::PackedHeadSize(image.parts[p]);
+  }
+}
+
+// The tails of the slot's program.  While it is being saved, those of the
+// pages still waiting follow its image in the stream buffer, one after the
+// other.
+void StorageManager::SavedSequenceTails(
+    uint8_t slot, const uint8_t** tails) const {
+  const PackedMulti& image = *reinterpret_cast<const PackedMulti*>(
+      stream_buffer_.bytes());
+  const uint8_t* held = stream_buffer_.bytes() + kPackedSize;
+  for (uint8_t p = 0; p < kNumParts; ++p) {
+    if (pending_page_ == 1 + slot &&
+        (pending_sequence_pages_ & (1 << (p / kSequenceTailsPerPage)))) {
+      tails[p] = held;
+      held += StepSequence::PackedTailSize(image.parts[p]);
+    } else {
+      tails[p] = sequence_tail(slot, p);
+    }
+  }
+}
+
+void StorageManager::HoldSequenceTails() {
+  const PackedMulti& image = *reinterpret_cast<const PackedMulti*>(
+      stream_buffer_.bytes());
+  const uint8_t* tails[kNumParts];
+  LiveSequenceTails(tails);
+  uint8_t* held = stream_buffer_.mutable_bytes() + kPackedSize;
+  for (uint8_t p = 0; p < kNumParts; ++p) {
+    if (pending_sequence_pages_ & (1 << (p / kSequenceTailsPerPage))) {
+      uint16_t size = StepSequence::PackedTailSize(image.parts[p]);
+      std::copy(tails[p], tails[p] + size, held);
+      held += size;
+    }
+  }
+}
+
+// Rewrites one of the slot's pages with the tails of the program at the start
+// of the stream buffer.
+void StorageManager::WriteSequencePage(
+    uint8_t slot, uint8_t page, const uint8_t* const* tails) {
+  const PackedMulti& image = *reinterpret_cast<const PackedMulti*>(
+      stream_buffer_.bytes());
+  const uint8_t* page_tails[kSequenceTailsPerPage];
+  uint16_t sizes[kSequenceTailsPerPage];
+  for (uint8_t half = 0; half < kSequenceTailsPerPage; ++half) {
+    uint8_t part = page * kSequenceTailsPerPage + half;
+    page_tails[half] = tails[part];
+    sizes[half] = StepSequence::PackedTailSize(image.parts[part]);
+  }
+  sequence_pages_.Write(
+      slot * kNumSequencePagesPerSlot + page, page_tails, sizes);
+}
+
+// From the last page, so that the tails of the others stay where
+// SavedSequenceTails finds them.  The image is saved after the last one, as
+// usual.  A power cut in between leaves the slot's previous program, whose
+// sequences no longer match their tails: they are cut to what it holds.
+void StorageManager::RewriteSequencePage() {
+  uint8_t slot = pending_page_ - 1;
+  uint8_t page = kNumSequencePagesPerSlot - 1;
+  while (!(pending_sequence_pages_ & (1 << page))) {
+    --page;
+  }
+  const uint8_t* tails[kNumParts];
+  SavedSequenceTails(slot, tails);
+  WriteSequencePage(slot, page, tails);
+  pending_sequence_pages_ &= ~(1 << page);
+  if (!pending_sequence_pages_) {
+    SaveImage(slot);
+  }
+}
+
+// The image is at the start of the stream buffer, where it waits for Tick
+// if the log can't take it yet.
+void StorageManager::SaveImage(uint8_t slot) {
+  pending_save_ = BeginLogSave(slot);
+  pending_page_ = pending_save_ == LOG_SAVE_STARTED ? kNoPendingPage : 1 + slot;
+}
+
+LogSave StorageManager::BeginLogSave(uint8_t slot) {
+  uint8_t* image = stream_buffer_.mutable_bytes();
+  uint8_t* saved_image = image + kPackedSize;
+  if (!storage_.Load(saved_image, kPackedSize, 1 + slot)) {
+    return LOG_SAVE_UNFIT;  // Nothing to patch
+  }
+  log_.Replay(slot, saved_image, kPackedSize);
+
+  uint16_t num_changes = 0;
+  for (uint16_t i = 0; i < kPackedSize; ++i) {
+    num_changes += image[i] != saved_image[i];
+  }
+  if (!num_changes) {
+    return LOG_SAVE_STARTED;
+  }
+  if (num_changes + kNumLogReservedRecords > log_.capacity()) {
+    return LOG_SAVE_UNFIT;
+  }
+  if (num_changes + kNumLogReservedRecords > log_.num_free_records()) {
+    return LOG_SAVE_FULL;
+  }
+  if (log_.uncommitted()) {
+    log_.Abort();
+  }
+  log_save_slot_ = slot;
+  log_save_offset_ = 0;
+  return LOG_SAVE_STARTED;
+}
+
+void StorageManager::ProgramNextLogRecord() {
+  const uint8_t* image = stream_buffer_.bytes();
+  const uint8_t* saved_image = image + kPackedSize;
+  while (log_save_offset_ < kPackedSize &&
+         image[log_save_offset_] == saved_image[log_save_offset_]) {
+    ++log_save_offset_;
+  }
+  if (log_save_offset_ < kPackedSize) {
+    log_.Append(log_save_slot_, log_save_offset_, image[log_save_offset_]);
+    ++log_save_offset_;
   } else {
-    DeserializeMultiPacked();
+    log_.Commit(log_save_slot_);
+    log_save_slot_ = kNoLogSlot;
+  }
+}
+
+void StorageManager::FinishLogSave() {
+  while (log_save_slot_ != kNoLogSlot) {
+    ProgramNextLogRecord();
+  }
+}
+
+// Records already logged for the slot would patch a rewritten page, so they
+// are marked as superseded.  Returns false if the log has no room to say so.
+bool StorageManager::MarkRewritten(uint8_t slot) {
+  return !log_.HasRecords(slot) || (
+      (!log_.uncommitted() || log_.Abort()) && log_.MarkRewritten(slot));
+}
+
+// The calibration has no log records.  Its image waits at the start of the
+// stream buffer, like a program's, for its page to be rewritten.
+void StorageManager::SaveCalibrationImage() {
+  pending_save_ = LOG_SAVE_UNFIT;
+  pending_page_ = 0;
+}
+
+// Rewriting sequence pages, compacting the log and rewriting the page all
+// erase, so they wait until nothing is playing.  Each Tick erases one page at
+// most.
+void StorageManager::TickPendingPage() {
+  if (can_erase()) {
+    StepPendingPage();
+  }
+}
+
+void StorageManager::StepPendingPage() {
+  if (pending_sequence_pages_) {
+    RewriteSequencePage();
+  } else if (pending_save_ == LOG_SAVE_FULL) {
+    CompactLog();
+    SaveImage(pending_page_ - 1);
+  } else {
+    RewritePendingPage();
+  }
+}
+
+void StorageManager::RewritePendingPage() {
+  if (pending_page_ == 0) {
+    storage_.Save(stream_buffer_.bytes(), kCalibrationSize, 0);
+  } else if (pending_page_ >= kNumFlashStoragePages) {
+    // A sequence page from a bulk restore
+    const uint8_t* tails[kSequenceTailsPerPage];
+    uint16_t sizes[kSequenceTailsPerPage];
+    for (uint8_t half = 0; half < kSequenceTailsPerPage; ++half) {
+      tails[half] = stream_buffer_.bytes() + half * kSequenceTailSize;
+      sizes[half] = kSequenceTailSize;
+    }
+    sequence_pages_.Write(pending_page_ - kNumFlashStoragePages, tails, sizes);
+  } else if (MarkRewritten(pending_page_ - 1)) {
+    storage_.Save(stream_buffer_.bytes(), kPackedSize, pending_page_);
+  } else {
+    CompactLog();  // Until the slot's records are folded away
+    return;
+  }
+  pending_page_ = kNoPendingPage;
+}
+
+void StorageManager::FlushPendingPage() {
+  while (pending_page_ != kNoPendingPage) {
+    StepPendingPage();
+  }
+  FinishLogSave();
+}
+
+bool StorageManager::ClaimStreamBuffer() {
+  if (can_erase()) {
+    FlushPendingPage();
+  } else if (pending_page_ == 0) {
+    pending_page_ = kNoPendingPage;
+    calibration_queued_ = true;
+  } else if (log_save_slot_ != kNoLogSlot ||
+             pending_page_ != kNoPendingPage) {
+    return false;
+  }
+  if (bulk_transfer_ != BULK_TRANSFER_NONE) {
+    EndBulkTransfer("B-");
+  }
+  receiving_ = false;
+  return true;
+}
+
+void StorageManager::Tick() {
+  uint8_t program = multi.PopRequestedProgram();
+  if (program < kNumFlashStoragePages - 1) {
+    LoadMulti(program);
+  } else if (log_save_slot_ != kNoLogSlot) {
+    // One record is two half-words, each stalling the CPU for ~50 us.
+    ProgramNextLogRecord();
+  } else if (pending_page_ != kNoPendingPage) {
+    TickPendingPage();
+  } else if (bulk_transfer_ == BULK_TRANSFER_DUMP) {
+    TickBulkDump();
+  } else if (bulk_transfer_ == BULK_TRANSFER_RESTORE) {
+    TickBulkRestore();
+  } else if (calibration_queued_ && !receiving_) {
+    SaveCalibration();
+  } else if (log_.needs_compaction() && !receiving_ && multi.idle()) {
+    CompactLog();
+  }
+}
+
+// Each step erases at most one page.
+void StorageManager::CompactLog() {
+  if (log_.empty()) {
+    return;
+  }
+  if (log_.has_stray_pages()) {
+    log_.EraseStrayPage();
+    return;
+  }
+  uint16_t slots = log_.OldestPageSlots() & ~folded_slots_;
+  if (slots) {
+    uint8_t slot = 0;
+    while (!(slots & (1 << slot))) {
+      ++slot;
+    }
+    Fold(slot);
+    folded_slots_ |= 1 << slot;
+    return;
+  }
+  // Replaying records that are already folded in changes nothing, so the
+  // later pages remain valid.
+  log_.EraseOldestPage();
+  folded_slots_ = 0;
+}
+
+// Works in the second half of the stream buffer, which leaves the image of a
+// waiting save alone.
+void StorageManager::Fold(uint8_t slot) {
+  uint8_t* image = stream_buffer_.mutable_bytes() + kPackedSize;
+  if (LoadImage(slot, image)) {
+    storage_.Save(image, kPackedSize, 1 + slot);
+  }
+}
+
+bool StorageManager::LoadImage(uint8_t slot, uint8_t* image) {
+  if (!storage_.Load(image, kPackedSize, 1 + slot)) {
+    return false;
+  }
+  log_.Replay(slot, image, kPackedSize);
+  return true;
+}
+
+bool StorageManager::LoadMulti(uint8_t slot) {
+  // The stream buffer is left alone, so a save to another slot can carry on.
+  // Pages aren't erased while a program waits to switch in, so it can be
+  // given its tails where they are.
+  const uint8_t* tails[kNumParts];
+  if (log_save_slot_ == slot || pending_page_ == 1 + slot) {
+    // Still being saved
+    std::copy(
+        stream_buffer_.bytes(), stream_buffer_.bytes() + kPackedSize,
+        reinterpret_cast<uint8_t*>(&preloaded_multi_));
+    SavedSequenceTails(slot, tails);
+    multi.QueueProgram(&preloaded_multi_, tails);
     return true;
   }
+  // A newer request replaces a program still waiting for its boundary.
+  if (!LoadImage(slot, reinterpret_cast<uint8_t*>(&preloaded_multi_))) {
+    // The waiting program may have been partly overwritten
+    multi.CancelQueuedProgram();
+    return false;
+  }
+  SavedSequenceTails(slot, tails);
+  multi.QueueProgram(&preloaded_multi_, tails);
+  return true;
+}
+
+bool StorageManager::LoadMorph(uint8_t slot_a, uint8_t slot_b) {
+  if (!ClaimStreamBuffer()) {
+    return false;
+  }
+  uint8_t* image_a = stream_buffer_.mutable_bytes();
+  uint8_t* image_b = image_a + kPackedSize;
+  if (!LoadImage(slot_a, image_a) || !LoadImage(slot_b, image_b)) {
+    return false;
+  }
+  const uint8_t* tails[kNumParts];
+  SavedSequenceTails(slot_a, tails);
+  stream_buffer_.Rewind();
+  multi.DeserializePacked(&stream_buffer_, tails);
+  // PackedMulti is packed, so the images can be used in place.
+  preset_morph.Start(
+      *reinterpret_cast<PackedMulti*>(image_a),
+      *reinterpret_cast<PackedMulti*>(image_b));
+  return true;
 }
 
 void StorageManager::SaveCalibration() {
+  calibration_queued_ = !ClaimStreamBuffer();
+  if (calibration_queued_) {
+    return;
+  }
   stream_buffer_.Rewind();
   multi.SerializeCalibration(&stream_buffer_);
-  storage_.Save(stream_buffer_.bytes(), stream_buffer_.position(), 0);
+  SaveCalibrationImage();
 }
 
 bool StorageManager::LoadCalibration() {
+  if (!ClaimStreamBuffer()) {
+    return false;
+  }
   stream_buffer_.Rewind();
   multi.SerializeCalibration(&stream_buffer_);
   uint32_t expected_size = stream_buffer_.position();
@@ -85,31 +517,248 @@ bool StorageManager::LoadCalibration() {
 }
 
 void StorageManager::SysExSendMultiPacked() {
-  stream_buffer_.Rewind();
-  multi.SerializePacked(&stream_buffer_);
-  midi_handler.SysExSendPackets(
-      stream_buffer_.bytes(),
-      stream_buffer_.position());
+  SysExPacketStream stream(SYSEX_COMMAND_DUMP_PACKET_PACKED);
+  multi.SerializePacked(&stream);
+  stream.Close();
 }
 
 void StorageManager::SysExSendMultiTagged() {
-  stream_buffer_.Rewind();
-  multi.SerializeTagged(&stream_buffer_);
-  midi_handler.SysExSendPackets(
-      stream_buffer_.bytes(),
-      stream_buffer_.position(),
-      SYSEX_COMMAND_DUMP_PACKET_TAGGED);
+  SysExPacketStream stream(SYSEX_COMMAND_DUMP_PACKET_TAGGED);
+  multi.SerializeTagged(&stream);
+  stream.Close();
+}
+
+bool StorageManager::StartBulkDump() {
+  if (!ClaimStreamBuffer()) {
+    return false;
+  }
+  bulk_transfer_ = BULK_TRANSFER_DUMP;
+  bulk_page_ = 0;
+  bulk_chunk_ = 0;
+  bulk_ack_pending_ = false;
+  bulk_retries_ = 0;
+  return true;
+}
+
+void StorageManager::TickBulkDump() {
+  if (bulk_ack_pending_) {
+    if (system_clock.milliseconds() - bulk_send_time_ < kBulkAckTimeout) {
+      return;
+    }
+    if (++bulk_retries_ > kBulkMaxRetries) {
+      EndBulkTransfer("B-");
+      return;
+    }
+    bulk_ack_pending_ = false;
+  }
+  uint8_t* image = stream_buffer_.mutable_bytes();
+  if (bulk_chunk_ == 0) {
+    // A page that can't be read goes as the empty chunk alone.
+    if (bulk_page_ == 0) {
+      bulk_size_ = storage_.Load(image, kCalibrationSize, 0)
+          ? kCalibrationSize : 0;
+    } else if (bulk_page_ >= kNumFlashStoragePages) {
+      const uint8_t* page = sequence_pages_.page(
+          bulk_page_ - kNumFlashStoragePages);
+      std::copy(page, page + kFlashPageSize, image);
+      bulk_size_ = kFlashPageSize;
+    } else {
+      bulk_size_ = LoadImage(bulk_page_ - 1, image) ? kPackedSize : 0;
+    }
+  }
+  // The chunk past the end of the image is the empty one.
+  uint16_t offset = bulk_chunk_ * kSysexBulkChunkSize;
+  uint16_t size = offset < bulk_size_
+      ? std::min<uint16_t>(bulk_size_ - offset, kSysexBulkChunkSize) : 0;
+  if (midi_handler.SysExTrySendBulkPacket(
+          bulk_page_, bulk_chunk_, image + offset, size)) {
+    bulk_ack_pending_ = true;
+    bulk_send_time_ = system_clock.milliseconds();
+  }
+}
+
+void StorageManager::OnBulkAck(uint8_t page, uint8_t chunk, bool ok) {
+  if (bulk_transfer_ != BULK_TRANSFER_DUMP || !bulk_ack_pending_ ||
+      page != bulk_page_ || chunk != bulk_chunk_) {
+    return;
+  }
+  bulk_ack_pending_ = false;
+  if (!ok) {
+    // Sent again by the next Tick
+    if (++bulk_retries_ > kBulkMaxRetries) {
+      EndBulkTransfer("B-");
+    }
+    return;
+  }
+  bulk_retries_ = 0;
+  if (bulk_chunk_ * kSysexBulkChunkSize < bulk_size_) {
+    ++bulk_chunk_;
+  } else if (++bulk_page_ < kNumBulkPages) {
+    bulk_chunk_ = 0;
+  } else {
+    EndBulkTransfer("B>");
+  }
+}
+
+void StorageManager::ReceiveBulkChunk(
+    uint8_t page, uint8_t chunk, const uint8_t* data, size_t size) {
+  if (bulk_transfer_ == BULK_TRANSFER_DUMP ||
+      (bulk_transfer_ == BULK_TRANSFER_RESTORE && bulk_ack_pending_) ||
+      page >= kNumBulkPages) {
+    return;  // The sender waits for our ack
+  }
+  // Our ack got lost, so the sender tried again
+  bool repeated = page == bulk_page_ && chunk + 1 == bulk_chunk_;
+  if (!repeated && (chunk == 0 || page != bulk_page_ ||
+                    bulk_transfer_ == BULK_TRANSFER_NONE)) {
+    if (!ClaimStreamBuffer()) {
+      return;  // Unacked, so the sender tries again
+    }
+    stream_buffer_.Rewind();
+    bulk_page_ = page;
+    bulk_chunk_ = 0;
+    bulk_size_ = 0;
+    bulk_page_done_ = false;
+  }
+  bulk_transfer_ = BULK_TRANSFER_RESTORE;
+  receiving_ = true;
+  bulk_ack_pending_ = true;
+  bulk_ack_status_ = 0;
+  if (repeated) {
+    return;
+  }
+  uint16_t page_size = page == 0 ? kCalibrationSize
+      : page < kNumFlashStoragePages ? kPackedSize : kFlashPageSize;
+  if (!data || chunk != bulk_chunk_ || bulk_size_ + size > page_size) {
+    // Answered with the chunk expected instead
+    bulk_ack_status_ = 1;
+    return;
+  }
+  if (size) {
+    stream_buffer_.Write(data, size);
+    bulk_size_ += size;
+    ++bulk_chunk_;
+    return;
+  }
+  if (bulk_size_ != page_size && bulk_size_ != 0) {
+    // Cut short: the page starts over
+    stream_buffer_.Rewind();
+    bulk_chunk_ = 0;
+    bulk_size_ = 0;
+    bulk_ack_status_ = 1;
+    return;
+  }
+  // An empty page in the dump leaves the slot as it is.  The ack waits for
+  // the page to be saved: a record per Tick once the log has room, or the
+  // whole page once nothing is playing.
+  if (bulk_size_ && page == 0) {
+    stream_buffer_.Rewind();
+    multi.DeserializeCalibration(&stream_buffer_);
+    SaveCalibrationImage();
+  } else if (bulk_size_ && page >= kNumFlashStoragePages) {
+    pending_save_ = LOG_SAVE_UNFIT;
+    pending_page_ = page;
+  } else if (bulk_size_) {
+    SaveImage(page - 1);
+  }
+  ++bulk_chunk_;
+  bulk_page_done_ = true;
+}
+
+void StorageManager::TickBulkRestore() {
+  if (!bulk_ack_pending_) {
+    return;
+  }
+  uint8_t chunk = bulk_ack_status_ ? bulk_chunk_ : bulk_chunk_ - 1;
+  if (!midi_handler.SysExTrySendBulkAck(bulk_page_, chunk, bulk_ack_status_)) {
+    return;
+  }
+  bulk_ack_pending_ = false;
+  if (bulk_page_done_) {
+    bulk_transfer_ = BULK_TRANSFER_NONE;
+    receiving_ = false;
+    if (bulk_page_ == kNumBulkPages - 1) {
+      ui.SplashString("B+");
+    }
+  }
+}
+
+void StorageManager::EndBulkTransfer(const char* result) {
+  bulk_transfer_ = BULK_TRANSFER_NONE;
+  bulk_ack_pending_ = false;
+  receiving_ = false;
+  ui.SplashString(result);
 }
 
 bool StorageManager::DeserializeMultiPacked() {
+  if (!receiving_) {
+    return false;  // Dropped
+  }
+  receiving_ = false;
   stream_buffer_.Rewind();
   multi.DeserializePacked(&stream_buffer_);
   return true;  // Packed format has no structural validation
 }
 
-bool StorageManager::DeserializeMultiTagged() {
+void StorageManager::AppendTaggedData(
+    const uint8_t* data, size_t size, bool first) {
+  if (first && ClaimStreamBuffer()) {
+    stream_buffer_.Rewind();
+    receiving_ = true;
+    tagged_receive_ = TAGGED_RECEIVE_VERSION;
+    tagged_skip_ = 0;
+  }
+  while (receiving_ && size--) {
+    ReceiveTaggedByte(*data++);
+  }
+}
+
+// The stream buffer holds the section being received, from its header on.
+void StorageManager::ReceiveTaggedByte(uint8_t byte) {
+  if (tagged_receive_ == TAGGED_RECEIVE_VERSION) {
+    tagged_receive_ = multi.BeginTagged(byte)
+        ? TAGGED_RECEIVE_SECTIONS : TAGGED_RECEIVE_FAILED;
+    return;
+  }
+  if (tagged_receive_ != TAGGED_RECEIVE_SECTIONS) {
+    return;
+  }
+  if (tagged_skip_) {
+    --tagged_skip_;
+    return;
+  }
+  stream_buffer_.Write(byte);
+  if (stream_buffer_.position() == 1 && byte == 0) {
+    tagged_receive_ = TAGGED_RECEIVE_DONE;  // End marker
+    return;
+  }
+  size_t received = stream_buffer_.position();
+  if (received < sizeof(Multi::TaggedSectionHeader)) {
+    return;
+  }
+  Multi::TaggedSectionHeader header;
   stream_buffer_.Rewind();
-  return multi.DeserializeTagged(&stream_buffer_);
+  stream_buffer_.Read(&header);
+  size_t section_end = sizeof(header) + header.length;
+  if (section_end > kStreamBufferSize) {
+    // Unknown to this firmware, which has no use for it
+    tagged_skip_ = header.length;
+    stream_buffer_.Rewind();
+  } else if (received == section_end) {
+    multi.DeserializeTaggedSection(&stream_buffer_, header.type, section_end);
+    multi.AfterDeserialize();
+    stream_buffer_.Rewind();
+  } else {
+    stream_buffer_.Seek(received);
+  }
+}
+
+bool StorageManager::DeserializeMultiTagged() {
+  if (!receiving_) {
+    return false;  // Dropped
+  }
+  receiving_ = false;
+  return tagged_receive_ == TAGGED_RECEIVE_DONE;
 }
 
 /* extern */
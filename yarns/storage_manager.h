@@ -34,45 +34,214 @@
 #include "stmlib/stmlib.h"
 
 #include "stmlib/utils/stream_buffer.h"
+#ifdef TEST
+#include "yarns/test/flash_storage.h"
+#else
 #include "stmlib/system/storage.h"
+#endif  // TEST
 
 #include "yarns/multi.h"
+#include "yarns/preset_log.h"
+#include "yarns/sequence_pages.h"
 
 namespace yarns {
 
-typedef stmlib::Storage<0x8020000, 9> FlashStorage;
+const uint32_t kFlashStorageEnd = 0x8020000;
+const uint16_t kNumFlashStoragePages = 9;
+typedef stmlib::Storage<kFlashStorageEnd, kNumFlashStoragePages> FlashStorage;
+// Each slot keeps the tails of its parts' sequences in pages of its own,
+// below the storage pages.  The preset log is below them.
+const uint8_t kNumSequencePagesPerSlot = kNumParts / kSequenceTailsPerPage;
+const uint32_t kSequencePagesEnd =
+    kFlashStorageEnd - kNumFlashStoragePages * kFlashPageSize;
+const uint32_t kPresetLogEnd =
+    kSequencePagesEnd - kNumSequencePages * kFlashPageSize;
+// A bulk transfer covers the storage pages, then the sequence pages.
+const uint8_t kNumBulkPages = kNumFlashStoragePages + kNumSequencePages;
 const uint16_t kPackedSize = sizeof(PackedMulti);
-// Must fit both packed and tagged payloads.
-const uint16_t kStreamBufferSize =
-    Multi::kTaggedPayloadSize > kPackedSize
-    ? Multi::kTaggedPayloadSize
-    : kPackedSize;
+// Must fit a program being saved along with the version it replaces, or with
+// the sequence tails waiting for their pages, and a section of a tagged
+// payload.
+const uint16_t kStreamBufferSize = 2 * kPackedSize;
+// Log records held back for a commit, an abort, and rewrite markers.
+const uint8_t kNumLogReservedRecords = 16;
+const uint8_t kNoLogSlot = 0xff;
+const uint8_t kNoPendingPage = 0xff;
+// 4 voices x 11 octaves x 2 bytes
+const uint16_t kCalibrationSize = kNumCVOutputs * kNumOctaves * 2;
+const uint32_t kBulkAckTimeout = 500;  // ms
+const uint8_t kBulkMaxRetries = 4;
+
+enum LogSave {
+  LOG_SAVE_STARTED,  // Or there was nothing to save
+  LOG_SAVE_FULL,  // Fits once the log is compacted
+  LOG_SAVE_UNFIT,  // The page has to be rewritten
+};
+
+enum TaggedReceive {
+  TAGGED_RECEIVE_VERSION,
+  TAGGED_RECEIVE_SECTIONS,
+  TAGGED_RECEIVE_DONE,  // The end marker came
+  TAGGED_RECEIVE_FAILED,
+};
+
+enum BulkTransfer {
+  BULK_TRANSFER_NONE,
+  BULK_TRANSFER_DUMP,
+  BULK_TRANSFER_RESTORE,
+};
 
 class StorageManager {
  public:
   StorageManager() { }
   ~StorageManager() { }
-  
-  void SaveMulti(uint8_t slot);
+
+  void Init();
+  // Returns false, leaving the slot unchanged, if a save to another slot is
+  // still being written while something plays.  A save to the same slot
+  // replaces it.  Sequence tails that have changed wait in the stream buffer
+  // for their pages to be rewritten once nothing plays, so the save is also
+  // refused if they take more than its second half.
+  bool SaveMulti(uint8_t slot);
+  // Decodes the slot into the shadow program, and queues it to replace the
+  // playing one at the multi's program change boundary.
   bool LoadMulti(uint8_t slot);
+  // Loads slot_a, and starts morphing its parts towards those of slot_b.
+  bool LoadMorph(uint8_t slot_a, uint8_t slot_b);
+  // Waits for a save in flight instead of being refused.
   void SaveCalibration();
   bool LoadCalibration();
+  // Both are sent as they are written, without the stream buffer.  A packed
+  // dump has no room for the tails of long sequences.
   void SysExSendMultiPacked();
   void SysExSendMultiTagged();
 
+  // Bulk transfer of every flash page: the calibration, the 8 program slots,
+  // then the sequence pages.  A page goes as numbered chunks followed by an
+  // empty one, and each chunk waits for the receiver's ack, so neither side
+  // has to keep up with the other.  Chunks are sent and restored pages written
+  // from Tick.
+  bool StartBulkDump();
+  void OnBulkAck(uint8_t page, uint8_t chunk, bool ok);
+  // data is NULL if the chunk arrived corrupted.
+  void ReceiveBulkChunk(
+      uint8_t page, uint8_t chunk, const uint8_t* data, size_t size);
+
+  // A dump is dropped if a save holds the stream buffer when it starts, or
+  // takes the buffer before it ends.
   void AppendData(const uint8_t* data, size_t size, bool rewind) {
-    if (rewind) {
+    if (rewind && ClaimStreamBuffer()) {
       stream_buffer_.Rewind();
+      receiving_ = true;
+    }
+    if (receiving_) {
+      stream_buffer_.Write(data, size);
     }
-    stream_buffer_.Write(data, size);
   }
   
+  // A tagged dump is applied a section at a time as it arrives, so that only
+  // a section has to be held.  It can be dropped like a packed one, which
+  // leaves the sections already applied.
+  void AppendTaggedData(const uint8_t* data, size_t size, bool first);
+
   bool DeserializeMultiPacked();
+  // Returns false if the dump was dropped, or ended before its end marker.
   bool DeserializeMultiTagged();
 
+  // Background work, run between block renders: loads a program requested by
+  // a program change, programs the next record of a save, moves a bulk
+  // transfer along, or starts a calibration save that was waiting.  Making
+  // room for a save that is waiting, and compaction, erase pages, so they
+  // wait until nothing is playing.
+  void Tick();
+
  private:
+  void FormatSlots();
+  LogSave BeginLogSave(uint8_t slot);
+  void ProgramNextLogRecord();
+  void FinishLogSave();
+  bool MarkRewritten(uint8_t slot);
+  void SaveCalibrationImage();
+  void TickPendingPage();
+  void StepPendingPage();
+  void RewritePendingPage();
+  void FlushPendingPage();
+  // Erasing waits until nothing plays, and until a program waiting to switch
+  // in no longer needs the sequence tails it was given.
+  inline bool can_erase() const {
+    return multi.idle() && !multi.queued_program();
+  }
+  inline const uint8_t* sequence_tail(uint8_t slot, uint8_t part) const {
+    return sequence_pages_.tail(
+        slot * kNumSequencePagesPerSlot + part / kSequenceTailsPerPage,
+        part % kSequenceTailsPerPage);
+  }
+  uint8_t StaleSequencePages(uint8_t slot, uint16_t* held_size) const;
+  void LiveSequenceTails(const uint8_t** tails) const;
+  void SavedSequenceTails(uint8_t slot, const uint8_t** tails) const;
+  void HoldSequenceTails();
+  void WriteSequencePage(
+      uint8_t slot, uint8_t page, const uint8_t* const* tails);
+  void RewriteSequencePage();
+  void ReceiveTaggedByte(uint8_t byte);
+  // Frees the stream buffer for something else, and ends a bulk transfer.  A
+  // save holding it is finished at once if nothing is playing; otherwise a
+  // calibration save gives way, to be started again by Tick, and a program's
+  // save keeps the buffer.  Returns false in that case.
+  bool ClaimStreamBuffer();
+  void SaveImage(uint8_t slot);
+  void TickBulkDump();
+  void TickBulkRestore();
+  void EndBulkTransfer(const char* result);
+  void CompactLog();
+  void Fold(uint8_t slot);
+  bool LoadImage(uint8_t slot, uint8_t* image);
+
   stmlib::StreamBuffer<kStreamBufferSize> stream_buffer_;
   FlashStorage storage_;
+  PresetLog log_;
+  SequencePages sequence_pages_;
+  // Decoded ahead of a program switch, while the multi plays on.
+  PackedMulti preloaded_multi_;
+
+  // While a save is being logged, the stream buffer holds the new image
+  // followed by the saved one.
+  uint8_t log_save_slot_;
+  uint16_t log_save_offset_;
+  // A save the log can't take yet, or the calibration.  Its image waits at
+  // the start of the stream buffer, for the log to be compacted or, failing
+  // that, for the page to be rewritten once nothing is playing.
+  uint8_t pending_page_;
+  LogSave pending_save_;
+  // The slot's sequence pages, as a bit mask, that wait to be rewritten
+  // before the program's image is saved.  Their tails follow the image.
+  uint8_t pending_sequence_pages_;
+  // The calibration gave way to something else, or waits for a save in
+  // flight.
+  bool calibration_queued_;
+  // Slots with records in the oldest log page that are already folded.
+  uint16_t folded_slots_;
+  // A SysEx dump is arriving in the stream buffer.
+  bool receiving_;
+  // A tagged dump's progress, and what is left of a section too large to be
+  // held, which is skipped.
+  TaggedReceive tagged_receive_;
+  uint16_t tagged_skip_;
+
+  // While a page is dumped or restored, the stream buffer holds its image.
+  BulkTransfer bulk_transfer_;
+  uint8_t bulk_page_;
+  // Dump: the chunk being sent.  Restore: the chunk expected next.
+  uint8_t bulk_chunk_;
+  // Dump: the size of the page image.  Restore: the bytes received so far.
+  uint16_t bulk_size_;
+  // Dump: waiting for an ack.  Restore: an ack is due.
+  bool bulk_ack_pending_;
+  // Restore: the empty chunk has been received, and the page written.
+  bool bulk_page_done_;
+  uint8_t bulk_ack_status_;
+  uint8_t bulk_retries_;
+  uint32_t bulk_send_time_;
   
   DISALLOW_COPY_AND_ASSIGN(StorageManager);
 };
@@ -50,6 +50,10 @@ class SyncedLFO {
 
   SyncedLFO() { }
   ~SyncedLFO() { }
+  void Init() {
+    phase_ = phase_increment_ = 0;
+    previous_phase_ = previous_target_phase_ = 0;
+  }
   void SetPhase(uint32_t phase) { phase_ = phase; }
   void RegisterPhase(uint32_t phase, bool force) {
     if (force) {
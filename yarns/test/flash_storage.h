@@ -0,0 +1,94 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Host stand-in for stmlib's flash storage: the pages are an array, and each
+// write to one counts as an erase.
+
+#ifndef YARNS_TEST_FLASH_STORAGE_H_
+#define YARNS_TEST_FLASH_STORAGE_H_
+
+#include <cstring>
+
+#include "stmlib/stmlib.h"
+
+namespace stmlib {
+
+template<uint32_t last_address = 0x8020000, uint16_t num_pages = 1>
+class Storage {
+ public:
+  enum {
+    PAGE_SIZE = 0x400,
+    // The checksum takes the rest of the page
+    MAX_DATA_SIZE = PAGE_SIZE - 4
+  };
+
+  static void Save(const void* data, size_t data_size, uint16_t page) {
+    uint8_t* bytes = mutable_page(page);
+    memset(bytes, 0xff, PAGE_SIZE);
+    memcpy(bytes, data, data_size);
+    uint32_t checksum = Checksum(data, data_size);
+    memcpy(bytes + data_size, &checksum, sizeof(checksum));
+    ++num_erases();
+  }
+
+  static bool Load(void* data, size_t data_size, uint16_t page) {
+    const uint8_t* bytes = mutable_page(page);
+    memcpy(data, bytes, data_size);
+    uint32_t checksum;
+    memcpy(&checksum, bytes + data_size, sizeof(checksum));
+    return checksum == Checksum(data, data_size);
+  }
+
+  // Where tests can corrupt a page
+  static uint8_t* mutable_page(uint16_t page) {
+    static uint8_t pages[num_pages][PAGE_SIZE];
+    static bool erased = false;
+    if (!erased) {
+      memset(pages, 0xff, sizeof(pages));
+      erased = true;
+    }
+    return pages[page];
+  }
+
+  static uint32_t& num_erases() {
+    static uint32_t count = 0;
+    return count;
+  }
+
+ private:
+  static uint32_t Checksum(const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint32_t checksum = 0;
+    while (size--) {
+      checksum = (checksum << 1 | checksum >> 31) ^ *bytes++;
+    }
+    return checksum;
+  }
+};
+
+}  // namespace stmlib
+
+#endif  // YARNS_TEST_FLASH_STORAGE_H_
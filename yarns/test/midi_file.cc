@@ -0,0 +1,231 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+//
+// Standard MIDI file reader for the host simulator.
+
+#include "yarns/test/midi_file.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace yarns {
+
+using namespace std;
+
+static uint32_t ReadBigEndian(const uint8_t* p, uint8_t num_bytes) {
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < num_bytes; ++i) {
+    value = (value << 8) | p[i];
+  }
+  return value;
+}
+
+static bool ReadVariableLength(
+    const uint8_t** p, const uint8_t* end, uint32_t* value) {
+  *value = 0;
+  for (uint8_t i = 0; i < 4; ++i) {
+    if (*p >= end) {
+      return false;
+    }
+    uint8_t byte = *(*p)++;
+    *value = (*value << 7) | (byte & 0x7f);
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* static */
+bool MidiFile::CompareEvents(const TrackEvent& a, const TrackEvent& b) {
+  return a.tick != b.tick ? a.tick < b.tick : a.order < b.order;
+}
+
+static bool CompareBytes(const TimedMidiByte& a, const TimedMidiByte& b) {
+  return a.time < b.time;
+}
+
+bool MidiFile::Load(const char* file_name) {
+  FILE* fp = fopen(file_name, "rb");
+  if (!fp) {
+    return false;
+  }
+  vector<uint8_t> file;
+  uint8_t chunk[4096];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+    file.insert(file.end(), chunk, chunk + read);
+  }
+  fclose(fp);
+
+  const uint8_t* p = file.empty() ? NULL : &file[0];
+  const uint8_t* end = p + file.size();
+  if (file.size() < 14 || ReadBigEndian(p, 4) != 0x4d546864) {  // MThd
+    return false;
+  }
+  uint32_t header_size = ReadBigEndian(p + 4, 4);
+  uint16_t num_tracks = ReadBigEndian(p + 10, 2);
+  division_ = ReadBigEndian(p + 12, 2);
+  if (division_ & 0x8000) {
+    // SMPTE time code is not supported.
+    return false;
+  }
+  p += 8 + header_size;
+
+  events_.clear();
+  for (uint16_t track = 0; track < num_tracks && p + 8 <= end; ++track) {
+    uint32_t chunk_type = ReadBigEndian(p, 4);
+    uint32_t chunk_size = ReadBigEndian(p + 4, 4);
+    p += 8;
+    if (p + chunk_size > end) {
+      return false;
+    }
+    if (chunk_type == 0x4d54726b) {  // MTrk
+      if (!ParseTrack(p, chunk_size, track)) {
+        return false;
+      }
+    }
+    p += chunk_size;
+  }
+  stable_sort(events_.begin(), events_.end(), CompareEvents);
+
+  // Convert ticks to seconds, following the tempo map.
+  double time = 0.0;
+  uint32_t tick = 0;
+  double seconds_per_tick = 0.5 / division_;  // 120 BPM until told otherwise.
+  bytes_.clear();
+  for (size_t i = 0; i < events_.size(); ++i) {
+    const TrackEvent& e = events_[i];
+    time += (e.tick - tick) * seconds_per_tick;
+    tick = e.tick;
+    if (e.tempo) {
+      seconds_per_tick = e.tempo * 1e-6 / division_;
+      continue;
+    }
+    for (size_t j = 0; j < e.data.size(); ++j) {
+      TimedMidiByte b = { time, e.data[j] };
+      bytes_.push_back(b);
+    }
+  }
+  events_.clear();
+  return true;
+}
+
+bool MidiFile::ParseTrack(
+    const uint8_t* data, size_t size, uint32_t track_index) {
+  const uint8_t* p = data;
+  const uint8_t* end = data + size;
+  uint32_t tick = 0;
+  uint8_t running_status = 0;
+  uint32_t order = track_index << 24;
+  while (p < end) {
+    uint32_t delta;
+    if (!ReadVariableLength(&p, end, &delta) || p >= end) {
+      return false;
+    }
+    tick += delta;
+
+    TrackEvent e;
+    e.tick = tick;
+    e.order = order++;
+    e.tempo = 0;
+
+    uint8_t status = *p;
+    if (status & 0x80) {
+      ++p;
+    } else {
+      status = running_status;
+      if (!status) {
+        return false;
+      }
+    }
+
+    if (status == 0xff) {
+      if (p >= end) {
+        return false;
+      }
+      uint8_t type = *p++;
+      uint32_t length;
+      if (!ReadVariableLength(&p, end, &length) || p + length > end) {
+        return false;
+      }
+      if (type == 0x51 && length == 3) {
+        e.tempo = ReadBigEndian(p, 3);
+        events_.push_back(e);
+      } else if (type == 0x2f) {
+        break;
+      }
+      p += length;
+    } else if (status == 0xf0 || status == 0xf7) {
+      uint32_t length;
+      if (!ReadVariableLength(&p, end, &length) || p + length > end) {
+        return false;
+      }
+      if (status == 0xf0) {
+        e.data.push_back(0xf0);
+      }
+      e.data.insert(e.data.end(), p, p + length);
+      events_.push_back(e);
+      p += length;
+      running_status = 0;
+    } else {
+      uint8_t type = status & 0xf0;
+      uint8_t num_data_bytes = (type == 0xc0 || type == 0xd0) ? 1 : 2;
+      if (p + num_data_bytes > end) {
+        return false;
+      }
+      e.data.push_back(status);
+      e.data.insert(e.data.end(), p, p + num_data_bytes);
+      events_.push_back(e);
+      p += num_data_bytes;
+      running_status = status;
+    }
+  }
+  return true;
+}
+
+void MidiFile::Append(
+    double time, uint8_t status, uint8_t data_1, uint8_t data_2) {
+  TimedMidiByte bytes[3] = { { time, status }, { time, data_1 }, { time, data_2 } };
+  bytes_.insert(bytes_.end(), bytes, bytes + 3);
+}
+
+void MidiFile::Append(double time, uint8_t status, uint8_t data_1) {
+  TimedMidiByte bytes[2] = { { time, status }, { time, data_1 } };
+  bytes_.insert(bytes_.end(), bytes, bytes + 2);
+}
+
+void MidiFile::AppendByte(double time, uint8_t byte) {
+  TimedMidiByte b = { time, byte };
+  bytes_.push_back(b);
+}
+
+void MidiFile::Sort() {
+  stable_sort(bytes_.begin(), bytes_.end(), CompareBytes);
+}
+
+}  // namespace yarns
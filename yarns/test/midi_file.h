@@ -0,0 +1,86 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+//
+// Standard MIDI file reader for the host simulator. Flattens all tracks into
+// a single stream of timestamped MIDI bytes, as they would arrive on the
+// UART.
+
+#ifndef YARNS_TEST_MIDI_FILE_H_
+#define YARNS_TEST_MIDI_FILE_H_
+
+#include "stmlib/stmlib.h"
+
+#include <vector>
+
+namespace yarns {
+
+struct TimedMidiByte {
+  // Time of arrival in seconds since the start of the file.
+  double time;
+  uint8_t byte;
+};
+
+class MidiFile {
+ public:
+  MidiFile() { }
+  ~MidiFile() { }
+
+  bool Load(const char* file_name);
+
+  // Appends a short message, for building sequences without a file.
+  void Append(double time, uint8_t status, uint8_t data_1, uint8_t data_2);
+  void Append(double time, uint8_t status, uint8_t data_1);
+  // Appends a single byte, for streams using running status.
+  void AppendByte(double time, uint8_t byte);
+  void Sort();
+
+  inline const std::vector<TimedMidiByte>& bytes() const { return bytes_; }
+  inline double duration() const {
+    return bytes_.empty() ? 0.0 : bytes_.back().time;
+  }
+
+ private:
+  struct TrackEvent {
+    uint32_t tick;
+    uint32_t order;
+    uint32_t tempo;  // Set for tempo meta-events, 0 otherwise.
+    std::vector<uint8_t> data;
+  };
+
+  static bool CompareEvents(const TrackEvent& a, const TrackEvent& b);
+  bool ParseTrack(const uint8_t* data, size_t size, uint32_t track_index);
+
+  std::vector<TrackEvent> events_;
+  std::vector<TimedMidiByte> bytes_;
+  uint16_t division_;
+
+  DISALLOW_COPY_AND_ASSIGN(MidiFile);
+};
+
+}  // namespace yarns
+
+#endif  // YARNS_TEST_MIDI_FILE_H_
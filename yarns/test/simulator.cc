@@ -0,0 +1,481 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+//
+// Host simulator.
+
+#include "yarns/test/simulator.h"
+
+#include <algorithm>
+#include <time.h>
+
+#include "stmlib/system/system_clock.h"
+
+#include "yarns/event_queue.h"
+#include "yarns/midi_handler.h"
+#include "yarns/multi.h"
+#include "yarns/preset_morph.h"
+#include "yarns/settings.h"
+#include "yarns/ui.h"
+
+namespace yarns {
+
+using namespace stmlib;
+
+STATIC_ASSERT(kSimulationHz % kSysTickHz == 0, systick_period);
+
+// The UI is not simulated: splash messages and debug output are discarded.
+Ui ui;
+void Ui::SplashString(const char* text) { }
+void Ui::SplashPartString(const char* label, uint8_t part) { }
+void Ui::SplashSetting(const Setting& s, uint8_t part) { }
+void Ui::PrintDebugByte(uint8_t byte) { }
+void Ui::PrintInt32E(int32_t value) { }
+
+static const char* const stage_names[STAGE_LAST] = {
+  "SysTick_Handler",
+  "midi.ProcessInput",
+  "multi.LowPriority",
+  "preset_morph.Tick",
+  "storage (load)",
+  "RenderSamples 1",
+  "RenderSamples 2",
+  "RenderSamples 3",
+  "RenderSamples 4",
+};
+
+static const char* const profiler_stage_names[PROFILER_STAGE_LAST] = {
+  "SysTick_Handler",
+  "ui.Poll",
+  "multi.Refresh",
+  "multi.GetCvGate",
+  "dac.UpdateDC",
+  "DMA IRQ",
+  "RenderSamples",
+  "Block fill latency",
+};
+
+#define TIME_STAGE(stage, statement) do { \
+  uint64_t start_ = ReadCycleCounter(); \
+  statement; \
+  counters_[stage].Add(ReadCycleCounter() - start_); \
+} while (0)
+
+void Simulator::Init() {
+  system_clock.Init();
+  setting_defs.Init();
+  multi.Init(true);
+  preset_morph.Init();
+  dac.Init();
+  event_queue.Init();
+  midi_handler.Init();
+  profiler.Init();
+
+  std::fill(&cv_[0], &cv_[kNumCVOutputs], 0);
+  std::fill(&gate_[0], &gate_[kNumCVOutputs], false);
+  std::fill(&gate_output_[0], &gate_output_[kNumCVOutputs], false);
+  std::fill(&latched_dac_code_[0], &latched_dac_code_[kNumCVOutputs], 0);
+  systick_counter_ = 0;
+  dma_cursor_frame_ = 0;
+  num_simulation_ticks_ = 0;
+  num_frames_ = num_systicks_ = num_blocks_filled_ = 0;
+  num_midi_bytes_in_ = num_midi_bytes_out_ = 0;
+  wav_ = NULL;
+  capture_ = NULL;
+  capture_gates_ = NULL;
+  midi_output_log_ = NULL;
+  programs_ = NULL;
+  num_programs_ = 0;
+  preload_programs_ = false;
+  program_switch_log_ = NULL;
+  after_input_ = NULL;
+  main_loop_hold_ = 0;
+  stall_start_ = stall_end_ = 0;
+  midi_rx_read_ptr_ = midi_rx_write_ptr_ = 0;
+  for (uint8_t i = 0; i < STAGE_LAST; ++i) {
+    counters_[i].Init();
+  }
+}
+
+static void WriteLE(FILE* fp, uint32_t value, uint8_t num_bytes) {
+  for (uint8_t i = 0; i < num_bytes; ++i) {
+    fputc((value >> (i * 8)) & 0xff, fp);
+  }
+}
+
+static void WriteWavHeader(FILE* fp, uint32_t frame_hz, uint32_t num_frames) {
+  const uint32_t bytes_per_frame = kNumCVOutputs * sizeof(int16_t);
+  const uint32_t data_size = num_frames * bytes_per_frame;
+  fwrite("RIFF", 4, 1, fp);
+  WriteLE(fp, 36 + data_size, 4);
+  fwrite("WAVEfmt ", 8, 1, fp);
+  WriteLE(fp, 16, 4);
+  WriteLE(fp, 1, 2);  // PCM
+  WriteLE(fp, kNumCVOutputs, 2);
+  WriteLE(fp, frame_hz, 4);
+  WriteLE(fp, frame_hz * bytes_per_frame, 4);
+  WriteLE(fp, bytes_per_frame, 2);
+  WriteLE(fp, 16, 2);
+  fwrite("data", 4, 1, fp);
+  WriteLE(fp, data_size, 4);
+}
+
+bool Simulator::OpenWav(const char* file_name) {
+  wav_ = fopen(file_name, "wb");
+  if (!wav_) {
+    return false;
+  }
+  // Changing layout mid-run changes the DAC rate; the header keeps the first.
+  wav_num_frames_ = 0;
+  wav_frame_hz_ = dac.frame_hz();
+  WriteWavHeader(wav_, wav_frame_hz_, 0);
+  return true;
+}
+
+void Simulator::CloseWav() {
+  if (!wav_) {
+    return;
+  }
+  fseek(wav_, 0, SEEK_SET);
+  WriteWavHeader(wav_, wav_frame_hz_, wav_num_frames_);
+  fclose(wav_);
+  wav_ = NULL;
+}
+
+void Simulator::WriteFrame() {
+  if (capture_) {
+    capture_->push_back(latched_dac_code_[capture_channel_]);
+  }
+  if (capture_gates_) {
+    capture_gates_->push_back(gate_output_[capture_gate_channel_]);
+  }
+  if (!wav_) {
+    return;
+  }
+  for (uint8_t channel = 0; channel < kNumCVOutputs; ++channel) {
+    // DAC codes are offset binary; the WAV file is two's complement.
+    WriteLE(wav_, latched_dac_code_[channel] ^ 0x8000, 2);
+  }
+  ++wav_num_frames_;
+}
+
+void Simulator::Run(const MidiFile& midi_file, double duration) {
+  const std::vector<TimedMidiByte>& midi_bytes = midi_file.bytes();
+  size_t midi_byte_index = 0;
+
+  const uint64_t end = static_cast<uint64_t>(duration * kSimulationHz);
+  uint64_t next_systick = 0;
+  uint64_t next_frame = 0;
+  // The UART receives a byte at most every byte time, and DMA writes the
+  // bytes received until the next SysTick to the buffer.
+  uint64_t midi_rx_end = 0;
+  midi_tx_ready_ = 0;
+  uint64_t main_loop_ready = 0;
+  while (next_systick < end || next_frame < end) {
+    uint64_t time = std::min(next_systick, next_frame);
+    if (next_systick <= next_frame) {
+      while (midi_byte_index < midi_bytes.size()) {
+        const TimedMidiByte& b = midi_bytes[midi_byte_index];
+        uint64_t rx_end = std::max(
+            static_cast<uint64_t>(b.time * kSimulationHz), midi_rx_end) +
+            kSimulationTicksPerMidiByte;
+        if (rx_end > next_systick) break;
+        midi_rx_end = rx_end;
+        midi_rx_buffer_[midi_rx_write_ptr_] = b.byte;
+        midi_rx_write_ptr_ = (midi_rx_write_ptr_ + 1) & \
+            (kMidiRxDmaBufferSize - 1);
+        ++num_midi_bytes_in_;
+        ++midi_byte_index;
+      }
+      now_ = next_systick;
+      TIME_STAGE(STAGE_SYSTICK, SysTick());
+      next_systick += kSimulationTicksPerSysTick;
+    } else {
+      TransferFrame();
+      next_frame += kSimulationHz / dac.frame_hz();
+    }
+    bool stalled = time >= stall_start_ && time < stall_end_;
+    if (!stalled && time >= main_loop_ready && MainLoop()) {
+      main_loop_ready = time + main_loop_hold_;
+    }
+  }
+  num_simulation_ticks_ += end;
+}
+
+void Simulator::SysTick() {
+  PROFILE_BEGIN(systick_start);
+  ++num_systicks_;
+  if ((++systick_counter_ & 7) == 0) {
+    system_clock.Tick();
+  }
+
+  uint8_t num_midi_bytes = (midi_rx_write_ptr_ - midi_rx_read_ptr_) & \
+      (kMidiRxDmaBufferSize - 1);
+  if (num_midi_bytes) {
+    uint16_t frames_per_byte = \
+        dac.frame_hz() * kSimulationTicksPerMidiByte / kSimulationHz;
+    uint16_t frame = dac.frame_counter() - \
+        (num_midi_bytes - 1) * frames_per_byte;
+    uint8_t num_queued = event_queue.num_writable_midi_bytes();
+    if (num_queued > num_midi_bytes) {
+      num_queued = num_midi_bytes;
+    }
+    uint8_t num_left = num_midi_bytes - num_queued;
+    if (num_left > kMidiRxDmaBufferSize - kMidiRxDmaHeadroom) {
+      uint8_t num_skipped = num_left - \
+          (kMidiRxDmaBufferSize - kMidiRxDmaHeadroom);
+      midi_rx_read_ptr_ = (midi_rx_read_ptr_ + num_skipped) & \
+          (kMidiRxDmaBufferSize - 1);
+      event_queue.CountDropped(num_skipped);
+      frame += num_skipped * frames_per_byte;
+    }
+    while (num_queued--) {
+      event_queue.Push(
+          EVENT_MIDI_BYTE, midi_rx_buffer_[midi_rx_read_ptr_], frame);
+      midi_rx_read_ptr_ = (midi_rx_read_ptr_ + 1) & \
+          (kMidiRxDmaBufferSize - 1);
+      frame += frames_per_byte;
+    }
+  }
+
+  // The UART takes a byte once it has sent the previous one.
+  if (now_ >= midi_tx_ready_) {
+    bool sent = true;
+    uint8_t byte = 0;
+    if (midi_handler.mutable_high_priority_output_buffer()->readable()) {
+      byte = midi_handler.mutable_high_priority_output_buffer()->ImmediateRead();
+    } else if (midi_handler.mutable_output_buffer()->readable()) {
+      byte = midi_handler.mutable_output_buffer()->ImmediateRead();
+    } else {
+      sent = false;
+    }
+    if (sent) {
+      ++num_midi_bytes_out_;
+      midi_tx_ready_ = now_ + kSimulationTicksPerMidiByte;
+      if (midi_output_log_) {
+        TimedMidiByte b = {
+          static_cast<double>(now_) / kSimulationHz, byte
+        };
+        midi_output_log_->push_back(b);
+      }
+    }
+  }
+
+  bool refresh = (systick_counter_ & 1) == 0;
+  if (refresh) {
+    std::copy(&gate_[0], &gate_[kNumCVOutputs], &gate_output_[0]);
+  }
+  multi.UpdateResetPulse();
+  if (refresh) {
+    multi.RefreshInternalClock();
+    PROFILE(PROFILER_STAGE_MULTI_REFRESH, multi.Refresh());
+    PROFILE(PROFILER_STAGE_GET_CV_GATE, multi.GetCvGate(cv_, gate_));
+
+    if (midi_handler.calibrating()) {
+      const CVOutput& voice = multi.cv_output(midi_handler.calibration_voice());
+      cv_[midi_handler.calibration_voice()] = voice.calibration_dac_code(
+          midi_handler.calibration_note());
+    }
+
+    PROFILE_BEGIN(update_dc_start);
+    uint16_t frame = dac.frame_counter();
+    for (uint8_t channel = 0; channel < kNumCVOutputs; ++channel) {
+      CVOutput* output = multi.mutable_cv_output(channel);
+      if (output->is_high_freq()) continue;
+      output->PushDCControlPoint(cv_[channel], frame);
+      if (!output->is_interpolated()) {
+        dac.UpdateDC(channel, output->DelayedDC(frame));
+      }
+    }
+    PROFILE_END(PROFILER_STAGE_UPDATE_DC, update_dc_start);
+  }
+  PROFILE_END(PROFILER_STAGE_SYSTICK, systick_start);
+}
+
+void Simulator::TransferFrame() {
+  const volatile uint16_t* words = \
+      &dac.spi_tx_buffer_[dma_cursor_frame_ * kDacWordsPerFrame];
+  for (uint8_t i = 0; i < kNumCVOutputs; ++i) {
+    uint16_t high = words[i << kDacWordsPerSampleBits];
+    uint16_t low = words[(i << kDacWordsPerSampleBits) + 1];
+    // Frames addressed to another DAC (NOOPs) leave the output unchanged.
+    if (high & kNoopHighWord) {
+      continue;
+    }
+    uint8_t channel = kNumCVOutputs - 1 - ((high >> 9) & 0x3);
+    latched_dac_code_[channel] = ((high & 0xff) << 8) | (low >> 8);
+  }
+  WriteFrame();
+  ++num_frames_;
+
+  ++dma_cursor_frame_;
+  if (dma_cursor_frame_ == kTotalFrames) {
+    dma_cursor_frame_ = 0;
+  }
+  dac.simulated_dma_cursor_frame_ = dma_cursor_frame_;
+  if (dma_cursor_frame_ == kAudioBlockSize) {
+    PROFILE(PROFILER_STAGE_DMA_IRQ, dac.OnBlockConsumed(true));
+    profiler.OnBlockConsumed();
+  } else if (dma_cursor_frame_ == 0) {
+    PROFILE(PROFILER_STAGE_DMA_IRQ, dac.OnBlockConsumed(false));
+    profiler.OnBlockConsumed();
+  }
+}
+
+void Simulator::ProcessInput() {
+  midi_handler.ProcessInput();
+  if (after_input_) {
+    after_input_();
+  }
+}
+
+bool Simulator::MainLoop() {
+  bool waiting = multi.queued_program() != NULL;
+  uint64_t start = ReadCycleCounter();
+  TIME_STAGE(STAGE_PROCESS_INPUT, ProcessInput());
+  TIME_STAGE(STAGE_LOW_PRIORITY, multi.LowPriority());
+  if (waiting && !multi.queued_program()) {
+    LogProgramSwitch(ReadCycleCounter() - start);
+  }
+  TIME_STAGE(STAGE_PRESET_MORPH, preset_morph.Tick());
+  uint8_t* block_num_ptr = dac.PtrToFillableBlockNum();
+  if (block_num_ptr) {
+    uint8_t block = *block_num_ptr;
+    PROFILE_BEGIN(render_start);
+    for (uint8_t channel = 0; channel < kNumCVOutputs; ++channel) {
+      TIME_STAGE(
+        static_cast<SimulatorStage>(STAGE_RENDER_SAMPLES_1 + channel),
+        multi.mutable_cv_output(channel)->RenderSamples(
+            block, channel, cv_[channel])
+      );
+    }
+    PROFILE_END(PROFILER_STAGE_RENDER_SAMPLES, render_start);
+    profiler.OnBlockFilled();
+    ++num_blocks_filled_;
+    if (programs_) {
+      TIME_STAGE(STAGE_LOAD_PROGRAM, LoadRequestedProgram());
+    }
+  }
+  return block_num_ptr != NULL;
+}
+
+void Simulator::LoadRequestedProgram() {
+  uint64_t start = ReadCycleCounter();
+  uint8_t program = multi.PopRequestedProgram();
+  if (program >= num_programs_) {
+    return;
+  }
+  if (preload_programs_) {
+    shadow_program_ = programs_[program];
+    multi.QueueProgram(&shadow_program_);
+    if (multi.queued_program()) {
+      return;  // Logged by the main loop once swapped in
+    }
+  } else {
+    PackedMultiStream stream = { &programs_[program] };
+    multi.DeserializePacked(&stream);
+    // Controller values were also inferred all at once
+    multi.InferControllerValues(128);
+  }
+  LogProgramSwitch(ReadCycleCounter() - start);
+}
+
+void Simulator::LogProgramSwitch(uint64_t cycles) {
+  if (program_switch_log_) {
+    TimedProgramSwitch s = {
+      static_cast<double>(now_) / kSimulationHz, cycles
+    };
+    program_switch_log_->push_back(s);
+  }
+}
+
+/* static */
+double Simulator::cycle_counter_hz() {
+  static double hz = 0.0;
+  if (hz == 0.0) {
+    timespec start_time, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    uint64_t start = ReadCycleCounter();
+    do {
+      clock_gettime(CLOCK_MONOTONIC, &end_time);
+    } while ((end_time.tv_sec - start_time.tv_sec) * 1e9 +
+             (end_time.tv_nsec - start_time.tv_nsec) < 2e7);
+    uint64_t end = ReadCycleCounter();
+    hz = (end - start) / ((end_time.tv_sec - start_time.tv_sec) +
+                          (end_time.tv_nsec - start_time.tv_nsec) * 1e-9);
+  }
+  return hz;
+}
+
+double Simulator::cpu_load() const {
+  uint64_t total = 0;
+  for (uint8_t i = 0; i < STAGE_LAST; ++i) {
+    total += counters_[i].total;
+  }
+  double seconds = simulated_seconds();
+  return seconds > 0.0 ? total / (seconds * cycle_counter_hz()) : 0.0;
+}
+
+void Simulator::PrintReport() const {
+  double seconds = simulated_seconds();
+  printf("Simulated %.2f s at %u Hz: %llu SysTicks, %llu blocks, "
+         "%llu MIDI bytes in, %llu out, %u events dropped\n",
+         seconds,
+         static_cast<unsigned>(dac.frame_hz()),
+         static_cast<unsigned long long>(num_systicks_),
+         static_cast<unsigned long long>(num_blocks_filled_),
+         static_cast<unsigned long long>(num_midi_bytes_in_),
+         static_cast<unsigned long long>(num_midi_bytes_out_),
+         static_cast<unsigned>(event_queue.num_dropped()));
+  printf("%-20s %10s %10s %10s %14s\n",
+         "Stage", "Calls", "Mean", "Max", "Per second");
+  for (uint8_t i = 0; i < STAGE_LAST; ++i) {
+    const CycleCounter& c = counters_[i];
+    printf("%-20s %10llu %10.0f %10llu %14.0f\n",
+           stage_names[i],
+           static_cast<unsigned long long>(c.calls),
+           c.calls ? static_cast<double>(c.total) / c.calls : 0.0,
+           static_cast<unsigned long long>(c.max),
+           seconds > 0.0 ? c.total / seconds : 0.0);
+  }
+
+  printf("\nInterrupt profiler (bins in eighths of the stage deadline, "
+         "last bin = overrun)\n");
+  printf("%-20s %10s %10s %10s  %s\n", "Stage", "Count", "Min", "Max", "Bins");
+  for (uint8_t i = 0; i < PROFILER_STAGE_LAST; ++i) {
+    const ProfilerStageStats& s = profiler.stats(
+        static_cast<ProfilerStage>(i));
+    printf("%-20s %10u %10u %10u ",
+           profiler_stage_names[i],
+           s.count, s.count ? s.min : 0, s.max);
+    for (uint8_t bin = 0; bin < kProfilerNumBins; ++bin) {
+      printf(" %u", s.histogram[bin]);
+    }
+    printf("\n");
+  }
+}
+
+}  // namespace yarns
@@ -0,0 +1,251 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+//
+// Host simulator. Stands in for the SysTick and DMA interrupts of yarns.cc,
+// the DAC and the MIDI UART, and records the 4 CV outputs to a WAV file.
+
+#ifndef YARNS_TEST_SIMULATOR_H_
+#define YARNS_TEST_SIMULATOR_H_
+
+#include "stmlib/stmlib.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "yarns/drivers/dac.h"
+#include "yarns/multi.h"
+#include "yarns/profiler.h"
+#include "yarns/test/midi_file.h"
+
+namespace yarns {
+
+// Time base in which both the SysTick (8 kHz) and every DAC frame rate
+// (45, 60 or 90 kHz) fall on integer ticks.
+const uint32_t kSimulationHz = 360000;
+const uint32_t kSysTickHz = 8000;
+const uint32_t kSimulationTicksPerSysTick = kSimulationHz / kSysTickHz;
+// 31250 bauds, 10 bits per byte
+const uint32_t kSimulationTicksPerMidiByte = kSimulationHz / 3125;
+// The UART's RX DMA buffer, and the room SysTick keeps free in it, as in
+// drivers/midi_io.h
+const uint8_t kMidiRxDmaBufferSize = 64;
+const uint8_t kMidiRxDmaHeadroom = 8;
+
+enum SimulatorStage {
+  STAGE_SYSTICK,
+  STAGE_PROCESS_INPUT,
+  STAGE_LOW_PRIORITY,
+  STAGE_PRESET_MORPH,
+  STAGE_LOAD_PROGRAM,
+  STAGE_RENDER_SAMPLES_1,
+  STAGE_RENDER_SAMPLES_2,
+  STAGE_RENDER_SAMPLES_3,
+  STAGE_RENDER_SAMPLES_4,
+  STAGE_LAST
+};
+
+// Serializes the multi into, or loads it from, a PackedMulti in memory.
+struct PackedMultiStream {
+  PackedMulti* packed;
+  template<typename T> void Write(const T& value) {
+    memcpy(packed, &value, sizeof(value));
+  }
+  template<typename T> void Read(T* value) {
+    memcpy(value, packed, sizeof(*value));
+  }
+};
+
+struct TimedProgramSwitch {
+  double time;  // In seconds
+  // Spent by the stages of the main loop iteration that made the switch
+  uint64_t cycles;
+};
+
+struct CycleCounter {
+  uint64_t calls;
+  uint64_t total;
+  uint64_t max;
+
+  void Init() {
+    calls = total = max = 0;
+  }
+  inline void Add(uint64_t cycles) {
+    ++calls;
+    total += cycles;
+    if (cycles > max) {
+      max = cycles;
+    }
+  }
+};
+
+class Simulator {
+ public:
+  Simulator() { }
+  ~Simulator() { }
+
+  // Resets the firmware state the same way yarns.cc's Init() does, minus
+  // storage and hardware.
+  void Init();
+  bool OpenWav(const char* file_name);
+  void CloseWav();
+  // Appends the DAC code of a channel to samples at every frame, and the
+  // state of its gate output to gates if given.
+  void Capture(uint8_t channel, std::vector<uint16_t>* samples,
+               std::vector<bool>* gates = NULL) {
+    capture_channel_ = capture_gate_channel_ = channel;
+    capture_ = samples;
+    capture_gates_ = gates;
+  }
+  // Appends the state of another channel's gate output at every frame.
+  void CaptureGates(uint8_t channel, std::vector<bool>* gates) {
+    capture_gate_channel_ = channel;
+    capture_gates_ = gates;
+  }
+  // Appends every byte sent to the MIDI out, with the time it was sent.
+  void LogMidiOutput(std::vector<TimedMidiByte>* log) {
+    midi_output_log_ = log;
+  }
+
+  // Stands in for the storage manager, loading the programs requested by
+  // program changes from a bank in memory after each block render.  Without
+  // preload, a program is deserialized straight into the multi, and its
+  // controller values inferred, as the storage manager once did.
+  void LoadPrograms(PackedMulti* programs, uint8_t num_programs, bool preload) {
+    programs_ = programs;
+    num_programs_ = num_programs;
+    preload_programs_ = preload;
+  }
+  // Appends each switch to a loaded program.
+  void LogProgramSwitches(std::vector<TimedProgramSwitch>* log) {
+    program_switch_log_ = log;
+  }
+
+  // Calls fn after each pass of the main loop's MIDI input processing, inside
+  // its timing.
+  void AfterInput(void (*fn)()) {
+    after_input_ = fn;
+  }
+
+  // Keeps the main loop from running for the given time (in seconds) after
+  // each block it renders, as a slower render would.
+  void HoldMainLoop(double duration) {
+    main_loop_hold_ = static_cast<uint64_t>(duration * kSimulationHz);
+  }
+
+  // Keeps the main loop from running for the given time (in seconds) from
+  // the given time into each run.
+  void StallMainLoop(double start, double duration) {
+    stall_start_ = static_cast<uint64_t>(start * kSimulationHz);
+    stall_end_ = stall_start_ + \
+        static_cast<uint64_t>(duration * kSimulationHz);
+  }
+
+  // Plays the MIDI stream for the given duration (in seconds).
+  void Run(const MidiFile& midi_file, double duration);
+  void PrintReport() const;
+
+  // Share of real time spent in the interrupt and main loop stages, in host
+  // CPU time.
+  double cpu_load() const;
+  // Rate of ReadCycleCounter, calibrated against the monotonic clock.
+  static double cycle_counter_hz();
+  double simulated_seconds() const {
+    return static_cast<double>(num_simulation_ticks_) / kSimulationHz;
+  }
+
+  inline const CycleCounter& counter(SimulatorStage stage) const {
+    return counters_[stage];
+  }
+  inline uint16_t latched_dac_code(uint8_t channel) const {
+    return latched_dac_code_[channel];
+  }
+  inline uint64_t num_frames() const { return num_frames_; }
+
+ private:
+  void SysTick();
+  void TransferFrame();
+  // Returns true if it rendered a block.
+  bool MainLoop();
+  void ProcessInput();
+  void LoadRequestedProgram();
+  void LogProgramSwitch(uint64_t cycles);
+  void WriteFrame();
+
+  uint16_t cv_[kNumCVOutputs];
+  bool gate_[kNumCVOutputs];
+  // Gate outputs, written a refresh after GetCvGate as yarns.cc does
+  bool gate_output_[kNumCVOutputs];
+  uint8_t systick_counter_;
+
+  // State of the DAC8564 output registers, as latched by the SPI stream.
+  uint16_t latched_dac_code_[kNumCVOutputs];
+  size_t dma_cursor_frame_;
+
+  uint64_t num_simulation_ticks_;
+  // Simulation tick of the current run
+  uint64_t now_;
+  // The UART sends one byte at a time, at the MIDI rate.
+  uint64_t midi_tx_ready_;
+  // Written by the UART's DMA, which overwrites unread bytes once it wraps
+  uint8_t midi_rx_buffer_[kMidiRxDmaBufferSize];
+  uint8_t midi_rx_read_ptr_;
+  uint8_t midi_rx_write_ptr_;
+  std::vector<TimedMidiByte>* midi_output_log_;
+
+  PackedMulti* programs_;
+  uint8_t num_programs_;
+  bool preload_programs_;
+  // Where a preloaded program waits for its switch, as in flash storage
+  PackedMulti shadow_program_;
+  std::vector<TimedProgramSwitch>* program_switch_log_;
+  void (*after_input_)();
+  uint64_t main_loop_hold_;
+  uint64_t stall_start_;
+  uint64_t stall_end_;
+  uint64_t num_frames_;
+  uint64_t num_systicks_;
+  uint64_t num_blocks_filled_;
+  uint64_t num_midi_bytes_in_;
+  uint64_t num_midi_bytes_out_;
+
+  FILE* wav_;
+  std::vector<uint16_t>* capture_;
+  std::vector<bool>* capture_gates_;
+  uint8_t capture_channel_;
+  uint8_t capture_gate_channel_;
+  uint32_t wav_num_frames_;
+  uint32_t wav_frame_hz_;
+
+  CycleCounter counters_[STAGE_LAST];
+
+  DISALLOW_COPY_AND_ASSIGN(Simulator);
+};
+
+}  // namespace yarns
+
+#endif  // YARNS_TEST_SIMULATOR_H_
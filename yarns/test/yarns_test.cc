@@ -0,0 +1,2930 @@
+// Copyright 2026 Chris Rogers.
+//
+// Author: Chris Rogers
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+//
+// Host-side test harness. Plays a MIDI file (or a built-in pattern) through
+// the firmware and renders the CV outputs to a 4-channel WAV file at the DAC
+// frame rate, reporting the CPU time spent in each stage of the interrupt
+// and main loop paths.
+//
+// Usage: yarns_test [-l layout] [-m oscillator_mode] [-s shape] [-r rate]
+//                   [-d seconds] [-o output.wav] [-H [-x slowdown]] [-S]
+//                   [-J] [-L] [-P] [-I] [-C] [-T] [-M] [-G] [-R]
+//                   [-X [-x slowdown]] [-F] [-Q] [-E] [-V] [-U] [-W]
+//                   [-D] [input.mid]
+//
+// -r forces a DAC frame rate (0: 45 kHz, 1: 60 kHz, 2: 90 kHz) instead of the
+// layout's choice. -H renders the input at every frame rate and reports the
+// CPU headroom left at each, with host time scaled by the slowdown factor to
+// estimate the target's (the profiler build measures it on the module). -S
+// reports the cost of rendering one voice for every oscillator shape. -J
+// measures the latency and jitter of note onsets scheduled within the block
+// on an audio output, and how far the gate opens from them. -L reports the cost
+// of advancing the looper decks through loops filled from the note pool. -P
+// reports the cost of sweeping the morph CC between two programs. -I compares
+// the pitch output of a glide with and without CV smoothing, and lists the
+// outputs of each layout that the render budget leaves room to smooth. -C
+// compares the semitone table used for pitch CVs with the per-octave
+// conversion it replaced. -T reports the cost of just intonation note-ons
+// under bursts of chords, and how consonant the chords come out with and
+// without chord mode. -M saturates the MIDI input with notes and CCs and
+// checks what reaches the MIDI out through the output queue. -G
+// switches programs under a held chord and a running clock, loaded in place
+// or preloaded and switched at each boundary, and reports the switch latency
+// and the worst main loop stall; it fails if a switch is missed or late, or if
+// a preloaded switch stops the clock. -R reports the cost of Multi::Refresh
+// in the octal polychained and paraphonic layouts, idle, with notes held, and
+// with the notes modulated by the LFOs. -X checks that a packed save keeps the
+// modulation matrix, adds a full matrix to every part and reports its
+// worst-case refresh as a share of the 4 kHz period. -F
+// lists the size of the synth's statically allocated objects. -Q checks step
+// sequences of up to 256 steps against a reference, compares the cost of
+// reading their steps from the prefetched pages and from the encoded bytes,
+// and checks that packed saves (alone, and next to a full looper) and tagged
+// ones keep every step, and that only packed saves too long for a preset are
+// refused. -E checks the integer math that shortens
+// envelope stages and rescales their levels against the float math it
+// replaced, on random stages and levels, compares their cost, and fails if
+// any ratio, phase increment or rescaled level differs. -V reports
+// the cost of a paraphonic output's block with each number of its voices
+// sounding, and of an envelope's block while it decays and once it is held.
+// -U sweeps the fine tuning of every part of a quad mono layout by CC, and
+// compares passing every setting on to the voices after each input with
+// collecting the changes for the next refresh, in cost and in latency of the
+// pitch CV, and fails if the pitch CVs differ. -W
+// saves programs through the preset log on emulated flash, cutting the power
+// mid-save and mid-record, filling the log while the clock runs, and leaving
+// torn and foreign pages among the log's, and checks what loads back.  It
+// also dumps all the pages in bulk and restores them, with acks lost and
+// repeated on the way. -D decodes the panel scan table through a model of the
+// display's shift register: the latch, clock and data steps, the segments
+// latched for each position, and the blanking compare; it also reports the
+// cost of a redraw and the profiler's worst SysTick.
+//
+// The benchmarks that compare against a reference, or check a result, print
+// the failed checks to stderr and exit with a non-zero status.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "stmlib/system/system_clock.h"
+#include "stmlib/utils/stream_buffer.h"
+
+#include "yarns/drivers/display.h"
+#include "yarns/drivers/panel_scan.h"
+#include "yarns/just_intonation_processor.h"
+#include "yarns/looper.h"
+#include "yarns/midi_handler.h"
+#include "yarns/multi.h"
+#include "yarns/oscillator.h"
+#include "yarns/preset_log.h"
+#include "yarns/preset_morph.h"
+#include "yarns/resources.h"
+#include "yarns/settings.h"
+#include "yarns/step_sequence.h"
+#include "yarns/storage_manager.h"
+#include "yarns/test/midi_file.h"
+#include "yarns/test/simulator.h"
+
+using namespace yarns;
+
+// Keeps the timed loops of the benchmarks from being optimized away
+volatile uint32_t benchmark_sink;
+
+// Checks failed by the benchmarks run, which make the run fail
+uint16_t num_failed_checks;
+
+// Reports a check that fails when any of its items do.
+void Check(const char* name, uint32_t num_failures) {
+  if (num_failures) {
+    fprintf(stderr, "FAILED: %s (%u)\n", name,
+            static_cast<unsigned>(num_failures));
+    ++num_failed_checks;
+  }
+}
+
+// Keeps the best total and worst case of a stage across runs, to leave out
+// host noise.
+void KeepBestCost(const CycleCounter& counter, CycleCounter* best) {
+  best->calls = counter.calls;
+  best->total = std::min(best->total, counter.total);
+  best->max = std::min(best->max, counter.max);
+}
+
+// Counts the frames of a capture that differ from the reference, or that only
+// one of them has.  The first capture compared becomes the reference.
+uint32_t CountDifferingFrames(
+    const std::vector<uint16_t>& samples, std::vector<uint16_t>* reference) {
+  if (reference->empty()) {
+    *reference = samples;
+  }
+  size_t size = std::min(samples.size(), reference->size());
+  uint32_t num_differing = std::max(samples.size(), reference->size()) - size;
+  for (size_t i = 0; i < size; ++i) {
+    num_differing += samples[i] != (*reference)[i];
+  }
+  return num_differing;
+}
+
+// Four bars of arpeggiated chords on every channel, each channel playing a
+// different inversion so that paraphonic and polyphonic layouts have work to
+// do on all voices.
+void BuildDemoPattern(MidiFile* midi_file) {
+  const uint8_t chord[4] = { 48, 55, 60, 64 };
+  const double step = 0.125;
+  for (uint8_t bar = 0; bar < 4; ++bar) {
+    for (uint8_t i = 0; i < 16; ++i) {
+      double time = (bar * 16 + i) * step;
+      for (uint8_t channel = 0; channel < 4; ++channel) {
+        uint8_t note = chord[(i + channel) & 3] + 12 * (bar & 1) + channel;
+        midi_file->Append(time, 0x90 | channel, note, 100);
+        midi_file->Append(time + step * 0.75, 0x80 | channel, note, 0);
+      }
+    }
+  }
+  midi_file->Sort();
+}
+
+void Configure(int layout, int oscillator_mode, int shape, int frame_rate) {
+  multi.ApplySetting(SETTING_LAYOUT, 0, layout);
+  for (uint8_t part = 0; part < kNumParts; ++part) {
+    if (oscillator_mode >= 0) {
+      multi.ApplySetting(SETTING_VOICING_OSCILLATOR_MODE, part, oscillator_mode);
+    }
+    if (shape >= 0) {
+      multi.ApplySetting(SETTING_VOICING_OSCILLATOR_SHAPE, part, shape);
+    }
+  }
+  if (frame_rate >= 0 && frame_rate < FRAME_RATE_LAST) {
+    dac.set_frame_rate(static_cast<FrameRate>(frame_rate));
+    // The gate delays and the interpolation budget follow the frame rate.
+    multi.AssignDCInterpolation();
+  }
+}
+
+// The main loop must refill a block before the DMA finishes the other one,
+// and the interrupts and the main loop together must fit in real time.
+// Host cycles are multiplied by slowdown to estimate the target's load.
+void PrintHeadroom(const MidiFile& midi_file, double duration,
+                   int layout, int oscillator_mode, int shape,
+                   double slowdown) {
+  printf("%-10s %12s %12s %10s %10s\n",
+         "Rate", "Block (us)", "Fill mean", "CPU load", "Headroom");
+  double us_per_cycle = slowdown * 1e6 / Simulator::cycle_counter_hz();
+  for (uint8_t rate = 0; rate < FRAME_RATE_LAST; ++rate) {
+    Simulator simulator;
+    simulator.Init();
+    Configure(layout, oscillator_mode, shape, rate);
+    simulator.Run(midi_file, duration);
+    double fill_cycles = 0.0;
+    for (uint8_t i = 0; i < kNumCVOutputs; ++i) {
+      const CycleCounter& c = simulator.counter(
+          static_cast<SimulatorStage>(STAGE_RENDER_SAMPLES_1 + i));
+      fill_cycles += c.calls ? static_cast<double>(c.total) / c.calls : 0.0;
+    }
+    double block_us = 1e6 * kAudioBlockSize / dac.frame_hz();
+    double load = slowdown * simulator.cpu_load();
+    printf("%-10u %12.1f %11.1f%% %9.1f%% %9.1f%%\n",
+           static_cast<unsigned>(dac.frame_hz()),
+           block_us,
+           100.0 * fill_cycles * us_per_cycle / block_us,
+           100.0 * load,
+           100.0 * (1.0 - load));
+  }
+}
+
+// Renders a held note on a single oscillator, which includes both envelopes
+// and the mix, and keeps the best of several runs to reject host noise.
+void PrintShapeBenchmark() {
+  const uint16_t kNumBlocks = 64;
+  const uint8_t kNumRuns = 64;
+  ADSR adsr;
+  adsr.peak = UINT16_MAX;
+  adsr.sustain = UINT16_MAX >> 1;
+  adsr.attack = adsr.decay = adsr.release = 1 << 20;
+  dac.Init();  // Base frame rate
+
+  printf("%-6s %-34s %12s\n", "Shape", "Name", "Cycles/block");
+  for (uint8_t shape = 0; shape <= OSC_SHAPE_FM; ++shape) {
+    static Oscillator oscillator;
+    oscillator.Init(0x4000);
+    oscillator.set_shape(static_cast<OscillatorShape>(shape));
+    oscillator.Refresh(60 << 7, 0x2000, 0);
+    oscillator.NoteOn(adsr, false, 0x4000, 0);
+
+    int16_t mix[kAudioBlockSize];
+    uint64_t best = ~0ULL;
+    for (uint8_t run = 0; run < kNumRuns; ++run) {
+      uint64_t start = ReadCycleCounter();
+      for (uint16_t block = 0; block < kNumBlocks; ++block) {
+        Oscillator* oscillators[1] = { &oscillator };
+        Oscillator::RenderBatch(oscillators, 1, 0, mix);
+      }
+      uint64_t elapsed = ReadCycleCounter() - start;
+      if (elapsed < best) {
+        best = elapsed;
+      }
+    }
+    char name[64];
+    setting_defs.Print(
+        setting_defs.get(SETTING_VOICING_OSCILLATOR_SHAPE), shape, name);
+    // Skip the two display glyphs that prefix the long names.
+    const char* label = name[0] && name[1] && name[2] == ' ' ? name + 3 : name;
+    printf("%-6d %-34s %12.0f\n", shape, label,
+           static_cast<double>(best) / kNumBlocks);
+  }
+}
+
+// Renders the four oscillators of a paraphonic output as a batch, the first
+// num_sounding of them holding a note and the others idle, and keeps the best
+// of several runs.
+double TimeBatch(OscillatorShape shape, uint8_t num_sounding) {
+  const uint16_t kNumBlocks = 64;
+  const uint8_t kNumRuns = 64;
+  ADSR adsr;
+  adsr.peak = UINT16_MAX;
+  adsr.sustain = UINT16_MAX >> 1;
+  adsr.attack = adsr.decay = adsr.release = 1 << 20;
+  static Oscillator oscillators[kMaxBatchedOscillators];
+  Oscillator* batch[kMaxBatchedOscillators];
+  for (uint8_t v = 0; v < kMaxBatchedOscillators; ++v) {
+    Oscillator* oscillator = &oscillators[v];
+    oscillator->Init(0x4000);
+    oscillator->set_shape(shape);
+    oscillator->Refresh((60 + 4 * v) << 7, 0x2000, 0);
+    if (v < num_sounding) {
+      oscillator->NoteOn(adsr, false, 0x4000, 0);
+    }
+    batch[v] = oscillator;
+  }
+
+  int16_t mix[kAudioBlockSize];
+  uint64_t best = ~0ULL;
+  for (uint8_t run = 0; run < kNumRuns; ++run) {
+    uint64_t start = ReadCycleCounter();
+    for (uint16_t block = 0; block < kNumBlocks; ++block) {
+      benchmark_sink += Oscillator::RenderBatch(
+          batch, kMaxBatchedOscillators, 0, mix);
+    }
+    best = std::min(best, ReadCycleCounter() - start);
+  }
+  return static_cast<double>(best) / kNumBlocks;
+}
+
+// Renders an envelope held at its sustain level, or still in its decay, and
+// keeps the best of several runs.
+double TimeEnvelopeBlock(bool held) {
+  const uint16_t kNumBlocks = 64;
+  const uint8_t kNumRuns = 64;
+  ADSR adsr;
+  adsr.peak = UINT16_MAX;
+  adsr.sustain = UINT16_MAX >> 1;
+  adsr.attack = lut_envelope_phase_increments[0];
+  adsr.decay = lut_envelope_phase_increments[held ? 0 : 127];
+  adsr.release = lut_envelope_phase_increments[127];
+  static Envelope envelope;
+  envelope.Init(0);
+  envelope.NoteOn(adsr, 0, INT16_MAX, 0);
+  int16_t block[kAudioBlockSize];
+  // Through the attack, and the decay if it is short
+  for (uint8_t i = 0; i < 16; ++i) {
+    envelope.RenderSamples(block, 0);
+  }
+
+  uint64_t best = ~0ULL;
+  for (uint8_t run = 0; run < kNumRuns; ++run) {
+    uint64_t start = ReadCycleCounter();
+    for (uint16_t i = 0; i < kNumBlocks; ++i) {
+      benchmark_sink += envelope.RenderSamples(block, 0);
+    }
+    best = std::min(best, ReadCycleCounter() - start);
+  }
+  return static_cast<double>(best) / kNumBlocks;
+}
+
+void PrintIdleVoiceBenchmark() {
+  const OscillatorShape kShapes[] = {
+    OSC_SHAPE_VARIABLE_SAW, OSC_SHAPE_FM
+  };
+  const char* const kShapeNames[] = { "Saw", "FM" };
+  dac.Init();  // Base frame rate
+  printf("%-6s %8s %12s\n", "Shape", "Sounding", "Cycles/block");
+  for (uint8_t s = 0; s < 2; ++s) {
+    for (uint8_t n = 0; n <= kMaxBatchedOscillators; ++n) {
+      printf("%-6s %5u/%u %12.0f\n", kShapeNames[s],
+             static_cast<unsigned>(n),
+             static_cast<unsigned>(kMaxBatchedOscillators),
+             TimeBatch(kShapes[s], n));
+    }
+  }
+  printf("\n%-16s %12s\n", "Envelope", "Cycles/block");
+  printf("%-16s %12.0f\n", "Decaying", TimeEnvelopeBlock(false));
+  printf("%-16s %12.0f\n", "Held at sustain", TimeEnvelopeBlock(true));
+}
+
+// Plays short notes at times that fall at every position within a block, and
+// measures when their attack starts on the audio output of a mono layout, and
+// when the gate of its CV output opens.  Every attack should start at the same
+// latency after its note, give or take the SysTick's polling of the UART and a
+// frame, and the gate should open with it, give or take half a DC refresh.
+// Both should hold when the main loop is held after each block it renders,
+// and handles the notes late.
+void PrintOnsetJitter(int frame_rate, double main_loop_hold) {
+  const uint8_t kNumNotes = 64;
+  const uint8_t kAudioChannel = 3;
+  const uint8_t kGateChannel = 0;
+  const uint16_t kThreshold = 256;
+
+  Simulator simulator;
+  simulator.Init();
+  simulator.HoldMainLoop(main_loop_hold);
+  Configure(LAYOUT_MONO, OSCILLATOR_MODE_ENVELOPED, OSC_SHAPE_VARIABLE_PULSE,
+            frame_rate);
+  multi.ApplySetting(SETTING_VOICING_ENV_INIT_ATTACK, 0, 0);
+  multi.ApplySetting(SETTING_VOICING_ENV_INIT_RELEASE, 0, 0);
+  multi.ApplySetting(SETTING_VOICING_ENV_MOD_ATTACK, 0, 0);
+  multi.ApplySetting(SETTING_VOICING_ENV_MOD_RELEASE, 0, 0);
+  double block_duration =
+      static_cast<double>(kAudioBlockSize) / dac.frame_hz();
+
+  MidiFile midi_file;
+  double times[kNumNotes];
+  for (uint8_t i = 0; i < kNumNotes; ++i) {
+    // Step through the block in an order unrelated to the note index.
+    times[i] = 0.25 + i * 0.06 +
+        ((i * 37) % kNumNotes) * block_duration / kNumNotes;
+    midi_file.Append(times[i], 0x90, 60, 100);
+    midi_file.Append(times[i] + 0.02, 0x80, 60, 0);
+  }
+  midi_file.Sort();
+
+  std::vector<uint16_t> samples;
+  std::vector<bool> gates;
+  simulator.Capture(kAudioChannel, &samples);
+  simulator.CaptureGates(kGateChannel, &gates);
+  simulator.Run(midi_file, midi_file.duration() + 0.1);
+
+  double sum = 0.0, sum_of_squares = 0.0, min = 1e9, max = -1e9;
+  double min_skew = 1e9, max_skew = -1e9;
+  uint8_t num_onsets = 0;
+  uint8_t num_gates = 0;
+  for (uint8_t i = 0; i < kNumNotes; ++i) {
+    size_t start = static_cast<size_t>(times[i] * dac.frame_hz());
+    size_t frame = start;
+    uint16_t silence = samples[frame];
+    while (frame < samples.size() &&
+           abs(samples[frame] - silence) <= kThreshold) {
+      ++frame;
+    }
+    if (frame == samples.size()) {
+      continue;
+    }
+    double latency =
+        1e6 * (static_cast<double>(frame) / dac.frame_hz() - times[i]);
+    sum += latency;
+    sum_of_squares += latency * latency;
+    min = std::min(min, latency);
+    max = std::max(max, latency);
+    ++num_onsets;
+
+    size_t gate_frame = start;
+    while (gate_frame < gates.size() && !gates[gate_frame]) {
+      ++gate_frame;
+    }
+    if (gate_frame == gates.size()) {
+      continue;
+    }
+    double skew = 1e6 * (static_cast<double>(gate_frame) - frame) /
+        dac.frame_hz();
+    min_skew = std::min(min_skew, skew);
+    max_skew = std::max(max_skew, skew);
+    ++num_gates;
+  }
+  double mean = num_onsets ? sum / num_onsets : 0.0;
+  double variance =
+      num_onsets ? sum_of_squares / num_onsets - mean * mean : 0.0;
+  printf("%8s %9s %6s %10s %10s %10s %10s %10s %10s\n",
+         "Rate", "Hold (us)", "Notes", "Mean (us)", "Jitter", "Min", "Max",
+         "Gate min", "Gate max");
+  printf("%8u %9.0f %6u %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+         static_cast<unsigned>(dac.frame_hz()), 1e6 * main_loop_hold,
+         num_onsets, mean, sqrt(std::max(variance, 0.0)), min, max,
+         min_skew, max_skew);
+  double spread = 1e6 / kSysTickHz + 2e6 / dac.frame_hz();
+  Check("onsets found", kNumNotes - num_onsets);
+  Check("onsets within a SysTick and a frame of each other",
+        max - min > spread);
+  Check("gates found", kNumNotes - num_gates);
+  // The gate opens at a DC refresh, so it can only be placed within half a
+  // refresh of the onset.
+  double gate_spread = 0.5e6 / kDCRefreshHz + spread;
+  Check("gates within half a refresh of their onset",
+        min_skew < -gate_spread || max_skew > gate_spread);
+}
+
+// Advances the decks through one loop at the refresh rate, stepping the
+// position as ProcessNotesUntilLFOPhase does for a 2-second loop, and returns
+// the cycles spent in the best of several loops and its worst refresh.
+uint64_t MeasureLooperLoop(uint8_t num_decks, uint64_t* worst_refresh) {
+  const uint16_t kNumRefreshes = 8000;
+  const uint8_t kNumRuns = 16;
+
+  uint64_t best_total = ~0ULL;
+  *worst_refresh = ~0ULL;
+  for (uint8_t run = 0; run < kNumRuns; ++run) {
+    uint64_t total = 0;
+    uint64_t worst = 0;
+    for (uint16_t r = 1; r <= kNumRefreshes; ++r) {
+      uint16_t pos = (static_cast<uint32_t>(r) << 16) / kNumRefreshes;
+      uint64_t start = ReadCycleCounter();
+      for (uint8_t d = 0; d < num_decks; ++d) {
+        multi.mutable_part(d)->mutable_looper().ProcessNotes(
+            pos, &Part::LooperPlayNoteOn, &Part::LooperPlayNoteOff);
+      }
+      uint64_t elapsed = ReadCycleCounter() - start;
+      total += elapsed;
+      worst = std::max(worst, elapsed);
+    }
+    best_total = std::min(best_total, total);
+    *worst_refresh = std::min(*worst_refresh, worst);
+  }
+  return best_total;
+}
+
+// Fills the decks with notes at random positions and lengths, and compares
+// their cost per refresh with that of the same decks empty.
+void MeasureLooper(uint8_t num_decks, uint16_t notes_per_deck) {
+  const uint16_t kNumRefreshes = 8000;
+
+  Simulator simulator;
+  simulator.Init();
+  uint64_t worst;
+  uint64_t empty = MeasureLooperLoop(num_decks, &worst);
+
+  uint32_t seed = 0x1234;
+  uint32_t num_lost = 0;
+  for (uint8_t d = 0; d < num_decks; ++d) {
+    looper::Deck& deck = multi.mutable_part(d)->mutable_looper();
+    for (uint16_t i = 0; i < notes_per_deck; ++i) {
+      seed = seed * 1664525 + 1013904223;
+      uint16_t on_pos = seed >> (32 - looper::kBitsPos);
+      uint16_t length = 64 + ((seed >> 8) & 511);
+      looper::PackedNote note;
+      note.on_pos = on_pos;
+      note.off_pos = (on_pos + length) & ((1 << looper::kBitsPos) - 1);
+      note.pitch = 36 + (seed & 63);
+      note.velocity = 100;
+      num_lost += !deck.AppendPackedNote(note);
+    }
+  }
+  Check("looper decks keep every note", num_lost);
+  uint64_t total = MeasureLooperLoop(num_decks, &worst);
+
+  printf("%5u %6u %8u %14.1f %12.0f %12.1f\n",
+         static_cast<unsigned>(num_decks),
+         static_cast<unsigned>(notes_per_deck),
+         static_cast<unsigned>(looper::note_pool.num_free()),
+         static_cast<double>(total) / kNumRefreshes,
+         static_cast<double>(worst),
+         static_cast<double>(empty) / kNumRefreshes);
+}
+
+void PrintLooperBenchmark() {
+  printf("%5s %6s %8s %14s %12s %12s\n",
+         "Decks", "Notes", "Free", "Cycles/refresh", "Worst", "Empty decks");
+  MeasureLooper(1, looper::kMaxPackedNotes);
+  MeasureLooper(4, looper::kMaxPackedNotes);
+  MeasureLooper(1, looper::note_pool.size() / 4);
+  MeasureLooper(1, looper::kMaxDeckNotes);
+  MeasureLooper(4, looper::note_pool.size() / 4);
+}
+
+// Every step a note, or (sparse) one note per beat held by three ties
+void BuildStepSequence(StepSequence* sequence, uint16_t num_steps, bool sparse) {
+  sequence->Clear();
+  for (uint16_t i = 0; i < num_steps; ++i) {
+    SequencerStep step(48 + (i * 7) % 24, 100);
+    if (sparse && (i & 3)) step = SequencerStep(SEQUENCER_STEP_TIE, 0);
+    if (!sequence->SetStep(i, step)) return;
+  }
+}
+
+// Compares the steps with a reference written step by step, at random
+// indices, and returns the number that differ.
+uint16_t CheckStepSequenceEdits() {
+  StepSequence sequence;
+  SequencerStep reference[kMaxNumSteps];
+  sequence.Clear();
+  uint16_t num_steps = 0;
+  uint32_t seed = 0xbeef;
+  for (uint16_t edit = 0; edit < 2000; ++edit) {
+    seed = seed * 1664525 + 1013904223;
+    uint16_t index = (seed >> 8) % kMaxNumSteps;
+    uint8_t kind = (seed >> 20) & 7;
+    SequencerStep step =
+        kind == 0 ? SequencerStep(36 + (seed & 63), (seed >> 24) & 0xff)
+        : kind < 5 ? SequencerStep(SEQUENCER_STEP_REST, 0)
+        : SequencerStep(SEQUENCER_STEP_TIE, 0);
+    if (!sequence.SetStep(index, step)) continue;
+    for (; num_steps <= index; ++num_steps) {
+      reference[num_steps] = SequencerStep(SEQUENCER_STEP_REST, 0);
+    }
+    reference[index] = step;
+    if (edit & 1) sequence.Prefetch(seed);
+  }
+  uint16_t mismatches = num_steps != sequence.num_steps();
+  for (uint16_t i = 0; i < num_steps; ++i) {
+    SequencerStep step = sequence.step(i);
+    mismatches += step.data[0] != reference[i].data[0] ||
+        step.data[1] != reference[i].data[1];
+  }
+  return mismatches;
+}
+
+// Cycles per clock step spent reading the step and the next one (peeked for
+// gate endings), with or without the prefetched window.
+double MeasureStepReads(const StepSequence& source, bool prefetch) {
+  const uint8_t kNumRuns = 16;
+  uint64_t best = ~0ULL;
+  uint16_t num_reads = source.num_steps() * 4;
+  for (uint8_t run = 0; run < kNumRuns; ++run) {
+    StepSequence sequence = source;
+    // A fresh copy of the bytes, without a decoded window
+    sequence.Load(source.data(), source.size(), source.num_steps());
+    uint32_t sum = 0;
+    uint64_t start = ReadCycleCounter();
+    for (uint16_t c = 0; c < num_reads; ++c) {
+      if (prefetch) sequence.Prefetch(c);
+      sum += sequence.step(c % sequence.num_steps()).data[0];
+      sum += sequence.step((c + 1) % sequence.num_steps()).data[0];
+    }
+    best = std::min(best, ReadCycleCounter() - start);
+    benchmark_sink = sum;
+  }
+  return static_cast<double>(best) / num_reads;
+}
+
+// Runs the storage manager's background work until a save is written.
+void FinishSaves() {
+  for (uint16_t i = 0; i < 2000; ++i) {
+    storage_manager.Tick();
+  }
+}
+
+// Saves and reloads part 1's sequence, with its looper holding num_notes and
+// a step offset that only the longer layout can hold past 32 steps, and
+// returns the number of steps that come back intact.  A packed round trip
+// goes through a preset slot and a power cycle.
+uint16_t RoundTripStepSequence(
+    const StepSequence& source, uint8_t num_notes, bool tagged) {
+  multi.Init(true);
+  uint8_t step_offset = source.num_steps() - 1;
+  *multi.mutable_part(0)->mutable_sequence() = source;
+  multi.ApplySetting(SETTING_SEQUENCER_STEP_OFFSET, 0, step_offset);
+  looper::Deck& deck = multi.mutable_part(0)->mutable_looper();
+  for (uint8_t i = 0; i < num_notes; ++i) {
+    looper::PackedNote note;
+    note.on_pos = i * 64;
+    note.off_pos = i * 64 + 32;
+    note.pitch = 60;
+    note.velocity = 100;
+    deck.AppendPackedNote(note);
+  }
+  uint8_t kept_notes = num_notes;
+  if (tagged) {
+    static stmlib::StreamBuffer<Multi::kTaggedPayloadSize> buffer;
+    buffer.Clear();
+    multi.SerializeTagged(&buffer);
+    multi.Init(true);
+    if (!multi.DeserializeTagged(&buffer)) return 0;
+  } else {
+    kept_notes = std::min(
+        num_notes, multi.part(0).packed_looper_capacity());
+    if (!storage_manager.SaveMulti(0)) return 0;
+    FinishSaves();
+    storage_manager.Init();
+    multi.Init(true);
+    if (!storage_manager.LoadMulti(0)) return 0;
+  }
+  const Part& part = multi.part(0);
+  if (part.sequencer_settings().step_offset != step_offset ||
+      part.looper().num_notes() != kept_notes) {
+    return 0;
+  }
+  uint16_t n = 0;
+  for (; n < part.sequence().num_steps(); ++n) {
+    SequencerStep a = part.sequence().step(n);
+    SequencerStep b = source.step(n);
+    if (a.data[0] != b.data[0] || a.data[1] != b.data[1]) break;
+  }
+  return n;
+}
+
+void MeasureStepSequence(uint16_t num_steps, bool sparse) {
+  StepSequence sequence;
+  BuildStepSequence(&sequence, num_steps, sparse);
+  uint16_t steps[3] = {
+    RoundTripStepSequence(sequence, 0, false),
+    RoundTripStepSequence(sequence, looper::kMaxPackedNotes, false),
+    RoundTripStepSequence(sequence, looper::kMaxPackedNotes, true)
+  };
+  printf("%5u %6s %5u %5u %10.1f %10.1f",
+         static_cast<unsigned>(num_steps),
+         sparse ? "ties" : "notes",
+         static_cast<unsigned>(sequence.num_steps()),
+         static_cast<unsigned>(sequence.size()),
+         MeasureStepReads(sequence, true),
+         MeasureStepReads(sequence, false));
+  uint16_t losses = 0;
+  for (uint8_t i = 0; i < 3; ++i) {
+    printf(" %7u", static_cast<unsigned>(steps[i]));
+    losses += steps[i] != sequence.num_steps();
+  }
+  printf("\n");
+  Check("step sequence round trips", losses);
+}
+
+// Counts the parts whose sequence doesn't come back from slot 1 after a power
+// cycle.  While the clock runs, the tails of two parts wait in the stream
+// buffer, and their pages are only erased once it stops.  All four are saved
+// at once with the clock stopped.
+uint16_t CountLongSequenceLosses() {
+  StepSequence sequence;
+  BuildStepSequence(&sequence, kMaxNumSteps, false);
+  uint16_t num_losses = 0;
+  for (uint8_t num_parts = 2; num_parts <= kNumParts; num_parts += 2) {
+    multi.Init(true);
+    for (uint8_t p = 0; p < num_parts; ++p) {
+      // Parts 1 and 3 share no page
+      uint8_t part = num_parts == 2 ? p * 2 : p;
+      *multi.mutable_part(part)->mutable_sequence() = sequence;
+    }
+    bool running = num_parts == 2;
+    if (running) {
+      multi.Start(false);
+    }
+    uint32_t num_erases =
+        FlashStorage::num_erases() + SequencePages::num_erases();
+    num_losses += !storage_manager.SaveMulti(1);
+    FinishSaves();
+    if (running) {
+      num_losses += FlashStorage::num_erases() +
+          SequencePages::num_erases() != num_erases;
+      multi.Stop();
+      FinishSaves();
+    }
+    storage_manager.Init();
+    multi.Init(true);
+    num_losses += !storage_manager.LoadMulti(1);
+    for (uint8_t part = 0; part < kNumParts; ++part) {
+      const StepSequence& loaded = multi.part(part).sequence();
+      bool long_sequence = num_parts == 2 ? part % 2 == 0 : true;
+      uint16_t expected = long_sequence ? sequence.size() : 0;
+      num_losses += loaded.size() != expected || !std::equal(
+          loaded.data(), loaded.data() + expected, sequence.data());
+    }
+  }
+  return num_losses;
+}
+
+void PrintStepSequenceBenchmark() {
+  Simulator simulator;
+  simulator.Init();
+  storage_manager.Init();
+  uint16_t mismatches = CheckStepSequenceEdits();
+  printf("Edits checked against a reference: %u mismatches\n",
+         static_cast<unsigned>(mismatches));
+  Check("step sequence edits", mismatches);
+  printf("%5s %6s %5s %5s %10s %10s %7s %7s %7s\n",
+         "Steps", "Kind", "Held", "Bytes", "Windowed", "Walked",
+         "Packed", "+Looper", "Tagged");
+  MeasureStepSequence(16, false);
+  MeasureStepSequence(30, false);
+  MeasureStepSequence(64, false);
+  MeasureStepSequence(128, false);
+  MeasureStepSequence(256, false);
+  MeasureStepSequence(64, true);
+  MeasureStepSequence(256, true);
+  uint16_t losses = CountLongSequenceLosses();
+  printf("Presets of 256-note sequences: %u parts lost\n",
+         static_cast<unsigned>(losses));
+  Check("long sequence presets", losses);
+}
+
+// What a morph without change tracking does for every CC: apply all the
+// settings that differ, at their value for the new position.
+void ApplyAllMorphSettings(
+    const int16_t (*a)[SETTING_LAST], const int16_t (*b)[SETTING_LAST],
+    uint8_t position) {
+  for (uint8_t part = 0; part < kNumParts; ++part) {
+    for (uint8_t i = 0; i < SETTING_LAST; ++i) {
+      if (a[part][i] == b[part][i]) continue;
+      int16_t value = PresetMorph::IsContinuous(i)
+          ? a[part][i] + (b[part][i] - a[part][i]) * position / 127
+          : (position < 64 ? a[part][i] : b[part][i]);
+      multi.ApplySetting(setting_defs.get(i), part, value);
+    }
+  }
+}
+
+// Morphs between two programs whose parts differ in num_differing settings,
+// sweeping the morph CC up and down one step at a time as a fader sending at
+// full MIDI rate would.  After each CC, the main loop gets one morph tick per
+// part.
+void MeasureMorph(uint8_t num_differing) {
+  const uint8_t kNumSweeps = 20;
+
+  Simulator simulator;
+  simulator.Init();
+  Configure(LAYOUT_QUAD_MONO, -1, -1, -1);
+  for (uint8_t part = 0; part < kNumParts; ++part) {
+    multi.ApplySetting(SETTING_MIDI_CHANNEL, part, kMidiChannelOmni);
+  }
+  PackedMulti packed_a, packed_b;
+  PackedMultiStream stream_a = { &packed_a };
+  PackedMultiStream stream_b = { &packed_b };
+  multi.SerializePacked(&stream_a);
+
+  static int16_t a[kNumParts][SETTING_LAST];
+  static int16_t b[kNumParts][SETTING_LAST];
+  uint32_t seed = 0x5eed;
+  for (uint8_t part = 0; part < kNumParts; ++part) {
+    uint8_t num_changed = 0;
+    for (uint8_t i = 0; i < SETTING_LAST; ++i) {
+      const Setting& setting = setting_defs.get(i);
+      a[part][i] = b[part][i] = 0;
+      if (!PresetMorph::IsMorphed(i)) continue;
+      a[part][i] = multi.GetSettingValue(setting, part);
+      if (num_changed < num_differing) {
+        seed = seed * 1664525 + 1013904223;
+        SettingRange range = multi.GetSettingRange(setting, part);
+        multi.ApplySetting(
+            setting, part, range.min + (seed >> 16) % range.delta());
+      }
+      b[part][i] = multi.GetSettingValue(setting, part);
+      num_changed += a[part][i] != b[part][i];
+    }
+  }
+  multi.SerializePacked(&stream_b);
+  multi.DeserializePacked(&stream_a);
+  bool complete = preset_morph.Start(packed_a, packed_b);
+
+  // Best of the sweeps, to leave out host noise
+  uint64_t morph_cycles = ~0ULL;
+  uint64_t worst_cc = ~0ULL;
+  uint32_t num_applied = 0;
+  const uint16_t kNumCCs = 254;
+  for (uint8_t sweep = 0; sweep < kNumSweeps; ++sweep) {
+    uint64_t total = 0;
+    uint64_t worst = 0;
+    num_applied = 0;
+    for (uint16_t step = 1; step <= kNumCCs; ++step) {
+      uint8_t position = step <= 127 ? step : 254 - step;
+      uint64_t start = ReadCycleCounter();
+      multi.ControlChange(0, 9, position);
+      for (uint8_t part = 0; part < kNumParts; ++part) {
+        num_applied += preset_morph.Tick();
+      }
+      uint64_t elapsed = ReadCycleCounter() - start;
+      total += elapsed;
+      worst = std::max(worst, elapsed);
+    }
+    morph_cycles = std::min(morph_cycles, total);
+    worst_cc = std::min(worst_cc, worst);
+  }
+
+  // Check the far end against program b
+  uint16_t num_wrong = 0;
+  multi.ControlChange(0, 9, 127);
+  for (uint8_t part = 0; part < kNumParts; ++part) {
+    preset_morph.Tick();
+  }
+  for (uint8_t part = 0; part < kNumParts; ++part) {
+    for (uint8_t i = 0; i < SETTING_LAST; ++i) {
+      num_wrong += multi.GetSettingValue(setting_defs.get(i), part) !=
+          (PresetMorph::IsMorphed(i) ? b[part][i] :
+           multi.GetSettingValue(setting_defs.get(i), part));
+    }
+  }
+
+  uint64_t all_cycles = ~0ULL;
+  for (uint8_t sweep = 0; sweep < kNumSweeps; ++sweep) {
+    uint64_t total = 0;
+    for (uint16_t step = 1; step <= kNumCCs; ++step) {
+      uint8_t position = step <= 127 ? step : 254 - step;
+      uint64_t start = ReadCycleCounter();
+      ApplyAllMorphSettings(a, b, position);
+      total += ReadCycleCounter() - start;
+    }
+    all_cycles = std::min(all_cycles, total);
+  }
+
+  printf("%9u %9u %10.2f %12.0f %10.0f %14.0f %7u\n",
+         static_cast<unsigned>(num_differing),
+         static_cast<unsigned>(preset_morph.num_settings()) +
+             (complete ? 0 : 1000),
+         static_cast<double>(num_applied) / kNumCCs,
+         static_cast<double>(morph_cycles) / kNumCCs,
+         static_cast<double>(worst_cc),
+         static_cast<double>(all_cycles) / kNumCCs,
+         static_cast<unsigned>(num_wrong));
+  Check("settings at the far end of the morph", num_wrong);
+}
+
+void PrintMorphBenchmark() {
+  printf("%9s %9s %10s %12s %10s %14s %7s\n",
+         "Per part", "Morphed", "Applied/CC", "Cycles/CC", "Worst CC",
+         "Apply all/CC", "Wrong");
+  MeasureMorph(4);
+  MeasureMorph(16);
+  MeasureMorph(kMaxMorphSettings / kNumParts);
+}
+
+// Glides the pitch output of a mono layout between two octaves while its
+// audio output plays, and compares the staircase left by the 4 kHz refresh
+// and the cost of rendering the pitch through the block path with that of
+// the oscillator.
+void MeasureDCInterpolation(DCInterpolation mode, int frame_rate) {
+  const uint8_t kPitchChannel = 0;
+  const uint8_t kAudioChannel = 3;
+
+  Simulator simulator;
+  simulator.Init();
+  Configure(LAYOUT_MONO, OSCILLATOR_MODE_ENVELOPED, OSC_SHAPE_VARIABLE_PULSE,
+            frame_rate);
+  multi.ApplySetting(SETTING_DC_INTERPOLATION, 0, mode);
+  multi.ApplySetting(SETTING_VOICING_PORTAMENTO, 0, 40);
+
+  MidiFile midi_file;
+  for (uint8_t i = 0; i < 8; ++i) {
+    midi_file.Append(0.1 + i * 0.25, 0x90, i & 1 ? 84 : 36, 100);
+  }
+  midi_file.Sort();
+
+  std::vector<uint16_t> samples;
+  simulator.Capture(kPitchChannel, &samples);
+  simulator.Run(midi_file, midi_file.duration() + 0.25);
+
+  // Skip the jump from 0V to the first note.
+  size_t start = static_cast<size_t>(0.3 * dac.frame_hz());
+  int32_t max_step = 0;
+  double sum_of_curvatures = 0.0;
+  for (size_t i = start; i < samples.size(); ++i) {
+    int32_t step = samples[i] - samples[i - 1];
+    int32_t previous_step = samples[i - 1] - samples[i - 2];
+    max_step = std::max(max_step, abs(step));
+    sum_of_curvatures += abs(step - previous_step);
+  }
+  const CycleCounter& pitch = simulator.counter(
+      static_cast<SimulatorStage>(STAGE_RENDER_SAMPLES_1 + kPitchChannel));
+  const CycleCounter& audio = simulator.counter(
+      static_cast<SimulatorStage>(STAGE_RENDER_SAMPLES_1 + kAudioChannel));
+  double pitch_cycles = static_cast<double>(pitch.total) / pitch.calls;
+  double audio_cycles = static_cast<double>(audio.total) / audio.calls;
+  uint16_t lag = mode == DC_INTERPOLATION_OFF ? 0 :
+      kOnsetLatencyFrames + dac.frames_per_dc_refresh() * mode;
+  char name[16];
+  setting_defs.Print(setting_defs.get(SETTING_DC_INTERPOLATION), mode, name);
+  printf("%-8s %8u %10d %12.1f %10.0f %11.1f%% %10.0f\n",
+         name,
+         static_cast<unsigned>(dac.frame_hz()),
+         max_step,
+         sum_of_curvatures / (samples.size() - start),
+         pitch_cycles,
+         100.0 * pitch_cycles / audio_cycles,
+         1e6 * lag / dac.frame_hz());
+}
+
+// Plays detached notes an octave apart on the pitch output of a mono layout,
+// and counts the onsets at which the gate opens before the pitch has reached
+// the note.
+uint32_t CountEarlyGates(
+    DCInterpolation mode, int frame_rate, double main_loop_hold) {
+  const uint8_t kPitchChannel = 0;
+
+  Simulator simulator;
+  simulator.Init();
+  simulator.HoldMainLoop(main_loop_hold);
+  Configure(LAYOUT_MONO, OSCILLATOR_MODE_ENVELOPED, OSC_SHAPE_VARIABLE_PULSE,
+            frame_rate);
+  multi.ApplySetting(SETTING_DC_INTERPOLATION, 0, mode);
+
+  MidiFile midi_file;
+  for (uint8_t i = 0; i < 8; ++i) {
+    uint8_t note = i & 1 ? 84 : 36 + i;
+    midi_file.Append(0.1 + i * 0.25, 0x90, note, 100);
+    midi_file.Append(0.25 + i * 0.25, 0x80, note, 0);
+  }
+  midi_file.Sort();
+
+  std::vector<uint16_t> samples;
+  std::vector<bool> gates;
+  simulator.Capture(kPitchChannel, &samples, &gates);
+  simulator.Run(midi_file, midi_file.duration() + 0.25);
+
+  // The pitch holds the note well before the gate closes again.  At 4 kHz,
+  // the DC is injected a little ahead of the DMA cursor, when the gate is
+  // written.  Skip the first note, which the pitch reaches from 0V.
+  size_t settle = static_cast<size_t>(0.1 * dac.frame_hz());
+  uint32_t num_onsets = 0;
+  uint32_t num_early = 0;
+  for (size_t i = 1; i + settle < samples.size(); ++i) {
+    if (gates[i] && !gates[i - 1] && num_onsets++) {
+      num_early += samples[i + kInjectGapFrames] != samples[i + settle];
+    }
+  }
+  return num_onsets == 8 ? num_early : 8;
+}
+
+// Lists the outputs of each layout that get the mode requested by the
+// setting, once the layout's audio voices have taken their share.
+void PrintDCInterpolationBudget(DCInterpolation mode) {
+  Simulator simulator;
+  simulator.Init();
+  multi.ApplySetting(SETTING_DC_INTERPOLATION, 0, mode);
+  char name[16];
+  setting_defs.Print(setting_defs.get(SETTING_DC_INTERPOLATION), mode, name);
+  printf("%-7s %6s %8s  %s\n", name, "Layout", "Rate", "Outputs 1-4");
+  for (uint8_t layout = 0; layout < LAYOUT_LAST; ++layout) {
+    multi.ApplySetting(SETTING_LAYOUT, 0, layout);
+    printf("%-7s %6d %8u ", "", layout, static_cast<unsigned>(dac.frame_hz()));
+    for (uint8_t i = 0; i < kNumCVOutputs; ++i) {
+      const CVOutput& output = multi.cv_output(i);
+      printf(" %c", output.num_audio_voices() ? 'A' :
+          output.dc_interpolation() == mode ? 'I' : '-');
+    }
+    printf("\n");
+  }
+}
+
+void PrintDCInterpolationBenchmark(int frame_rate) {
+  printf("%-8s %8s %10s %12s %10s %12s %10s\n",
+         "Mode", "Rate", "Max step", "Curvature", "Cycles", "Of a voice",
+         "Lag (us)");
+  for (uint8_t mode = 0; mode < DC_INTERPOLATION_LAST; ++mode) {
+    MeasureDCInterpolation(static_cast<DCInterpolation>(mode), frame_rate);
+  }
+  uint32_t num_early = 0;
+  for (int rate = 0; rate < FRAME_RATE_LAST; ++rate) {
+    for (uint8_t mode = 0; mode < DC_INTERPOLATION_LAST; ++mode) {
+      // Also with the main loop held after each block, so that the notes are
+      // handled late and the gates of outputs left at 4 kHz are moved back.
+      for (uint8_t hold = 0; hold <= 1; ++hold) {
+        num_early += CountEarlyGates(
+            static_cast<DCInterpolation>(mode), rate, hold * 0.0005);
+      }
+    }
+  }
+  printf("Gates opened before the pitch: %u\n",
+         static_cast<unsigned>(num_early));
+  Check("Interpolated pitch in place when the gate opens", num_early);
+  printf("\nA: can carry audio, I: interpolated, -: left at 4 kHz\n");
+  PrintDCInterpolationBudget(DC_INTERPOLATION_LINEAR);
+  PrintDCInterpolationBudget(DC_INTERPOLATION_CUBIC);
+}
+
+// The conversion from before the semitone table: linear between the
+// calibrated octaves, found by subtracting octaves one at a time.
+uint16_t NoteToDacCodeByOctave(const uint16_t* calibrated_dac_code,
+                               int32_t note) {
+  const int32_t kOctave = 12 << 7;
+  const int32_t kMaxNote = 120 << 7;
+  if (note <= 0) {
+    note = 0;
+  }
+  if (note >= kMaxNote) {
+    note = kMaxNote - 1;
+  }
+  uint8_t octave = 0;
+  while (note >= kOctave) {
+    note -= kOctave;
+    ++octave;
+  }
+  int32_t a = calibrated_dac_code[octave];
+  int32_t b = calibrated_dac_code[octave + 1];
+  return a + ((b - a) * note / kOctave);
+}
+
+// Converts every note in 1/128 semitones both ways, on calibrations spread
+// around the factory one, and reports the cost per conversion on the host
+// and the largest difference between the two.
+void PrintCalibrationBenchmark() {
+  const uint8_t kNumCalibrations = 16;
+  const uint8_t kNumRuns = 16;
+  const int32_t kNumNotes = 121 << 7;  // Includes notes past the top
+  uint64_t best_table = ~0ULL;
+  uint64_t best_octave = ~0ULL;
+  int32_t max_error = 0;
+  uint32_t checksum = 0;
+  srand(1);
+  static CVOutput output;
+  output.Init(true);
+  for (uint8_t c = 0; c < kNumCalibrations; ++c) {
+    uint16_t calibrated_dac_code[kNumOctaves];
+    for (uint8_t i = 0; i < kNumOctaves; ++i) {
+      calibrated_dac_code[i] = 54586 - 5133 * i + (rand() % 401) - 200;
+    }
+    output.Calibrate(calibrated_dac_code);
+    for (int32_t note = -128; note < kNumNotes; ++note) {
+      int32_t error = output.NoteToDacCode(note) -
+          NoteToDacCodeByOctave(calibrated_dac_code, note);
+      max_error = std::max(max_error, abs(error));
+    }
+    for (uint8_t run = 0; run < kNumRuns; ++run) {
+      uint64_t start = ReadCycleCounter();
+      for (int32_t note = 0; note < kNumNotes; note += 3) {
+        checksum += output.NoteToDacCode(note);
+      }
+      best_table = std::min(best_table, ReadCycleCounter() - start);
+      start = ReadCycleCounter();
+      for (int32_t note = 0; note < kNumNotes; note += 3) {
+        checksum += NoteToDacCodeByOctave(calibrated_dac_code, note);
+      }
+      best_octave = std::min(best_octave, ReadCycleCounter() - start);
+    }
+  }
+  double num_conversions = (kNumNotes + 2) / 3;
+  printf("%-22s %14s\n", "Note to DAC code", "Cycles/note");
+  printf("%-22s %14.2f\n", "By octave", best_octave / num_conversions);
+  printf("%-22s %14.2f\n", "Semitone table", best_table / num_conversions);
+  printf("Max difference: %d DAC codes (%.3f cents)\n",
+         static_cast<int>(max_error),
+         max_error * 1200.0 / 5133);
+  // The table rounds between semitones, the octave conversion truncated
+  Check("semitone table within a DAC code", max_error > 1);
+  benchmark_sink = checksum;
+}
+
+// Copy of the just intonation processor before the sorted history, as a
+// reference for the tunings and the cost of the new one.
+class ReferenceJustIntonation {
+ public:
+  void Init() {
+    write_ptr_ = 0;
+    cached_note_ = 0xff;
+    cached_pitch_ = 0;
+    for (uint8_t i = 0; i < kHistorySize; ++i) {
+      history_[i].note = 0;
+      history_[i].weight = 0;
+      history_[i].pitch = 0;
+    }
+  }
+
+  void NoteOff(uint8_t note) {
+    for (uint8_t i = 0; i < kHistorySize; ++i) {
+      if (history_[i].note == note && history_[i].weight == 255) {
+        history_[i].weight = 192;
+      }
+    }
+  }
+
+  int16_t NoteOn(uint8_t note) {
+    if (note != cached_note_) {
+      cached_note_ = note;
+      int pitch = static_cast<int>(note) << 7;
+      int coarse = Tune(pitch, -32, 32, 4);
+      cached_pitch_ = int16_t(pitch + Tune(pitch, coarse - 6, coarse + 6, 1));
+    }
+    for (size_t i = 0; i < kHistorySize; ++i) {
+      if (history_[i].weight != 255) {
+        history_[i].weight = (history_[i].weight * 3) >> 2;
+      }
+    }
+    history_[write_ptr_].note = note;
+    history_[write_ptr_].weight = 255;
+    history_[write_ptr_].pitch = cached_pitch_;
+    write_ptr_ = (write_ptr_ + 1) % kHistorySize;
+    return cached_pitch_;
+  }
+
+ private:
+  int Tune(int note, int min, int max, int step) {
+    const int kOctave = 12 << 7;
+    int best_score = 0x7fffffff;
+    int best_correction = 0;
+    for (int correction = min; correction <= max; correction += step) {
+      int score = lut_consonance[
+          correction >= 0 ? correction : (kOctave + correction)];
+      int pitch = correction + note;
+      for (size_t i = 0; i < kHistorySize; ++i) {
+        int interval = (pitch - history_[i].pitch + kOctave * 12) % kOctave;
+        score += lut_consonance[interval] * history_[i].weight;
+        if (score > best_score) {
+          break;
+        }
+      }
+      if (score < best_score) {
+        best_correction = correction;
+        best_score = score;
+      }
+    }
+    return best_correction;
+  }
+
+  size_t write_ptr_;
+  int16_t cached_pitch_;
+  uint8_t cached_note_;
+  HistoryEntry history_[kHistorySize];
+};
+
+// Sum of the dissonance of every interval within a chord.
+uint32_t ChordDissonance(const int16_t* pitch, uint8_t size) {
+  const int kOctave = 12 << 7;
+  uint32_t dissonance = 0;
+  for (uint8_t i = 0; i < size; ++i) {
+    for (uint8_t j = i + 1; j < size; ++j) {
+      dissonance += lut_consonance[(pitch[i] - pitch[j] + kOctave * 12) % kOctave];
+    }
+  }
+  return dissonance;
+}
+
+enum TuningBenchmarkMode {
+  TUNING_BENCHMARK_REFERENCE,
+  TUNING_BENCHMARK_SORTED,
+  TUNING_BENCHMARK_CHORDS,
+  TUNING_BENCHMARK_LAST
+};
+
+// Plays bursts of 3 to 8 note-ons received on the same frame, the chords
+// 50 ms apart and each released just before the next, through the reference
+// processor, the current one, and the current one in chord mode.  Each
+// note-on is timed on the host, keeping its best of several runs, and the
+// tunings of the first two are compared.  The chord dissonance is the mean
+// over all chords once their last note is in, including the retunes.
+void PrintJustIntonationBenchmark() {
+  const uint16_t kNumChords = 512;
+  const uint8_t kMinChordSize = 3;
+  const uint8_t kNumRuns = 16;
+  const uint16_t kMaxNoteOns = kNumChords * kMaxChordNotes;
+  static uint8_t chord_size[kNumChords];
+  static uint8_t chord_notes[kNumChords][kMaxChordNotes];
+  static uint64_t cycles[TUNING_BENCHMARK_LAST][kMaxNoteOns];
+  static int16_t pitch[TUNING_BENCHMARK_LAST][kMaxNoteOns];
+  static uint32_t dissonance[TUNING_BENCHMARK_LAST];
+  Simulator simulator;
+  simulator.Init();
+  srand(1);
+  uint16_t num_note_ons = 0;
+  for (uint16_t c = 0; c < kNumChords; ++c) {
+    chord_size[c] = kMinChordSize + rand() % (kMaxChordNotes - kMinChordSize + 1);
+    for (uint8_t i = 0; i < chord_size[c]; ++i) {
+      uint8_t note;
+      bool repeated;
+      do {
+        note = 36 + rand() % 48;
+        repeated = false;
+        for (uint8_t j = 0; j < i; ++j) {
+          repeated = repeated || chord_notes[c][j] == note;
+        }
+      } while (repeated);
+      chord_notes[c][i] = note;
+    }
+    num_note_ons += chord_size[c];
+  }
+  std::fill(&cycles[0][0], &cycles[0][0] + TUNING_BENCHMARK_LAST * kMaxNoteOns,
+            ~0ULL);
+  uint16_t blocks_per_chord = dac.frame_hz() / 20 / kAudioBlockSize;
+
+  static ReferenceJustIntonation reference;
+  for (uint8_t run = 0; run < kNumRuns; ++run) {
+    for (uint8_t mode = 0; mode < TUNING_BENCHMARK_LAST; ++mode) {
+      reference.Init();
+      just_intonation_processor.Init();
+      dissonance[mode] = 0;
+      uint16_t n = 0;
+      for (uint16_t c = 0; c < kNumChords; ++c) {
+        for (uint16_t b = 0; b < blocks_per_chord; ++b) {
+          dac.OnBlockConsumed(b & 1);
+        }
+        int16_t chord_pitch[kMaxChordNotes];
+        for (uint8_t i = 0; i < chord_size[c]; ++i) {
+          uint8_t note = chord_notes[c][i];
+          uint64_t start = ReadCycleCounter();
+          int16_t p;
+          if (mode == TUNING_BENCHMARK_REFERENCE) {
+            p = reference.NoteOn(note);
+          } else if (mode == TUNING_BENCHMARK_SORTED) {
+            p = just_intonation_processor.NoteOn(note);
+          } else {
+            p = just_intonation_processor.NoteOn(note, true);
+            uint8_t retuned_note;
+            int16_t retuned_pitch;
+            while (just_intonation_processor.PopRetuned(
+                &retuned_note, &retuned_pitch)) {
+              for (uint8_t j = 0; j < i; ++j) {
+                if (chord_notes[c][j] == retuned_note) {
+                  chord_pitch[j] = retuned_pitch;
+                }
+              }
+            }
+          }
+          cycles[mode][n] = std::min(
+              cycles[mode][n], ReadCycleCounter() - start);
+          chord_pitch[i] = pitch[mode][n++] = p;
+        }
+        dissonance[mode] += ChordDissonance(chord_pitch, chord_size[c]);
+        for (uint8_t i = 0; i < chord_size[c]; ++i) {
+          reference.NoteOff(chord_notes[c][i]);
+          just_intonation_processor.NoteOff(chord_notes[c][i]);
+        }
+      }
+    }
+  }
+
+  uint16_t mismatches = 0;
+  for (uint16_t n = 0; n < num_note_ons; ++n) {
+    mismatches += pitch[TUNING_BENCHMARK_REFERENCE][n] !=
+        pitch[TUNING_BENCHMARK_SORTED][n];
+  }
+  const char* const mode_names[TUNING_BENCHMARK_LAST] = {
+    "Reference", "Sorted history", "Chord mode"
+  };
+  printf("%u note-ons in %u chords\n", num_note_ons, kNumChords);
+  printf("%-16s %12s %12s %12s\n",
+         "Just intonation", "Mean cycles", "Max cycles", "Dissonance");
+  for (uint8_t mode = 0; mode < TUNING_BENCHMARK_LAST; ++mode) {
+    uint64_t total = 0;
+    uint64_t max = 0;
+    for (uint16_t n = 0; n < num_note_ons; ++n) {
+      total += cycles[mode][n];
+      max = std::max(max, cycles[mode][n]);
+    }
+    printf("%-16s %12.1f %12u %12.1f\n",
+           mode_names[mode],
+           static_cast<double>(total) / num_note_ons,
+           static_cast<unsigned>(max),
+           static_cast<double>(dissonance[mode]) / kNumChords);
+  }
+  printf("Tunings differing from the reference: %u\n", mismatches);
+  Check("tunings of the sorted history", mismatches);
+}
+
+// Writes messages back to back at the MIDI byte rate, with running status,
+// like a sequencer whose output is saturated.
+class MidiWireWriter {
+ public:
+  MidiWireWriter(MidiFile* midi_file)
+      : midi_file_(midi_file), num_bytes_(0), running_status_(0) { }
+
+  inline double time() const { return num_bytes_ / 3125.0; }
+
+  void Realtime(uint8_t byte) {
+    Byte(byte);
+  }
+
+  void Message(uint8_t status, uint8_t data_1, uint8_t data_2) {
+    if (status != running_status_) {
+      Byte(status);
+      running_status_ = status;
+    }
+    Byte(data_1);
+    Byte(data_2);
+  }
+
+ private:
+  void Byte(uint8_t byte) {
+    midi_file_->AppendByte(time(), byte);
+    ++num_bytes_;
+  }
+
+  MidiFile* midi_file_;
+  uint32_t num_bytes_;
+  uint8_t running_status_;
+};
+
+// Clock at 120 BPM, a note every 125 ms on each of 4 channels, and bursts of
+// mod wheel CCs taking up the rest of the input's bandwidth.
+void BuildThruStressPattern(MidiFile* midi_file, double duration) {
+  MidiWireWriter wire(midi_file);
+  double next_clock = 0.0;
+  double next_notes = 0.0;
+  uint8_t note[4] = { 0, 0, 0, 0 };
+  uint8_t cc_value[4] = { 0, 32, 64, 96 };
+  uint8_t channel = 0;
+  while (wire.time() < duration) {
+    if (wire.time() >= next_clock) {
+      wire.Realtime(0xf8);
+      next_clock += 60.0 / 120 / 24;
+    } else if (wire.time() >= next_notes) {
+      for (uint8_t c = 0; c < 4; ++c) {
+        if (note[c]) {
+          wire.Message(0x80 | c, note[c], 64);
+        }
+        note[c] = 48 + 12 * c + (rand() % 12);
+        wire.Message(0x90 | c, note[c], 100);
+      }
+      next_notes += 0.125;
+    } else {
+      for (uint8_t i = 0; i < 4; ++i) {
+        cc_value[channel] = (cc_value[channel] + 1) & 0x7f;
+        wire.Message(0xb0 | channel, 1, cc_value[channel]);
+      }
+      channel = (channel + 1) & 3;
+    }
+  }
+}
+
+struct TimedMidiMessage {
+  double time;  // Of the last byte
+  uint8_t status;
+  uint8_t data[2];
+};
+
+// Splits a byte stream into channel messages, and counts the data bytes
+// that belong to no message.
+uint32_t ParseMidiMessages(
+    const std::vector<TimedMidiByte>& bytes,
+    std::vector<TimedMidiMessage>* messages) {
+  uint32_t num_stray_bytes = 0;
+  uint8_t running_status = 0;
+  uint8_t num_data_bytes = 0;
+  TimedMidiMessage m;
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    uint8_t byte = bytes[i].byte;
+    if (byte >= 0xf8) continue;
+    if (byte & 0x80) {
+      num_stray_bytes += num_data_bytes;
+      running_status = byte < 0xf0 ? byte : 0;
+      num_data_bytes = 0;
+      continue;
+    }
+    if (!running_status) {
+      ++num_stray_bytes;
+      continue;
+    }
+    m.data[num_data_bytes++] = byte;
+    uint8_t type = running_status & 0xf0;
+    uint8_t size = type == 0xc0 || type == 0xd0 ? 1 : 2;
+    if (num_data_bytes == size) {
+      m.time = bytes[i].time;
+      m.status = running_status;
+      if (type == 0x90 && m.data[1] == 0) {
+        m.status = 0x80 | (running_status & 0x0f);
+      }
+      messages->push_back(m);
+      num_data_bytes = 0;
+    }
+  }
+  return num_stray_bytes;
+}
+
+// Plays a saturated input through a quad part layout, whose parts send their
+// notes and forward the CCs through the output queue, under the internal
+// clock.  Notes are matched between input and output in order, per channel,
+// note and on/off, to measure their delay.  Fails unless the output is well
+// formed, every note gets through, and each channel ends on the last CC value
+// it received.  A second run stalls the main loop for 40 ms, as a flash page
+// erase would, which must lose no input byte and no clock tick.
+void PrintThruBenchmark() {
+  const double kDuration = 8.0;
+  const double kStallStart = 4.0;
+  const double kStall[] = { 0.0, 0.04 };
+  MidiFile midi_file;
+  srand(1);
+  BuildThruStressPattern(&midi_file, kDuration);
+  std::vector<TimedMidiMessage> input;
+  ParseMidiMessages(midi_file.bytes(), &input);
+  uint32_t num_notes_in = 0;
+  uint32_t num_ccs_in = 0;
+  uint8_t last_cc_value[4];
+  for (size_t i = 0; i < input.size(); ++i) {
+    uint8_t type = input[i].status & 0xf0;
+    num_notes_in += type == 0x80 || type == 0x90;
+    if (type == 0xb0) {
+      ++num_ccs_in;
+      last_cc_value[input[i].status & 3] = input[i].data[1];
+    }
+  }
+  printf("Input: %u bytes, %u notes, %u CCs in %.1f s\n",
+         static_cast<unsigned>(midi_file.bytes().size()),
+         static_cast<unsigned>(num_notes_in),
+         static_cast<unsigned>(num_ccs_in),
+         kDuration);
+  printf("%10s %8s %8s %8s %8s %8s %8s %8s %6s %10s %10s\n",
+         "Stall (ms)", "Bytes", "Stray", "Notes", "CCs", "Merged", "Dropped",
+         "Lost in", "Ticks", "Mean (ms)", "Max (ms)");
+
+  int32_t num_ticks = 0;
+  for (uint8_t run = 0; run < sizeof(kStall) / sizeof(kStall[0]); ++run) {
+    Simulator simulator;
+    simulator.Init();
+    simulator.StallMainLoop(kStallStart, kStall[run]);
+    multi.ApplySetting(SETTING_LAYOUT, 0, LAYOUT_QUAD_MONO);
+    multi.ApplySetting(SETTING_CLOCK_TEMPO, 0, 240);
+    multi.Start(false);
+    std::vector<TimedMidiByte> output_bytes;
+    simulator.LogMidiOutput(&output_bytes);
+    // Leave time for the output to catch up.
+    simulator.Run(midi_file, kDuration + 2.0);
+    if (run == 0) {
+      num_ticks = multi.tick_counter();
+    }
+
+    std::vector<TimedMidiMessage> output;
+    uint32_t num_stray_bytes = ParseMidiMessages(output_bytes, &output);
+    uint32_t num_notes_out = 0;
+    uint32_t num_ccs_out = 0;
+    uint8_t final_cc_value[4] = { 0xff, 0xff, 0xff, 0xff };
+    double total_delay = 0.0;
+    double max_delay = 0.0;
+    std::vector<bool> matched(input.size(), false);
+    for (size_t i = 0; i < output.size(); ++i) {
+      const TimedMidiMessage& m = output[i];
+      uint8_t type = m.status & 0xf0;
+      if (type == 0xb0) {
+        ++num_ccs_out;
+        final_cc_value[m.status & 3] = m.data[1];
+        continue;
+      }
+      if (type != 0x80 && type != 0x90) continue;
+      for (size_t j = 0; j < input.size(); ++j) {
+        const TimedMidiMessage& n = input[j];
+        if (n.time > m.time) break;
+        if (!matched[j] && n.status == m.status && n.data[0] == m.data[0]) {
+          matched[j] = true;
+          double delay = m.time - n.time;
+          total_delay += delay;
+          max_delay = std::max(max_delay, delay);
+          ++num_notes_out;
+          break;
+        }
+      }
+    }
+    uint8_t num_stale_ccs = 0;
+    for (uint8_t c = 0; c < 4; ++c) {
+      num_stale_ccs += final_cc_value[c] != last_cc_value[c];
+    }
+    const MidiOutputQueue& queue = midi_handler.output_queue();
+    printf("%10.0f %8u %8u %8u %8u %8u %8u %8u %6d %10.2f %10.2f\n",
+           1000.0 * kStall[run],
+           static_cast<unsigned>(output_bytes.size()),
+           static_cast<unsigned>(num_stray_bytes),
+           static_cast<unsigned>(num_notes_out),
+           static_cast<unsigned>(num_ccs_out),
+           static_cast<unsigned>(queue.num_merged()),
+           static_cast<unsigned>(queue.num_dropped()),
+           static_cast<unsigned>(event_queue.num_dropped()),
+           static_cast<int>(multi.tick_counter()),
+           num_notes_out ? 1000.0 * total_delay / num_notes_out : 0.0,
+           1000.0 * max_delay);
+    Check("stray bytes on the MIDI out", num_stray_bytes);
+    Check("notes missing from the MIDI out", num_notes_in - num_notes_out);
+    Check("notes dropped by the output queue", queue.num_dropped());
+    Check("channels not ending on their last CC value", num_stale_ccs);
+    Check("input lost before the event queue", event_queue.num_dropped());
+    Check("clock ticks lost", multi.tick_counter() != num_ticks);
+  }
+}
+
+const uint8_t kCCFineTuning = 25;
+
+// Holds a note on each of 4 channels, then sweeps their fine tuning in bursts
+// of 4 CCs per channel, taking up the whole input's bandwidth.
+void BuildTuningSweepPattern(MidiFile* midi_file, double duration) {
+  MidiWireWriter wire(midi_file);
+  for (uint8_t c = 0; c < 4; ++c) {
+    wire.Message(0x90 | c, 48 + 12 * c, 100);
+  }
+  uint8_t cc_value[4] = { 0, 32, 64, 96 };
+  uint8_t channel = 0;
+  while (wire.time() < duration) {
+    for (uint8_t i = 0; i < 4; ++i) {
+      cc_value[channel] = (cc_value[channel] + 1) & 0x7f;
+      wire.Message(0xb0 | channel, kCCFineTuning, cc_value[channel]);
+    }
+    channel = (channel + 1) & 3;
+  }
+}
+
+// Passes every voicing setting of every part to its voices, as Part::Set did
+// on each change before the changes were collected for the refresh.
+void PushAllVoicing() {
+  for (uint8_t p = 0; p < kNumParts; ++p) {
+    const Part& part = multi.part(p);
+    const VoicingSettings& voicing = part.voicing_settings();
+    for (uint8_t i = 0; i < part.num_voices(); ++i) {
+      Voice* voice = part.voice(i);
+      voice->garbage(0);
+      voice->set_pitch_bend_range(voicing.pitch_bend_range);
+      voice->set_vibrato_range(voicing.vibrato_range);
+      voice->set_vibrato_mod(voicing.vibrato_mod);
+      voice->set_tremolo_mod(voicing.tremolo_mod);
+      voice->set_lfo_shape(LFO_ROLE_PITCH, voicing.vibrato_shape);
+      voice->set_lfo_shape(LFO_ROLE_TIMBRE, voicing.timbre_lfo_shape);
+      voice->set_lfo_shape(LFO_ROLE_AMPLITUDE, voicing.tremolo_shape);
+      voice->set_trigger_duration(voicing.trigger_duration);
+      voice->set_trigger_scale(voicing.trigger_scale);
+      voice->set_trigger_shape(voicing.trigger_shape);
+      voice->set_aux_cv(voicing.aux_cv);
+      voice->set_aux_cv_2(voicing.aux_cv_2);
+      voice->set_oscillator_mode(voicing.oscillator_mode);
+      voice->set_oscillator_shape(voicing.oscillator_shape);
+      voice->set_tuning(voicing.tuning_transpose, voicing.tuning_fine);
+      voice->set_timbre_init(voicing.timbre_initial);
+      voice->set_timbre_mod_lfo(voicing.timbre_mod_lfo);
+    }
+  }
+}
+
+// Plays the sweep through a quad mono layout, with every voicing setting
+// passed to the voices after each pass of the input processing
+// (PushAllVoicing), or only the changed ones at the next refresh.  The main loop cost is that of MIDI input processing, per CC; the
+// interrupt's is that of the SysTick, which now does the passing.  Latency
+// runs from each CC on channel 1, once the note has settled, to the next
+// change of the pitch CV of part 1, and the CV is compared frame by frame with
+// that of the first mode.
+// Costs are the best of a few runs, to leave out host noise.
+void MeasureTuningSweep(
+    bool immediate, const MidiFile& midi_file, double duration,
+    std::vector<uint16_t>* reference) {
+  const uint8_t kPitchChannel = 0;
+  const uint8_t kNumRuns = 3;
+  // Leaves out the CCs that arrive before the notes' pitch has settled
+  const double kSettleTime = 0.05;
+  std::vector<uint16_t> samples;
+  CycleCounter input_cost = { 0, ~0ULL, ~0ULL };
+  CycleCounter systick_cost = { 0, ~0ULL, ~0ULL };
+  double frame_hz = 0.0;
+  for (uint8_t run = 0; run < kNumRuns; ++run) {
+    Simulator simulator;
+    simulator.Init();
+    multi.ApplySetting(SETTING_LAYOUT, 0, LAYOUT_QUAD_MONO);
+    simulator.AfterInput(immediate ? &PushAllVoicing : NULL);
+    samples.clear();
+    simulator.Capture(kPitchChannel, &samples);
+    simulator.Run(midi_file, duration);
+    KeepBestCost(simulator.counter(STAGE_PROCESS_INPUT), &input_cost);
+    KeepBestCost(simulator.counter(STAGE_SYSTICK), &systick_cost);
+    frame_hz = simulator.num_frames() / simulator.simulated_seconds();
+  }
+
+  std::vector<TimedMidiMessage> input;
+  ParseMidiMessages(midi_file.bytes(), &input);
+  uint32_t num_ccs = 0;
+  uint32_t num_measured = 0;
+  double total_latency = 0.0;
+  double max_latency = 0.0;
+  for (size_t i = 0; i < input.size(); ++i) {
+    if ((input[i].status & 0xf0) != 0xb0) continue;
+    ++num_ccs;
+    if (input[i].status != 0xb0 || input[i].time < kSettleTime) continue;
+    size_t frame = static_cast<size_t>(ceil(input[i].time * frame_hz));
+    for (; frame < samples.size(); ++frame) {
+      if (frame && samples[frame] != samples[frame - 1]) break;
+    }
+    if (frame == samples.size()) continue;
+    double latency = frame / frame_hz - input[i].time;
+    total_latency += latency;
+    max_latency = std::max(max_latency, latency);
+    ++num_measured;
+  }
+  uint32_t num_differing = CountDifferingFrames(samples, reference);
+
+  double us_per_cycle = 1e6 / Simulator::cycle_counter_hz();
+  printf("%-10s %11.2f %11.1f %11.2f %11.1f %12.3f %11.3f %9u\n",
+         immediate ? "Immediate" : "Refresh",
+         us_per_cycle * input_cost.total / num_ccs,
+         us_per_cycle * input_cost.max,
+         us_per_cycle * systick_cost.total / systick_cost.calls,
+         us_per_cycle * systick_cost.max,
+         num_measured ? 1000.0 * total_latency / num_measured : 0.0,
+         1000.0 * max_latency,
+         static_cast<unsigned>(num_differing));
+  Check("voicing refresh against a full push", num_differing);
+}
+
+void PrintTuningSweepBenchmark() {
+  const double kDuration = 8.0;
+  MidiFile midi_file;
+  BuildTuningSweepPattern(&midi_file, kDuration);
+  printf("%-10s %11s %11s %11s %11s %12s %11s %9s\n",
+         "Voicing", "Input/CC", "Input max", "SysTick", "SysTick max",
+         "Latency (ms)", "Worst (ms)", "Differing");
+  printf("%-10s %11s %11s %11s %11s\n", "", "(us)", "(us)", "(us)", "(us)");
+  std::vector<uint16_t> reference;
+  MeasureTuningSweep(true, midi_file, kDuration, &reference);
+  MeasureTuningSweep(false, midi_file, kDuration, &reference);
+}
+
+const uint8_t kNumBenchmarkPrograms = 4;
+const uint8_t kProgramChangeChannel = 15;
+
+// Four programs for a set, switched by program changes on channel 16: quad
+// poly, quad mono arpeggiating part 1, dual poly, and quad poly an octave up
+// arpeggiating part 1.
+void BuildProgramBank(ProgramChangeMode mode, PackedMulti* bank) {
+  const uint8_t layouts[kNumBenchmarkPrograms] = {
+    LAYOUT_QUAD_POLY, LAYOUT_QUAD_MONO, LAYOUT_DUAL_POLY, LAYOUT_QUAD_POLY
+  };
+  for (uint8_t i = 0; i < kNumBenchmarkPrograms; ++i) {
+    multi.Init(true);
+    multi.ApplySetting(SETTING_LAYOUT, 0, layouts[i]);
+    multi.ApplySetting(
+        SETTING_REMOTE_CONTROL_CHANNEL, 0, kProgramChangeChannel + 1);
+    multi.ApplySetting(SETTING_PROGRAM_CHANGE_MODE, 0, mode);
+    multi.ApplySetting(SETTING_MIDI_TRANSPOSE_OCTAVES, 0, i == 3 ? 1 : 0);
+    multi.ApplySetting(
+        SETTING_SEQUENCER_PLAY_MODE, 0,
+        i & 1 ? PLAY_MODE_ARPEGGIATOR : PLAY_MODE_MANUAL);
+    PackedMultiStream stream = { &bank[i] };
+    multi.SerializePacked(&stream);
+  }
+}
+
+// Holds a chord on channel 1 under a running clock, while program changes
+// cycle through the bank every 2.3 s, out of step with the 2 s bars.
+void BuildProgramChangePattern(MidiFile* midi_file, uint8_t num_changes) {
+  midi_file->AppendByte(0.05, 0xfa);
+  const uint8_t chord[] = { 48, 55, 60, 64 };
+  for (uint8_t i = 0; i < sizeof(chord); ++i) {
+    midi_file->Append(0.1, 0x90, chord[i], 100);
+  }
+  for (uint8_t i = 0; i < num_changes; ++i) {
+    midi_file->Append(
+        1.0 + 2.3 * i, 0xc0 | kProgramChangeChannel,
+        (i + 1) % kNumBenchmarkPrograms);
+  }
+  midi_file->Sort();
+}
+
+// Plays the pattern with programs loaded in place, as the storage manager
+// used to, or preloaded then switched at the boundary of the mode.  Latency
+// runs from each program change to its switch, leaving out changes superseded
+// before theirs.  The stall is the time spent by the main loop iteration that
+// switches, worst of the switches and best of a few runs to leave out host
+// noise.
+void MeasureProgramSwitch(const char* name, bool preload, uint8_t mode) {
+  const double kDuration = 20.0;
+  const uint8_t kNumChanges = 8;
+  const uint8_t kNumRuns = 5;
+  uint64_t stall = ~0ULL;
+  std::vector<TimedProgramSwitch> switches;
+  for (uint8_t run = 0; run < kNumRuns; ++run) {
+    Simulator simulator;
+    simulator.Init();
+    static PackedMulti bank[kNumBenchmarkPrograms];
+    BuildProgramBank(static_cast<ProgramChangeMode>(mode), bank);
+    PackedMultiStream stream = { &bank[0] };
+    multi.DeserializePacked(&stream);
+
+    MidiFile midi_file;
+    BuildProgramChangePattern(&midi_file, kNumChanges);
+    switches.clear();
+    simulator.LoadPrograms(bank, kNumBenchmarkPrograms, preload);
+    simulator.LogProgramSwitches(&switches);
+    simulator.Run(midi_file, kDuration);
+    uint64_t worst = 0;
+    for (size_t i = 0; i < switches.size(); ++i) {
+      worst = std::max(worst, switches[i].cycles);
+    }
+    stall = std::min(stall, worst);
+  }
+
+  double total_latency = 0.0;
+  double max_latency = 0.0;
+  uint8_t num_measured = 0;
+  for (uint8_t i = 0; i < kNumChanges; ++i) {
+    double change = 1.0 + 2.3 * i;
+    double next_change = i + 1 < kNumChanges ? change + 2.3 : kDuration;
+    for (size_t j = 0; j < switches.size(); ++j) {
+      double time = switches[j].time;
+      if (time < change) continue;
+      if (time < next_change) {
+        total_latency += time - change;
+        max_latency = std::max(max_latency, time - change);
+        ++num_measured;
+      }
+      break;
+    }
+  }
+  uint8_t num_gates = 0;
+  for (uint8_t i = 0; i < kNumCVOutputs; ++i) {
+    num_gates += multi.cv_output(i).gate();
+  }
+  printf("%-9s %8u %12.1f %11.1f %11.1f %6u %7s\n",
+         name,
+         static_cast<unsigned>(switches.size()),
+         num_measured ? 1000.0 * total_latency / num_measured : 0.0,
+         1000.0 * max_latency,
+         1e6 * stall / Simulator::cycle_counter_hz(),
+         static_cast<unsigned>(num_gates),
+         multi.running() ? "running" : "stopped");
+  Check("program switches made", switches.size() != kNumChanges);
+  Check("program switches timed after their change",
+        kNumChanges - num_measured);
+  // Only a load in place stops the clock
+  Check("clock running through preloaded switches",
+        preload && !multi.running());
+}
+
+void PrintProgramSwitchBenchmark() {
+  printf("%-9s %8s %12s %11s %11s %6s %7s\n",
+         "Switch", "Switches", "Latency (ms)", "Worst (ms)", "Stall (us)",
+         "Gates", "Clock");
+  MeasureProgramSwitch("In place", false, PROGRAM_CHANGE_MODE_NOW);
+  MeasureProgramSwitch("Now", true, PROGRAM_CHANGE_MODE_NOW);
+  MeasureProgramSwitch("Step", true, PROGRAM_CHANGE_MODE_STEP);
+  MeasureProgramSwitch("Bar", true, PROGRAM_CHANGE_MODE_BAR);
+}
+
+enum RefreshScenario {
+  REFRESH_SCENARIO_IDLE,
+  REFRESH_SCENARIO_HELD,
+  REFRESH_SCENARIO_MODULATED,
+  REFRESH_SCENARIO_LAST
+};
+
+const char* const kRefreshScenarioNames[REFRESH_SCENARIO_LAST] = {
+  "Idle", "Held", "LFOs",
+};
+
+// Times Multi::Refresh, keeping the best of several runs.  Returns the mean
+// cycles per refresh, and the mean of the costliest of the 32 refresh phases,
+// where the low-rate modulation targets are recomputed.
+void TimeRefreshes(double* mean, double* worst_phase) {
+  const uint16_t kNumRefreshes = 32 * 256;
+  const uint8_t kNumRuns = 16;
+  const uint8_t kNumPhases = 1 << kLowFreqRefreshBits;
+
+  // Let the slews and the note-on transients settle
+  for (uint16_t i = 0; i < 4096; ++i) {
+    multi.Refresh();
+  }
+
+  uint64_t best_total = ~0ULL;
+  uint64_t phase_cycles[kNumPhases];
+  uint64_t best_phase_cycles[kNumPhases];
+  std::fill(&best_phase_cycles[0], &best_phase_cycles[kNumPhases], ~0ULL);
+  for (uint8_t run = 0; run < kNumRuns; ++run) {
+    uint64_t total = 0;
+    std::fill(&phase_cycles[0], &phase_cycles[kNumPhases], 0);
+    for (uint16_t i = 0; i < kNumRefreshes; ++i) {
+      uint64_t start = ReadCycleCounter();
+      multi.Refresh();
+      uint64_t elapsed = ReadCycleCounter() - start;
+      total += elapsed;
+      phase_cycles[i % kNumPhases] += elapsed;
+    }
+    best_total = std::min(best_total, total);
+    for (uint8_t i = 0; i < kNumPhases; ++i) {
+      best_phase_cycles[i] = std::min(best_phase_cycles[i], phase_cycles[i]);
+    }
+  }
+  *mean = static_cast<double>(best_total) / kNumRefreshes;
+  *worst_phase = static_cast<double>(*std::max_element(
+      &best_phase_cycles[0], &best_phase_cycles[kNumPhases])) *
+      kNumPhases / kNumRefreshes;
+}
+
+// Times Multi::Refresh with no notes, with a chord held on every part, and
+// with the chord modulated by all three LFOs.
+void MeasureRefresh(uint8_t layout, const char* name) {
+  for (uint8_t scenario = 0; scenario < REFRESH_SCENARIO_LAST; ++scenario) {
+    Simulator simulator;
+    simulator.Init();
+    Configure(layout, -1, -1, -1);
+    for (uint8_t p = 0; p < multi.num_active_parts(); ++p) {
+      if (scenario == REFRESH_SCENARIO_MODULATED) {
+        multi.ApplySetting(SETTING_VOICING_VIBRATO_RANGE, p, 2);
+        multi.ApplySetting(SETTING_VOICING_VIBRATO_MOD, p, 64);
+        multi.ApplySetting(SETTING_VOICING_TREMOLO_MOD, p, 64);
+        multi.ApplySetting(SETTING_VOICING_TIMBRE_MOD_LFO, p, 64);
+      }
+      if (scenario == REFRESH_SCENARIO_IDLE) continue;
+      const Part& part = multi.part(p);
+      for (uint8_t v = 0; v < part.num_voices(); ++v) {
+        multi.NoteOn(part.midi_settings().channel, 48 + 4 * v, 100);
+      }
+    }
+    // A note starts the clock, which holds the LFOs until its first tick
+    multi.Clock();
+    double mean, worst_phase;
+    TimeRefreshes(&mean, &worst_phase);
+    printf("%-14s %-6s %14.1f %12.1f\n",
+           scenario == 0 ? name : "",
+           kRefreshScenarioNames[scenario],
+           mean,
+           worst_phase);
+  }
+}
+
+void PrintRefreshBenchmark() {
+  printf("%-14s %-6s %14s %12s\n",
+         "Layout", "Notes", "Cycles/refresh", "Worst phase");
+  MeasureRefresh(LAYOUT_OCTAL_POLYCHAINED, "Octal chained");
+  MeasureRefresh(LAYOUT_PARAPHONIC_PLUS_TWO, "Paraphonic+2");
+  MeasureRefresh(LAYOUT_QUAD_POLY, "Quad poly");
+}
+
+// Holds a chord on every part with the LFOs running, as -R does, then fills
+// every slot of the modulation matrix of every part, each slot on its own
+// destination and fed by a bipolar LFO, which is the costliest route.  Reports
+// the costliest refresh phase, with host time scaled by the slowdown factor,
+// as a share of the 4 kHz refresh period.
+void MeasureModMatrix(uint8_t layout, const char* name, double slowdown) {
+  const ModDestination kDestinations[kNumModSlots] = {
+    MOD_DESTINATION_TIMBRE,
+    MOD_DESTINATION_ATTACK,
+    MOD_DESTINATION_PORTAMENTO,
+    MOD_DESTINATION_LFO_RATE,
+  };
+  const uint8_t kSlotSettings = 3;
+  double refresh_us = 1e6 / kDCRefreshHz;
+  double us_per_cycle = slowdown * 1e6 / Simulator::cycle_counter_hz();
+
+  double worst_phase[2];
+  uint8_t num_voices = 0;
+  for (uint8_t full = 0; full < 2; ++full) {
+    Simulator simulator;
+    simulator.Init();
+    Configure(layout, -1, -1, -1);
+    num_voices = 0;
+    for (uint8_t p = 0; p < multi.num_active_parts(); ++p) {
+      multi.ApplySetting(SETTING_VOICING_VIBRATO_RANGE, p, 2);
+      multi.ApplySetting(SETTING_VOICING_VIBRATO_MOD, p, 64);
+      multi.ApplySetting(SETTING_VOICING_TREMOLO_MOD, p, 64);
+      multi.ApplySetting(SETTING_VOICING_TIMBRE_MOD_LFO, p, 64);
+      for (uint8_t i = 0; full && i < kNumModSlots; ++i) {
+        uint8_t source = SETTING_VOICING_MOD_1_SOURCE + i * kSlotSettings;
+        multi.ApplySetting(
+            static_cast<SettingIndex>(source), p, MOD_SOURCE_LFO);
+        multi.ApplySetting(
+            static_cast<SettingIndex>(source + 1), p, kDestinations[i]);
+        multi.ApplySetting(static_cast<SettingIndex>(source + 2), p, 32);
+      }
+      const Part& part = multi.part(p);
+      for (uint8_t v = 0; v < part.num_voices(); ++v) {
+        multi.NoteOn(part.midi_settings().channel, 48 + 4 * v, 100);
+      }
+      num_voices += part.num_voices();
+    }
+    multi.Clock();
+    double mean;
+    TimeRefreshes(&mean, &worst_phase[full]);
+  }
+  printf("%-14s %5u %6u %11.1f %11.1f %11.1f %9.2f%%\n",
+         name,
+         static_cast<unsigned>(multi.num_active_parts()),
+         static_cast<unsigned>(num_voices),
+         worst_phase[0],
+         worst_phase[1],
+         worst_phase[1] - worst_phase[0],
+         100.0 * worst_phase[1] * us_per_cycle / refresh_us);
+}
+
+// Saves and reloads a program whose parts all use the modulation matrix,
+// with part 1's looper full, and counts the slots that don't come back and
+// the looper notes kept past the slots the matrix leaves.
+uint32_t CountModMatrixLosses() {
+  const uint8_t kSlotSettings = 3;
+  Simulator simulator;
+  simulator.Init();
+  Configure(LAYOUT_QUAD_MONO, -1, -1, -1);
+  for (uint8_t p = 0; p < kNumParts; ++p) {
+    for (uint8_t i = 0; i < kNumModSlots; ++i) {
+      uint8_t source = SETTING_VOICING_MOD_1_SOURCE + i * kSlotSettings;
+      multi.ApplySetting(static_cast<SettingIndex>(source), p,
+                         1 + (p + i) % (MOD_SOURCE_LAST - 1));
+      multi.ApplySetting(static_cast<SettingIndex>(source + 1), p,
+                         (p * 3 + i) % MOD_DESTINATION_LAST);
+      multi.ApplySetting(static_cast<SettingIndex>(source + 2), p,
+                         i & 1 ? -9 * (p + i) : 9 * (p + i));
+    }
+  }
+  ModSlot saved[kNumParts][kNumModSlots];
+  for (uint8_t p = 0; p < kNumParts; ++p) {
+    std::copy(&multi.part(p).voicing_settings().mod_slot[0],
+              &multi.part(p).voicing_settings().mod_slot[kNumModSlots],
+              &saved[p][0]);
+  }
+  looper::Deck& deck = multi.mutable_part(0)->mutable_looper();
+  for (uint8_t i = 0; i < looper::kMaxPackedNotes; ++i) {
+    looper::PackedNote note;
+    note.on_pos = i * 64;
+    note.off_pos = i * 64 + 32;
+    note.pitch = 60;
+    note.velocity = 100;
+    deck.AppendPackedNote(note);
+  }
+  uint32_t num_losses = multi.looper_notes_fit_packed();
+
+  PackedMulti packed;
+  PackedMultiStream stream = { &packed };
+  multi.SerializePacked(&stream);
+  multi.Init(true);
+  multi.DeserializePacked(&stream);
+  for (uint8_t p = 0; p < kNumParts; ++p) {
+    const ModSlot* slots = multi.part(p).voicing_settings().mod_slot;
+    for (uint8_t i = 0; i < kNumModSlots; ++i) {
+      num_losses += slots[i].source != saved[p][i].source ||
+          slots[i].destination != saved[p][i].destination ||
+          slots[i].depth != saved[p][i].depth;
+    }
+  }
+  num_losses += multi.part(0).looper().num_notes() !=
+      looper::kMaxPackedNotes - kPackedModMatrixNotes;
+  return num_losses;
+}
+
+void PrintModMatrixBenchmark(double slowdown) {
+  uint32_t num_losses = CountModMatrixLosses();
+  printf("Matrix slots lost by a packed save: %u\n\n",
+         static_cast<unsigned>(num_losses));
+  Check("modulation matrix through a packed save", num_losses);
+  printf("%-14s %5s %6s %11s %11s %11s %10s\n",
+         "Layout", "Parts", "Voices", "No matrix", "Full matrix", "Matrix",
+         "Of 4 kHz");
+  MeasureModMatrix(LAYOUT_QUAD_MONO, "Quad mono", slowdown);
+  MeasureModMatrix(LAYOUT_QUAD_POLY, "Quad poly", slowdown);
+  MeasureModMatrix(LAYOUT_OCTAL_POLYCHAINED, "Octal chained", slowdown);
+  MeasureModMatrix(LAYOUT_PARAPHONIC_PLUS_TWO, "Paraphonic+2", slowdown);
+}
+
+// Fills part 1's step slots with random notes, which changes up to 60 bytes
+// of the packed image.
+void ScrambleSteps(uint32_t* seed) {
+  StepSequence* sequence = multi.mutable_part(0)->mutable_sequence();
+  for (uint8_t i = 0; i < kNumSteps; ++i) {
+    *seed = *seed * 1664525 + 1013904223;
+    sequence->SetStep(
+        i, SequencerStep((*seed >> 24) & 0x7f, 1 + (*seed >> 8) % 127));
+  }
+}
+
+void CapturePacked(PackedMulti* image) {
+  PackedMultiStream stream = { image };
+  multi.SerializePacked(&stream);
+}
+
+// Runs the storage manager's background work, as the main loop does between
+// block renders.
+void TickStorage(uint16_t num_ticks) {
+  while (num_ticks--) {
+    storage_manager.Tick();
+  }
+}
+
+// Whether the slot loads back as image.  With reboot, after a power cycle,
+// which also shows that nothing was left waiting to be written.  The clock
+// is stopped, so the program replaces the multi at once.
+bool SlotHolds(uint8_t slot, const PackedMulti& image, bool reboot) {
+  if (reboot) {
+    storage_manager.Init();
+  }
+  multi.Stop();
+  PackedMulti loaded;
+  if (!storage_manager.LoadMulti(slot)) {
+    return false;
+  }
+  CapturePacked(&loaded);
+  return !memcmp(&loaded, &image, sizeof(image));
+}
+
+bool LogPageErased(PresetLog* log, uint8_t page) {
+  const uint16_t* words = log->mutable_page(page);
+  for (uint16_t i = 0; i < kFlashPageSize / 2; ++i) {
+    if (words[i] != 0xffff) return false;
+  }
+  return true;
+}
+
+void CheckPresetLogStep(const char* name, uint32_t num_failures) {
+  printf("%-44s %s\n", name, num_failures ? "FAILED" : "ok");
+  Check(name, num_failures);
+}
+
+// Saves programs through the preset log, with the power cut in the middle of
+// a save and of a record, with a slot's page gone bad, with the log filling
+// up while the clock runs, and with torn and foreign pages among the log's.
+void PrintPresetLogChecks() {
+  Simulator simulator;
+  simulator.Init();
+  storage_manager.Init();
+  // Shares the emulated flash with the storage manager's log
+  PresetLog log;
+  log.Init(0);
+  uint32_t seed = 0x10c;
+  PackedMulti image, saved;
+  uint32_t num_failures = 0;
+
+  CapturePacked(&image);
+  for (uint8_t slot = 0; slot < kNumFlashStoragePages - 1; ++slot) {
+    num_failures += !SlotHolds(slot, image, false);
+  }
+  CheckPresetLogStep("Unsaved slots hold the initial program", num_failures);
+
+  ScrambleSteps(&seed);
+  CapturePacked(&saved);
+  uint32_t num_erases = FlashStorage::num_erases();
+  storage_manager.SaveMulti(0);
+  TickStorage(200);
+  CheckPresetLogStep(
+      "First save is logged",
+      (FlashStorage::num_erases() != num_erases) + !SlotHolds(0, saved, true));
+
+  ScrambleSteps(&seed);
+  storage_manager.SaveMulti(0);
+  TickStorage(10);
+  CheckPresetLogStep(
+      "Save cut short leaves the slot as it was", !SlotHolds(0, saved, true));
+
+  // Program the value of the next record, and not its header
+  num_failures = 1;
+  for (uint8_t page = 0; page < kNumLogPages && num_failures; ++page) {
+    uint16_t* words = log.mutable_page(page);
+    for (uint16_t i = 0; i < kLogRecordsPerPage && words[1] != 0xffff; ++i) {
+      uint16_t* record = &words[2 + 2 * i];
+      if (record[0] == 0xffff && record[1] == 0xffff) {
+        record[0] = 0x1234;
+        num_failures = 0;
+        break;
+      }
+    }
+  }
+  ScrambleSteps(&seed);
+  CapturePacked(&image);
+  storage_manager.Init();
+  storage_manager.SaveMulti(0);
+  TickStorage(200);
+  num_failures += !SlotHolds(0, image, true);
+  CapturePacked(&saved);
+  multi.Init(true);
+  CapturePacked(&image);
+  num_failures += !SlotHolds(1, image, false);
+  CheckPresetLogStep(
+      "Torn record and aborted save are skipped", num_failures);
+
+  ScrambleSteps(&seed);
+  storage_manager.SaveMulti(2);
+  TickStorage(200);
+  FlashStorage::mutable_page(1 + 2)[0] ^= 0xff;
+  ScrambleSteps(&seed);
+  CapturePacked(&image);
+  storage_manager.SaveMulti(2);
+  TickStorage(200);
+  CheckPresetLogStep(
+      "Bad page is rewritten past its records",
+      !SlotHolds(2, image, false) + !SlotHolds(2, image, true));
+
+  // The log holds about 16 of these saves.  Once it is full, a save waits
+  // for the clock to stop, and only a save to the same slot can take the
+  // stream buffer from it.
+  num_failures = 0;
+  num_erases = FlashStorage::num_erases();
+  multi.Start(false);
+  uint8_t refused = 0;
+  for (uint8_t i = 0; i < 96 && !refused; ++i) {
+    uint8_t slot = 4 + (i & 1);
+    ScrambleSteps(&seed);
+    if (!storage_manager.SaveMulti(slot)) {
+      refused = slot;
+    }
+    TickStorage(200);
+  }
+  uint8_t waiting = refused ^ 1;
+  ScrambleSteps(&seed);
+  CapturePacked(&image);
+  num_failures += !refused || !storage_manager.SaveMulti(waiting);
+  num_failures += storage_manager.StartBulkDump();
+  TickStorage(200);
+  num_failures += !multi.running() || FlashStorage::num_erases() != num_erases;
+  multi.Stop();
+  TickStorage(200);
+  num_failures += FlashStorage::num_erases() == num_erases;
+  num_failures += !SlotHolds(waiting, image, true);
+  CheckPresetLogStep(
+      "Full log waits for the clock to stop", num_failures);
+
+  // A log page with its magic and no sequence number, and a page that holds
+  // something else, in the pages that compaction leaves erased
+  TickStorage(200);
+  uint8_t torn = kNumLogPages;
+  uint8_t foreign = kNumLogPages;
+  uint16_t magic = 0xffff;
+  for (uint8_t page = 0; page < kNumLogPages; ++page) {
+    if (!LogPageErased(&log, page)) {
+      magic = log.mutable_page(page)[0];
+    } else if (torn == kNumLogPages) {
+      torn = page;
+    } else if (foreign == kNumLogPages) {
+      foreign = page;
+    }
+  }
+  num_failures = foreign == kNumLogPages;
+  if (!num_failures) {
+    log.mutable_page(torn)[0] = magic;
+    for (uint16_t i = 0; i < kFlashPageSize / 2; ++i) {
+      log.mutable_page(foreign)[i] = 0x4770 + i;
+    }
+    storage_manager.Init();
+    ScrambleSteps(&seed);
+    CapturePacked(&image);
+    storage_manager.SaveMulti(5);
+    TickStorage(200);
+    num_failures += !LogPageErased(&log, torn);
+    num_failures += !SlotHolds(5, image, true);
+    for (uint16_t i = 0; i < kFlashPageSize / 2; ++i) {
+      num_failures += log.mutable_page(foreign)[i] != 0x4770 + i;
+      log.mutable_page(foreign)[i] = 0xffff;
+    }
+  }
+  CheckPresetLogStep(
+      "Torn page is erased, and foreign page kept", num_failures);
+}
+
+// A bulk transfer message read back from the MIDI out
+struct BulkMessage {
+  uint8_t command;
+  uint8_t page;
+  uint8_t chunk;
+  uint8_t status;  // Of an ack
+  uint8_t size;  // Of a packet's data
+  uint8_t data[kSysexBulkChunkSize];
+};
+
+// Takes the next message off the MIDI out, and checks its encoding.
+bool ReadBulkMessage(BulkMessage* message) {
+  MidiHandler::MidiBuffer* buffer = midi_handler.mutable_output_buffer();
+  uint8_t bytes[12 + 2 * kSysexBulkChunkSize];
+  size_t size = 0;
+  while (buffer->readable() && (!size || bytes[size - 1] != 0xf7)) {
+    uint8_t byte = buffer->ImmediateRead();
+    if (byte == 0xf0) {
+      size = 0;
+    }
+    if (size < sizeof(bytes)) {
+      bytes[size++] = byte;
+    }
+  }
+  if (size < 11 || bytes[0] != 0xf0 || bytes[size - 1] != 0xf7) {
+    return false;
+  }
+  message->command = bytes[6];
+  message->page = bytes[7];
+  message->chunk = bytes[8];
+  if (message->command == SYSEX_COMMAND_BULK_ACK) {
+    message->status = bytes[9];
+    return size == 11;
+  }
+  message->size = (size - 12) / 2;
+  uint8_t checksum = 0;
+  for (uint8_t i = 0; i <= message->size; ++i) {
+    uint8_t byte = bytes[9 + 2 * i] << 4 | bytes[10 + 2 * i];
+    if (i < message->size) {
+      message->data[i] = byte;
+      checksum += byte;
+    } else if (byte != checksum) {
+      return false;
+    }
+  }
+  return message->command == SYSEX_COMMAND_BULK_PACKET;
+}
+
+// Runs Tick, with the clock at 1 ms per call, until a message is sent.
+bool TickUntilBulkMessage(BulkMessage* message) {
+  for (uint16_t i = 0; i < 2 * kBulkAckTimeout; ++i) {
+    storage_manager.Tick();
+    stmlib::system_clock.Tick();
+    if (ReadBulkMessage(message)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void CaptureCalibration(uint16_t* dac_codes) {
+  for (uint8_t i = 0; i < kNumCVOutputs; ++i) {
+    for (uint8_t j = 0; j < kNumOctaves; ++j) {
+      *dac_codes++ = multi.cv_output(i).calibration_dac_code(j);
+    }
+  }
+}
+
+// Dumps every page, restores the dump over other programs and calibration,
+// and checks that the flash holds the dumped ones again, with the tail of a
+// long sequence in slot 1.  Every fifth ack is
+// lost, so the chunk is sent again, and every seventh arrives twice.
+void PrintBulkTransferChecks() {
+  const uint8_t kNumSlots = kNumFlashStoragePages - 1;
+  Simulator simulator;
+  simulator.Init();
+  storage_manager.Init();
+  uint32_t seed = 0xb01c;
+  PackedMulti images[kNumSlots];
+  uint16_t calibration[kNumCVOutputs * kNumOctaves];
+  uint32_t num_failures = 0;
+
+  multi.mutable_cv_output(1)->set_calibration_dac_code(3, 31337);
+  CaptureCalibration(calibration);
+  uint32_t num_erases = FlashStorage::num_erases();
+  storage_manager.SaveCalibration();
+  num_failures += FlashStorage::num_erases() != num_erases;
+  multi.Start(false);
+  TickStorage(10);
+  num_failures += FlashStorage::num_erases() != num_erases;
+  multi.Stop();
+  TickStorage(10);
+  num_failures += FlashStorage::num_erases() != num_erases + 1;
+  CheckPresetLogStep(
+      "Calibration is saved once nothing is playing", num_failures);
+
+  StepSequence sequence;
+  BuildStepSequence(&sequence, kMaxNumSteps, false);
+  for (uint8_t slot = 0; slot < kNumSlots; ++slot) {
+    if (slot == 0) {
+      *multi.mutable_part(0)->mutable_sequence() = sequence;
+    } else {
+      ScrambleSteps(&seed);
+    }
+    CapturePacked(&images[slot]);
+    storage_manager.SaveMulti(slot);
+    TickStorage(2000);
+  }
+
+  static uint8_t dump[kNumBulkPages][kFlashPageSize];
+  uint16_t dump_size[kNumBulkPages] = { 0 };
+  BulkMessage m;
+  uint32_t num_messages = 0;
+  num_failures = 0;
+  storage_manager.StartBulkDump();
+  while (TickUntilBulkMessage(&m)) {
+    if (m.command != SYSEX_COMMAND_BULK_PACKET ||
+        m.page >= kNumBulkPages) {
+      ++num_failures;
+      break;
+    }
+    uint16_t& size = dump_size[m.page];
+    if (m.chunk * kSysexBulkChunkSize == size &&
+        size + m.size <= kFlashPageSize) {
+      std::copy(m.data, m.data + m.size, &dump[m.page][size]);
+      size += m.size;
+    }
+    if (++num_messages % 5 == 0) {
+      continue;
+    }
+    storage_manager.OnBulkAck(m.page, m.chunk, true);
+    if (num_messages % 7 == 0) {
+      storage_manager.OnBulkAck(m.page, m.chunk, true);
+    }
+  }
+  num_failures += dump_size[0] != kCalibrationSize;
+  for (uint8_t slot = 0; slot < kNumSlots; ++slot) {
+    num_failures += dump_size[1 + slot] != kPackedSize;
+  }
+  for (uint8_t page = kNumFlashStoragePages; page < kNumBulkPages; ++page) {
+    num_failures += dump_size[page] != kFlashPageSize;
+  }
+  CheckPresetLogStep("Dump sends every page once acked", num_failures);
+
+  multi.Init(true);
+  storage_manager.SaveCalibration();
+  for (uint8_t slot = 0; slot < kNumSlots; ++slot) {
+    ScrambleSteps(&seed);
+    storage_manager.SaveMulti(slot);
+    TickStorage(200);
+  }
+
+  num_failures = 0;
+  for (uint8_t page = 0; page < kNumBulkPages; ++page) {
+    for (uint8_t chunk = 0; ; ++chunk) {
+      uint16_t offset = chunk * kSysexBulkChunkSize;
+      uint16_t size = offset < dump_size[page] ? std::min<uint16_t>(
+          dump_size[page] - offset, kSysexBulkChunkSize) : 0;
+      const uint8_t* data = dump[page] + std::min(offset, kFlashPageSize);
+      bool acked = false;
+      for (uint8_t retry = 0; retry <= kBulkMaxRetries && !acked; ++retry) {
+        storage_manager.ReceiveBulkChunk(page, chunk, data, size);
+        if (!TickUntilBulkMessage(&m)) {
+          break;
+        }
+        acked = ++num_messages % 5 != 0;
+      }
+      num_failures += !acked || m.command != SYSEX_COMMAND_BULK_ACK ||
+          m.page != page || m.chunk != chunk || m.status;
+      if (num_messages % 7 == 0) {
+        storage_manager.ReceiveBulkChunk(page, chunk, data, size);
+        num_failures += !TickUntilBulkMessage(&m) || m.chunk != chunk ||
+            m.status;
+      }
+      if (!size || num_failures) {
+        break;
+      }
+    }
+  }
+  uint16_t restored_calibration[kNumCVOutputs * kNumOctaves];
+  multi.Init(true);
+  storage_manager.Init();
+  num_failures += !storage_manager.LoadCalibration();
+  CaptureCalibration(restored_calibration);
+  num_failures += memcmp(
+      calibration, restored_calibration, sizeof(calibration)) != 0;
+  for (uint8_t slot = 0; slot < kNumSlots; ++slot) {
+    num_failures += !SlotHolds(slot, images[slot], false);
+  }
+  SlotHolds(0, images[0], false);
+  const StepSequence& loaded = multi.part(0).sequence();
+  num_failures += loaded.size() != sequence.size() || !std::equal(
+      loaded.data(), loaded.data() + loaded.size(), sequence.data());
+  CheckPresetLogStep("Restore writes back the dumped pages", num_failures);
+}
+
+// Feeds the first size bytes of a tagged dump to the storage manager in SysEx
+// chunks, and returns whether it was applied whole.
+bool ReceiveTagged(const uint8_t* payload, size_t size) {
+  for (size_t offset = 0; offset < size; offset += kSysexMaxChunkSize) {
+    storage_manager.AppendTaggedData(
+        payload + offset, std::min(size - offset, kSysexMaxChunkSize),
+        offset == 0);
+  }
+  return storage_manager.DeserializeMultiTagged();
+}
+
+// A tagged dump with a long sequence in every part is larger than the stream
+// buffer, and is applied a section at a time.  One cut short keeps the
+// sections that came.
+void PrintTaggedReceiveChecks() {
+  Simulator simulator;
+  simulator.Init();
+  storage_manager.Init();
+  static stmlib::StreamBuffer<Multi::kTaggedPayloadSize> payload;
+  StepSequence sequence;
+  BuildStepSequence(&sequence, kMaxNumSteps, false);
+  multi.Init(true);
+  for (uint8_t part = 0; part < kNumParts; ++part) {
+    *multi.mutable_part(part)->mutable_sequence() = sequence;
+  }
+  multi.ApplySetting(SETTING_SEQUENCER_STEP_OFFSET, 3, 7);
+  PackedMulti image, received;
+  CapturePacked(&image);
+  payload.Clear();
+  multi.SerializeTagged(&payload);
+  uint32_t num_failures = payload.position() <= kStreamBufferSize;
+
+  multi.Init(true);
+  num_failures += !ReceiveTagged(payload.bytes(), payload.position());
+  CapturePacked(&received);
+  num_failures += memcmp(&image, &received, sizeof(image)) != 0;
+  for (uint8_t part = 0; part < kNumParts; ++part) {
+    const StepSequence& loaded = multi.part(part).sequence();
+    num_failures += loaded.size() != sequence.size() || !std::equal(
+        loaded.data(), loaded.data() + loaded.size(), sequence.data());
+  }
+  CheckPresetLogStep("Tagged dump is applied as it arrives", num_failures);
+
+  multi.Init(true);
+  num_failures = ReceiveTagged(payload.bytes(), payload.position() / 2);
+  num_failures += multi.part(0).sequence().size() != sequence.size();
+  num_failures += multi.part(kNumParts - 1).sequence().size() != 0;
+  CheckPresetLogStep("Tagged dump cut short keeps its sections", num_failures);
+}
+
+struct Footprint {
+  const char* name;
+  size_t size;
+  size_t count;
+};
+
+// Lists the statically allocated state of the synth, each object indented
+// under the one that holds it.  Sizes are the host's, whose pointers are
+// twice as wide as the target's; make ram_report lists the firmware's own.
+void PrintFootprint() {
+  const Footprint kObjects[] = {
+    { "Multi", sizeof(multi), 1 },
+    { "  Part", sizeof(Part), kNumParts },
+    { "    SequencerSettings", sizeof(SequencerSettings), kNumParts },
+    { "    StepSequence", sizeof(StepSequence), kNumParts },
+    { "    HeldKeys", sizeof(HeldKeys), 2 * kNumParts },
+    { "    looper::Deck", sizeof(looper::Deck), kNumParts },
+    { "  Voice", sizeof(Voice), kNumSystemVoices },
+    { "    FastSyncedLFO", sizeof(FastSyncedLFO),
+      LFO_ROLE_LAST * kNumSystemVoices },
+    { "    Oscillator", sizeof(Oscillator), kNumSystemVoices },
+    { "      Envelope", sizeof(Envelope), 2 * kNumSystemVoices },
+    { "  CVOutput", sizeof(CVOutput), kNumCVOutputs },
+    { "    Envelope", sizeof(Envelope), kNumCVOutputs },
+    { "looper::NotePool", sizeof(looper::note_pool), 1 },
+    { "  looper::Note", sizeof(looper::Note), looper::kMaxPoolSize },
+    { "PresetMorph", sizeof(preset_morph), 1 },
+    { "JustIntonationProcessor", sizeof(just_intonation_processor), 1 },
+    { "EventQueue", sizeof(event_queue), 1 },
+    { "SysEx receive buffer", kSysexRxBufferSize, 1 },
+  };
+  printf("%-26s %6s %6s %7s\n", "Object", "Count", "Size", "Total");
+  for (size_t i = 0; i < sizeof(kObjects) / sizeof(kObjects[0]); ++i) {
+    const Footprint& object = kObjects[i];
+    printf("%-26s %6u %6u %7u\n",
+           object.name,
+           static_cast<unsigned>(object.count),
+           static_cast<unsigned>(object.size),
+           static_cast<unsigned>(object.size * object.count));
+  }
+}
+
+// The float math that Envelope::Trigger did to shorten a stage.  The ratio
+// went through the integer abs(), the only one in scope on the target, which
+// truncates it and saturates it as the F103 does.
+uint32_t FloatTriggerRatio(int32_t nominal_delta, int32_t actual_delta) {
+  float ratio = static_cast<float>(nominal_delta) /
+      static_cast<float>(actual_delta);
+  int32_t whole_ratio = ratio >= 2147483648.0f
+      ? INT32_MAX
+      : ratio <= -2147483648.0f ? INT32_MIN : static_cast<int32_t>(ratio);
+  return whole_ratio == INT32_MIN ? INT32_MAX : abs(whole_ratio);
+}
+
+// Its product with the phase increment, saturated like the target's
+// conversion.
+uint32_t FloatScalePhaseIncrement(uint32_t phase_increment, uint32_t ratio) {
+  float increment = static_cast<float>(phase_increment) *
+      static_cast<float>(ratio);
+  return increment >= 4294967296.0f
+      ? UINT32_MAX
+      : static_cast<uint32_t>(increment);
+}
+
+// The float math that Envelope::Rescale did to each level, saturated like
+// the target's conversion.
+int32_t FloatScaleLevel(int32_t level, int16_t new_scale, int16_t old_scale) {
+  float factor = static_cast<float>(new_scale) / static_cast<float>(old_scale);
+  float scaled = level * factor;
+  return scaled >= 2147483648.0f
+      ? INT32_MAX
+      : scaled <= -2147483648.0f ? INT32_MIN : static_cast<int32_t>(scaled);
+}
+
+uint32_t RandomWord() {
+  return (static_cast<uint32_t>(rand()) << 16) ^ rand();
+}
+
+struct Retarget {
+  uint32_t phase_increment;
+  int32_t nominal_delta;
+  int32_t actual_delta;
+};
+
+// A stage cut short: deltas of the same direction, the actual one smaller,
+// as Trigger sees them.  Every other one is a near-whole multiple, where the
+// float quotient can round up to the next integer.
+void RandomRetarget(Retarget* retarget) {
+  const int32_t kMaxDelta = INT32_MAX >> 1;
+  retarget->phase_increment = rand() & 1
+      ? Interpolate88(lut_envelope_phase_increments, rand() & 0x7fff)
+      : RandomWord();
+  int32_t actual = 1 + (RandomWord() >> (rand() % 32)) % (kMaxDelta - 1);
+  int32_t nominal;
+  if (rand() & 1) {
+    int32_t multiple = 2 + rand() % std::max(1, kMaxDelta / actual - 2);
+    nominal = std::min(kMaxDelta, actual * multiple + rand() % 5 - 2);
+    nominal = std::max(nominal, actual + 1);
+  } else {
+    nominal = actual + 1 + RandomWord() % (kMaxDelta - actual);
+  }
+  bool negative = rand() & 1;
+  retarget->nominal_delta = negative ? -nominal : nominal;
+  retarget->actual_delta = negative ? -actual : actual;
+}
+
+// Checks the integer math of the envelope's retargets and rescales against
+// the float math it replaced, on random stages cut short and on random levels
+// rescaled by random pairs of levels, and compares their cost.
+void PrintEnvelopeRetargetBenchmark() {
+  const uint32_t kNumRetargets = 1000000;
+  const uint32_t kNumRescales = 1000000;
+  const uint16_t kNumTimed = 1024;
+  const uint8_t kNumRuns = 64;
+  const int32_t kLevels[] = { 0, 1, -1, INT32_MAX, INT32_MIN, 1 << 30 };
+  const int16_t kScales[][2] = { { 12000, 1 << 14 }, { 1 << 14, 12000 },
+                                 { 1, INT16_MAX }, { INT16_MAX, 1 } };
+
+  srand(1);
+  static Retarget retargets[kNumTimed];
+  uint32_t num_differing_ratios = 0;
+  uint32_t num_differing_increments = 0;
+  for (uint32_t i = 0; i < kNumRetargets; ++i) {
+    Retarget& r = retargets[i % kNumTimed];
+    RandomRetarget(&r);
+    uint32_t ratio = TruncatedFloatRatio(
+        abs(r.nominal_delta), abs(r.actual_delta));
+    num_differing_ratios +=
+        ratio != FloatTriggerRatio(r.nominal_delta, r.actual_delta);
+    num_differing_increments +=
+        ScalePhaseIncrement(r.phase_increment, ratio) !=
+        FloatScalePhaseIncrement(r.phase_increment, ratio);
+  }
+
+  uint32_t num_differing_levels = 0;
+  uint32_t num_rescales = 0;
+  for (uint32_t i = 0; i < kNumRescales; ++i) {
+    int32_t level = i < sizeof(kLevels) / sizeof(kLevels[0])
+        ? kLevels[i]
+        : static_cast<int32_t>(RandomWord() >> (rand() % 32));
+    if (rand() & 1) level = -level;
+    for (uint8_t s = 0; s < 5; ++s) {
+      int16_t new_scale = s < 4 ? kScales[s][0] : rand() & INT16_MAX;
+      int16_t old_scale = s < 4 ? kScales[s][1] : 1 + rand() % INT16_MAX;
+      num_differing_levels += ScaleLevel(level, new_scale, old_scale) !=
+          FloatScaleLevel(level, new_scale, old_scale);
+      ++num_rescales;
+    }
+  }
+  printf("%-16s %9s %9s\n", "Math", "Checked", "Differ");
+  printf("%-16s %9u %9u\n", "Trigger ratio",
+         static_cast<unsigned>(kNumRetargets),
+         static_cast<unsigned>(num_differing_ratios));
+  printf("%-16s %9u %9u\n", "Phase increment",
+         static_cast<unsigned>(kNumRetargets),
+         static_cast<unsigned>(num_differing_increments));
+  printf("%-16s %9u %9u\n\n", "Rescaled level",
+         static_cast<unsigned>(num_rescales),
+         static_cast<unsigned>(num_differing_levels));
+  Check("envelope retarget ratios", num_differing_ratios);
+  Check("envelope phase increments", num_differing_increments);
+  Check("envelope rescales", num_differing_levels);
+
+  uint64_t best_float = ~0ULL, best_integer = ~0ULL;
+  for (uint8_t run = 0; run < kNumRuns; ++run) {
+    uint32_t sum = 0;
+    uint64_t start = ReadCycleCounter();
+    for (uint16_t i = 0; i < kNumTimed; ++i) {
+      const Retarget& r = retargets[i];
+      sum += FloatScalePhaseIncrement(
+          r.phase_increment,
+          FloatTriggerRatio(r.nominal_delta, r.actual_delta));
+    }
+    best_float = std::min(best_float, ReadCycleCounter() - start);
+    start = ReadCycleCounter();
+    for (uint16_t i = 0; i < kNumTimed; ++i) {
+      const Retarget& r = retargets[i];
+      sum += ScalePhaseIncrement(
+          r.phase_increment,
+          TruncatedFloatRatio(abs(r.nominal_delta), abs(r.actual_delta)));
+    }
+    best_integer = std::min(best_integer, ReadCycleCounter() - start);
+    benchmark_sink = sum;
+  }
+  printf("%-8s %17s\n", "Math", "Cycles/retarget");
+  printf("%-8s %17.1f\n", "Float",
+         static_cast<double>(best_float) / kNumTimed);
+  printf("%-8s %17.1f\n", "Integer",
+         static_cast<double>(best_integer) / kNumTimed);
+}
+
+// Port B pins of the display (drivers/display.cc), as wired on the module
+const uint16_t kScanPinClock = 1 << 7;  // DISP_SCK, shift register clock
+const uint16_t kScanPinLatch = 1 << 8;  // DISP_EN, storage register clock
+const uint16_t kScanPinData = 1 << 9;  // DISP_SER, serial data
+const uint16_t kScanPinEnables[kDisplayWidth] = { 1 << 6, 1 << 5 };
+
+// Counts the port B words that drive the display's pins outside their steps.
+// The latch rises on step 0 of each half and falls on step 1.  The clock
+// falls on the odd steps up to 31 and rises on the even ones from 2 to 32, so
+// the data, written on the odd steps only, is steady at each rising edge.
+// Every slot drives its half's position enable high and the other one low.
+uint16_t CountMisplacedScanWords() {
+  uint16_t num_misplaced = 0;
+  for (uint8_t slot = 0; slot < kNumScanSlots; ++slot) {
+    uint8_t position = slot / kScanSlotsPerPosition;
+    uint8_t step = slot % kScanSlotsPerPosition;
+    uint32_t word = panel_scan.word(SCAN_PORT_B, slot);
+    uint16_t set = word & 0xffff;
+    uint16_t reset = word >> 16;
+    bool shifting = step && step <= 32;
+    num_misplaced += !(set & kScanPinLatch) != (step != 0);
+    num_misplaced += !(reset & kScanPinLatch) != (step != 1);
+    num_misplaced += !(set & kScanPinClock) != !(shifting && !(step & 1));
+    num_misplaced += !(reset & kScanPinClock) != !(shifting && (step & 1));
+    num_misplaced += !((set | reset) & kScanPinData) != !(step & 1 && step < 32);
+    num_misplaced += !(set & kScanPinEnables[position]);
+    num_misplaced += !(reset & kScanPinEnables[1 - position]);
+  }
+  return num_misplaced;
+}
+
+// Plays the port B words through a model of the 74HC595 for two scans, the
+// first one to fill the registers, and returns in latched the segments that
+// each position shows while its enable is high.  Counts the slots of the
+// second scan where a position shows other segments than at its first slot.
+uint16_t DecodeScan(uint16_t* latched) {
+  uint16_t pins = 0;
+  uint16_t shifted = 0;
+  uint16_t stored = 0;
+  uint16_t num_unsteady = 0;
+  bool shown[kDisplayWidth] = { false, false };
+  for (uint16_t i = 0; i < 2 * kNumScanSlots; ++i) {
+    uint32_t word = panel_scan.word(SCAN_PORT_B, i % kNumScanSlots);
+    uint16_t previous = pins;
+    // BSRR: a set bit wins over a reset one
+    pins = (pins & ~(word >> 16)) | (word & 0xffff);
+    uint16_t rising = pins & ~previous;
+    if (rising & kScanPinClock) {
+      // Shifted in least significant bit first, as Display::Draw sends them
+      shifted = shifted >> 1 | (pins & kScanPinData ? 0x8000 : 0);
+    }
+    if (rising & kScanPinLatch) {
+      stored = shifted;
+    }
+    if (i < kNumScanSlots) continue;
+    for (uint8_t p = 0; p < kDisplayWidth; ++p) {
+      if (!(pins & kScanPinEnables[p])) continue;
+      if (!shown[p]) {
+        latched[p] = stored;
+        shown[p] = true;
+      }
+      num_unsteady += latched[p] != stored;
+    }
+  }
+  num_unsteady += !shown[0] + !shown[1];
+  return num_unsteady;
+}
+
+// Share of each slot that the display is lit, with the blanking compare of
+// TIM4 CC2: the counter runs from 0 to kScanSlotPeriod - 1, so a compare of 0
+// blanks the display from the start of the slot, and one of kScanSlotPeriod
+// never fires.
+double ScanLitShare() {
+  uint16_t delay = panel_scan.blanking_delay();
+  if (!(panel_scan.blanking_pins() & kScanPinEnables[0]) ||
+      !(panel_scan.blanking_pins() & kScanPinEnables[1])) {
+    return 1.0;
+  }
+  return delay >= kScanSlotPeriod
+      ? 1.0
+      : static_cast<double>(delay) / kScanSlotPeriod;
+}
+
+// Decodes the scan table as Display::RefreshScan leaves it: masks and text
+// through the shift register model, then the blanking of a blinking and of a
+// dimmed display.  Then reports the cost of a redraw of both positions, and
+// the worst SysTick of the demo pattern as the profiler records it, which no
+// longer includes any display or LED work.
+void PrintPanelScanChecks() {
+  static Display display;
+  panel_scan.Init();
+  display.Init();
+
+  uint16_t num_misplaced = CountMisplacedScanWords();
+  printf("%-44s %u\n", "Port B words off their steps",
+         static_cast<unsigned>(num_misplaced));
+  Check("panel scan words", num_misplaced);
+
+  uint32_t seed = 0x5ca7;
+  uint16_t num_wrong = 0;
+  uint16_t num_unsteady = 0;
+  for (uint16_t i = 0; i < 256; ++i) {
+    uint16_t masks[kDisplayWidth];
+    for (uint8_t p = 0; p < kDisplayWidth; ++p) {
+      seed = seed * 1664525 + 1013904223;
+      masks[p] = seed >> 16;
+    }
+    if (i & 1) masks[i & 2 ? 0 : 1] = 0;  // Redraw one position only
+    display.PrintMasks(masks);
+    display.RefreshSlow();
+    display.RefreshScan();
+    uint16_t latched[kDisplayWidth];
+    num_unsteady += DecodeScan(latched);
+    num_wrong += latched[0] != masks[0] || latched[1] != masks[1];
+  }
+  display.Print("A7");
+  display.RefreshSlow();
+  display.RefreshScan();
+  uint16_t latched[kDisplayWidth];
+  num_unsteady += DecodeScan(latched);
+  num_wrong += latched[0] != chr_characters[static_cast<uint8_t>('A')] ||
+      latched[1] != chr_characters[static_cast<uint8_t>('7')];
+  printf("%-44s %u\n", "Redraws latching other segments",
+         static_cast<unsigned>(num_wrong));
+  printf("%-44s %u\n", "Slots showing unsteady segments",
+         static_cast<unsigned>(num_unsteady));
+  Check("panel scan segments", num_wrong);
+  Check("panel scan steadiness", num_unsteady);
+
+  // Full brightness never blanks, and the low half of a blink always does
+  double lit = ScanLitShare();
+  display.set_blink(true);
+  uint16_t num_blink_refreshes = 0;
+  uint16_t num_blink_lit = 0;
+  for (uint16_t i = 0; i < kBlinkMask; ++i) {
+    display.RefreshSlow();
+    display.RefreshScan();
+    if (!display.blink_high()) {
+      ++num_blink_refreshes;
+      num_blink_lit += ScanLitShare() != 0.0;
+    }
+  }
+  display.set_blink(false);
+  display.Print("A7", "A7", UINT16_MAX >> 2);
+  display.RefreshSlow();
+  display.RefreshScan();
+  double dimmed = ScanLitShare();
+  printf("%-44s %.3f\n", "Lit share at full brightness", lit);
+  printf("%-44s %.3f\n", "Lit share dimmed", dimmed);
+  printf("%-44s %u of %u\n", "Blink refreshes left lit",
+         static_cast<unsigned>(num_blink_lit),
+         static_cast<unsigned>(num_blink_refreshes));
+  Check("panel scan at full brightness", lit != 1.0);
+  Check("panel scan dimmed", dimmed <= 0.0 || dimmed >= 1.0);
+  Check("panel scan blinks", num_blink_lit + !num_blink_refreshes);
+
+  const uint16_t kNumRedraws = 1024;
+  uint64_t best = ~0ULL;
+  for (uint8_t run = 0; run < 16; ++run) {
+    uint64_t start = ReadCycleCounter();
+    for (uint16_t i = 0; i < kNumRedraws; ++i) {
+      uint16_t masks[kDisplayWidth] = { i, static_cast<uint16_t>(~i) };
+      display.PrintMasks(masks);
+      display.RefreshScan();
+    }
+    best = std::min(best, ReadCycleCounter() - start);
+  }
+  double us_per_cycle = 1e6 / Simulator::cycle_counter_hz();
+  printf("%-44s %.3f\n", "Redraw of both positions (us)",
+         us_per_cycle * best / kNumRedraws);
+
+  Simulator simulator;
+  simulator.Init();
+  MidiFile midi_file;
+  BuildDemoPattern(&midi_file);
+  simulator.Run(midi_file, 4.0);
+  const ProfilerStageStats& systick = profiler.stats(PROFILER_STAGE_SYSTICK);
+  printf("%-44s %.2f (%.1f%% of the 125 us tick)\n",
+         "Worst SysTick, demo pattern (us)",
+         us_per_cycle * systick.max,
+         100.0 * us_per_cycle * systick.max / 125.0);
+}
+
+int main(int argc, char** argv) {
+  int layout = LAYOUT_QUAD_MONO;
+  int oscillator_mode = -1;
+  int shape = -1;
+  int frame_rate = -1;
+  bool headroom = false;
+  bool shape_benchmark = false;
+  bool onset_jitter = false;
+  bool looper_benchmark = false;
+  bool morph_benchmark = false;
+  bool interpolation_benchmark = false;
+  bool calibration_benchmark = false;
+  bool tuning_benchmark = false;
+  bool thru_benchmark = false;
+  bool program_switch_benchmark = false;
+  bool refresh_benchmark = false;
+  bool matrix_benchmark = false;
+  bool footprint = false;
+  bool sequence_benchmark = false;
+  bool envelope_benchmark = false;
+  bool idle_voice_benchmark = false;
+  bool voicing_benchmark = false;
+  bool preset_log_checks = false;
+  bool panel_scan_checks = false;
+  double slowdown = 1.0;
+  double duration = 0.0;
+  const char* output_file_name = "yarns_test.wav";
+
+  int option;
+  while ((option = getopt(argc, argv, "l:m:s:r:d:o:Hx:SJLPICTMGRXFQEVUWD")) != -1) {
+    switch (option) {
+      case 'l': layout = atoi(optarg); break;
+      case 'm': oscillator_mode = atoi(optarg); break;
+      case 's': shape = atoi(optarg); break;
+      case 'r': frame_rate = atoi(optarg); break;
+      case 'd': duration = atof(optarg); break;
+      case 'o': output_file_name = optarg; break;
+      case 'H': headroom = true; break;
+      case 'x': slowdown = atof(optarg); break;
+      case 'S': shape_benchmark = true; break;
+      case 'J': onset_jitter = true; break;
+      case 'L': looper_benchmark = true; break;
+      case 'P': morph_benchmark = true; break;
+      case 'I': interpolation_benchmark = true; break;
+      case 'C': calibration_benchmark = true; break;
+      case 'T': tuning_benchmark = true; break;
+      case 'M': thru_benchmark = true; break;
+      case 'G': program_switch_benchmark = true; break;
+      case 'R': refresh_benchmark = true; break;
+      case 'X': matrix_benchmark = true; break;
+      case 'F': footprint = true; break;
+      case 'Q': sequence_benchmark = true; break;
+      case 'E': envelope_benchmark = true; break;
+      case 'V': idle_voice_benchmark = true; break;
+      case 'U': voicing_benchmark = true; break;
+      case 'W': preset_log_checks = true; break;
+      case 'D': panel_scan_checks = true; break;
+      default:
+        fprintf(stderr, "Usage: %s [-l layout] [-m oscillator_mode] "
+                "[-s shape] [-r rate] [-d seconds] [-o output.wav] "
+                "[-H [-x slowdown]] [-S] [-J] [-L] [-P] [-I] [-C] [-T] [-M] "
+                "[-G] [-R] [-X [-x slowdown]] [-F] [-Q] [-E] [-V] [-U] "
+                "[-W] [-D] [input.mid]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+
+  bool benchmark = true;
+  if (shape_benchmark) {
+    PrintShapeBenchmark();
+  } else if (onset_jitter) {
+    PrintOnsetJitter(frame_rate, 0.0);
+    PrintOnsetJitter(frame_rate, 0.0005);
+  } else if (looper_benchmark) {
+    PrintLooperBenchmark();
+  } else if (morph_benchmark) {
+    PrintMorphBenchmark();
+  } else if (interpolation_benchmark) {
+    PrintDCInterpolationBenchmark(frame_rate);
+  } else if (calibration_benchmark) {
+    PrintCalibrationBenchmark();
+  } else if (tuning_benchmark) {
+    PrintJustIntonationBenchmark();
+  } else if (thru_benchmark) {
+    PrintThruBenchmark();
+  } else if (program_switch_benchmark) {
+    PrintProgramSwitchBenchmark();
+  } else if (refresh_benchmark) {
+    PrintRefreshBenchmark();
+  } else if (matrix_benchmark) {
+    PrintModMatrixBenchmark(slowdown);
+  } else if (footprint) {
+    PrintFootprint();
+  } else if (sequence_benchmark) {
+    PrintStepSequenceBenchmark();
+  } else if (envelope_benchmark) {
+    PrintEnvelopeRetargetBenchmark();
+  } else if (idle_voice_benchmark) {
+    PrintIdleVoiceBenchmark();
+  } else if (voicing_benchmark) {
+    PrintTuningSweepBenchmark();
+  } else if (preset_log_checks) {
+    PrintPresetLogChecks();
+    PrintBulkTransferChecks();
+    PrintTaggedReceiveChecks();
+  } else if (panel_scan_checks) {
+    PrintPanelScanChecks();
+  } else {
+    benchmark = false;
+  }
+  if (benchmark) {
+    return num_failed_checks ? 1 : 0;
+  }
+
+  MidiFile midi_file;
+  if (optind < argc) {
+    if (!midi_file.Load(argv[optind])) {
+      fprintf(stderr, "Could not read MIDI file %s\n", argv[optind]);
+      return 1;
+    }
+  } else {
+    BuildDemoPattern(&midi_file);
+  }
+  if (duration <= 0.0) {
+    // Leave room for release tails.
+    duration = midi_file.duration() + 1.0;
+  }
+
+  if (headroom) {
+    PrintHeadroom(
+        midi_file, duration, layout, oscillator_mode, shape, slowdown);
+    return 0;
+  }
+
+  Simulator simulator;
+  simulator.Init();
+  Configure(layout, oscillator_mode, shape, frame_rate);
+
+  if (!simulator.OpenWav(output_file_name)) {
+    fprintf(stderr, "Could not write %s\n", output_file_name);
+    return 1;
+  }
+  simulator.Run(midi_file, duration);
+  simulator.CloseWav();
+  simulator.PrintReport();
+  return 0;
+}
@@ -51,6 +51,7 @@ const uint32_t kFastFade = kRefreshFreq << 1;
 const Ui::Command Ui::commands_[] = {
   { "*LOAD*", UI_MODE_LOAD_SELECT_PROGRAM, NULL },
   { "*SAVE*", UI_MODE_SAVE_SELECT_PROGRAM, NULL },
+  { "*MORPH*", UI_MODE_MORPH_SELECT_PROGRAM, NULL },
   { "*PART SWAP SETTINGS*", UI_MODE_SWAP_SELECT_PART, NULL },
   { "*INIT*", UI_MODE_PARAMETER_SELECT, &Ui::DoInitCommand },
   { "*QUICK CONFIG*", UI_MODE_LEARNING, &Ui::DoLearnCommand },
@@ -91,6 +92,12 @@ Ui::Mode Ui::modes_[] = {
     UI_MODE_MAIN_MENU,
     NULL, 0, kNumPrograms },
   
+  // UI_MODE_MORPH_SELECT_PROGRAM
+  { &Ui::OnIncrement, &Ui::OnClickLoadSave,
+    &Ui::PrintProgramNumber,
+    UI_MODE_MAIN_MENU,
+    NULL, 0, kNumPrograms },
+  
   // UI_MODE_SWAP_SELECT_PART
   { &Ui::OnIncrement, &Ui::OnClickSwapPart,
     &Ui::PrintSwapPart,
@@ -146,6 +153,7 @@ void Ui::Init() {
   setup_menu_.Init(SETTING_MENU_SETUP);
   oscillator_menu_.Init(SETTING_MENU_OSCILLATOR);
   envelope_menu_.Init(SETTING_MENU_ENVELOPE);
+  matrix_menu_.Init(SETTING_MENU_MATRIX);
   live_menu_.Init(SETTING_LAST);
   current_menu_ = &live_menu_;
 
@@ -154,6 +162,7 @@ void Ui::Init() {
   tap_tempo_resolved_ = true;
   
   start_stop_press_time_ = 0;
+  num_dropped_events_ = 0;
   
   push_it_note_ = kC4;
   command_index_ = 0;
@@ -162,6 +171,7 @@ void Ui::Init() {
   modes_[UI_MODE_MAIN_MENU].incremented_variable = &command_index_;
   modes_[UI_MODE_LOAD_SELECT_PROGRAM].incremented_variable = &program_index_;
   modes_[UI_MODE_SAVE_SELECT_PROGRAM].incremented_variable = &program_index_;
+  modes_[UI_MODE_MORPH_SELECT_PROGRAM].incremented_variable = &program_index_;
   modes_[UI_MODE_SWAP_SELECT_PART].incremented_variable = &swap_part_index_;
   modes_[UI_MODE_CALIBRATION_SELECT_VOICE].incremented_variable = \
       &calibration_voice_;
@@ -341,16 +351,16 @@ void Ui::PrintArpeggiatorMovementStep(SequencerStep step) {
 uint16_t Ui::GetBrightnessFromSequencerPhase(const Part& part) {
   if (part.looped()) {
     return UINT16_MAX - part.looper().phase();
-  } else if (!part.sequencer_settings().num_steps) {
+  } else if (!part.num_steps()) {
     return UINT16_MAX;
   } else {
-    return ((1 + part.playing_step()) << 16) / part.sequencer_settings().num_steps;
+    return ((1 + part.playing_step()) << 16) / part.num_steps();
   }
 }
 
 const uint16_t kMasksNewLooperBeat[kDisplayWidth] = { 0x8000, 0x8000 };
 void Ui::PrintLoopSequencerStatus() {
-  uint8_t note_index = recording_part().LooperCurrentNoteIndex();
+  uint16_t note_index = recording_part().LooperCurrentNoteIndex();
 
   if (note_index == looper::kNullIndex) { // Print the metronome
     // Display metronome if the looper is in the first 1/16th of a beat
@@ -382,13 +392,13 @@ void Ui::PrintStepSequencerStatus() {
     return;
   }
 
-  uint8_t rec_step = recording_part().recording_step();
+  uint16_t rec_step = recording_part().recording_step();
   // If playing a sequencer step other than the selected one, 2/3 brightness
   uint16_t brightness = (
     recording_part().num_steps() == 0 ||
     rec_step == recording_part().playing_step()
   ) ? UINT16_MAX : 43690;
-  const SequencerStep& step = recording_part().sequencer_settings().step[rec_step];
+  const SequencerStep step = recording_part().recording_step_contents();
   uint16_t fade = step.is_slide() ? kFastFade : 0;
 
   if (recording_mode_is_displaying_pitch_) {
@@ -396,7 +406,9 @@ void Ui::PrintStepSequencerStatus() {
     else if (step.is_tie()) display_.Print("TI", "TI", brightness, fade);
     else PrintNote(step.note(), brightness, fade);
   } else {
-    Settings::PrintInteger(buffer_, rec_step + 1);
+    // The last two digits past step 99
+    Settings::PrintInteger(buffer_, (rec_step + 1) % 100);
+    if (rec_step >= 99 && buffer_[0] == ' ') buffer_[0] = '0';
     display_.Print(buffer_, buffer_, brightness, fade);
   }
 }
@@ -510,6 +522,7 @@ void Ui::OnLongClick(const Event& e) {
     case UI_MODE_MAIN_MENU:
     case UI_MODE_LOAD_SELECT_PROGRAM:
     case UI_MODE_SAVE_SELECT_PROGRAM:
+    case UI_MODE_MORPH_SELECT_PROGRAM:
     case UI_MODE_SWAP_SELECT_PART:
       mode_ = UI_MODE_PARAMETER_SELECT;
       break;
@@ -536,6 +549,9 @@ void Ui::OnClick(const Event& e) {
   } else if (&setting() == &setting_defs.get(SETTING_MENU_ENVELOPE)) {
     current_menu_ = &envelope_menu_;
     return;
+  } else if (&setting() == &setting_defs.get(SETTING_MENU_MATRIX)) {
+    current_menu_ = &matrix_menu_;
+    return;
   } else if (current_menu_ != &live_menu_ && mode_ == UI_MODE_PARAMETER_EDIT) {
     current_menu_ = &live_menu_;
   }
@@ -571,11 +587,21 @@ void Ui::OnClickLoadSave(const Event& e) {
   if (program_index_ == kNumPrograms) {
     program_index_ = active_program_;  // Cancel
   } else {
-    active_program_ = program_index_;
-    if (mode_ == UI_MODE_SAVE_SELECT_PROGRAM) {
-      storage_manager.SaveMulti(program_index_);
-      strcpy(buffer_, "S1");
+    if (mode_ == UI_MODE_MORPH_SELECT_PROGRAM) {
+      // Morph from the active program towards the selected one
+      bool morphing = storage_manager.LoadMorph(
+          active_program_, program_index_);
+      strcpy(buffer_, morphing ? "M1" : "M1 ERROR");
+    } else if (mode_ == UI_MODE_SAVE_SELECT_PROGRAM) {
+      if (!storage_manager.SaveMulti(program_index_)) {
+        strcpy(buffer_, "S1 BUSY");
+      } else {
+        active_program_ = program_index_;
+        // Warn that the oldest looper notes were left out
+        strcpy(buffer_, multi.looper_notes_fit_packed() ? "S1" : "S1 LOOP CUT");
+      }
     } else {
+      active_program_ = program_index_;
       storage_manager.LoadMulti(program_index_);
       strcpy(buffer_, "L1");
     }
@@ -623,7 +649,7 @@ void Ui::OnClickRecording(const Event& e) {
     push_it_ = false;
     mutable_recording_part()->RecordStep(SequencerStep(push_it_note_, 100));
   } else {
-    const SequencerStep& step = recording_part().sequencer_settings().step[recording_part().recording_step()];
+    const SequencerStep step = recording_part().recording_step_contents();
     if (step.has_note()) {
       push_it_note_ = step.note();
     } else {
@@ -810,8 +836,8 @@ void Ui::OnSwitchHeld(const Event& e) {
           // Do nothing
         } else {
           // Toggle slide flag on recording step
-          SequencerStep* step = &mutable_recording_part()->mutable_sequencer_settings()->step[recording_part().recording_step()];
-          step->set_slide(!step->is_slide());
+          mutable_recording_part()->SetRecordingStepSlide(
+              !recording_part().recording_step_contents().is_slide());
         }
       } else {
         multi.set_next_clock_input_tick(0); // Reset song position
@@ -885,6 +911,9 @@ void Ui::DoEvents() {
   bool refresh_display = false;
   bool scroll_display = false;
 
+  display_.RefreshScan();
+  channel_leds.RefreshScan();
+
   if (active_part_ >= multi.num_active_parts()) {
     // Handle layout change
     active_part_ = multi.num_active_parts() - 1;
@@ -939,6 +968,12 @@ void Ui::DoEvents() {
     OnClickLearning(Event());
   }
 
+  if (event_queue.num_dropped() != num_dropped_events_) {
+    // MIDI input was lost while the main loop was held up
+    num_dropped_events_ = event_queue.num_dropped();
+    SplashString("MIDI OVERFLOW");
+  }
+
   if (splash_) { // Check whether to end this splash (and maybe chain another)
     if (display_.scrolling() || queue_.idle_time() < kRefreshMsec) {
       // If scrolling, fade-out never begins, we will just exit splash after scrolling
@@ -994,7 +1029,7 @@ void Ui::DoEvents() {
   }
   if (display_.scrolling()) { return; }
 
-  bool print_command = mode_ == UI_MODE_LOAD_SELECT_PROGRAM || mode_ == UI_MODE_SAVE_SELECT_PROGRAM;
+  bool print_command = mode_ == UI_MODE_LOAD_SELECT_PROGRAM || mode_ == UI_MODE_SAVE_SELECT_PROGRAM || mode_ == UI_MODE_MORPH_SELECT_PROGRAM;
   bool print_latch =
     (mode_ == UI_MODE_PARAMETER_SELECT || mode_ == UI_MODE_PARAMETER_EDIT) &&
     active_part().midi_settings().sustain_mode != SUSTAIN_MODE_OFF &&
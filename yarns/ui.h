@@ -53,6 +53,7 @@ enum UiMode {
   UI_MODE_MAIN_MENU,
   UI_MODE_LOAD_SELECT_PROGRAM,
   UI_MODE_SAVE_SELECT_PROGRAM,
+  UI_MODE_MORPH_SELECT_PROGRAM,
   UI_MODE_SWAP_SELECT_PART,
   UI_MODE_CALIBRATION_SELECT_VOICE,
   UI_MODE_CALIBRATION_SELECT_NOTE,
@@ -76,6 +77,7 @@ enum Splash {
 enum MainMenuEntry {
   MAIN_MENU_LOAD,
   MAIN_MENU_SAVE,
+  MAIN_MENU_MORPH,
   MAIN_MENU_SWAP_PART,
   MAIN_MENU_INIT,
   MAIN_MENU_LEARN,
@@ -114,9 +116,6 @@ class Ui {
   void Init();
   void Poll();
   void PollSwitch(const UiSwitch ui_switch, uint32_t& press_time, bool& long_press_event_sent);
-  void PollFast() {
-    display_.RefreshFast();
-  }
   void DoEvents();
   void FlushEvents();
 
@@ -261,6 +260,8 @@ class Ui {
   uint32_t rec_press_time_;
   bool start_stop_long_press_event_sent_;
   uint32_t start_stop_press_time_;
+  // Last seen count of events that the event queue had no room for
+  uint16_t num_dropped_events_;
   bool tap_tempo_long_press_event_sent_;
   uint32_t tap_tempo_press_time_;
   bool encoder_long_press_event_sent_;
@@ -277,6 +278,7 @@ class Ui {
   Menu setup_menu_;
   Menu oscillator_menu_;
   Menu envelope_menu_;
+  Menu matrix_menu_;
   Menu live_menu_;
   Menu* current_menu_;
 
@@ -29,6 +29,7 @@
 
 #include "yarns/voice.h"
 
+#include <algorithm>
 #include <cmath>
 
 #include "stmlib/midi/midi.h"
@@ -36,6 +37,7 @@
 #include "stmlib/utils/random.h"
 #include "stmlib/dsp/dsp.h"
 
+#include "yarns/event_queue.h"
 #include "yarns/resources.h"
 #include "yarns/multi.h"
 
@@ -44,8 +46,8 @@ namespace yarns {
 using namespace stmlib;
 using namespace stmlib_midi;
 
-const int32_t kOctave = 12 << 7;
-const int32_t kMaxNote = 120 << 7;
+STATIC_ASSERT(kNumMaxVoicesPerPart <= kMaxBatchedOscillators, batch_fits_part);
+
 const int32_t kQuadrature = 0x40000000;
 
 void Voice::Init() {
@@ -53,13 +55,15 @@ void Voice::Init() {
   note_ = -1;
   note_source_ = note_target_ = note_portamento_ = 60 << 7;
   gate_ = false;
+  gate_frame_ = 0;
   is_highest_priority_ = false;
 
   mod_velocity_ = 0x7f;
   ResetAllControllers();
+  ClearModMatrix();
   
   for (uint8_t i = 0; i < LFO_ROLE_LAST; i++) {
-    lfos_[i].SetPhase(0);
+    lfos_[i].Init();
     lfos_[i].SetPhaseIncrement(lut_lfo_increments[50]);
   }
   pitch_bend_range_ = 2;
@@ -70,6 +74,7 @@ void Voice::Init() {
   timbre_init_current_ = 0;
 
   refresh_counter_ = 0;
+  lfo_interpolating_ = false;
   pitch_lfo_interpolator_.Init();
   timbre_lfo_interpolator_.Init();
   amplitude_lfo_interpolator_.Init();
@@ -80,10 +85,14 @@ void Voice::Init() {
   portamento_exponential_shape_ = false;
 
   trigger_duration_ = 2;
+
+  // Give the oscillator a valid phase increment before TouchVoices sets its
+  // shape; CVOutput::AssignVoices sets the real output scale later.
+  oscillator_.Init(0);
 }
 
 /* static */
-CVOutput::DCFn CVOutput::dc_fn_table_[] = {
+const CVOutput::DCFn CVOutput::dc_fn_table_[] = {
   &CVOutput::pitch_dac_code,
   &CVOutput::velocity_dac_code,
   &CVOutput::aux_cv_dac_code,
@@ -96,12 +105,22 @@ void CVOutput::Init(bool reset_calibration) {
     for (uint8_t i = 0; i < kNumOctaves; ++i) {
       calibrated_dac_code_[i] = 54586 - 5133 * i;
     }
+    UpdateNoteDacCodes(0, kNumOctaves - 2);
   }
   dirty_ = false;
   dc_role_ = DC_PITCH;
   envelope_.Init(0);
   envelope_bias_ = 0;
   num_dc_voices_ = 0;
+  dc_interpolation_ = DC_INTERPOLATION_OFF;
+  for (uint8_t i = 0; i < kDCHistorySize; ++i) {
+    dc_history_[i].frame = 0;
+    dc_history_[i].dac_code = 0;
+  }
+  dc_history_head_ = 0;
+  dc_delay_ = gate_delay_ = interpolated_gate_delay_ = 0;
+  gate_delay_line_ = 0;
+  dc_backdate_ = next_dc_backdate_ = 0;
 }
 
 void CVOutput::Calibrate(uint16_t* calibrated_dac_code) {
@@ -109,6 +128,18 @@ void CVOutput::Calibrate(uint16_t* calibrated_dac_code) {
       &calibrated_dac_code[0],
       &calibrated_dac_code[kNumOctaves],
       &calibrated_dac_code_[0]);
+  UpdateNoteDacCodes(0, kNumOctaves - 2);
+}
+
+void CVOutput::UpdateNoteDacCodes(uint8_t first_octave, uint8_t last_octave) {
+  if (last_octave > kNumOctaves - 2) last_octave = kNumOctaves - 2;
+  for (uint8_t octave = first_octave; octave <= last_octave; ++octave) {
+    int32_t a = calibrated_dac_code_[octave];
+    int32_t b = calibrated_dac_code_[octave + 1];
+    for (uint8_t semitone = 0; semitone <= 12; ++semitone) {
+      note_dac_code_[octave * 12 + semitone] = a + (b - a) * semitone / 12;
+    }
+  }
 }
 
 uint16_t CVOutput::pitch_dac_code() {
@@ -119,26 +150,6 @@ uint16_t CVOutput::pitch_dac_code() {
   return dac_code_;
 }
 
-uint16_t CVOutput::NoteToDacCode(int32_t note) const {
-  if (note <= 0) {
-    note = 0;
-  }
-  if (note >= kMaxNote) {
-    note = kMaxNote - 1;
-  }
-  uint8_t octave = 0;
-  while (note >= kOctave) {
-    note -= kOctave;
-    ++octave;
-  }
-  
-  // Note is now between 0 and kOctave
-  // Octave indicates the octave. Look up in the DAC code table.
-  int32_t a = calibrated_dac_code_[octave];
-  int32_t b = calibrated_dac_code_[octave + 1];
-  return a + ((b - a) * note / kOctave);
-}
-
 void Voice::ResetAllControllers() {
   mod_pitch_bend_ = 8192;
   vibrato_mod_ = 0;
@@ -150,6 +161,23 @@ void Voice::garbage(uint8_t x) {
   (void) foo;
 }
 
+void Voice::RefreshModMatrix(const ModRoute* routes, uint8_t num_routes) {
+  const ModRoute* end = routes + num_routes;
+  while (routes != end) {
+    uint8_t destination = routes->destination;
+    int32_t sum = 0;
+    do {
+      int32_t source = static_cast<int32_t>(mod_aux_[routes->mod_aux]) -
+          routes->center;
+      sum += source * routes->depth;
+    } while (++routes != end && routes->destination == destination);
+    // Full depth of a unipolar source spans the whole destination
+    sum >>= 7;
+    CONSTRAIN(sum, INT16_MIN, INT16_MAX);
+    mod_matrix_[destination] = sum;
+  }
+}
+
 void Voice::Refresh() {
   if (retrigger_delay_) {
     --retrigger_delay_;
@@ -160,25 +188,33 @@ void Voice::Refresh() {
   if (!has_cv_output()) return;
 
   // Slew coarse inputs to avoid clicks
-  tremolo_mod_current_ = stmlib::slew(
-    tremolo_mod_current_, tremolo_mod_target_);
-  timbre_init_current_ = stmlib::slew(
-    timbre_init_current_, timbre_init_target_);
-  timbre_mod_lfo_current_ = stmlib::slew(
-    timbre_mod_lfo_current_, timbre_mod_lfo_target_);
-
-  // Compute base pitch with portamento.
-  portamento_phase_ += portamento_phase_increment_;
-  if (portamento_phase_ < portamento_phase_increment_) {
-    portamento_phase_ = 0;
-    portamento_phase_increment_ = 0;
-    note_source_ = note_target_;
+  if (tremolo_mod_current_ != tremolo_mod_target_ ||
+      timbre_init_current_ != timbre_init_target_ ||
+      timbre_mod_lfo_current_ != timbre_mod_lfo_target_) {
+    tremolo_mod_current_ = stmlib::slew(
+      tremolo_mod_current_, tremolo_mod_target_);
+    timbre_init_current_ = stmlib::slew(
+      timbre_init_current_, timbre_init_target_);
+    timbre_mod_lfo_current_ = stmlib::slew(
+      timbre_mod_lfo_current_, timbre_mod_lfo_target_);
+  }
+
+  // Compute base pitch with portamento.  Once a glide ends, the source is the
+  // target until the next note.
+  int32_t note = note_source_;
+  if (portamento_phase_increment_) {
+    portamento_phase_ += portamento_phase_increment_;
+    if (portamento_phase_ < portamento_phase_increment_) {
+      portamento_phase_ = 0;
+      portamento_phase_increment_ = 0;
+      note_source_ = note_target_;
+    }
+    uint16_t portamento_level = portamento_exponential_shape_
+        ? Interpolate824(lut_env_expo, portamento_phase_)
+        : portamento_phase_ >> 16;
+    note = note_source_ + \
+        ((note_target_ - note_source_) * portamento_level >> 16);
   }
-  uint16_t portamento_level = portamento_exponential_shape_
-      ? Interpolate824(lut_env_expo, portamento_phase_)
-      : portamento_phase_ >> 16;
-  int32_t note = note_source_ + \
-      ((note_target_ - note_source_) * portamento_level >> 16);
 
   note_portamento_ = note;
   
@@ -210,19 +246,29 @@ void Voice::Refresh() {
     int32_t pitch_lfo_15 = scaled_vibrato_lfo_interpolator_.target() * vibrato_range_ >> 8;
     pitch_lfo_interpolator_.SetTarget(pitch_lfo_15);
     pitch_lfo_interpolator_.ComputeSlope();
+
+    // With no modulation depth, the targets stay at 0 once reached
+    lfo_interpolating_ =
+        !amplitude_lfo_interpolator_.settled() ||
+        !timbre_lfo_interpolator_.settled() ||
+        !scaled_vibrato_lfo_interpolator_.settled() ||
+        !pitch_lfo_interpolator_.settled();
   }
   refresh_counter_ = (refresh_counter_ + 1) % (1 << kLowFreqRefreshBits);
 
-  pitch_lfo_interpolator_.Tick();
-  timbre_lfo_interpolator_.Tick();
-  amplitude_lfo_interpolator_.Tick();
-  scaled_vibrato_lfo_interpolator_.Tick();
+  if (lfo_interpolating_) {
+    pitch_lfo_interpolator_.Tick();
+    timbre_lfo_interpolator_.Tick();
+    amplitude_lfo_interpolator_.Tick();
+    scaled_vibrato_lfo_interpolator_.Tick();
+  }
 
   note += pitch_lfo_interpolator_.value();
 
   int32_t timbre_15 =
     (timbre_init_current_ >> (16 - 15)) +
-    timbre_lfo_interpolator_.value();
+    timbre_lfo_interpolator_.value() +
+    mod_matrix_[MOD_DESTINATION_TIMBRE];
   CONSTRAIN(timbre_15, 0, (1 << 15) - 1);
 
   uint16_t tremolo = amplitude_lfo_interpolator_.value() << 1;
@@ -235,7 +281,9 @@ void Voice::Refresh() {
     mod_aux_[MOD_AUX_ENVELOPE] = dc_output(DC_AUX_2)->RefreshEnvelope(tremolo, is_highest_priority_);
   }
 
-  oscillator_.Refresh(note, timbre_15, tremolo);
+  if (uses_audio()) {
+    oscillator_.Refresh(note, timbre_15, tremolo);
+  }
 
   mod_aux_[MOD_AUX_VELOCITY] = mod_velocity_ << 9;
   mod_aux_[MOD_AUX_MODULATION] = vibrato_mod_ << 9;
@@ -262,26 +310,107 @@ void CVOutput::Refresh() {
 void CVOutput::RenderSamples(uint8_t block, uint8_t channel, uint16_t default_low_freq_cv) {
   int16_t samples[kAudioBlockSize] = {0};
   if (is_envelope()) {
-    envelope_.RenderSamples(samples, envelope_bias_ << 16);
+    if (envelope_.RenderSamples(samples, envelope_bias_ << 16)) {
+      dac.BufferStaticSample(block, channel, samples[0] << 1);
+      return;
+    }
     for (size_t i = 0; i < kAudioBlockSize; ++i) {
       samples[i] <<= 1;
     }
     dac.BufferSamples(block, channel, samples);
   } else if (is_audio()) {
-    std::fill(
-        samples,
-        samples + kAudioBlockSize,
-        zero_dac_code_
-    );
+    Oscillator* oscillators[kNumMaxVoicesPerPart];
     for (uint8_t v = 0; v < num_audio_voices_; ++v) {
-      audio_voices_[v]->oscillator()->Render(samples);
+      oscillators[v] = audio_voices_[v]->oscillator();
+    }
+    if (Oscillator::RenderBatch(
+        oscillators, num_audio_voices_, zero_dac_code_, samples)) {
+      dac.BufferSamples(block, channel, samples);
+    } else {
+      dac.BufferStaticSample(block, channel, zero_dac_code_);
     }
+  } else if (is_interpolated()) {
+    RenderInterpolatedDC(samples);
     dac.BufferSamples(block, channel, samples);
   } else {
     dac.FillDCNoops(block, channel);
   }
 }
 
+void CVOutput::RenderInterpolatedDC(int16_t* samples) const {
+  const uint8_t mask = kDCHistorySize - 1;
+  // Every frame needs the point after it, and the one after that for cubic,
+  // which adds as many refresh periods to the onset latency.
+  uint16_t frame = dac.rendering_block_frame() - kOnsetLatencyFrames -
+      dac.frames_per_dc_refresh() * dc_interpolation_;
+
+  // Find the newest point at or before the first frame.  Stopping short of
+  // the oldest ones keeps clear of a point SysTick may push meanwhile.
+  uint8_t head = dc_history_head_;
+  uint8_t k = head;
+  for (uint8_t n = 3; n < kDCHistorySize; ++n) {
+    if (static_cast<int16_t>(frame - dc_history_[k].frame) >= 0) break;
+    k = (k - 1) & mask;
+  }
+
+  size_t i = 0;
+  while (i < kAudioBlockSize) {
+    const DCControlPoint& p1 = dc_history_[k];
+    if (k == head) {
+      // Nothing newer yet
+      for (; i < kAudioBlockSize; ++i) {
+        samples[i] = p1.dac_code;
+      }
+      break;
+    }
+    uint8_t next = (k + 1) & mask;
+    const DCControlPoint& p2 = dc_history_[next];
+    int16_t span = p2.frame - p1.frame;
+    int16_t elapsed = static_cast<uint16_t>(frame + i) - p1.frame;
+    if (span <= 0 || elapsed >= span) {
+      k = next;
+      continue;
+    }
+    if (elapsed < 0) {
+      // Older than the history
+      size_t end = std::min<size_t>(i - elapsed, kAudioBlockSize);
+      for (; i < end; ++i) {
+        samples[i] = p1.dac_code;
+      }
+      continue;
+    }
+
+    size_t end = std::min<size_t>(i + span - elapsed, kAudioBlockSize);
+    uint32_t increment = 65536 / span;
+    uint32_t phase = elapsed * increment;
+    int32_t y1 = p1.dac_code;
+    int32_t y2 = p2.dac_code;
+    if (dc_interpolation_ == DC_INTERPOLATION_CUBIC && next != head) {
+      // Catmull-Rom, with every coefficient doubled
+      int32_t y0 = dc_history_[(k - 1) & mask].dac_code;
+      int32_t y3 = dc_history_[(next + 1) & mask].dac_code;
+      int32_t a = 3 * (y1 - y2) + y3 - y0;
+      int32_t b = 2 * y0 - 5 * y1 + 4 * y2 - y3;
+      int32_t c = y2 - y0;
+      for (; i < end; ++i) {
+        int64_t t = phase;
+        int64_t x = (a * t >> 16) + b;
+        x = (x * t >> 16) + c;
+        int32_t y = y1 + static_cast<int32_t>(x * t >> 17);
+        CONSTRAIN(y, 0, UINT16_MAX);
+        samples[i] = y;
+        phase += increment;
+      }
+    } else {
+      int32_t delta = y2 - y1;
+      for (; i < end; ++i) {
+        samples[i] = y1 + (delta * static_cast<int32_t>(phase >> 1) >> 15);
+        phase += increment;
+      }
+    }
+  }
+}
+
 void Voice::NoteOn(
   int16_t note, uint8_t velocity, uint8_t portamento, bool trigger,
   ADSR& adsr, int16_t timbre_envelope_target
@@ -296,11 +425,17 @@ void Voice::NoteOn(
     trigger_phase_increment_ = lut_portamento_increments[trigger_duration_ >> 1];
   }
   gate_ = true;
+  gate_frame_ = event_queue.event_frame();
+  if (retrigger_delay_) {
+    // The gate reopens once the dip is over
+    gate_frame_ += retrigger_delay_ * dac.frames_per_dc_refresh();
+  }
   adsr_ = adsr;
 
-  if (uses_audio()) oscillator_.NoteOn(adsr_, oscillator_mode_ == OSCILLATOR_MODE_DRONE, timbre_envelope_target);
-  if (aux_1_envelope()) dc_output(DC_AUX_1)->NoteOn(adsr_);
-  if (aux_2_envelope()) dc_output(DC_AUX_2)->NoteOn(adsr_);
+  uint16_t delay = dac.OnsetDelay(event_queue.event_frame());
+  if (uses_audio()) oscillator_.NoteOn(adsr_, oscillator_mode_ == OSCILLATOR_MODE_DRONE, timbre_envelope_target, delay);
+  if (aux_1_envelope()) dc_output(DC_AUX_1)->NoteOn(adsr_, delay);
+  if (aux_2_envelope()) dc_output(DC_AUX_2)->NoteOn(adsr_, delay);
 
   if (!has_cv_output()) return;
 
@@ -326,11 +461,22 @@ void Voice::NoteOn(
   mod_velocity_ = velocity;
 }
 
+void Voice::Retune(int16_t note) {
+  if (!has_cv_output()) return;
+  // A note that is not gliding moves at once.
+  if (note_source_ == note_target_) {
+    note_source_ = note;
+  }
+  note_target_ = note;
+}
+
 void Voice::NoteOff(bool force_envelope) {
   gate_ = false;
-  if (uses_audio()) oscillator_.NoteOff();
-  if (aux_1_envelope()) dc_output(DC_AUX_1)->NoteOff(force_envelope);
-  if (aux_2_envelope()) dc_output(DC_AUX_2)->NoteOff(force_envelope);
+  gate_frame_ = event_queue.event_frame();
+  uint16_t delay = dac.OnsetDelay(gate_frame_);
+  if (uses_audio()) oscillator_.NoteOff(delay);
+  if (aux_1_envelope()) dc_output(DC_AUX_1)->NoteOff(force_envelope, delay);
+  if (aux_2_envelope()) dc_output(DC_AUX_2)->NoteOff(force_envelope, delay);
 }
 
 void Voice::ControlChange(uint8_t controller, uint8_t value) {
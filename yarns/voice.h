@@ -41,6 +41,8 @@
 namespace yarns {
 
 const uint16_t kNumOctaves = 11;
+// Calibrated DAC code of every semitone, interpolated between octaves
+const uint8_t kNumNoteDacCodes = (kNumOctaves - 1) * 12 + 1;
 
 // 4 kHz / 32 = 125 Hz (the ~minimum that doesn't cause obvious LFO sampling error)
 const uint8_t kLowFreqRefreshBits = 5;
@@ -95,6 +97,25 @@ enum DCRole {
   DC_LAST
 };
 
+// How a DC output moves between the values computed by SysTick at 4 kHz.  An
+// interpolated output is rendered by the main loop at the frame rate, like
+// an envelope, instead of being injected near the DMA cursor.
+enum DCInterpolation {
+  DC_INTERPOLATION_OFF,
+  DC_INTERPOLATION_LINEAR,
+  DC_INTERPOLATION_CUBIC,
+  DC_INTERPOLATION_LAST
+};
+
+// Covers the onset latency plus the points around it, at any frame rate
+const uint8_t kDCHistorySizeBits = 4;
+const uint8_t kDCHistorySize = 1 << kDCHistorySizeBits;
+
+struct DCControlPoint {
+  uint16_t frame;  // dac.frame_counter() when SysTick computed the value
+  uint16_t dac_code;
+};
+
 enum LFORole {
   LFO_ROLE_PITCH,
   LFO_ROLE_TIMBRE,
@@ -112,12 +133,19 @@ class Voice {
   void Init();
   void ResetAllControllers();
 
+  // Voices recompute their low-rate modulation on different refreshes, so
+  // that no single refresh does it for all of them.
+  inline void set_refresh_phase(uint8_t phase) {
+    refresh_counter_ = phase & ((1 << kLowFreqRefreshBits) - 1);
+  }
+
   void Refresh();
   void NoteOn(
     int16_t note, uint8_t velocity, uint8_t portamento, bool trigger,
     ADSR& adsr, int16_t timbre_envelope_target
   );
   void NoteOff(bool force = false);
+  void Retune(int16_t note);
   void ControlChange(uint8_t controller, uint8_t value);
   void PitchBend(uint16_t pitch_bend) {
     mod_pitch_bend_ = pitch_bend;
@@ -126,6 +154,19 @@ class Voice {
     mod_aux_[MOD_AUX_AFTERTOUCH] = velocity << 9;
   }
 
+  // Sums the routes of the modulation matrix, in 15-bit units of each
+  // destination's range
+  void RefreshModMatrix(const ModRoute* routes, uint8_t num_routes);
+  inline void ClearModMatrix() {
+    std::fill(&mod_matrix_[0], &mod_matrix_[MOD_DESTINATION_LAST], 0);
+  }
+  inline int16_t mod_matrix(ModDestination d) const { return mod_matrix_[d]; }
+  // Lets the matrix see a note's velocity before the note starts
+  inline void set_mod_velocity(uint8_t velocity) {
+    mod_velocity_ = velocity;
+    mod_aux_[MOD_AUX_VELOCITY] = velocity << 9;
+  }
+
   void garbage(uint8_t x);
   inline void set_pitch_bend_range(uint8_t pitch_bend_range) {
     pitch_bend_range_ = pitch_bend_range;
@@ -138,10 +179,10 @@ class Voice {
     tremolo_mod_target_ = n << (16 - 7); }
 
   inline void set_lfo_shape(LFORole role, uint8_t shape) {
-    lfo_shapes_[role] = static_cast<LFOShape>(shape);
+    lfo_shapes_[role] = shape;
   }
   inline int16_t lfo_value(LFORole role) const {
-    return lfos_[role].shape(lfo_shapes_[role]);
+    return lfos_[role].shape(static_cast<LFOShape>(lfo_shapes_[role]));
   }
 
   inline void set_trigger_duration(uint8_t trigger_duration) {
@@ -169,6 +210,8 @@ class Voice {
   inline void set_highest_priority(bool v) { is_highest_priority_ = v; }
 
   inline bool gate() const { return gate_ && !retrigger_delay_; }
+  // Frame of the event that last opened or closed the gate
+  inline uint16_t gate_frame() const { return gate_frame_; }
   inline bool trigger() const  {
     return gate_ && trigger_pulse_;
   }
@@ -178,6 +221,7 @@ class Voice {
   inline void set_oscillator_mode(uint8_t m) {
     oscillator_mode_ = m;
   }
+  inline uint8_t oscillator_mode() const { return oscillator_mode_; }
   inline void set_oscillator_shape(uint8_t s) {
     oscillator_.set_shape(static_cast<OscillatorShape>(s));
   }
@@ -225,53 +269,37 @@ class Voice {
   inline FastSyncedLFO* lfo(LFORole l) { return &lfos_[l]; }
   
  private:
+  // State read by Refresh comes first, so that the 4 kHz path reaches it with
+  // short load offsets.  Fields are grouped by size to avoid padding.
   FastSyncedLFO lfos_[LFO_ROLE_LAST];
-  Oscillator oscillator_;
-  ADSR adsr_;
 
   int32_t note_source_;
   int32_t note_target_;
   int32_t note_portamento_;
   int32_t note_;
   int32_t tuning_;
-  bool gate_;
 
-  // Sets whether this voice can control a paraphonic CV envelope's tremolo
-  bool is_highest_priority_;
+  uint32_t portamento_phase_;
+  uint32_t portamento_phase_increment_;
+  uint32_t trigger_phase_increment_;
+  uint32_t trigger_phase_;
+
+  Interpolator<kLowFreqRefreshBits> pitch_lfo_interpolator_, timbre_lfo_interpolator_, amplitude_lfo_interpolator_, scaled_vibrato_lfo_interpolator_;
+
+  CVOutput* audio_output_;
+  CVOutput* dc_outputs_[DC_LAST];
 
   int16_t mod_pitch_bend_;
   uint16_t mod_aux_[MOD_AUX_LAST];
-  uint8_t mod_velocity_;
-  
-  uint8_t pitch_bend_range_;
-  uint8_t vibrato_range_;
-  uint8_t vibrato_mod_;
-  
-  uint8_t trigger_duration_;
-  uint8_t trigger_shape_;
-  bool trigger_scale_;
+  int16_t mod_matrix_[MOD_DESTINATION_LAST];
 
-  uint8_t oscillator_mode_;
-  LFOShape lfo_shapes_[LFO_ROLE_LAST];
-  uint8_t aux_cv_source_;
-  uint8_t aux_cv_source_2_;
-  
-  uint32_t portamento_phase_;
-  uint32_t portamento_phase_increment_;
-  bool portamento_exponential_shape_;
-  
   // This counter is used to artificially create a 750µs (3-systick) dip at LOW
   // level when the gate is currently HIGH and a new note arrive with a
   // retrigger command. This happens with note-stealing; or when sending a MIDI
   // sequence with overlapping notes.
   uint16_t retrigger_delay_;
-  
   uint16_t trigger_pulse_;
-  uint32_t trigger_phase_increment_;
-  uint32_t trigger_phase_;
-
-  uint8_t refresh_counter_;
-  Interpolator<kLowFreqRefreshBits> pitch_lfo_interpolator_, timbre_lfo_interpolator_, amplitude_lfo_interpolator_, scaled_vibrato_lfo_interpolator_;
+  uint16_t gate_frame_;
 
   uint16_t tremolo_mod_target_;
   uint16_t tremolo_mod_current_;
@@ -281,8 +309,31 @@ class Voice {
   uint16_t timbre_init_target_;
   uint16_t timbre_init_current_;
 
-  CVOutput* audio_output_;
-  CVOutput* dc_outputs_[DC_LAST];
+  uint8_t mod_velocity_;
+  uint8_t pitch_bend_range_;
+  uint8_t vibrato_range_;
+  uint8_t vibrato_mod_;
+  uint8_t refresh_counter_;
+  uint8_t lfo_shapes_[LFO_ROLE_LAST];  // LFOShape
+  uint8_t oscillator_mode_;
+  uint8_t aux_cv_source_;
+  uint8_t aux_cv_source_2_;
+
+  bool gate_;
+  // Sets whether this voice can control a paraphonic CV envelope's tremolo
+  bool is_highest_priority_;
+  bool portamento_exponential_shape_;
+  // Some LFO interpolator is still moving towards its target
+  bool lfo_interpolating_;
+
+  // Read at note on
+  uint8_t trigger_duration_;
+  uint8_t trigger_shape_;
+  bool trigger_scale_;
+  ADSR adsr_;
+
+  // Audio rate state, last, as it is the bulk of the voice
+  Oscillator oscillator_;
 
   DISALLOW_COPY_AND_ASSIGN(Voice);
 };
@@ -293,7 +344,7 @@ class CVOutput {
   ~CVOutput() { }
 
   typedef uint16_t (CVOutput::*DCFn)();
-  static DCFn dc_fn_table_[];
+  static const DCFn dc_fn_table_[];
 
   void Init(bool reset_calibration);
 
@@ -312,7 +363,7 @@ class CVOutput {
     zero_dac_code_ = volts_dac_code(0);
     envelope_.Init(zero_dac_code_ >> 1);
     uint16_t scale = volts_dac_code(0) - volts_dac_code(5); // 5Vpp
-    scale /= num_audio_voices_;
+    if (num_audio_voices_) scale /= num_audio_voices_;
     for (uint8_t i = 0; i < num_audio_voices_; ++i) {
       Voice* audio_voice = audio_voices_[i] = dc_voices_[0] + i;
       audio_voice->oscillator()->Init(scale);
@@ -327,6 +378,15 @@ class CVOutput {
     }
     return false;
   }
+  // Frame of the event behind the latest change of the gate.
+  inline uint16_t gate_frame() const {
+    uint16_t frame = dc_voices_[0]->gate_frame();
+    for (uint8_t i = 1; i < num_audio_voices_; ++i) {
+      uint16_t voice_frame = audio_voices_[i]->gate_frame();
+      if (static_cast<int16_t>(voice_frame - frame) > 0) frame = voice_frame;
+    }
+    return frame;
+  }
   inline bool trigger() const {
     if (!is_audio()) return dc_voices_[0]->trigger();
     for (uint8_t i = 0; i < num_audio_voices_; ++i) {
@@ -335,7 +395,92 @@ class CVOutput {
     return false;
   }
 
+  inline uint8_t num_audio_voices() const { return num_audio_voices_; }
+  inline bool drone() const {
+    return is_audio() &&
+        audio_voices_[0]->oscillator_mode() == OSCILLATOR_MODE_DRONE;
+  }
   inline bool is_high_freq() const { return is_audio() || is_envelope(); }
+  inline bool is_interpolated() const {
+    return dc_interpolation_ != DC_INTERPOLATION_OFF && !is_high_freq();
+  }
+  inline void set_dc_interpolation(DCInterpolation dc_interpolation) {
+    dc_interpolation_ = dc_interpolation;
+  }
+  inline DCInterpolation dc_interpolation() const {
+    return static_cast<DCInterpolation>(dc_interpolation_);
+  }
+  // Frames by which a DC output that is not interpolated trails SysTick, and
+  // refreshes by which the output holds back its gate, so that both move with
+  // the audio onsets and the gate opens once the DC has reached the note.
+  inline void set_delays(
+      uint8_t dc_delay, uint8_t gate_delay, uint8_t interpolated_gate_delay) {
+    dc_delay_ = dc_delay;
+    gate_delay_ = gate_delay;
+    interpolated_gate_delay_ = interpolated_gate_delay;
+  }
+  // A stamped gate that the main loop changed more than a refresh after its
+  // event, because it was busy, changes as many refreshes earlier in the
+  // delay line, without crossing an earlier change, and the pitch of a note
+  // it opens, computed a refresh later, is backdated as much.  Interpolated
+  // outputs need their history in order, and keep the lag.
+  inline bool DelayGate(bool gate, bool stamped, uint16_t frame) {
+    uint32_t line = gate_delay_line_;
+    gate_delay_line_ = (line << 1) | gate;
+    if (is_interpolated()) {
+      return (gate_delay_line_ >> interpolated_gate_delay_) & 1;
+    }
+    if (stamped && gate != (line & 1)) {
+      // Refreshes since the event beyond the first, which a prompt main loop
+      // takes, with a quarter of a refresh to spare
+      int32_t age = static_cast<int16_t>(frame - gate_frame());
+      int32_t frame_hz = dac.frame_hz();
+      int32_t missed = (age * static_cast<int32_t>(kDCRefreshHz) * 4 -
+          frame_hz) / (frame_hz * 4);
+      if (missed < 0) missed = 0;
+      if (missed > gate_delay_) missed = gate_delay_;
+      uint8_t n = 0;
+      while (n < missed && ((line >> (n + 1)) & 1) != gate) ++n;
+      uint32_t mask = ((1UL << n) - 1) << 1;
+      if (gate) {
+        gate_delay_line_ |= mask;
+        if (!is_high_freq()) {
+          next_dc_backdate_ = n * dac.frames_per_dc_refresh();
+        }
+      } else {
+        gate_delay_line_ &= ~mask;
+      }
+    }
+    return (gate_delay_line_ >> gate_delay_) & 1;
+  }
+
+  // SysTick records every DC value, interpolated or not, so the history is
+  // already current when an output starts being interpolated.
+  inline void PushDCControlPoint(uint16_t dac_code, uint16_t frame) {
+    // A backdated point takes over from the newer ones it predates, as
+    // DelayedDC looks for the newest point played by the frame.
+    frame -= dc_backdate_;
+    dc_backdate_ = next_dc_backdate_;
+    next_dc_backdate_ = 0;
+    uint8_t head = (dc_history_head_ + 1) & (kDCHistorySize - 1);
+    dc_history_[head].frame = frame;
+    dc_history_[head].dac_code = dac_code;
+    dc_history_head_ = head;
+  }
+  // The value SysTick computed the DC delay before the frame, which a DC
+  // output that is not interpolated plays.  The newest value until the
+  // history reaches back that far.
+  inline uint16_t DelayedDC(uint16_t frame) const {
+    uint16_t played_frame = frame - dc_delay_;
+    uint8_t k = dc_history_head_;
+    for (uint8_t n = 0; n < kDCHistorySize; ++n) {
+      if (static_cast<int16_t>(played_frame - dc_history_[k].frame) >= 0) {
+        return dc_history_[k].dac_code;
+      }
+      k = (k - 1) & (kDCHistorySize - 1);
+    }
+    return dc_history_[dc_history_head_].dac_code;
+  }
   inline bool is_audio() const {
     return num_audio_voices_ > 0 && audio_voices_[0]->uses_audio();
   }
@@ -345,16 +490,18 @@ class CVOutput {
       (dc_role_ == DC_AUX_2 && dc_voices_[0]->aux_2_envelope())
     );
   }
-  inline void NoteOn(ADSR& adsr) {
-    envelope_.NoteOn(adsr, volts_dac_code(0) >> 1, volts_dac_code(7) >> 1);
+  inline void NoteOn(ADSR& adsr, uint16_t delay) {
+    envelope_.NoteOn(
+      adsr, volts_dac_code(0) >> 1, volts_dac_code(7) >> 1, delay
+    );
   }
-  inline void NoteOff(bool force = false) {
+  inline void NoteOff(bool force, uint16_t delay) {
     if (!force) {
       for (uint8_t i = 0; i < num_dc_voices_; ++i) {
         if (dc_voices_[i]->gate_on()) return;
       }
     }
-    envelope_.NoteOff();
+    envelope_.NoteOff(delay);
   }
 
   // When paraphonic (num_dc_voices_ > 1), only the highest-priority voice
@@ -417,6 +564,7 @@ class CVOutput {
 
   inline void set_calibration_dac_code(uint8_t note, uint16_t dac_code) {
     calibrated_dac_code_[note] = dac_code;
+    UpdateNoteDacCodes(note ? note - 1 : 0, note);
     dirty_ = true;
   }
 
@@ -424,22 +572,45 @@ class CVOutput {
     return calibration_dac_code(volts + 3);
   }
 
+  // Note in 1/128 semitones
+  inline uint16_t NoteToDacCode(int32_t note) const {
+    CONSTRAIN(note, 0, ((kNumNoteDacCodes - 1) << 7) - 1);
+    int32_t a = note_dac_code_[note >> 7];
+    int32_t b = note_dac_code_[(note >> 7) + 1];
+    return a + (((b - a) * (note & 0x7f) + 0x40) >> 7);
+  }
+
  private:
-  uint16_t NoteToDacCode(int32_t note) const;
+  // Between the calibration points from first_octave to last_octave + 1
+  void UpdateNoteDacCodes(uint8_t first_octave, uint8_t last_octave);
+  void RenderInterpolatedDC(int16_t* samples) const;
 
   Voice* dc_voices_[kNumMaxVoicesPerPart];  // dc_voices_[0] is primary, others for paraphonic envelope
   Voice* audio_voices_[kNumMaxVoicesPerPart];
-  uint8_t num_dc_voices_;
-  uint8_t num_audio_voices_;
-  DCRole dc_role_;
 
   int32_t note_;
   uint16_t dac_code_;
-  bool dirty_;  // Set to true when the calibration settings have changed.
   uint16_t zero_dac_code_;
-  uint16_t calibrated_dac_code_[kNumOctaves];
-  Envelope envelope_;
   int16_t envelope_bias_;
+  uint8_t num_dc_voices_;
+  uint8_t num_audio_voices_;
+  uint8_t dc_role_;  // DCRole
+  uint8_t dc_interpolation_;  // DCInterpolation
+  uint8_t dc_delay_;
+  uint8_t gate_delay_;
+  uint8_t interpolated_gate_delay_;
+  bool dirty_;  // Set to true when the calibration settings have changed.
+  volatile uint8_t dc_history_head_;  // Newest point, written by SysTick
+  uint32_t gate_delay_line_;  // One gate per refresh, newest in bit 0
+  // Frames by which to backdate the next DC point, and the one after
+  uint16_t dc_backdate_;
+  uint16_t next_dc_backdate_;
+
+  Envelope envelope_;
+  DCControlPoint dc_history_[kDCHistorySize];
+
+  uint16_t calibrated_dac_code_[kNumOctaves];
+  uint16_t note_dac_code_[kNumNoteDacCodes];
 
   DISALLOW_COPY_AND_ASSIGN(CVOutput);
 };
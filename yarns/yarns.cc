@@ -30,9 +30,13 @@
 #include "yarns/drivers/dac.h"
 #include "yarns/drivers/gate_output.h"
 #include "yarns/drivers/midi_io.h"
+#include "yarns/drivers/panel_scan.h"
 #include "yarns/drivers/system.h"
+#include "yarns/event_queue.h"
 #include "yarns/midi_handler.h"
 #include "yarns/multi.h"
+#include "yarns/preset_morph.h"
+#include "yarns/profiler.h"
 #include "yarns/settings.h"
 #include "yarns/storage_manager.h"
 #include "yarns/ui.h"
@@ -67,20 +71,39 @@ uint16_t factory_testing_counter;
 
 void SysTick_Handler() {
   // MIDI I/O, and CV/Gate refresh at 8kHz.
-  // UI polling at 1kHz.
+  // UI polling at 1kHz. The display and LEDs are scanned out by DMA.
+  PROFILE_BEGIN(systick_start);
   static uint8_t counter;
   if ((++counter & 7) == 0) {
-    ui.Poll();
+    PROFILE(PROFILER_STAGE_UI_POLL, ui.Poll());
     system_clock.Tick();
   }
 
-  // Display refresh at 8kHz
-  ui.PollFast();
-  channel_leds.Write();
-  
-  // Try to read some MIDI input if available.
-  if (midi_io.readable()) {
-    midi_handler.PushByte(midi_io.ImmediateRead());
+  // Queue the MIDI input received since the last tick, as much as the queue
+  // has room for. It is parsed by the main loop. The rest waits in the DMA
+  // buffer, whose oldest bytes are dropped once it nears full. Waiting bytes
+  // came back to back at the latest, so each one is dated a byte before the
+  // next, the last one now.
+  uint8_t num_midi_bytes = midi_io.num_readable();
+  if (num_midi_bytes) {
+    uint16_t frames_per_byte = dac.frame_hz() / kMidiByteHz;
+    uint16_t frame = dac.frame_counter() - \
+        (num_midi_bytes - 1) * frames_per_byte;
+    uint8_t num_queued = event_queue.num_writable_midi_bytes();
+    if (num_queued > num_midi_bytes) {
+      num_queued = num_midi_bytes;
+    }
+    uint8_t num_left = num_midi_bytes - num_queued;
+    if (num_left > kMidiRxBufferSize - kMidiRxHeadroom) {
+      uint8_t num_skipped = num_left - (kMidiRxBufferSize - kMidiRxHeadroom);
+      midi_io.Skip(num_skipped);
+      event_queue.CountDropped(num_skipped);
+      frame += num_skipped * frames_per_byte;
+    }
+    while (num_queued--) {
+      event_queue.Push(EVENT_MIDI_BYTE, midi_io.ImmediateRead(), frame);
+      frame += frames_per_byte;
+    }
   }
   
   // Try to push some MIDI data out.
@@ -107,8 +130,8 @@ void SysTick_Handler() {
   multi.UpdateResetPulse();
   if (refresh) {
     multi.RefreshInternalClock();
-    multi.Refresh();
-    multi.GetCvGate(cv, gate);
+    PROFILE(PROFILER_STAGE_MULTI_REFRESH, multi.Refresh());
+    PROFILE(PROFILER_STAGE_GET_CV_GATE, multi.GetCvGate(cv, gate));
     
     // In calibration mode, overrides the DAC outputs with the raw calibration
     // table values.
@@ -131,17 +154,27 @@ void SysTick_Handler() {
       ++factory_testing_counter;
     }
 
-    // Low-latency DC injection: write frame 0 of the fillable block and
-    // inject near the DMA cursor in the being-consumed block.
+    // DC injection of the value computed the output's DC delay ago, so that
+    // it moves with the audio onsets: write frame 0 of the fillable block and
+    // inject near the DMA cursor in the being-consumed block.  Interpolated
+    // outputs are instead rendered by the main loop from the recorded values.
+    PROFILE_BEGIN(update_dc_start);
+    uint16_t frame = dac.frame_counter();
     for (uint8_t channel = 0; channel < kNumCVOutputs; ++channel) {
-      if (!multi.cv_output(channel).is_high_freq()) {
-        dac.UpdateDC(channel, cv[channel]);
+      CVOutput* output = multi.mutable_cv_output(channel);
+      if (output->is_high_freq()) continue;
+      output->PushDCControlPoint(cv[channel], frame);
+      if (!output->is_interpolated()) {
+        dac.UpdateDC(channel, output->DelayedDC(frame));
       }
     }
+    PROFILE_END(PROFILER_STAGE_UPDATE_DC, update_dc_start);
   }
+  PROFILE_END(PROFILER_STAGE_SYSTICK, systick_start);
 }
 
 void DMA1_Channel6_IRQHandler(void) {
+  PROFILE_BEGIN(dma_start);
   uint32_t flags = DMA1->ISR;
   DMA1->IFCR = DMA1_FLAG_HT6 | DMA1_FLAG_TC6;
   if (flags & DMA1_FLAG_HT6) {
@@ -149,18 +182,28 @@ void DMA1_Channel6_IRQHandler(void) {
   } else if (flags & DMA1_FLAG_TC6) {
     dac.OnBlockConsumed(false);
   }
+#ifdef PROFILE_INTERRUPTS
+  profiler.OnBlockConsumed();
+#endif  // PROFILE_INTERRUPTS
+  PROFILE_END(PROFILER_STAGE_DMA_IRQ, dma_start);
 }
 
 }
 
 void Init() {
   sys.Init();
+#ifdef PROFILE_INTERRUPTS
+  profiler.Init();
+#endif  // PROFILE_INTERRUPTS
+  panel_scan.Init();
   
   setting_defs.Init();
   multi.Init(true);
+  preset_morph.Init();
   ui.Init();
 
   // Load multi 0 on boot.
+  storage_manager.Init();
   storage_manager.LoadMulti(0);
   storage_manager.LoadCalibration(); // Can disable to reset calibration
   
@@ -169,6 +212,7 @@ void Init() {
   channel_leds.Init();
   dac.Init();
   midi_io.Init();
+  event_queue.Init();
   midi_handler.Init();
   sys.StartTimers();
 }
@@ -180,14 +224,22 @@ int main(void) {
     ui.DoEvents();
     midi_handler.ProcessInput();
     multi.LowPriority();
+    preset_morph.Tick();
     uint8_t* block_num_ptr = dac.PtrToFillableBlockNum();
     if (block_num_ptr) {
       uint8_t block = *block_num_ptr;
+      PROFILE_BEGIN(render_start);
       for (uint8_t channel = 0; channel < kNumCVOutputs; ++channel) {
         multi.mutable_cv_output(channel)->RenderSamples(
           block, channel, cv[channel]
         );
       }
+      PROFILE_END(PROFILER_STAGE_RENDER_SAMPLES, render_start);
+#ifdef PROFILE_INTERRUPTS
+      profiler.OnBlockFilled();
+#endif  // PROFILE_INTERRUPTS
+      // A block was just filled, so this is when a flash stall hurts least
+      storage_manager.Tick();
     }
     if (midi_handler.factory_testing_requested()) {
       midi_handler.AcknowledgeFactoryTestingRequest();